@@ -0,0 +1,638 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include <rm/rm.h>
+
+#include <roger/main.h>
+#include <roger/contactimage.h>
+#include <roger/contactlist.h>
+#include <roger/contactlookup.h>
+#include <roger/contactsdelta.h>
+
+/**
+ * AllBooksEntry:
+ * @contact: contact as provided by the source address book
+ * @name_key: case folded contact name
+ * @numbers: normalised phone numbers of @contact (%NULL terminated)
+ */
+typedef struct {
+	RmContact *contact;
+	gchar *name_key;
+	gchar **numbers;
+} AllBooksEntry;
+
+/**
+ * AllBooksSource:
+ * @book: source address book
+ * @generation: bumped whenever "contacts-changed" reports a change of @book
+ * @entries_generation: @generation @entries have been built for
+ * @entries: #AllBooksEntry array describing the contacts of @book
+ */
+typedef struct {
+	RmAddressBook *book;
+	guint generation;
+	guint entries_generation;
+	GArray *entries;
+} AllBooksSource;
+
+/**
+ * AllBooksContact:
+ * @contact: merged contact
+ * @name_key: case folded contact name
+ * @owned: %TRUE if @contact is a merged copy owned by this plugin
+ */
+typedef struct {
+	RmContact *contact;
+	const gchar *name_key;
+	gboolean owned;
+} AllBooksContact;
+
+RmAddressBook allbooks_book;
+
+/* Sources keyed by address book */
+static GHashTable *allbooks_sources = NULL;
+/* Combined index: normalised number -> AllBooksContact, used for merging and lookups */
+static GHashTable *allbooks_number_index = NULL;
+/* Contacts without numbers: name key -> AllBooksContact */
+static GHashTable *allbooks_name_index = NULL;
+/* All AllBooksContact of the combined view */
+static GPtrArray *allbooks_merged = NULL;
+static GSList *allbooks_contacts = NULL;
+/* Source contact -> AllBooksSource, used to map deltas to sources */
+static GHashTable *allbooks_owners = NULL;
+/* Merged arrays replaced by a rebuild, freed once views had the chance to drop them */
+static GSList *allbooks_retired = NULL;
+static guint allbooks_retired_id = 0;
+
+/**
+ * allbooks_entry_clear:
+ * @data: a #AllBooksEntry
+ *
+ * Frees the normalised data of an entry
+ */
+static void allbooks_entry_clear(gpointer data)
+{
+	AllBooksEntry *entry = data;
+
+	g_free(entry->name_key);
+	g_strfreev(entry->numbers);
+}
+
+/**
+ * allbooks_source_free:
+ * @data: a #AllBooksSource
+ *
+ * Frees source data
+ */
+static void allbooks_source_free(gpointer data)
+{
+	AllBooksSource *source = data;
+	guint index;
+
+	for (index = 0; allbooks_owners && index < source->entries->len; index++) {
+		g_hash_table_remove(allbooks_owners, g_array_index(source->entries, AllBooksEntry, index).contact);
+	}
+
+	g_array_free(source->entries, TRUE);
+	g_slice_free(AllBooksSource, source);
+}
+
+/**
+ * allbooks_contact_free:
+ * @data: a #AllBooksContact
+ *
+ * Frees merged contact, including the contact copy if owned
+ */
+static void allbooks_contact_free(gpointer data)
+{
+	AllBooksContact *merged = data;
+
+	if (merged->owned) {
+		contact_image_clear(merged->contact);
+		rm_contact_free(merged->contact);
+	}
+
+	g_slice_free(AllBooksContact, merged);
+}
+
+/**
+ * allbooks_source_refresh:
+ * @source: a #AllBooksSource
+ *
+ * Normalise names and numbers of source contacts in case the source has changed since the last refresh.
+ *
+ * Returns: %TRUE if source has been changed, otherwise %FALSE
+ */
+static gboolean allbooks_source_refresh(AllBooksSource *source)
+{
+	GSList *list;
+	GSList *iter;
+	guint index;
+
+	if (source->entries_generation == source->generation) {
+		return FALSE;
+	}
+
+	list = rm_addressbook_get_contacts(source->book);
+
+	g_debug("%s(): Refreshing '%s' (%d contacts)", __FUNCTION__, rm_addressbook_get_name(source->book), g_slist_length(list));
+
+	/* Previous contacts are only used as keys, they may be gone already */
+	for (index = 0; index < source->entries->len; index++) {
+		g_hash_table_remove(allbooks_owners, g_array_index(source->entries, AllBooksEntry, index).contact);
+	}
+	g_array_set_size(source->entries, 0);
+
+	for (iter = list; iter != NULL; iter = iter->next) {
+		RmContact *contact = iter->data;
+		AllBooksEntry entry;
+		GSList *numbers;
+		gint index = 0;
+
+		entry.contact = contact;
+		entry.name_key = g_utf8_casefold(contact->name ? contact->name : "", -1);
+		entry.numbers = g_new0(gchar *, g_slist_length(contact->numbers) + 1);
+
+		for (numbers = contact->numbers; numbers != NULL; numbers = numbers->next) {
+			RmPhoneNumber *phone_number = numbers->data;
+
+			if (RM_EMPTY_STRING(phone_number->number)) {
+				continue;
+			}
+
+			entry.numbers[index++] = rm_number_full(phone_number->number, FALSE);
+		}
+
+		g_array_append_val(source->entries, entry);
+		g_hash_table_insert(allbooks_owners, contact, source);
+	}
+
+	source->entries_generation = source->generation;
+
+	return TRUE;
+}
+
+/**
+ * allbooks_contact_merge:
+ * @merged: a #AllBooksContact
+ * @entry: duplicate #AllBooksEntry
+ *
+ * Merges missing details of @entry into @merged. The first duplicate creates a private copy of the contact.
+ */
+static void allbooks_contact_merge(AllBooksContact *merged, AllBooksEntry *entry)
+{
+	RmContact *contact;
+	RmContact *other = entry->contact;
+	GSList *list;
+	gint index;
+
+	if (!merged->owned) {
+		RmContact *source = merged->contact;
+
+		/* Share lazy image handle, it is decoded once shown */
+		merged->contact = rm_contact_dup(source);
+		contact_image_copy(merged->contact, source);
+		merged->owned = TRUE;
+	}
+
+	contact = merged->contact;
+
+	for (list = other->numbers, index = 0; list != NULL; list = list->next) {
+		RmPhoneNumber *phone_number = list->data;
+		RmPhoneNumber *copy;
+		gchar *number;
+
+		if (RM_EMPTY_STRING(phone_number->number)) {
+			continue;
+		}
+
+		number = entry->numbers[index++];
+		if (g_hash_table_lookup(allbooks_number_index, number) == merged) {
+			continue;
+		}
+
+		copy = g_slice_new(RmPhoneNumber);
+		copy->type = phone_number->type;
+		copy->number = g_strdup(phone_number->number);
+		contact->numbers = g_slist_append(contact->numbers, copy);
+
+		if (!g_hash_table_contains(allbooks_number_index, number)) {
+			g_hash_table_insert(allbooks_number_index, number, merged);
+		}
+	}
+
+	if (RM_EMPTY_STRING(contact->company) && !RM_EMPTY_STRING(other->company)) {
+		g_free(contact->company);
+		contact->company = g_strdup(other->company);
+	}
+
+	if (!contact_image_has(contact)) {
+		if (other->image) {
+			contact->image = g_object_ref(other->image);
+			contact->image_len = other->image_len;
+		} else {
+			contact_image_copy(contact, other);
+		}
+	}
+
+	if (!contact->addresses) {
+		for (list = other->addresses; list != NULL; list = list->next) {
+			RmContactAddress *address = list->data;
+			RmContactAddress *copy = g_slice_new(RmContactAddress);
+
+			copy->type = address->type;
+			copy->street = g_strdup(address->street);
+			copy->zip = g_strdup(address->zip);
+			copy->city = g_strdup(address->city);
+
+			contact->addresses = g_slist_append(contact->addresses, copy);
+		}
+	}
+}
+
+/**
+ * allbooks_add_entry:
+ * @entry: a #AllBooksEntry
+ *
+ * Adds @entry to the combined index. Contacts sharing a normalised number and name are merged.
+ */
+static void allbooks_add_entry(AllBooksEntry *entry)
+{
+	AllBooksContact *merged = NULL;
+	gint index;
+
+	for (index = 0; entry->numbers[index] != NULL; index++) {
+		AllBooksContact *candidate = g_hash_table_lookup(allbooks_number_index, entry->numbers[index]);
+
+		if (candidate && !strcmp(candidate->name_key, entry->name_key)) {
+			merged = candidate;
+			break;
+		}
+	}
+
+	if (!entry->numbers[0]) {
+		merged = g_hash_table_lookup(allbooks_name_index, entry->name_key);
+	}
+
+	if (merged) {
+		allbooks_contact_merge(merged, entry);
+		return;
+	}
+
+	merged = g_slice_new0(AllBooksContact);
+	merged->contact = entry->contact;
+	merged->name_key = entry->name_key;
+	g_ptr_array_add(allbooks_merged, merged);
+
+	if (!entry->numbers[0]) {
+		g_hash_table_insert(allbooks_name_index, entry->name_key, merged);
+		return;
+	}
+
+	for (index = 0; entry->numbers[index] != NULL; index++) {
+		/* First book wins for numbers shared by different persons */
+		if (!g_hash_table_contains(allbooks_number_index, entry->numbers[index])) {
+			g_hash_table_insert(allbooks_number_index, entry->numbers[index], merged);
+		}
+	}
+}
+
+/**
+ * allbooks_source_vanished:
+ * @key: a #RmAddressBook
+ * @value: a #AllBooksSource
+ * @user_data: list of registered address books
+ *
+ * Checks whether source address book has been unregistered
+ *
+ * Returns: %TRUE if source is not registered anymore
+ */
+static gboolean allbooks_source_vanished(gpointer key, gpointer value, gpointer user_data)
+{
+	return g_slist_find(user_data, key) == NULL;
+}
+
+/**
+ * allbooks_retired_free_idle:
+ * @user_data: unused
+ *
+ * Frees merged contacts replaced by previous rebuilds
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean allbooks_retired_free_idle(gpointer user_data)
+{
+	g_slist_free_full(allbooks_retired, (GDestroyNotify)g_ptr_array_unref);
+	allbooks_retired = NULL;
+	allbooks_retired_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * allbooks_update_delta:
+ * @delta: a #ContactsDelta of the current emission
+ * @old_merged: merged contacts before the rebuild
+ *
+ * Adds the changes of the combined view to @delta: merged copies that have been
+ * replaced and contacts that are merged into another one now are removed, new
+ * merged copies and contacts no longer merged are added.
+ */
+static void allbooks_update_delta(ContactsDelta *delta, GPtrArray *old_merged)
+{
+	GHashTable *shown = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GHashTableIter iter;
+	gpointer key;
+	guint index;
+
+	for (index = 0; index < allbooks_merged->len; index++) {
+		AllBooksContact *merged = g_ptr_array_index(allbooks_merged, index);
+
+		g_hash_table_add(shown, merged->contact);
+	}
+
+	for (index = 0; index < old_merged->len; index++) {
+		AllBooksContact *merged = g_ptr_array_index(old_merged, index);
+
+		if (!g_hash_table_remove(shown, merged->contact) && !g_slist_find(delta->removed, merged->contact)) {
+			contacts_delta_removed(delta, merged->contact);
+		}
+	}
+
+	/* Whatever is left is new to the combined view */
+	g_hash_table_iter_init(&iter, shown);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (!g_slist_find(delta->added, key)) {
+			contacts_delta_added(delta, key);
+		}
+	}
+
+	g_hash_table_destroy(shown);
+}
+
+/**
+ * allbooks_rebuild:
+ * @delta: a #ContactsDelta of the current emission or %NULL
+ *
+ * Refreshes all changed sources and rebuilds the combined index if needed. Replaced
+ * merged contacts are added to @delta and freed once the emission is done, as views
+ * may still reference them.
+ */
+static void allbooks_rebuild(ContactsDelta *delta)
+{
+	ContactListBuilder *builder;
+	GPtrArray *old_merged;
+	GSList *plugins;
+	gboolean changed;
+	guint index;
+
+	changed = g_hash_table_foreach_remove(allbooks_sources, allbooks_source_vanished, rm_addressbook_get_plugins()) > 0;
+
+	for (plugins = rm_addressbook_get_plugins(); plugins != NULL; plugins = plugins->next) {
+		RmAddressBook *book = plugins->data;
+		AllBooksSource *source;
+
+		if (book == &allbooks_book) {
+			continue;
+		}
+
+		source = g_hash_table_lookup(allbooks_sources, book);
+		if (!source) {
+			source = g_slice_new0(AllBooksSource);
+			source->book = book;
+			source->generation = 1;
+			source->entries = g_array_new(FALSE, FALSE, sizeof(AllBooksEntry));
+			g_array_set_clear_func(source->entries, allbooks_entry_clear);
+
+			g_hash_table_insert(allbooks_sources, book, source);
+		}
+
+		changed |= allbooks_source_refresh(source);
+	}
+
+	if (!changed && allbooks_contacts) {
+		return;
+	}
+
+	g_slist_free(allbooks_contacts);
+	allbooks_contacts = NULL;
+
+	g_hash_table_remove_all(allbooks_number_index);
+	g_hash_table_remove_all(allbooks_name_index);
+
+	old_merged = allbooks_merged;
+	allbooks_merged = g_ptr_array_new_with_free_func(allbooks_contact_free);
+
+	for (plugins = rm_addressbook_get_plugins(); plugins != NULL; plugins = plugins->next) {
+		AllBooksSource *source = g_hash_table_lookup(allbooks_sources, plugins->data);
+
+		if (!source) {
+			continue;
+		}
+
+		for (index = 0; index < source->entries->len; index++) {
+			allbooks_add_entry(&g_array_index(source->entries, AllBooksEntry, index));
+		}
+	}
+
+	builder = contact_list_builder_new(allbooks_merged->len);
+	for (index = 0; index < allbooks_merged->len; index++) {
+		AllBooksContact *merged = g_ptr_array_index(allbooks_merged, index);
+
+		contact_list_builder_add(builder, merged->contact);
+	}
+
+	allbooks_contacts = contact_list_builder_end(builder);
+
+	if (delta) {
+		allbooks_update_delta(delta, old_merged);
+	}
+
+	allbooks_retired = g_slist_prepend(allbooks_retired, old_merged);
+	if (!allbooks_retired_id) {
+		allbooks_retired_id = g_idle_add(allbooks_retired_free_idle, NULL);
+	}
+
+	g_debug("%s(): %d merged contacts, %d numbers", __FUNCTION__, allbooks_merged->len, g_hash_table_size(allbooks_number_index));
+}
+
+/**
+ * allbooks_delta_touches:
+ * @delta: a #ContactsDelta
+ * @source: a #AllBooksSource
+ *
+ * Checks whether a modified or removed contact of @delta belongs to @source
+ *
+ * Returns: %TRUE if @source is affected
+ */
+static gboolean allbooks_delta_touches(ContactsDelta *delta, AllBooksSource *source)
+{
+	GSList *list;
+
+	for (list = delta->modified; list != NULL; list = list->next) {
+		if (g_hash_table_lookup(allbooks_owners, list->data) == source) {
+			return TRUE;
+		}
+	}
+
+	for (list = delta->removed; list != NULL; list = list->next) {
+		if (g_hash_table_lookup(allbooks_owners, list->data) == source) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * allbooks_contacts_changed_cb:
+ * @object: a #RmObject
+ * @user_data: unused
+ *
+ * Bumps the generation of changed sources. Once the combined view has been built,
+ * it is rebuilt right away: removed contacts are still valid during the emission
+ * and views connected later on see our changes within the same delta.
+ */
+static void allbooks_contacts_changed_cb(RmObject *object, gpointer user_data)
+{
+	ContactsDelta *delta = contacts_delta_get();
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, allbooks_sources);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		AllBooksSource *source = value;
+
+		/* Added contacts can not be mapped to their book */
+		if (!delta || delta->added || allbooks_delta_touches(delta, source)) {
+			source->generation++;
+		}
+	}
+
+	if (allbooks_contacts) {
+		allbooks_rebuild(delta);
+	}
+}
+
+/**
+ * allbooks_get_contacts:
+ *
+ * Get merged contacts of all address books. Only sources whose contact list
+ * changed since the last call are normalised again.
+ *
+ * Returns: contact list
+ */
+static GSList *allbooks_get_contacts(void)
+{
+	allbooks_rebuild(NULL);
+
+	return allbooks_contacts;
+}
+
+/**
+ * allbooks_find_by_number:
+ * @full_number: normalised phone number
+ *
+ * Looks up number in the combined index instead of scanning the merged contact list
+ *
+ * Returns: merged #RmContact or %NULL
+ */
+static RmContact *allbooks_find_by_number(const gchar *full_number)
+{
+	AllBooksContact *merged;
+
+	allbooks_rebuild(NULL);
+
+	merged = g_hash_table_lookup(allbooks_number_index, full_number);
+
+	return merged ? merged->contact : NULL;
+}
+
+static gchar *allbooks_get_active_book_name(void)
+{
+	return g_strdup(_("All address books"));
+}
+
+static gchar **allbooks_get_sub_books(void)
+{
+	return NULL;
+}
+
+static gboolean allbooks_set_sub_book(gchar *name)
+{
+	return TRUE;
+}
+
+RmAddressBook allbooks_book = {
+	"All address books",
+	allbooks_get_active_book_name,
+	allbooks_get_contacts,
+	NULL,
+	NULL,
+	allbooks_get_sub_books,
+	allbooks_set_sub_book
+};
+
+gboolean allbooks_plugin_init(RmPlugin *plugin)
+{
+	allbooks_sources = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, allbooks_source_free);
+	allbooks_number_index = g_hash_table_new(g_str_hash, g_str_equal);
+	allbooks_name_index = g_hash_table_new(g_str_hash, g_str_equal);
+	allbooks_merged = g_ptr_array_new_with_free_func(allbooks_contact_free);
+	allbooks_owners = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	/* Connected before any view, so views see the combined changes */
+	g_signal_connect(rm_object, "contacts-changed", G_CALLBACK(allbooks_contacts_changed_cb), NULL);
+
+	rm_addressbook_register(&allbooks_book);
+	contact_lookup_register(&allbooks_book, allbooks_find_by_number);
+
+	return TRUE;
+}
+
+gboolean allbooks_plugin_shutdown(RmPlugin *plugin)
+{
+	contact_lookup_register(&allbooks_book, NULL);
+	rm_addressbook_unregister(&allbooks_book);
+	g_signal_handlers_disconnect_by_func(rm_object, allbooks_contacts_changed_cb, NULL);
+
+	if (allbooks_retired_id) {
+		g_source_remove(allbooks_retired_id);
+	}
+	allbooks_retired_free_idle(NULL);
+
+	g_slist_free(allbooks_contacts);
+	allbooks_contacts = NULL;
+
+	g_clear_pointer(&allbooks_number_index, g_hash_table_destroy);
+	g_clear_pointer(&allbooks_name_index, g_hash_table_destroy);
+	g_clear_pointer(&allbooks_merged, g_ptr_array_unref);
+	g_clear_pointer(&allbooks_sources, g_hash_table_destroy);
+	g_clear_pointer(&allbooks_owners, g_hash_table_destroy);
+
+	return TRUE;
+}
+
+RM_PLUGIN(allbooks)
@@ -27,6 +27,9 @@
 #include <rm/rm.h>
 
 #include <roger/main.h>
+#include <roger/contactimage.h>
+#include <roger/contactlist.h>
+#include <roger/contactsdelta.h>
 #include "config.h"
 
 #include <libebook/libebook.h>
@@ -36,6 +39,16 @@
 static GSList *contacts = NULL;
 static GSettings *ebook_settings = NULL;
 static EClient *e_client = NULL;
+/* Contact UID -> RmContact */
+static GHashTable *evolution_contacts = NULL;
+static EBookClientView *ebook_view = NULL;
+static GCancellable *ebook_cancellable = NULL;
+/* Initial contacts of view are still streamed in */
+static gboolean ebook_loading = FALSE;
+/* Pending changes, emitted by evolution_flush() */
+static ContactsDelta *ebook_delta = NULL;
+static GSList *ebook_removed = NULL;
+static guint ebook_flush_id = 0;
 
 gboolean evolution_reload(void);
 
@@ -151,227 +164,524 @@ GList *get_ebook_list(void)
 	return ebook_list;
 }
 
-void ebook_objects_changed_cb(EBookClientView *view, const GSList *ids, gpointer user_data)
+/* Fields roger needs, photos are decoded on first use */
+static const EContactField evolution_fields[] = {
+	E_CONTACT_UID,
+	E_CONTACT_FULL_NAME,
+	E_CONTACT_ORG,
+	E_CONTACT_PHONE_HOME,
+	E_CONTACT_PHONE_BUSINESS,
+	E_CONTACT_PHONE_MOBILE,
+	E_CONTACT_PHONE_HOME_FAX,
+	E_CONTACT_PHONE_BUSINESS_FAX,
+	E_CONTACT_ADDRESS_HOME,
+	E_CONTACT_ADDRESS_WORK,
+	E_CONTACT_PHOTO,
+};
+
+/* Interval in ms in which contacts of the initial load are passed on */
+#define EVOLUTION_FLUSH_INTERVAL 250
+
+/**
+ * \brief Create roger contact from evolution contact
+ * \param e_contact evolution contact
+ * \return new contact or NULL if contact has no name
+ */
+static RmContact *evolution_contact_new(EContact *e_contact)
 {
-	g_debug("%s(): called", __FUNCTION__);
+	const gchar *display_name;
+	RmContact *contact;
+	RmPhoneNumber *phone_number;
+	const gchar *number;
+	const gchar *company;
+	EContactAddress *address;
 
-	/* Reload contacts */
-	evolution_reload();
+	display_name = e_contact_get_const(e_contact, E_CONTACT_FULL_NAME);
 
-	/* Send signal to redraw journal and update contacts view */
-	rm_object_emit_contacts_changed();
+	if (RM_EMPTY_STRING(display_name)) {
+		return NULL;
+	}
+
+	contact = g_slice_new0(RmContact);
+
+	contact->priv = e_contact_get(e_contact, E_CONTACT_UID);
+	contact->name = g_strdup(display_name);
+	contact->numbers = NULL;
+
+	number = e_contact_get_const(e_contact, E_CONTACT_PHONE_HOME);
+	if (!RM_EMPTY_STRING(number)) {
+		phone_number = g_slice_new(RmPhoneNumber);
+		phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
+		phone_number->number = rm_number_full(number, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+	}
+
+	number = e_contact_get_const(e_contact, E_CONTACT_PHONE_BUSINESS);
+	if (!RM_EMPTY_STRING(number)) {
+		phone_number = g_slice_new(RmPhoneNumber);
+		phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
+		phone_number->number = rm_number_full(number, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+	}
+
+	number = e_contact_get_const(e_contact, E_CONTACT_PHONE_MOBILE);
+	if (!RM_EMPTY_STRING(number)) {
+		phone_number = g_slice_new(RmPhoneNumber);
+		phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
+		phone_number->number = rm_number_full(number, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+	}
+
+	number = e_contact_get_const(e_contact, E_CONTACT_PHONE_HOME_FAX);
+	if (!RM_EMPTY_STRING(number)) {
+		phone_number = g_slice_new(RmPhoneNumber);
+		phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
+		phone_number->number = rm_number_full(number, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+	}
+
+	number = e_contact_get_const(e_contact, E_CONTACT_PHONE_BUSINESS_FAX);
+	if (!RM_EMPTY_STRING(number)) {
+		phone_number = g_slice_new(RmPhoneNumber);
+		phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
+		phone_number->number = rm_number_full(number, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+	}
+
+	company = e_contact_get_const(e_contact, E_CONTACT_ORG);
+	if (!RM_EMPTY_STRING(company)) {
+		contact->company = g_strdup(company);
+	}
+
+	address = e_contact_get(e_contact, E_CONTACT_ADDRESS_HOME);
+	if (address) {
+		RmContactAddress *c_address = g_slice_new(RmContactAddress);
+		c_address->type = 0;
+		c_address->street = g_strdup(address->street);
+		c_address->zip = g_strdup(address->code);
+		c_address->city = g_strdup(address->locality);
+		contact->addresses = g_slist_prepend(contact->addresses, c_address);
+		e_contact_address_free(address);
+	}
+
+	address = e_contact_get(e_contact, E_CONTACT_ADDRESS_WORK);
+	if (address) {
+		RmContactAddress *c_address = g_slice_new(RmContactAddress);
+		c_address->type = 1;
+		c_address->street = g_strdup(address->street);
+		c_address->zip = g_strdup(address->code);
+		c_address->city = g_strdup(address->locality);
+		contact->addresses = g_slist_prepend(contact->addresses, c_address);
+		e_contact_address_free(address);
+	}
+
+	return contact;
 }
 
-void ebook_read_data(EClient *e_client)
+/**
+ * \brief Free contact and its image handle
+ * \param data contact
+ */
+static void evolution_contact_free(gpointer data)
 {
-	EBookClient *client;
-	EBookQuery *query;
-	gchar *sexp = NULL;
-	EContact *e_contact;
-	EContactPhoto *photo;
-	GdkPixbufLoader *loader;
-	GSList *list;
-	GSList *ebook_contacts;
-	GError *error = NULL;
+	contact_image_clear(data);
+	rm_contact_free(data);
+}
 
-	/* TODO: Free list */
-	contacts = NULL;
+/**
+ * \brief Attach photo of evolution contact. Local books store photos as file URIs, those
+ * are loaded on first use. Inlined photos are kept encoded and decoded on first use.
+ * \param contact contact
+ * \param e_contact evolution contact
+ */
+static void evolution_contact_set_photo(RmContact *contact, EContact *e_contact)
+{
+	EContactPhoto *photo = e_contact_get(e_contact, E_CONTACT_PHOTO);
+	gboolean has_photo = FALSE;
 
-	if (!e_client) {
-		g_debug("no callback!!!! (Error: %s)", error ? error->message : "?");
-		return;
+	if (photo) {
+		switch (photo->type) {
+		case E_CONTACT_PHOTO_TYPE_INLINED: {
+			GBytes *bytes = g_bytes_new(photo->data.inlined.data, photo->data.inlined.length);
+
+			contact_image_set_data(contact, bytes);
+			g_bytes_unref(bytes);
+			has_photo = TRUE;
+			break;
+		}
+		case E_CONTACT_PHOTO_TYPE_URI: {
+			gchar *file_name = g_filename_from_uri(photo->data.uri, NULL, NULL);
+
+			if (file_name) {
+				contact_image_set_file(contact, file_name);
+				has_photo = TRUE;
+				g_free(file_name);
+			} else {
+				g_debug("Cannot handle URI: '%s'!", photo->data.uri);
+			}
+			break;
+		}
+		default:
+			g_debug("Unhandled photo type: %d", photo->type);
+			break;
+		}
+
+		e_contact_photo_free(photo);
 	}
 
-	client = E_BOOK_CLIENT(e_client);
+	if (!has_photo) {
+		contact_image_clear(contact);
+	}
+}
 
-	query = e_book_query_any_field_contains("");
-	if (!query) {
-		g_warning("Couldn't create query.");
+/**
+ * \brief Rebuild sorted contact list from contact store
+ */
+static void evolution_sort_contacts(void)
+{
+	ContactListBuilder *builder = contact_list_builder_new(g_hash_table_size(evolution_contacts));
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, evolution_contacts);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		contact_list_builder_add(builder, value);
+	}
+
+	g_slist_free(contacts);
+	contacts = contact_list_builder_end(builder);
+}
+
+/**
+ * \brief Get delta collecting pending changes
+ * \return contacts delta
+ */
+static ContactsDelta *evolution_get_delta(void)
+{
+	if (!ebook_delta) {
+		ebook_delta = contacts_delta_new();
+	}
+
+	return ebook_delta;
+}
+
+/**
+ * \brief Remove contact from store and record it in delta
+ * \param uid contact uid
+ */
+static void evolution_remove_uid(const gchar *uid)
+{
+	RmContact *contact = g_hash_table_lookup(evolution_contacts, uid);
+
+	if (!contact) {
 		return;
 	}
-	sexp = e_book_query_to_string(query);
 
-	EBookClientView *view;
+	/* Contact is freed after delta has been emitted */
+	contacts_delta_removed(evolution_get_delta(), contact);
+	ebook_removed = g_slist_prepend(ebook_removed, contact);
 
-	if (!e_book_client_get_view_sync(client, sexp, &view, NULL, &error)) {
-		g_error("get_view_sync");
+	g_hash_table_remove(evolution_contacts, uid);
+}
+
+/**
+ * \brief Sort contacts and emit pending changes
+ */
+static void evolution_flush(void)
+{
+	if (ebook_flush_id) {
+		g_source_remove(ebook_flush_id);
+		ebook_flush_id = 0;
 	}
 
-	g_signal_connect(view, "objects-added", G_CALLBACK(ebook_objects_changed_cb), NULL);
-	g_signal_connect(view, "objects-removed", G_CALLBACK(ebook_objects_changed_cb), NULL);
-	g_signal_connect(view, "objects-modified", G_CALLBACK(ebook_objects_changed_cb), NULL);
-	e_book_client_view_set_fields_of_interest(view, NULL, &error);
-	if (error) {
-		g_error("set_fields_of_interest()");
+	if (!ebook_delta) {
+		return;
 	}
 
-	e_book_client_view_set_flags(view, 0, &error);
-	if (error) {
-		g_error("set_flags()");
+	if (!contacts_delta_is_empty(ebook_delta)) {
+		evolution_sort_contacts();
 	}
 
-	e_book_client_view_start(view, &error);
+	contacts_delta_emit(ebook_delta);
+	ebook_delta = NULL;
 
-	if (!e_book_client_get_contacts_sync(client, sexp, &ebook_contacts, NULL, NULL)) {
-		g_warning("Couldn't get query results.");
-		e_book_query_unref(query);
-		g_object_unref(client);
-		return;
+	g_slist_free_full(ebook_removed, evolution_contact_free);
+	ebook_removed = NULL;
+}
+
+static gboolean evolution_flush_cb(gpointer user_data)
+{
+	ebook_flush_id = 0;
+	evolution_flush();
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * \brief Emit pending changes, batched while the initial contacts are streamed in
+ */
+static void evolution_changed(void)
+{
+	if (!ebook_loading) {
+		evolution_flush();
+	} else if (!ebook_flush_id) {
+		ebook_flush_id = g_timeout_add(EVOLUTION_FLUSH_INTERVAL, evolution_flush_cb, NULL);
 	}
-	g_free(sexp);
+}
 
-	e_book_query_unref(query);
+/**
+ * \brief Add or update evolution contacts in store
+ * \param e_contacts list of EContact
+ */
+static void evolution_update_contacts(const GSList *e_contacts)
+{
+	ContactsDelta *delta;
+	const GSList *list;
 
-	if (!ebook_contacts) {
-		g_debug("%s(): No contacts in book", __FUNCTION__);
+	if (!evolution_contacts) {
 		return;
 	}
-	for (list = ebook_contacts; list != NULL; list = list->next) {
-		const gchar *display_name;
+
+	delta = evolution_get_delta();
+	for (list = e_contacts; list != NULL; list = list->next) {
+		EContact *e_contact;
 		RmContact *contact;
-		RmPhoneNumber *phone_number;
-		const gchar *number;
-		const gchar *company;
-		EContactAddress *address;
+		RmContact *old;
+		const gchar *uid;
 
-		g_return_if_fail(E_IS_CONTACT(list->data));
+		if (!E_IS_CONTACT(list->data)) {
+			g_warning("%s(): Invalid contact", __FUNCTION__);
+			continue;
+		}
 		e_contact = E_CONTACT(list->data);
 
-		display_name = e_contact_get_const(e_contact, E_CONTACT_FULL_NAME);
-
-		if (RM_EMPTY_STRING(display_name)) {
+		uid = e_contact_get_const(e_contact, E_CONTACT_UID);
+		if (!uid) {
 			continue;
 		}
 
-		contact = g_slice_new0(RmContact);
-
-		contact->priv = (gpointer)e_contact_get_const(e_contact, E_CONTACT_UID);
-
-		photo = e_contact_get(e_contact, E_CONTACT_PHOTO);
-		if (photo) {
-			GdkPixbuf *buf = NULL;
-
-			switch (photo->type) {
-			case E_CONTACT_PHOTO_TYPE_INLINED:
-				loader = gdk_pixbuf_loader_new();
-
-				if (gdk_pixbuf_loader_write(loader, photo->data.inlined.data, photo->data.inlined.length, NULL)) {
-					gdk_pixbuf_loader_close(loader, NULL);
-					buf = gdk_pixbuf_loader_get_pixbuf(loader);
-				} else {
-					g_debug("Could not load inlined photo!");
-				}
-				break;
-			case E_CONTACT_PHOTO_TYPE_URI: {
-				GRegex *pro = g_regex_new("%25", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-
-				if (!strncmp(photo->data.uri, "file://", 7)) {
-					gchar *uri = g_regex_replace_literal(pro, photo->data.uri + 7, -1, 0, "%", 0, NULL);
-					buf = gdk_pixbuf_new_from_file(uri, NULL);
-				} else {
-					g_debug("Cannot handle URI: '%s'!", photo->data.uri);
-				}
-				g_regex_unref(pro);
-				break;
-			}
-			default:
-				g_debug("Unhandled photo type: %d", photo->type);
-				break;
-			}
-
-			contact->image = buf;
+		contact = evolution_contact_new(e_contact);
+		if (!contact) {
+			/* Name has been cleared, no longer a roger contact */
+			evolution_remove_uid(uid);
+			continue;
+		}
 
-			e_contact_photo_free(photo);
+		old = g_hash_table_lookup(evolution_contacts, uid);
+		if (old) {
+			/* Keep pointer, views and journal may reference it */
+			contacts_delta_add_numbers(delta, old);
+			rm_contact_copy(contact, old);
+			rm_contact_free(contact);
+			contact = old;
+			contacts_delta_modified(delta, contact);
 		} else {
-			contact->image = NULL;
+			g_hash_table_insert(evolution_contacts, g_strdup(uid), contact);
+			contacts_delta_added(delta, contact);
 		}
 
-		contact->name = g_strdup(display_name);
-		contact->numbers = NULL;
+		/* Photo is part of the view, it is passed on with the batch */
+		evolution_contact_set_photo(contact, e_contact);
+	}
 
-		number = e_contact_get_const(e_contact, E_CONTACT_PHONE_HOME);
-		if (!RM_EMPTY_STRING(number)) {
-			phone_number = g_slice_new(RmPhoneNumber);
-			phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_slist_prepend(contact->numbers, phone_number);
-		}
+	evolution_changed();
+}
 
-		number = e_contact_get_const(e_contact, E_CONTACT_PHONE_BUSINESS);
-		if (!RM_EMPTY_STRING(number)) {
-			phone_number = g_slice_new(RmPhoneNumber);
-			phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_slist_prepend(contact->numbers, phone_number);
-		}
+static void ebook_objects_added_cb(EBookClientView *view, const GSList *e_contacts, gpointer user_data)
+{
+	g_debug("%s(): %d contacts", __FUNCTION__, g_slist_length((GSList*)e_contacts));
 
-		number = e_contact_get_const(e_contact, E_CONTACT_PHONE_MOBILE);
-		if (!RM_EMPTY_STRING(number)) {
-			phone_number = g_slice_new(RmPhoneNumber);
-			phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_slist_prepend(contact->numbers, phone_number);
-		}
+	evolution_update_contacts(e_contacts);
+}
 
-		number = e_contact_get_const(e_contact, E_CONTACT_PHONE_HOME_FAX);
-		if (!RM_EMPTY_STRING(number)) {
-			phone_number = g_slice_new(RmPhoneNumber);
-			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_slist_prepend(contact->numbers, phone_number);
-		}
+static void ebook_objects_modified_cb(EBookClientView *view, const GSList *e_contacts, gpointer user_data)
+{
+	g_debug("%s(): %d contacts", __FUNCTION__, g_slist_length((GSList*)e_contacts));
 
-		number = e_contact_get_const(e_contact, E_CONTACT_PHONE_BUSINESS_FAX);
-		if (!RM_EMPTY_STRING(number)) {
-			phone_number = g_slice_new(RmPhoneNumber);
-			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_slist_prepend(contact->numbers, phone_number);
-		}
+	evolution_update_contacts(e_contacts);
+}
 
-		company = e_contact_get_const(e_contact, E_CONTACT_ORG);
-		if (!RM_EMPTY_STRING(company)) {
-			contact->company = g_strdup(company);
-		}
+static void ebook_objects_removed_cb(EBookClientView *view, const GSList *uids, gpointer user_data)
+{
+	const GSList *list;
 
-		address = e_contact_get(e_contact, E_CONTACT_ADDRESS_HOME);
-		if (address) {
-			RmContactAddress *c_address = g_slice_new(RmContactAddress);
-			c_address->type = 0;
-			c_address->street = g_strdup(address->street);
-			c_address->zip = g_strdup(address->code);
-			c_address->city = g_strdup(address->locality);
-			contact->addresses = g_slist_prepend(contact->addresses, c_address);
-		}
+	g_debug("%s(): %d contacts", __FUNCTION__, g_slist_length((GSList*)uids));
 
-		address = e_contact_get(e_contact, E_CONTACT_ADDRESS_WORK);
-		if (address) {
-			RmContactAddress *c_address = g_slice_new(RmContactAddress);
-			c_address->type = 1;
-			c_address->street = g_strdup(address->street);
-			c_address->zip = g_strdup(address->code);
-			c_address->city = g_strdup(address->locality);
-			contact->addresses = g_slist_prepend(contact->addresses, c_address);
-		}
+	if (!evolution_contacts) {
+		return;
+	}
+
+	for (list = uids; list != NULL; list = list->next) {
+		evolution_remove_uid(list->data);
+	}
+
+	evolution_changed();
+}
+
+static void ebook_complete_cb(EBookClientView *view, const GError *error, gpointer user_data)
+{
+	if (error) {
+		g_warning("%s(): Could not read book (%s)", __FUNCTION__, error->message);
+	}
+
+	g_debug("%s(): %d contacts loaded", __FUNCTION__, evolution_contacts ? g_hash_table_size(evolution_contacts) : 0);
+
+	ebook_loading = FALSE;
+	evolution_flush();
+}
+
+/**
+ * \brief Stop listening to book changes
+ */
+static void ebook_view_stop(void)
+{
+	if (!ebook_view) {
+		return;
+	}
+
+	g_signal_handlers_disconnect_by_data(ebook_view, NULL);
+	e_book_client_view_stop(ebook_view, NULL);
+	g_clear_object(&ebook_view);
+
+	ebook_loading = FALSE;
+}
+
+/**
+ * \brief Create empty contact store, UID -> RmContact
+ * \return new contact store
+ */
+static GHashTable *evolution_store_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+/**
+ * \brief Free contact store and its contacts
+ * \param store contact store
+ */
+static void evolution_store_free(GHashTable *store)
+{
+	GHashTableIter iter;
+	gpointer value;
 
-		contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
+	g_hash_table_iter_init(&iter, store);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		evolution_contact_free(value);
 	}
 
-	g_slist_free(ebook_contacts);
+	g_hash_table_destroy(store);
+}
+
+/**
+ * \brief Replace contact store, e.g. after the book has been switched
+ * \param store new contact store
+ */
+static void evolution_replace_contacts(GHashTable *store)
+{
+	GHashTable *old = evolution_contacts;
+
+	/* Pending changes refer to the old store */
+	evolution_flush();
+
+	evolution_contacts = store;
+	evolution_sort_contacts();
 
 	/* Send signal to redraw journal and update contacts view */
-	g_debug("%s(): ********************************* loaded", __FUNCTION__);
 	rm_object_emit_contacts_changed();
+
+	if (old) {
+		evolution_store_free(old);
+	}
 }
 
-static void ebook_read_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+static void ebook_view_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 {
+	EBookClientView *view = NULL;
+	GSList *fields = NULL;
 	GError *error = NULL;
+	guint index;
+
+	if (!e_book_client_get_view_finish(E_BOOK_CLIENT(source), res, &view, &error)) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("%s(): Could not get view (%s)", __FUNCTION__, error ? error->message : "?");
+		}
+		g_clear_error(&error);
+		return;
+	}
+
+	ebook_view_stop();
+	ebook_view = view;
+
+	g_signal_connect(ebook_view, "objects-added", G_CALLBACK(ebook_objects_added_cb), NULL);
+	g_signal_connect(ebook_view, "objects-removed", G_CALLBACK(ebook_objects_removed_cb), NULL);
+	g_signal_connect(ebook_view, "objects-modified", G_CALLBACK(ebook_objects_modified_cb), NULL);
+	g_signal_connect(ebook_view, "complete", G_CALLBACK(ebook_complete_cb), NULL);
+
+	for (index = 0; index < G_N_ELEMENTS(evolution_fields); index++) {
+		fields = g_slist_prepend(fields, (gpointer)e_contact_field_name(evolution_fields[index]));
+	}
+
+	e_book_client_view_set_fields_of_interest(ebook_view, fields, &error);
+	g_slist_free(fields);
+	if (error) {
+		g_warning("%s(): set_fields_of_interest() failed (%s)", __FUNCTION__, error->message);
+		g_clear_error(&error);
+	}
+
+	/* Current contacts are streamed in as objects-added, followed by complete */
+	e_book_client_view_set_flags(ebook_view, E_BOOK_CLIENT_VIEW_FLAGS_NOTIFY_INITIAL, &error);
+	if (error) {
+		g_warning("%s(): set_flags() failed (%s)", __FUNCTION__, error->message);
+		g_clear_error(&error);
+	}
+
+	evolution_replace_contacts(evolution_store_new());
+	ebook_loading = TRUE;
+
+	e_book_client_view_start(ebook_view, &error);
+	if (error) {
+		g_warning("%s(): Could not start view (%s)", __FUNCTION__, error->message);
+		g_clear_error(&error);
+		ebook_loading = FALSE;
+	}
+}
+
+void ebook_read_data(EClient *e_client)
+{
+	EBookQuery *query;
+	gchar *sexp = NULL;
 
-	e_client = e_book_client_connect_finish(res, &error);
 	if (!e_client) {
-		g_warning("Error finishing client connection. Error: %s", error ?  error->message : "?");
+		g_debug("%s(): No client", __FUNCTION__);
+		return;
+	}
+
+	query = e_book_query_any_field_contains("");
+	if (!query) {
+		g_warning("Couldn't create query.");
+		return;
+	}
+	sexp = e_book_query_to_string(query);
+	e_book_query_unref(query);
+
+	e_book_client_get_view(E_BOOK_CLIENT(e_client), sexp, ebook_cancellable, ebook_view_ready_cb, NULL);
+	g_free(sexp);
+}
+
+static void ebook_read_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GError *error = NULL;
+	EClient *client;
+
+	client = e_book_client_connect_finish(res, &error);
+	if (!client) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("Error finishing client connection. Error: %s", error ?  error->message : "?");
+		}
+		g_clear_error(&error);
 	} else {
+		g_clear_object(&e_client);
+		e_client = client;
 		ebook_read_data(e_client);
 	}
 }
@@ -389,37 +699,20 @@ gboolean ebook_read_book(void)
 		return FALSE;
 	}
 
+	/* Abort reading a previously selected book */
+	if (ebook_cancellable) {
+		g_cancellable_cancel(ebook_cancellable);
+		g_object_unref(ebook_cancellable);
+	}
+	ebook_cancellable = g_cancellable_new();
+
 	e_book_client_connect(source,
 #if EDS_CHECK_VERSION(3, 16, 0)
 			      5,
 #endif
-			      NULL, ebook_read_cb, NULL);
-
-	return TRUE;
-}
-
-/**
- * \brief Read ebook list (sync)
- * \return error code
- */
-gboolean ebook_read_book_sync(void)
-{
-	EClient *client;
-	ESource *source = get_selected_ebook_esource();
-
-	if (!source) {
-		g_debug("Book could not be found....");
-		return FALSE;
-	}
+			      ebook_cancellable, ebook_read_cb, NULL);
 
-	client = e_book_client_connect_sync(source,
-#if EDS_CHECK_VERSION(3, 16, 0)
-					    5,
-#endif
-					    NULL, NULL);
-	if (client) {
-		ebook_read_data(client);
-	}
+	g_object_unref(source);
 
 	return TRUE;
 }
@@ -433,9 +726,7 @@ GSList *evolution_get_contacts(void)
 
 gboolean evolution_reload(void)
 {
-	ebook_read_book_sync();
-
-	return TRUE;
+	return ebook_read_book();
 }
 
 gboolean evolution_remove_contact(RmContact *contact)
@@ -449,10 +740,8 @@ gboolean evolution_remove_contact(RmContact *contact)
 
 	client = E_BOOK_CLIENT(e_client);
 
+	/* Book view notifies us about the removal */
 	ret = e_book_client_remove_contact_by_uid_sync(client, contact->priv, NULL, NULL);
-	if (ret) {
-		ebook_read_book_sync();
-	}
 
 	return ret;
 }
@@ -470,7 +759,8 @@ static void evolution_set_image(EContact *e_contact, RmContact *contact)
 		} else {
 			g_warning("%s(): gdk_pixbuf_save_to_buffer failed (%s)", __FUNCTION__, error? error->message : "");
 		}
-	} else if (contact->image == NULL) {
+	} else if (contact_image_is_removed(contact)) {
+		/* Only an explicit removal drops the photo, no image may just mean not decoded */
 		e_contact_set(e_contact, E_CONTACT_PHOTO, NULL);
 	}
 }
@@ -571,13 +861,11 @@ gboolean evolution_save_contact(RmContact *contact)
 
 	if (!ret && error) {
 		g_debug("Error saving contact. '%s'", error->message);
+		g_error_free(error);
 	}
 
-	g_object_unref(client);
-
-	if (ret) {
-		ebook_read_book_sync();
-	}
+	/* Book view notifies us about the change, no need to read the book again */
+	g_object_unref(e_contact);
 
 	return ret;
 }
@@ -607,7 +895,8 @@ gboolean evolution_set_sub_book(gchar *name)
 {
 	g_settings_set_string(ebook_settings, "book", name);
 
-	contacts = NULL;
+	/* Old contacts stay until the new book has been read */
+	ebook_view_stop();
 	ebook_read_book();
 
 	return TRUE;
@@ -637,6 +926,35 @@ gboolean evolution_plugin_init(RmPlugin *plugin)
 gboolean evolution_plugin_shutdown(RmPlugin *plugin)
 {
 	rm_addressbook_unregister(&evolution_book);
+
+	if (ebook_cancellable) {
+		g_cancellable_cancel(ebook_cancellable);
+		g_clear_object(&ebook_cancellable);
+	}
+
+	ebook_view_stop();
+	g_clear_object(&e_client);
+
+	if (ebook_flush_id) {
+		g_source_remove(ebook_flush_id);
+		ebook_flush_id = 0;
+	}
+
+	if (ebook_delta) {
+		contacts_delta_free(ebook_delta);
+		ebook_delta = NULL;
+	}
+	g_slist_free_full(ebook_removed, evolution_contact_free);
+	ebook_removed = NULL;
+
+	g_slist_free(contacts);
+	contacts = NULL;
+
+	if (evolution_contacts) {
+		evolution_store_free(evolution_contacts);
+		evolution_contacts = NULL;
+	}
+
 	g_clear_object(&ebook_settings);
 
 	return TRUE;
@@ -19,6 +19,8 @@
 
 #include <string.h>
 
+#include <glib/gstdio.h>
+
 #include <gtk/gtk.h>
 
 #include <rm/rm.h>
@@ -28,6 +30,9 @@
 
 #include <roger/main.h>
 #include <roger/uitools.h>
+#include <roger/contactimage.h>
+#include <roger/contactlist.h>
+#include <roger/contactsdelta.h>
 
 typedef struct {
 	guint signal_id;
@@ -35,7 +40,11 @@ typedef struct {
 
 static GSList *contacts = NULL;
 static GSettings *google_settings = NULL;
-static GHashTable *table = NULL;
+
+/* Entries per query page */
+#define GOOGLE_PAGE_SIZE 500
+/* Concurrent photo downloads */
+#define GOOGLE_PHOTO_DOWNLOADS 4
 
 static GDataContactsService *service = NULL;
 
@@ -271,178 +280,822 @@ static int google_shutdown(void)
 }
 
 /**
- * \brief Read address book
- * \return error code
+ * google_entry:
+ * @contact: roger contact
+ * @gcontact: google contact it has been created from
+ * @photo_etag: etag of contact photo or %NULL
  */
-static int google_read_book(void)
-{
+struct google_entry {
+	RmContact *contact;
+	GDataContactsContact *gcontact;
+	gchar *photo_etag;
+};
+
+/**
+ * google_sync:
+ * @query: contacts query, advanced page by page
+ * @delta: changes of this sync
+ * @removed: removed contacts, freed once @delta has been emitted
+ * @seen: ids of all entries of a full sync
+ * @updated: server time of first page, next sync asks for entries updated since then
+ */
+struct google_sync {
 	GDataQuery *query;
-	GDataFeed *feed;
-	GList *list;
+	ContactsDelta *delta;
+	GSList *removed;
+	GHashTable *seen;
+	gint64 updated;
+};
+
+/**
+ * google_photo_request:
+ * @contact: contact the photo belongs to
+ * @gcontact: google contact holding the photo link
+ */
+struct google_photo_request {
+	RmContact *contact;
+	GDataContactsContact *gcontact;
+};
+
+/* Entry id -> struct google_entry */
+static GHashTable *google_entries = NULL;
+/* Server time of last complete sync, 0 if a full sync is needed */
+static gint64 google_updated = 0;
+static GCancellable *google_cancellable = NULL;
+static gboolean google_syncing = FALSE;
+static GQueue google_photo_queue = G_QUEUE_INIT;
+static guint google_photo_active = 0;
+
+static void google_entry_free(gpointer data)
+{
+	struct google_entry *entry = data;
+
+	g_object_unref(entry->gcontact);
+	g_free(entry->photo_etag);
+	g_slice_free(struct google_entry, entry);
+}
+
+/**
+ * google_contact_free:
+ * @data: a #RmContact
+ *
+ * Free contact and its image handle
+ */
+static void google_contact_free(gpointer data)
+{
+	contact_image_clear(data);
+	rm_contact_free(data);
+}
+
+/**
+ * google_cache_file:
+ * @name: file name within cache or %NULL for the cache directory
+ *
+ * Returns: path within google cache directory, free with g_free()
+ */
+static gchar *google_cache_file(const gchar *name)
+{
+	return g_build_filename(rm_get_user_cache_dir(), "google", name, NULL);
+}
+
+/**
+ * google_photo_file:
+ * @id: entry id
+ * @photo_etag: photo etag
+ *
+ * Photos are cached per entry and photo etag, so a changed photo gets a new file
+ *
+ * Returns: cache file name of photo, free with g_free()
+ */
+static gchar *google_photo_file(const gchar *id, const gchar *photo_etag)
+{
+	gchar *key = g_strconcat(id, "\n", photo_etag, NULL);
+	gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	gchar *file = g_build_filename(rm_get_user_cache_dir(), "google", "photos", checksum, NULL);
+
+	g_free(checksum);
+	g_free(key);
+
+	return file;
+}
+
+/**
+ * google_photo_next:
+ *
+ * Start queued photo downloads, at most GOOGLE_PHOTO_DOWNLOADS at a time
+ */
+static void google_photo_next(void);
+
+/**
+ * google_photo_ready_cb:
+ * @source: a #GDataContactsContact
+ * @res: a #GAsyncResult
+ * @user_data: a #google_photo_request
+ *
+ * Photo download finished, store it in the cache, attach it to contact and notify views
+ */
+static void google_photo_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	struct google_photo_request *request = user_data;
+	struct google_entry *entry = NULL;
+	ContactsDelta *delta;
 	GError *error = NULL;
-	int chunk_size = 16;
-	int result = 0;
+	GBytes *bytes;
+	guint8 *photo;
+	gsize photo_len;
+	gchar *photo_type = NULL;
+	const gchar *id;
 
-	if (google_init()) {
-		g_warning("google_init() failed!");
-		return -1;
+	google_photo_active--;
+
+	photo = gdata_contacts_contact_get_photo_finish(GDATA_CONTACTS_CONTACT(source), res, &photo_len, &photo_type, &error);
+	g_free(photo_type);
+
+	/* Contact may have been removed or replaced meanwhile */
+	id = gdata_entry_get_id(GDATA_ENTRY(request->gcontact));
+	if (google_entries) {
+		entry = g_hash_table_lookup(google_entries, id);
 	}
 
-	query = GDATA_QUERY(gdata_contacts_query_new_with_limits(NULL, 1, chunk_size));
-	if (query == NULL) {
-		g_warning("Contact query failed");
-		google_shutdown();
-		return -2;
+	if (entry && (entry->contact != request->contact || entry->gcontact != request->gcontact)) {
+		entry = NULL;
 	}
 
-	do {
-		feed = gdata_contacts_service_query_contacts(service, query, NULL, NULL, NULL, &error);
-		if (feed == NULL) {
-			g_warning("Query contacts failed");
-			if (error != NULL) {
-				g_warning("Error: %s", error->message);
-				g_error_free(error);
+	if (!photo) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_debug("%s(): Could not get photo (%s)", __FUNCTION__, error ? error->message : "?");
+
+			/* Allow another attempt on next display */
+			if (entry) {
+				contact_image_set_data(entry->contact, NULL);
 			}
 
-			return -1;
+			google_photo_next();
 		}
+		g_clear_error(&error);
+		goto out;
+	}
 
-		list = gdata_feed_get_entries(feed);
-		result = list ? g_list_length(list) : 0;
-
-		for (list = gdata_feed_get_entries(feed); list != NULL; list = list->next) {
-			GDataContactsContact *gcontact;
-			GDataGDName *name = NULL;
-			GList *number_list = NULL;
-			GList *address_list = NULL;
-			const gchar *id;
-			GHashTable *table;
-			guint8 *photo;
-			gsize photo_len;
-			gchar *photo_type;
-			RmContact *contact;
-
-			if (list->data == NULL) {
-				g_warning("Strange... data == NULL");
-				continue;
-			}
+	if (entry) {
+		if (entry->photo_etag) {
+			gchar *file = google_photo_file(id, entry->photo_etag);
+			gchar *dir = g_path_get_dirname(file);
 
-			gcontact = GDATA_CONTACTS_CONTACT(list->data);
-			if (gcontact == NULL) {
-				g_warning("gcontact == NULL");
-				return -2;
+			g_mkdir_with_parents(dir, 0700);
+			if (!g_file_set_contents(file, (gchar*)photo, photo_len, &error)) {
+				g_debug("%s(): Could not cache photo (%s)", __FUNCTION__, error->message);
+				g_clear_error(&error);
 			}
 
-			id = gdata_entry_get_id(GDATA_ENTRY(list->data));
-			if (id == NULL) {
-				g_warning("id == NULL");
-				return -2;
-			}
+			g_free(dir);
+			g_free(file);
+		}
 
-			table = g_hash_table_new(NULL, NULL);
-			if (table == NULL) {
-				g_warning("table == NULL");
-				return -2;
-			}
+		bytes = g_bytes_new_take(photo, photo_len);
+		contact_image_set_data(entry->contact, bytes);
+		g_bytes_unref(bytes);
 
-			name = gdata_contacts_contact_get_name(gcontact);
-			if (!name) {
-				g_debug("name is NULL");
-				continue;
-			}
+		delta = contacts_delta_new();
+		contacts_delta_modified(delta, entry->contact);
+		contacts_delta_emit(delta);
+	} else {
+		g_free(photo);
+	}
 
-			contact = g_slice_new0(RmContact);
-			contact->priv = g_strdup(id);
+	google_photo_next();
 
-			contact->name = g_strdup(gdata_gd_name_get_full_name(name));
-			if (contact->name == NULL) {
-				g_debug("contact name is NULL");
-				continue;
-			}
+out:
+	g_object_unref(request->gcontact);
+	g_slice_free(struct google_photo_request, request);
+}
 
-			number_list = gdata_contacts_contact_get_phone_numbers(gcontact);
-			while (number_list != NULL && number_list->data != NULL) {
-				GDataGDPhoneNumber *number = number_list->data;
-				const gchar *type = gdata_gd_phone_number_get_relation_type(number);
-				const gchar *num = gdata_gd_phone_number_get_number(number);
-				RmPhoneNumber *phone_number;
-
-				if (type == NULL) {
-					g_warning("type == NULL");
-					break;
-				}
-				if (num == NULL) {
-					g_warning("num == NULL");
-					break;
-				}
+static void google_photo_next(void)
+{
+	while (service && google_photo_active < GOOGLE_PHOTO_DOWNLOADS && !g_queue_is_empty(&google_photo_queue)) {
+		struct google_photo_request *request = g_queue_pop_head(&google_photo_queue);
 
-				phone_number = g_slice_new(RmPhoneNumber);
-				if (strcmp(type, GDATA_GD_PHONE_NUMBER_WORK) == 0) {
-					phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
-				} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_HOME) == 0) {
-					phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
-				} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_MOBILE) == 0) {
-					phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
-				} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_HOME_FAX) == 0) {
-					phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
-				} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_WORK_FAX) == 0) {
-					phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
-				}
-				phone_number->number = rm_number_full(num, FALSE);
-				contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+		google_photo_active++;
+		gdata_contacts_contact_get_photo_async(request->gcontact, service, google_cancellable, google_photo_ready_cb, request);
+	}
+}
 
-				number_list = number_list->next;
-			}
+/**
+ * google_photo_load:
+ * @contact: a #RmContact
+ * @user_data: a #GDataContactsContact
+ *
+ * Queue photo download of contact
+ */
+static void google_photo_load(RmContact *contact, gpointer user_data)
+{
+	struct google_photo_request *request = g_slice_new(struct google_photo_request);
 
-			address_list = gdata_contacts_contact_get_postal_addresses(gcontact);
-			while (address_list != NULL && address_list->data != NULL) {
-				GDataGDPostalAddress *gaddress = address_list->data;
-				const gchar *type = gdata_gd_postal_address_get_relation_type(gaddress);
-				RmContactAddress *address;
+	request->contact = contact;
+	request->gcontact = g_object_ref(user_data);
 
-				if (type == NULL) {
-					g_warning("type == NULL");
-					break;
-				}
+	g_queue_push_tail(&google_photo_queue, request);
+	google_photo_next();
+}
 
-				address = g_slice_new0(RmContactAddress);
-				if (!strcmp(type, GDATA_GD_POSTAL_ADDRESS_WORK)) {
-					address->type = 1;
-				} else {
-					address->type = 0;
-				}
+/**
+ * google_entry_set_photo:
+ * @entry: a #google_entry
+ * @id: entry id
+ *
+ * Attach cached photo to contact, or a loader if it has not been downloaded yet
+ */
+static void google_entry_set_photo(struct google_entry *entry, const gchar *id)
+{
+	gchar *file;
+
+	/* Only contacts with a photo have an etag */
+	if (entry->photo_etag == NULL) {
+		return;
+	}
+
+	file = google_photo_file(id, entry->photo_etag);
+	if (g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+		contact_image_set_file(entry->contact, file);
+	} else {
+		/* Download it on first display */
+		contact_image_set_loader(entry->contact, google_photo_load, g_object_ref(entry->gcontact), g_object_unref);
+	}
+	g_free(file);
+}
+
+/**
+ * google_contact_new:
+ * @gcontact: a #GDataContactsContact
+ *
+ * Create roger contact from google contact
+ *
+ * Returns: new #RmContact or %NULL if contact has no name
+ */
+static RmContact *google_contact_new(GDataContactsContact *gcontact)
+{
+	GDataGDName *name;
+	GList *number_list;
+	GList *address_list;
+	RmContact *contact;
+	const gchar *full_name;
+
+	name = gdata_contacts_contact_get_name(gcontact);
+	full_name = name ? gdata_gd_name_get_full_name(name) : NULL;
+	if (full_name == NULL) {
+		g_debug("%s(): contact name is NULL", __FUNCTION__);
+		return NULL;
+	}
+
+	contact = g_slice_new0(RmContact);
+	contact->priv = g_strdup(gdata_entry_get_id(GDATA_ENTRY(gcontact)));
+	contact->name = g_strdup(full_name);
+
+	number_list = gdata_contacts_contact_get_phone_numbers(gcontact);
+	while (number_list != NULL && number_list->data != NULL) {
+		GDataGDPhoneNumber *number = number_list->data;
+		const gchar *type = gdata_gd_phone_number_get_relation_type(number);
+		const gchar *num = gdata_gd_phone_number_get_number(number);
+		RmPhoneNumber *phone_number;
+
+		if (type == NULL) {
+			g_warning("type == NULL");
+			break;
+		}
+		if (num == NULL) {
+			g_warning("num == NULL");
+			break;
+		}
+
+		phone_number = g_slice_new0(RmPhoneNumber);
+		if (strcmp(type, GDATA_GD_PHONE_NUMBER_WORK) == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
+		} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_HOME) == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
+		} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_MOBILE) == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
+		} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_HOME_FAX) == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
+		} else if (strcmp(type, GDATA_GD_PHONE_NUMBER_WORK_FAX) == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
+		}
+		phone_number->number = rm_number_full(num, FALSE);
+		contact->numbers = g_slist_prepend(contact->numbers, phone_number);
+
+		number_list = number_list->next;
+	}
+
+	address_list = gdata_contacts_contact_get_postal_addresses(gcontact);
+	while (address_list != NULL && address_list->data != NULL) {
+		GDataGDPostalAddress *gaddress = address_list->data;
+		const gchar *type = gdata_gd_postal_address_get_relation_type(gaddress);
+		RmContactAddress *address;
+
+		if (type == NULL) {
+			g_warning("type == NULL");
+			break;
+		}
+
+		address = g_slice_new0(RmContactAddress);
+		if (!strcmp(type, GDATA_GD_POSTAL_ADDRESS_WORK)) {
+			address->type = 1;
+		} else {
+			address->type = 0;
+		}
+
+		const gchar *tmp = gdata_gd_postal_address_get_street(gaddress);
+		address->street = g_strdup(tmp ? tmp : "");
+		tmp = gdata_gd_postal_address_get_city(gaddress);
+		address->city = g_strdup(tmp ? tmp : "");
+		//address->country = g_strdup(gdata_gd_postal_address_get_country(gaddress));
+		tmp = gdata_gd_postal_address_get_postcode(gaddress);
+		address->zip = g_strdup(tmp ? tmp : "");
+
+		contact->addresses = g_slist_prepend(contact->addresses, address);
+
+		address_list = address_list->next;
+	}
+
+	return contact;
+}
+
+/**
+ * google_sort_contacts:
+ *
+ * Rebuild sorted contact list from entries
+ */
+static void google_sort_contacts(void)
+{
+	ContactListBuilder *builder = contact_list_builder_new(g_hash_table_size(google_entries));
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, google_entries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct google_entry *entry = value;
+
+		contact_list_builder_add(builder, entry->contact);
+	}
+
+	g_slist_free(contacts);
+	contacts = contact_list_builder_end(builder);
+}
+
+/**
+ * google_cache_load:
+ *
+ * Load contacts and sync state of previous session, so that contacts are available without network
+ */
+static void google_cache_load(void)
+{
+	GKeyFile *keyfile = g_key_file_new();
+	gchar *file = google_cache_file("contacts.cache");
+	gchar *user = g_settings_get_string(google_settings, "user");
+	gchar *cached_user = NULL;
+	gchar **groups = NULL;
+	gint index;
+
+	if (!g_key_file_load_from_file(keyfile, file, G_KEY_FILE_NONE, NULL)) {
+		goto out;
+	}
+
+	/* Cache of another account is of no use */
+	cached_user = g_key_file_get_string(keyfile, "sync", "user", NULL);
+	if (g_strcmp0(user, cached_user)) {
+		goto out;
+	}
+
+	groups = g_key_file_get_groups(keyfile, NULL);
+	for (index = 0; groups[index] != NULL; index++) {
+		GDataParsable *parsable;
+		struct google_entry *entry;
+		RmContact *contact;
+		GError *error = NULL;
+		gchar *xml;
+		const gchar *id;
+
+		if (!g_str_has_prefix(groups[index], "contact ")) {
+			continue;
+		}
+
+		xml = g_key_file_get_string(keyfile, groups[index], "entry", NULL);
+		parsable = xml ? gdata_parsable_new_from_xml(GDATA_TYPE_CONTACTS_CONTACT, xml, -1, &error) : NULL;
+		g_free(xml);
+
+		if (parsable == NULL) {
+			g_debug("%s(): Could not parse cached entry (%s)", __FUNCTION__, error ? error->message : "?");
+			g_clear_error(&error);
+			continue;
+		}
+
+		id = gdata_entry_get_id(GDATA_ENTRY(parsable));
+		contact = id ? google_contact_new(GDATA_CONTACTS_CONTACT(parsable)) : NULL;
+		if (contact == NULL) {
+			g_object_unref(parsable);
+			continue;
+		}
+
+		entry = g_slice_new0(struct google_entry);
+		entry->contact = contact;
+		entry->gcontact = GDATA_CONTACTS_CONTACT(parsable);
+		entry->photo_etag = g_key_file_get_string(keyfile, groups[index], "photo-etag", NULL);
+		g_hash_table_insert(google_entries, g_strdup(id), entry);
+
+		google_entry_set_photo(entry, id);
+	}
+
+	google_updated = g_key_file_get_int64(keyfile, "sync", "updated", NULL);
+	google_sort_contacts();
+
+	g_debug("%s(): %d cached contacts", __FUNCTION__, g_hash_table_size(google_entries));
+
+out:
+	g_strfreev(groups);
+	g_free(cached_user);
+	g_free(user);
+	g_free(file);
+	g_key_file_free(keyfile);
+}
+
+/**
+ * google_cache_save:
+ *
+ * Store contacts and sync state for next session
+ */
+static void google_cache_save(void)
+{
+	GKeyFile *keyfile = g_key_file_new();
+	gchar *dir = google_cache_file(NULL);
+	gchar *file = google_cache_file("contacts.cache");
+	gchar *user = g_settings_get_string(google_settings, "user");
+	GError *error = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	gint index = 0;
+
+	g_key_file_set_string(keyfile, "sync", "user", user);
+	g_key_file_set_int64(keyfile, "sync", "updated", google_updated);
+
+	g_hash_table_iter_init(&iter, google_entries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct google_entry *entry = value;
+		gchar *group = g_strdup_printf("contact %d", index++);
+		gchar *xml = gdata_parsable_get_xml(GDATA_PARSABLE(entry->gcontact));
+
+		g_key_file_set_string(keyfile, group, "entry", xml);
+		if (entry->photo_etag) {
+			g_key_file_set_string(keyfile, group, "photo-etag", entry->photo_etag);
+		}
+
+		g_free(xml);
+		g_free(group);
+	}
+
+	g_mkdir_with_parents(dir, 0700);
+	if (!g_key_file_save_to_file(keyfile, file, &error)) {
+		g_warning("%s(): Could not save cache (%s)", __FUNCTION__, error->message);
+		g_clear_error(&error);
+	}
+
+	g_free(user);
+	g_free(file);
+	g_free(dir);
+	g_key_file_free(keyfile);
+}
+
+/**
+ * google_remove_entry:
+ * @sync: a #google_sync
+ * @id: entry id
+ *
+ * Remove entry and record it in delta, contact is freed after the delta has been emitted
+ */
+static void google_remove_entry(struct google_sync *sync, const gchar *id)
+{
+	struct google_entry *entry = g_hash_table_lookup(google_entries, id);
+	GList *list;
+	GList *next;
+
+	if (entry == NULL) {
+		return;
+	}
+
+	if (entry->photo_etag) {
+		gchar *file = google_photo_file(id, entry->photo_etag);
 
-				const gchar *tmp = gdata_gd_postal_address_get_street(gaddress);
-				address->street = g_strdup(tmp ? tmp : "");
-				tmp = gdata_gd_postal_address_get_city(gaddress);
-				address->city = g_strdup(tmp ? tmp : "");
-				//address->country = g_strdup(gdata_gd_postal_address_get_country(gaddress));
-				tmp = gdata_gd_postal_address_get_postcode(gaddress);
-				address->zip = g_strdup(tmp ? tmp : "");
+		g_remove(file);
+		g_free(file);
+	}
+
+	/* Drop queued photo downloads of contact */
+	for (list = google_photo_queue.head; list != NULL; list = next) {
+		struct google_photo_request *request = list->data;
+
+		next = list->next;
+		if (request->contact == entry->contact) {
+			g_queue_delete_link(&google_photo_queue, list);
+			g_object_unref(request->gcontact);
+			g_slice_free(struct google_photo_request, request);
+		}
+	}
 
-				contact->addresses = g_slist_prepend(contact->addresses, address);
+	contacts_delta_removed(sync->delta, entry->contact);
+	sync->removed = g_slist_prepend(sync->removed, entry->contact);
+	g_hash_table_remove(google_entries, id);
+}
+
+/**
+ * google_apply_entry:
+ * @sync: a #google_sync
+ * @gcontact: a #GDataContactsContact
+ *
+ * Apply a new, changed or deleted google contact
+ */
+static void google_apply_entry(struct google_sync *sync, GDataContactsContact *gcontact)
+{
+	const gchar *id = gdata_entry_get_id(GDATA_ENTRY(gcontact));
+	const gchar *photo_etag = gdata_contacts_contact_get_photo_etag(gcontact);
+	struct google_entry *entry;
+	RmContact *contact;
+
+	if (id == NULL) {
+		g_warning("id == NULL");
+		return;
+	}
+
+	if (sync->seen) {
+		g_hash_table_add(sync->seen, g_strdup(id));
+	}
+
+	if (gdata_contacts_contact_is_deleted(gcontact)) {
+		google_remove_entry(sync, id);
+		return;
+	}
+
+	entry = g_hash_table_lookup(google_entries, id);
+
+	/* Unchanged since last sync */
+	if (entry && !g_strcmp0(gdata_entry_get_etag(GDATA_ENTRY(entry->gcontact)), gdata_entry_get_etag(GDATA_ENTRY(gcontact)))) {
+		return;
+	}
+
+	contact = google_contact_new(gcontact);
+	if (contact == NULL) {
+		google_remove_entry(sync, id);
+		return;
+	}
 
-				address_list = address_list->next;
+	if (entry) {
+		/* Modified, keep contact pointer but update its content */
+		contacts_delta_add_numbers(sync->delta, entry->contact);
+		rm_contact_copy(contact, entry->contact);
+		rm_contact_free(contact);
+		contact_image_clear(entry->contact);
+
+		if (entry->photo_etag && g_strcmp0(entry->photo_etag, photo_etag)) {
+			gchar *file = google_photo_file(id, entry->photo_etag);
+
+			g_remove(file);
+			g_free(file);
+		}
+
+		g_object_unref(entry->gcontact);
+		g_free(entry->photo_etag);
+		contacts_delta_modified(sync->delta, entry->contact);
+	} else {
+		entry = g_slice_new0(struct google_entry);
+		entry->contact = contact;
+		g_hash_table_insert(google_entries, g_strdup(id), entry);
+		contacts_delta_added(sync->delta, contact);
+	}
+
+	entry->gcontact = g_object_ref(gcontact);
+	entry->photo_etag = g_strdup(photo_etag);
+	google_entry_set_photo(entry, id);
+}
+
+/**
+ * google_sync_finish:
+ * @sync: a #google_sync
+ * @complete: %TRUE if all pages have been read
+ *
+ * Emit changes of sync and persist the new state
+ */
+static void google_sync_finish(struct google_sync *sync, gboolean complete)
+{
+	gboolean changed = !contacts_delta_is_empty(sync->delta);
+
+	if (complete && sync->seen) {
+		/* Full sync: whatever has not been seen is gone */
+		GHashTableIter iter;
+		gpointer key;
+		GSList *gone = NULL;
+		GSList *list;
+
+		g_hash_table_iter_init(&iter, google_entries);
+		while (g_hash_table_iter_next(&iter, &key, NULL)) {
+			if (!g_hash_table_contains(sync->seen, key)) {
+				gone = g_slist_prepend(gone, g_strdup(key));
 			}
+		}
 
-			photo = gdata_contacts_contact_get_photo(gcontact, service, &photo_len, &photo_type, NULL, NULL);
-			if (photo != NULL) {
-				GdkPixbufLoader *loader;
+		for (list = gone; list != NULL; list = list->next) {
+			google_remove_entry(sync, list->data);
+		}
+		g_slist_free_full(gone, g_free);
 
-				loader = gdk_pixbuf_loader_new();
-				if (gdk_pixbuf_loader_write(loader, photo, photo_len, NULL)) {
-					contact->image = gdk_pixbuf_loader_get_pixbuf(loader);
-				}
-				gdk_pixbuf_loader_close(loader, NULL);
+		changed = !contacts_delta_is_empty(sync->delta);
+	}
+
+	if (complete && sync->updated) {
+		google_updated = sync->updated;
+	}
+
+	g_debug("%s(): %d added, %d modified, %d removed", __FUNCTION__,
+		g_slist_length(sync->delta->added), g_slist_length(sync->delta->modified), g_slist_length(sync->delta->removed));
+
+	if (changed) {
+		google_sort_contacts();
+	}
+
+	if (changed || complete) {
+		google_cache_save();
+	}
+
+	contacts_delta_emit(sync->delta);
+	g_slist_free_full(sync->removed, google_contact_free);
+
+	if (sync->seen) {
+		g_hash_table_destroy(sync->seen);
+	}
+	g_object_unref(sync->query);
+	g_slice_free(struct google_sync, sync);
+
+	google_syncing = FALSE;
+}
+
+/**
+ * google_sync_fail:
+ * @sync: a #google_sync
+ *
+ * Finish a sync whose query failed
+ *
+ * Returns: %TRUE if a full sync has to be started, as the sync state may be too old for an incremental query
+ */
+static gboolean google_sync_fail(struct google_sync *sync)
+{
+	gboolean restart = sync->seen == NULL && sync->updated == 0;
+
+	if (restart) {
+		google_updated = 0;
+	}
+
+	google_sync_finish(sync, FALSE);
+
+	return restart;
+}
+
+static int google_read_book(void);
+
+/**
+ * google_query_ready_cb:
+ * @source: a #GDataContactsService
+ * @res: a #GAsyncResult
+ * @user_data: a #google_sync
+ *
+ * A page of contacts has been received, apply it and ask for the next one
+ */
+static void google_query_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	struct google_sync *sync = user_data;
+	GDataFeed *feed;
+	GError *error = NULL;
+	GList *list;
+	guint count;
+
+	feed = gdata_service_query_finish(GDATA_SERVICE(source), res, &error);
+	if (feed == NULL) {
+		if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			/* Plugin shutdown, nothing left to update */
+			contacts_delta_free(sync->delta);
+			g_slist_free_full(sync->removed, google_contact_free);
+			if (sync->seen) {
+				g_hash_table_destroy(sync->seen);
 			}
+			g_object_unref(sync->query);
+			g_slice_free(struct google_sync, sync);
+			g_error_free(error);
+			return;
+		}
+
+		g_warning("Query contacts failed");
+		g_warning("Error: %s", error ? error->message : "?");
+		g_clear_error(&error);
 
-			contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
+		if (google_sync_fail(sync)) {
+			/* Start over with a full sync */
+			google_read_book();
 		}
+		return;
+	}
+
+	if (!sync->updated) {
+		sync->updated = gdata_feed_get_updated(feed);
+	}
+
+	list = gdata_feed_get_entries(feed);
+	count = g_list_length(list);
+
+	for (; list != NULL; list = list->next) {
+		if (list->data == NULL || !GDATA_IS_CONTACTS_CONTACT(list->data)) {
+			g_warning("Strange... data == NULL");
+			continue;
+		}
+
+		google_apply_entry(sync, list->data);
+	}
+
+	g_object_unref(feed);
+
+	if (count == GOOGLE_PAGE_SIZE) {
+		gdata_query_next_page(sync->query);
+		gdata_contacts_service_query_contacts_async(service, sync->query, google_cancellable, NULL, NULL, NULL, google_query_ready_cb, sync);
+		return;
+	}
 
-		gdata_query_next_page(GDATA_QUERY(query));
-	} while (result == chunk_size);
+	google_sync_finish(sync, TRUE);
+}
+
+/**
+ * google_sync_new:
+ *
+ * Create sync of contacts. Only entries changed since the last sync are requested,
+ * unless there is no sync state yet.
+ *
+ * Returns: a new #google_sync or %NULL on error
+ */
+static struct google_sync *google_sync_new(void)
+{
+	struct google_sync *sync;
+	GDataQuery *query;
+
+	query = GDATA_QUERY(gdata_contacts_query_new_with_limits(NULL, 1, GOOGLE_PAGE_SIZE));
+	if (query == NULL) {
+		return NULL;
+	}
+
+	sync = g_slice_new0(struct google_sync);
+	sync->query = query;
+	sync->delta = contacts_delta_new();
+
+	if (google_updated) {
+		gdata_query_set_updated_min(query, google_updated);
+		gdata_contacts_query_set_show_deleted(GDATA_CONTACTS_QUERY(query), TRUE);
+	} else {
+		sync->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	}
+
+	return sync;
+}
+
+/**
+ * google_read_book:
+ *
+ * Fetch contacts in the background
+ *
+ * Returns: error code
+ */
+static int google_read_book(void)
+{
+	struct google_sync *sync;
+
+	if (google_syncing) {
+		return 0;
+	}
+
+	if (google_init()) {
+		g_warning("google_init() failed!");
+		return -1;
+	}
+
+	if (service == NULL) {
+		/* Not configured */
+		return 0;
+	}
+
+	sync = google_sync_new();
+	if (sync == NULL) {
+		g_warning("Contact query failed");
+		google_shutdown();
+		return -2;
+	}
+
+	if (!google_cancellable) {
+		google_cancellable = g_cancellable_new();
+	}
+
+	google_syncing = TRUE;
+	gdata_contacts_service_query_contacts_async(service, sync->query, google_cancellable, NULL, NULL, NULL, google_query_ready_cb, sync);
 
-	g_debug("done");
 	return 0;
 }
 
@@ -838,11 +1491,25 @@ gchar *google_get_active_book_name(void)
 	return g_strdup("Google");
 }
 
+/**
+ * google_reload_contacts:
+ *
+ * Sync contacts with the server, only changes since the last sync are requested
+ *
+ * Returns: %TRUE
+ */
+static gboolean google_reload_contacts(void)
+{
+	google_read_book();
+
+	return TRUE;
+}
+
 RmAddressBook google_book = {
 	"Google",
 	google_get_active_book_name,
 	google_get_contacts,
-	NULL,//google_reload_contacts,
+	google_reload_contacts,
 	NULL,//google_remove_contact,
 	NULL//google_save_contact
 };
@@ -854,8 +1521,10 @@ gboolean google_plugin_init(RmPlugin *plugin)
 	plugin->priv = google_plugin;
 	google_settings = rm_settings_new("org.tabos.roger.plugins.google");
 
-	table = g_hash_table_new(g_str_hash, g_str_equal);
+	google_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, google_entry_free);
 
+	/* Show contacts of last session right away, sync in background */
+	google_cache_load();
 	google_read_book();
 
 	//google_plugin->signal_id = g_signal_connect(G_OBJECT(rm_object), "contact-process", G_CALLBACK(google_contact_process_cb), NULL);
@@ -875,14 +1544,42 @@ gboolean google_plugin_shutdown(RmPlugin *plugin)
 		g_signal_handler_disconnect(G_OBJECT(rm_object), google_plugin->signal_id);
 	}
 
+	if (google_cancellable) {
+		g_cancellable_cancel(google_cancellable);
+		g_clear_object(&google_cancellable);
+	}
+
+	while (!g_queue_is_empty(&google_photo_queue)) {
+		struct google_photo_request *request = g_queue_pop_head(&google_photo_queue);
+
+		g_object_unref(request->gcontact);
+		g_slice_free(struct google_photo_request, request);
+	}
+
 	google_shutdown();
 
-	g_clear_object(&google_settings);
+	g_slist_free(contacts);
+	contacts = NULL;
+
+	if (google_entries) {
+		GHashTableIter iter;
+		gpointer value;
 
-	if (table) {
-		g_hash_table_destroy(table);
+		g_hash_table_iter_init(&iter, google_entries);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			struct google_entry *entry = value;
+
+			google_contact_free(entry->contact);
+		}
+		g_hash_table_destroy(google_entries);
+		google_entries = NULL;
 	}
 
+	google_updated = 0;
+	google_syncing = FALSE;
+
+	g_clear_object(&google_settings);
+
 	return TRUE;
 }
 
@@ -25,6 +25,7 @@
 
 #include <roger/main.h>
 #include <roger/uitools.h>
+#include <roger/contactimage.h>
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 
@@ -72,6 +73,7 @@ gpointer gtknotify_show(RmConnection *connection, RmContact *contact)
 	GtkWidget *contact_street_label;
 	GtkWidget *contact_city_label;
 	GtkWidget *image;
+	GdkPixbuf *pixbuf;
 	gchar *tmp;
 	GtkBuilder *builder;
 
@@ -103,8 +105,9 @@ gpointer gtknotify_show(RmConnection *connection, RmContact *contact)
 	gtk_label_set_text(GTK_LABEL(contact_city_label), tmp);
 	g_free(tmp);
 
-	if (contact->image) {
-		GdkPixbuf *buf = rm_image_scale(contact->image, 96);
+	pixbuf = contact_image_get(contact);
+	if (pixbuf) {
+		GdkPixbuf *buf = rm_image_scale(pixbuf, 96);
 		gtk_image_set_from_pixbuf(GTK_IMAGE(image), buf);
 	}
 
@@ -28,6 +28,8 @@
 
 #include <rm/rm.h>
 
+#include <roger/contactlist.h>
+
 #define RM_TYPE_OSXAB_PLUGIN        (rm_osxab_plugin_get_type())
 #define RM_OSXAB_PLUGIN(o)          (G_TYPE_CHECK_INSTANCE_CAST((o), RM_TYPE_OSXAB_PLUGIN, RmOSXAbPlugin))
 
@@ -65,6 +67,7 @@ static char *cstring(CFStringRef s)
 static int osxab_read_book(void)
 {
 	ABAddressBookRef ab = ABGetSharedAddressBook();
+	ContactListBuilder *builder;
 	CFArrayRef entries;
 	CFIndex len;
 
@@ -79,6 +82,7 @@ static int osxab_read_book(void)
 
 	len = CFArrayGetCount(entries);
 
+	builder = contact_list_builder_new(len);
 	for (int i = 0; i < len; i++) {
 		ABPersonRef person = (ABPersonRef)CFArrayGetValueAtIndex(entries, i);
 		CFTypeRef firstName = ABRecordCopyValue(person, kABFirstNameProperty);
@@ -170,9 +174,11 @@ static int osxab_read_book(void)
 			gdk_pixbuf_loader_close(loader, NULL);
 		}
 
-		contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
+		contact_list_builder_add(builder, contact);
 	}
 
+	contacts = contact_list_builder_end(builder);
+
 	return 0;
 }
 
@@ -21,15 +21,21 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <fcntl.h>
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
 
 #include <rm/rm.h>
 
 #include <roger/main.h>
 #include <roger/settings.h>
 #include <roger/uitools.h>
+#include <roger/contactimage.h>
+#include <roger/contactlist.h>
+#include <roger/contactsdelta.h>
 
 void pref_notebook_add_page(GtkWidget *notebook, GtkWidget *page, gchar *title);
 GtkWidget *pref_group_create(GtkWidget *box, gchar *title_str, gboolean hexpand, gboolean vexpand);
@@ -40,90 +46,185 @@ static GHashTable *table = NULL;
 
 #define MORK_COLUMN_META        "<(a=c)>"
 #define DEFAULT_SCOPE           0x80
+#define MORK_TAIL_SIZE          32
 
-#define MAX_VAL                         0x7FFFFFFF
+/**
+ * \brief Columns of interest, column ids are mapped to them once per column dictionary
+ */
+enum mork_field {
+	MORK_FIELD_NONE,
+	MORK_FIELD_DISPLAY_NAME,
+	MORK_FIELD_HOME_PHONE,
+	MORK_FIELD_WORK_PHONE,
+	MORK_FIELD_FAX_NUMBER,
+	MORK_FIELD_CELLULAR_NUMBER,
+	MORK_FIELD_HOME_ADDRESS,
+	MORK_FIELD_HOME_CITY,
+	MORK_FIELD_HOME_ZIP,
+	MORK_FIELD_WORK_ADDRESS,
+	MORK_FIELD_WORK_CITY,
+	MORK_FIELD_WORK_ZIP,
+	MORK_FIELD_PHOTO_NAME,
+	MORK_FIELD_MAX
+};
 
-enum {
-	PARSE_VALUES,
-	PARSE_ROWS,
-	PARSE_COLUMNS
+static const gchar *mork_field_names[MORK_FIELD_MAX] = {
+	NULL,
+	"DisplayName",
+	"HomePhone",
+	"WorkPhone",
+	"FaxNumber",
+	"CellularNumber",
+	"HomeAddress",
+	"HomeCity",
+	"HomeZipCode",
+	"WorkAddress",
+	"WorkCity",
+	"WorkZipCode",
+	"PhotoName",
 };
 
-static gchar *mork_data = NULL;
-static gint mork_pos = 0;
-static gint mork_now_parsing = PARSE_VALUES;
-static gint mork_next_add_value_id = MAX_VAL;
-static GHashTable *mork_values = NULL;
-static GHashTable *mork_columns = NULL;
-static GHashTable *current_cells = NULL;
+static const struct {
+	enum mork_field field;
+	RmPhoneNumberType type;
+} mork_numbers[] = {
+	{ MORK_FIELD_HOME_PHONE, RM_PHONE_NUMBER_TYPE_HOME },
+	{ MORK_FIELD_WORK_PHONE, RM_PHONE_NUMBER_TYPE_WORK },
+	{ MORK_FIELD_FAX_NUMBER, RM_PHONE_NUMBER_TYPE_FAX_HOME },
+	{ MORK_FIELD_CELLULAR_NUMBER, RM_PHONE_NUMBER_TYPE_MOBILE },
+};
 
-static GHashTable *table_scope_map = NULL;
-static gint num_possible = 0;
-static gint num_persons = 0;
-static off_t mork_size = 0;
-static gint default_table_id = 1;
+static const struct {
+	enum mork_field street;
+	enum mork_field city;
+	enum mork_field zip;
+	gint type;
+} mork_addresses[] = {
+	{ MORK_FIELD_HOME_ADDRESS, MORK_FIELD_HOME_CITY, MORK_FIELD_HOME_ZIP, 0 },
+	{ MORK_FIELD_WORK_ADDRESS, MORK_FIELD_WORK_CITY, MORK_FIELD_WORK_ZIP, 1 },
+};
 
 /**
- * \brief Get selected thunderbird addressbook
- * \return thunderbird addressbook
+ * \brief Mork row, only the columns of interest are kept
+ * \param key row scope in the upper and row id in the lower 32 bits
+ * \param fields file offset + 1 of cell values, 0 if not set, see mork_decode()
  */
-static const gchar *thunderbird_get_selected_book(void)
-{
-	return g_settings_get_string(thunderbird_settings, "filename");
-}
+struct mork_row {
+	gint64 key;
+	gsize fields[MORK_FIELD_MAX];
+};
 
 /**
- * \brief Set selected thunderbird addressbook
- * \param uri thunderbird addressbook
+ * \brief Parsed state of an address book, kept between parses so that only appended groups are parsed
+ * \param file_name address book file name
+ * \param inode inode of file, a new inode means that the file has been rewritten
+ * \param offset end of last complete group, parsing continues here
+ * \param tail bytes in front of offset, used to detect a compacted file
+ * \param tail_len length of tail
+ * \param values value id to file offset + 1 of value
+ * \param columns column id to enum mork_field
+ * \param rows row key to struct mork_row
+ * \param db abook.sqlite connection, kept open as PRAGMA data_version is per connection
+ * \param data_version data version of db when it has been read
+ *
+ * Mork files only grow by appending, so file offsets stay valid until the file is compacted.
  */
-void thunderbird_set_selected_book(gchar *uri)
-{
-	g_settings_set_string(thunderbird_settings, "filename", uri);
-}
+struct mork_state {
+	gchar *file_name;
+	guint64 inode;
+	gsize offset;
+	gchar tail[MORK_TAIL_SIZE];
+	gsize tail_len;
+	GHashTable *values;
+	GHashTable *columns;
+	GHashTable *rows;
+#ifdef HAVE_SQLITE3
+	sqlite3 *db;
+	gint64 data_version;
+#endif
+};
 
 /**
- * \brief Destroy hashtable
- * \param data hashtable widget
+ * \brief Mork parser, one per parse so that it can run on a worker thread
+ * \param map mapped address book file
+ * \param data contents of map
+ * \param pos current position
+ * \param size size of data
+ * \param end end of last complete group or top level section
+ * \param in_group TRUE while within a group
+ * \param state parsed state, updated in place
+ * \param touched set of row keys touched by this parse, NULL on a full parse
+ * \param row row currently parsed
+ * \param buffer scratch buffer for values with escapes
  */
-void hash_destroy(void *data)
-{
-	g_hash_table_destroy(data);
-}
+struct mork_parser {
+	GMappedFile *map;
+	const gchar *data;
+	gsize pos;
+	gsize size;
+	gsize end;
+	gboolean in_group;
+	struct mork_state *state;
+	GHashTable *touched;
+	struct mork_row *row;
+	GString *buffer;
+};
 
 /**
- * \brief Create map structure
- * \param FreeData free data function
- * \return new hash table
+ * \brief Result of a book read in the worker thread
+ * \param state parsed state, handed back to the main thread
+ * \param full TRUE if book has been parsed from scratch
+ * \param persons row key to #RmContact, all persons on a full parse, otherwise touched rows only with %NULL for removed persons
+ * \param photos contact to photo file name, applied in main thread
+ * \param num_possible number of rows
+ * \param num_persons number of imported persons
  */
-static GHashTable *create_map(GDestroyNotify notify)
-{
-	GHashTable *table;
+struct mork_book {
+	struct mork_state *state;
+	gboolean full;
+	GHashTable *persons;
+	GHashTable *photos;
+	gint num_possible;
+	gint num_persons;
+};
+
+/**
+ * \brief Job handed to the worker thread
+ * \param file_name address book file name
+ * \param state state of previous parse or NULL
+ */
+struct mork_job {
+	gchar *file_name;
+	struct mork_state *state;
+};
 
-	table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, notify);
+static GCancellable *thunderbird_cancellable = NULL;
+static GFileMonitor *thunderbird_monitor = NULL;
+/* Row key to RmContact */
+static GHashTable *thunderbird_contacts = NULL;
+/* Parsed state, NULL while a parse is running */
+static struct mork_state *thunderbird_state = NULL;
+static gboolean thunderbird_busy = FALSE;
+static gboolean thunderbird_pending = FALSE;
 
-	return table;
-}
+static int thunderbird_read_book(void);
 
 /**
- * \brief Insert key and value into map structure, check for double entries
- * \param table pointer to hash table
- * \param key key value
- * \param value value pointer
+ * \brief Get selected thunderbird addressbook
+ * \return thunderbird addressbook, free with g_free()
  */
-static inline void insert_map(GHashTable *table, long key, void *value)
+static gchar *thunderbird_get_selected_book(void)
 {
-	g_hash_table_insert(table, GINT_TO_POINTER(key), value);
+	return g_settings_get_string(thunderbird_settings, "filename");
 }
 
 /**
- * \brief Find map entry by key
- * \param table pointer to hash table
- * \param key key id
- * \return value of key or NULL on error
+ * \brief Set selected thunderbird addressbook
+ * \param uri thunderbird addressbook
  */
-static inline void *find_map_entry(GHashTable *table, int key)
+void thunderbird_set_selected_book(gchar *uri)
 {
-	return g_hash_table_lookup(table, GINT_TO_POINTER(key));
+	g_settings_set_string(thunderbird_settings, "filename", uri);
 }
 
 /**
@@ -186,20 +287,31 @@ static gchar *find_thunderbird_dir(void)
 
 /**
  * \brief Get next gchar of buffer
- * \return next gchar
+ * \param parser mork parser
+ * \return next gchar or 0 at end of file
  */
-static inline gchar next_char(void)
+static inline gchar next_char(struct mork_parser *parser)
 {
 	gchar cur = 0;
 
-	if (mork_pos < mork_size) {
-		cur = mork_data[mork_pos];
-		mork_pos++;
+	if (parser->pos < parser->size) {
+		cur = parser->data[parser->pos];
+		parser->pos++;
 	}
 
 	return cur;
 }
 
+/**
+ * \brief Get next gchar of buffer without consuming it
+ * \param parser mork parser
+ * \return next gchar or 0 at end of file
+ */
+static inline gchar peek_char(struct mork_parser *parser)
+{
+	return parser->pos < parser->size ? parser->data[parser->pos] : 0;
+}
+
 /**
  * \brief Check if gchar is whitespace
  * \param character gchar to check
@@ -220,760 +332,1349 @@ static gboolean is_whitespace(gchar character)
 }
 
 /**
- * \brief Parse comment section
- * \return 1 on success, else error
+ * \brief Parse hex number at current position
+ * \param parser mork parser
+ * \return number
  */
-static inline gboolean parse_comment(void)
+static gint parse_hex(struct mork_parser *parser)
 {
-	gchar cur = next_char();
-
-	if (cur != '/') {
-		return FALSE;
-	}
+	gint value = 0;
 
-	while (cur != '\r' && cur != '\n' && cur) {
-		cur = next_char();
+	while (parser->pos < parser->size && g_ascii_isxdigit(parser->data[parser->pos])) {
+		value = (value << 4) | g_ascii_xdigit_value(parser->data[parser->pos]);
+		parser->pos++;
 	}
 
-	return TRUE;
+	return value;
 }
 
 /**
- * \brief Parse cell section
- * \return 1 on success, else error
+ * \brief Skip cell value up to and including the closing bracket
+ * \param parser mork parser
+ * \return TRUE if cell is complete
  */
-static gboolean parse_cell(void)
+static gboolean skip_value(struct mork_parser *parser)
 {
-	gboolean result = TRUE;
-	gboolean is_column = TRUE;
-	gboolean is_value_oid = FALSE;
-	GString *column = g_string_new_len(NULL, 4);
-	GString *text = g_string_new_len(NULL, 32);
-	int corners = 0;
-	gchar cur = next_char();
-
-	while (result && cur != ')' && cur) {
-		switch (cur) {
-		case '=':
-			/* From column to value */
-			if (is_column) {
-				is_column = FALSE;
-			} else {
-				text = g_string_append_c(text, cur);
-			}
-			break;
-		case '$': {
-			gchar hex_chr[3];
-			int x;
-
-			hex_chr[0] = next_char();
-			hex_chr[1] = next_char();
-			hex_chr[2] = '\0';
-			x = strtoul(hex_chr, 0, 16);
-			g_string_append_printf(text, "%c", x);
-			break;
-		}
-		case '\\': {
-			gchar next_chr = next_char();
-			if (next_chr != '\r' && next_chr != '\n') {
-				text = g_string_append_c(text, next_chr);
-			} else {
-				/* Ignored */
-				cur = next_char();
-			}
-			break;
+	const gchar *ptr = parser->data + parser->pos;
+	const gchar *end = parser->data + parser->size;
+
+	while (ptr < end) {
+		if (*ptr == ')') {
+			parser->pos = ptr + 1 - parser->data;
+			return TRUE;
 		}
-		case '^':
-			corners++;
-			if (corners == 1) {
-			} else if (corners == 2) {
-				is_column = FALSE;
-				is_value_oid = TRUE;
-			} else {
-				text = g_string_append_c(text, cur);
-			}
-			break;
-		default:
-			if (is_column) {
-				column = g_string_append_c(column, cur);
-			} else {
-				text = g_string_append_c(text, cur);
-			}
-			break;
+
+		/* Escaped character, e.g. \) */
+		if (*ptr == '\\') {
+			ptr++;
 		}
+		ptr++;
+	}
 
-		cur = next_char();
+	parser->pos = parser->size;
+
+	return FALSE;
+}
+
+/**
+ * \brief Decode cell value, resolving escapes and line continuations
+ * \param parser mork parser
+ * \param offset file offset + 1 of value, 0 if not set
+ * \return newly allocated string or NULL if value is empty
+ */
+static gchar *mork_decode(struct mork_parser *parser, gsize offset)
+{
+	const gchar *end = parser->data + parser->size;
+	const gchar *value;
+	const gchar *ptr;
+
+	if (!offset || offset > parser->size) {
+		return NULL;
 	}
 
-	int column_id = strtoul(column->str, 0, 16);
+	value = parser->data + offset - 1;
 
-	if (mork_now_parsing != PARSE_ROWS) {
-		/* Dicts */
-		if (text && strlen(text->str)) {
-			//g_debug("Text: %s, %lx, %d", text->str, column_id, mork_now_parsing == PARSE_COLUMNS);
-			if (mork_now_parsing == PARSE_COLUMNS) {
-				insert_map(mork_columns, column_id, g_strdup(text->str));
-			} else {
-				insert_map(mork_values, column_id, g_strdup(text->str));
+	/* Most values are plain text and can be copied in one go */
+	for (ptr = value; ptr < end && *ptr != ')' && *ptr != '\\' && *ptr != '$'; ptr++) {
+	}
+
+	if (ptr == end || *ptr == ')') {
+		return ptr != value ? g_strndup(value, ptr - value) : NULL;
+	}
+
+	g_string_truncate(parser->buffer, 0);
+	g_string_append_len(parser->buffer, value, ptr - value);
+
+	while (ptr < end && *ptr != ')') {
+		if (*ptr == '\\') {
+			ptr++;
+			if (ptr == end) {
+				break;
 			}
-		}
-	} else {
-		if (text && strlen(text->str)) {
-			gint value_id = strtoul(text->str, 0, 16);
 
-			//g_debug("is_value_oid: %d", is_value_oid);
-			/* Rows */
-			if (is_value_oid) {
-				insert_map(current_cells, column_id, GINT_TO_POINTER(value_id));
+			if (*ptr == '\r' || *ptr == '\n') {
+				/* Line continuation, ignored */
+				if (*ptr == '\r' && ptr + 1 < end && ptr[1] == '\n') {
+					ptr++;
+				}
 			} else {
-				mork_next_add_value_id--;
-				insert_map(mork_values, mork_next_add_value_id, g_strdup(text->str));
-				insert_map(current_cells, column_id, GINT_TO_POINTER(mork_next_add_value_id));
-				//g_debug("text: %s", text->str);
+				g_string_append_c(parser->buffer, *ptr);
 			}
+		} else if (*ptr == '$' && end - ptr > 2 && g_ascii_isxdigit(ptr[1]) && g_ascii_isxdigit(ptr[2])) {
+			g_string_append_c(parser->buffer, (g_ascii_xdigit_value(ptr[1]) << 4) | g_ascii_xdigit_value(ptr[2]));
+			ptr += 2;
+		} else {
+			g_string_append_c(parser->buffer, *ptr);
 		}
+		ptr++;
 	}
 
-	g_string_free(column, TRUE);
-	g_string_free(text, TRUE);
-
-	return result;
+	return parser->buffer->len ? g_strndup(parser->buffer->str, parser->buffer->len) : NULL;
 }
 
 /**
- * \brief Parse dictionary section
- * \return 1 on success, else error
+ * \brief Look up field of a column name
+ * \param name column name, not NUL-terminated
+ * \param len length of name
+ * \return field or MORK_FIELD_NONE if column is of no interest
  */
-static gboolean parse_dict(void)
+static enum mork_field mork_lookup_field(const gchar *name, gsize len)
 {
-	gchar cur = next_char();
-	gboolean result = TRUE;
+	gint field;
 
-	mork_now_parsing = PARSE_VALUES;
-
-	while (result && cur != '>' && cur) {
-		if (!is_whitespace(cur)) {
-			switch (cur) {
-			case '<':
-				if (!strncmp(mork_data + mork_pos - 1, MORK_COLUMN_META, strlen(MORK_COLUMN_META))) {
-					mork_now_parsing = PARSE_COLUMNS;
-					mork_pos += strlen(MORK_COLUMN_META) - 1;
-				}
-				break;
-			case '/':
-				result = parse_comment();
-				break;
-			case '(':
-				result = parse_cell();
-				break;
-			default:
-				g_warning("[%s]: error '%c'", __FUNCTION__, cur);
-				result = FALSE;
-				break;
-			}
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		if (strlen(mork_field_names[field]) == len && !memcmp(mork_field_names[field], name, len)) {
+			return field;
 		}
-		cur = next_char();
 	}
 
-	return result;
+	return MORK_FIELD_NONE;
 }
 
 /**
- * \brief Parse scope id
- * \param pnText while text
- * \param pid pointer to save id
- * \param scope pointer to save scope
+ * \brief Free mork row
+ * \param data struct mork_row
  */
-static void parse_scope_id(GString *text, gint *id, gint *scope)
+static void mork_row_free(gpointer data)
 {
-	gchar *pos;
-
-	if ((pos = strchr(text->str, ':')) != NULL) {
-		gint size = pos - text->str;
-		gchar *id_str = NULL;
-		gchar *sc_str = NULL;
-		gint pos = size;
-
-		id_str = g_malloc(size + 1);
-		strncpy(id_str, text->str, pos);
-		id_str[size] = '\0';
-
-		size = strlen(text->str) - pos;
-		sc_str = g_malloc(size);
-		strncpy(sc_str, text->str + pos + 1, size);
-		sc_str[size] = '\0';
-
-		if (size > 1 && sc_str[0] == '^') {
-			/*gchar *tmp = g_malloc(strlen(sc_str));
-			   strncpy(tmp, sc_str + 1, strlen(sc_str));
-			   g_free(sc_str);
-			   sc_str = tmp;*/
-			memmove(sc_str, sc_str + 1, size - 1);
-		}
+	g_slice_free(struct mork_row, data);
+}
 
-		*id = strtoul(id_str, 0, 16);
-		g_free(id_str);
-		*scope = strtoul(sc_str, 0, 16);
-		g_free(sc_str);
-	} else {
-		*id = strtoul(text->str, 0, 16);
-		*scope = 0;
+/**
+ * \brief Create row key
+ * \param scope row scope id, 0 for default scope
+ * \param id row id
+ * \return row key
+ */
+static inline gint64 mork_row_key(gint scope, gint id)
+{
+	return ((gint64)(scope ? scope : DEFAULT_SCOPE) << 32) | (guint32)id;
+}
+
+/**
+ * \brief Remember row as touched by an incremental parse
+ * \param parser mork parser
+ * \param key row key
+ */
+static void mork_touch_row(struct mork_parser *parser, gint64 key)
+{
+	if (parser->touched != NULL && !g_hash_table_contains(parser->touched, &key)) {
+		gint64 *copy = g_new(gint64, 1);
+
+		*copy = key;
+		g_hash_table_add(parser->touched, copy);
 	}
 }
 
 /**
- * \brief Parse meta section
- * \param character current gchar
+ * \brief Get row by scope and id, create it if needed
+ * \param parser mork parser
+ * \param scope row scope id, 0 for default scope
+ * \param id row id
+ * \return mork row
+ */
+static struct mork_row *mork_get_row(struct mork_parser *parser, gint scope, gint id)
+{
+	struct mork_row *row;
+	gint64 key = mork_row_key(scope, id);
+
+	row = g_hash_table_lookup(parser->state->rows, &key);
+	if (row == NULL) {
+		row = g_slice_new0(struct mork_row);
+		row->key = key;
+		g_hash_table_insert(parser->state->rows, &row->key, row);
+	}
+
+	mork_touch_row(parser, key);
+
+	return row;
+}
+
+/**
+ * \brief Parse comment section
+ * \param parser mork parser
  * \return 1 on success, else error
  */
-static gchar parse_meta(gchar character)
+static inline gboolean parse_comment(struct mork_parser *parser)
 {
-	gchar cur = next_char();
+	gchar cur = next_char(parser);
+
+	if (cur != '/') {
+		return FALSE;
+	}
 
-	while (cur != character && cur) {
-		cur = next_char();
+	while (cur != '\r' && cur != '\n' && cur) {
+		cur = next_char(parser);
 	}
 
-	return 1;
+	return TRUE;
 }
 
 /**
- * \brief Set current row
- * \param table_scope table scope id
- * \param table_id table id
- * \param row_scope row scope id
- * \param row_id row id
+ * \brief Parse dictionary cell, e.g. (80=value)
+ * \param parser mork parser
+ * \param columns TRUE if dictionary defines columns
+ * \return 1 on success, else error
  */
-static inline void set_current_row(int table_scope, int table_id, int row_scope, int row_id)
+static gboolean parse_dict_cell(struct mork_parser *parser, gboolean columns)
 {
-	GHashTable *map;
-	GHashTable *tmp;
+	gsize value;
+	gint id = parse_hex(parser);
+	gchar cur = next_char(parser);
 
-	if (!row_scope) {
-		row_scope = DEFAULT_SCOPE;
+	if (cur == ')') {
+		return TRUE;
 	}
 
-	if (!table_scope) {
-		table_scope = DEFAULT_SCOPE;
+	if (cur != '=') {
+		return skip_value(parser);
 	}
 
-	if (table_id) {
-		default_table_id = table_id;
+	value = parser->pos;
+	if (!skip_value(parser)) {
+		return FALSE;
 	}
 
-	if (!table_id) {
-		table_id = default_table_id;
+	if (columns) {
+		/* Resolve column once, rows only need a table lookup */
+		enum mork_field field = mork_lookup_field(parser->data + value, parser->pos - 1 - value);
+
+		if (field != MORK_FIELD_NONE) {
+			g_hash_table_insert(parser->state->columns, GINT_TO_POINTER(id), GINT_TO_POINTER(field));
+		} else {
+			g_hash_table_remove(parser->state->columns, GINT_TO_POINTER(id));
+		}
+	} else {
+		g_hash_table_insert(parser->state->values, GINT_TO_POINTER(id), GSIZE_TO_POINTER(value + 1));
 	}
 
-	//g_debug("Set to %lx/%lx/%lx/%lx", table_scope, table_id, row_scope, row_id);
+	return TRUE;
+}
 
-	/* First: Get table scope map */
-	tmp = find_map_entry(table_scope_map, abs(table_scope));
-	if (tmp == NULL) {
-		insert_map(table_scope_map, abs(table_scope), create_map(hash_destroy));
-		tmp = find_map_entry(table_scope_map, abs(table_scope));
-		if (tmp == NULL) {
-			g_warning("Could not create table scope map!!");
-			return;
+/**
+ * \brief Parse row cell, e.g. (^83=value) or (^83^a1)
+ * \param parser mork parser
+ * \return 1 on success, else error
+ */
+static gboolean parse_row_cell(struct mork_parser *parser)
+{
+	enum mork_field field;
+	gsize value = 0;
+	gchar cur;
+
+	if (peek_char(parser) == '^') {
+		parser->pos++;
+		field = GPOINTER_TO_INT(g_hash_table_lookup(parser->state->columns, GINT_TO_POINTER(parse_hex(parser))));
+	} else {
+		/* Literal column name */
+		gsize start = parser->pos;
+
+		while (parser->pos < parser->size && !strchr("=^)", parser->data[parser->pos])) {
+			parser->pos++;
 		}
+
+		field = mork_lookup_field(parser->data + start, parser->pos - start);
 	}
-	map = tmp;
 
-	/* Second: Get table id map */
-	tmp = find_map_entry(map, abs(table_id));
-	if (tmp == NULL) {
-		insert_map(map, abs(table_id), create_map(hash_destroy));
-		tmp = find_map_entry(map, abs(table_id));
-		if (tmp == NULL) {
-			g_warning("Could not create table id map!!");
-			return;
-		}
+	cur = next_char(parser);
+	if (cur == ')') {
+		return TRUE;
 	}
-	map = tmp;
 
-	/* Third: Get row scope map */
-	tmp = find_map_entry(map, abs(row_scope));
-	if (tmp == NULL) {
-		insert_map(map, abs(row_scope), create_map(hash_destroy));
-		tmp = find_map_entry(map, abs(row_scope));
-		if (tmp == NULL) {
-			g_warning("Could not create row scope map!!");
-			return;
+	if (cur == '^') {
+		/* Value is stored in value dictionary */
+		value = GPOINTER_TO_SIZE(g_hash_table_lookup(parser->state->values, GINT_TO_POINTER(parse_hex(parser))));
+	} else if (cur == '=') {
+		value = parser->pos + 1;
+	}
+
+	if (!skip_value(parser)) {
+		return FALSE;
+	}
+
+	if (field != MORK_FIELD_NONE && parser->row != NULL) {
+		parser->row->fields[field] = value;
+	}
+
+	return TRUE;
+}
+
+/**
+ * \brief Parse meta section
+ * \param parser mork parser
+ * \param character end gchar
+ * \return 1 on success, 0 if end gchar is missing
+ */
+static gchar parse_meta(struct mork_parser *parser, gchar character)
+{
+	const gchar *end = memchr(parser->data + parser->pos, character, parser->size - parser->pos);
+
+	parser->pos = end ? end - parser->data + 1 : parser->size;
+
+	return end != NULL;
+}
+
+/**
+ * \brief Parse dictionary section
+ * \param parser mork parser
+ * \return 1 on success, else error
+ */
+static gboolean parse_dict(struct mork_parser *parser)
+{
+	gboolean columns = FALSE;
+	gboolean result = TRUE;
+	gchar cur = next_char(parser);
+
+	while (result && cur != '>' && cur) {
+		if (!is_whitespace(cur)) {
+			switch (cur) {
+			case '<':
+				if (parser->size - parser->pos + 1 >= strlen(MORK_COLUMN_META) && !memcmp(parser->data + parser->pos - 1, MORK_COLUMN_META, strlen(MORK_COLUMN_META))) {
+					columns = TRUE;
+				}
+				result = parse_meta(parser, '>');
+				break;
+			case '/':
+				result = parse_comment(parser);
+				break;
+			case '(':
+				result = parse_dict_cell(parser, columns);
+				break;
+			default:
+				g_warning("[%s]: error '%c'", __FUNCTION__, cur);
+				result = FALSE;
+				break;
+			}
 		}
+		cur = next_char(parser);
 	}
-	map = tmp;
 
-	/* Fourth: Get row id map */
-	tmp = find_map_entry(map, abs(row_id));
-	if (tmp == NULL) {
-		insert_map(map, abs(row_id), create_map(NULL));
-		tmp = find_map_entry(map, abs(row_id));
-		if (tmp == NULL) {
-			g_warning("Could not create row id map!!");
-			return;
+	return result && cur == '>';
+}
+
+/**
+ * \brief Parse object id with optional scope, e.g. 1:^80 or -5
+ * \param parser mork parser
+ * \param id pointer to save id
+ * \param scope pointer to save scope, 0 if not present
+ * \return TRUE if id is preceded by a cut marker
+ */
+static gboolean parse_scope_id(struct mork_parser *parser, gint *id, gint *scope)
+{
+	gboolean cut = FALSE;
+	gchar cur;
+
+	while (is_whitespace(peek_char(parser))) {
+		parser->pos++;
+	}
+
+	cur = peek_char(parser);
+	if (cur == '-' || cur == '+') {
+		cut = cur == '-';
+		parser->pos++;
+	}
+
+	*id = parse_hex(parser);
+	*scope = 0;
+
+	if (peek_char(parser) != ':') {
+		return cut;
+	}
+
+	parser->pos++;
+	if (peek_char(parser) == '^') {
+		parser->pos++;
+		*scope = parse_hex(parser);
+	} else {
+		/* Literal scope names are mapped to the default scope */
+		while ((cur = peek_char(parser)) && !is_whitespace(cur) && !strchr("()[]{}", cur)) {
+			parser->pos++;
 		}
 	}
-	map = tmp;
 
-	current_cells = map;
+	return cut;
 }
 
 /**
- * \brief Parse row
- * \param table_id table id
- * \param table_scope table scope id
+ * \brief Parse row, a leading cut marker replaces all existing cells
+ * \param parser mork parser
  * \return 1 on success, else error
  */
-static gchar parse_row(int table_id, int table_scope)
+static gchar parse_row(struct mork_parser *parser)
 {
 	gchar result = 1;
-	gchar cur = next_char();
-	GString *text = g_string_new(NULL);
-	int id, scope;
+	gint id, scope;
+	gboolean cut;
+	gchar cur;
 
-	mork_now_parsing = PARSE_ROWS;
+	cut = parse_scope_id(parser, &id, &scope);
+	parser->row = mork_get_row(parser, scope, id);
 
-	while (cur != '(' && cur != ']' && cur != '[' && cur) {
-		if (!is_whitespace(cur)) {
-			text = g_string_append_c(text, cur);
-		}
-		cur = next_char();
+	if (cut) {
+		memset(parser->row->fields, 0, sizeof(parser->row->fields));
 	}
 
-	parse_scope_id(text, &id, &scope);
-	set_current_row(table_scope, table_id, scope, id);
-
+	cur = next_char(parser);
 	while (result && cur != ']' && cur) {
 		if (!is_whitespace(cur)) {
 			switch (cur) {
 			case '(':
-				result = parse_cell();
+				result = parse_row_cell(parser);
 				break;
 			case '[':
-				result = parse_meta(']');
+				result = parse_meta(parser, ']');
 				break;
 			default:
 				result = 0;
 				break;
 			}
 		}
-		cur = next_char();
+		cur = next_char(parser);
 	}
 
-	g_string_free(text, TRUE);
+	parser->row = NULL;
 
-	return result;
+	return result && cur == ']';
 }
 
 /**
  * \brief Parse table section
+ * \param parser mork parser
  * \return 1 on success, else error
  */
-static gboolean parse_table(void)
+static gboolean parse_table(struct mork_parser *parser)
 {
 	gboolean result = TRUE;
-	GString *text_id = g_string_new(NULL);
 	gint id = 0, scope = 0;
-	gchar cur = next_char();
+	gchar cur;
 
-	while (cur != '{' && cur != '[' && cur != '}' && cur) {
-		if (!is_whitespace(cur)) {
-			text_id = g_string_append_c(text_id, cur);
-		}
-		cur = next_char();
-	}
-
-	parse_scope_id(text_id, &id, &scope);
+	/* Persons are collected from all rows, table id is not needed */
+	parse_scope_id(parser, &id, &scope);
 
+	cur = next_char(parser);
 	while (result && cur != '}' && cur) {
 		if (!is_whitespace(cur)) {
 			switch (cur) {
 			case '{':
-				result = parse_meta('}');
+				result = parse_meta(parser, '}');
 				break;
 			case '[':
-				result = parse_row(id, scope);
-				break;
-			case '-':
-			case '+':
+				result = parse_row(parser);
 				break;
 			default: {
-				GString *just_id = g_string_new(NULL);
+				/* Row reference, removed from table if preceded by a cut marker */
+				gsize start = --parser->pos;
+				gint row_id, row_scope;
 
-				while (!is_whitespace(cur) && cur) {
-					just_id = g_string_append_c(just_id, cur);
-					cur = next_char();
+				if (parse_scope_id(parser, &row_id, &row_scope)) {
+					gint64 key = mork_row_key(row_scope, row_id);
 
-					if (cur == '}') {
-						g_string_free(just_id, TRUE);
-						g_string_free(text_id, TRUE);
-						return result;
-					}
+					g_hash_table_remove(parser->state->rows, &key);
+					mork_touch_row(parser, key);
 				}
 
-				int just_id_num = 0, just_scope_num = 0;
-				parse_scope_id(just_id, &just_id_num, &just_scope_num);
-				set_current_row(scope, id, just_scope_num, just_id_num);
-				g_string_free(just_id, TRUE);
+				if (parser->pos == start) {
+					parser->pos++;
+				}
 				break;
 			}
 			}
 		}
-		cur = next_char();
+		cur = next_char(parser);
 	}
 
-	g_string_free(text_id, TRUE);
+	return result && cur == '}';
+}
 
-	return result;
+/**
+ * \brief Find group end marker, e.g. @$$}1}@ or @$$}~abort~1}@
+ * \param parser mork parser
+ * \param prefix marker prefix
+ * \param id group id
+ * \param id_len length of id
+ * \param len pointer to store marker length at
+ * \return position of marker or parser->size if not found
+ */
+static gsize mork_find_group_end(struct mork_parser *parser, const gchar *prefix, const gchar *id, gsize id_len, gsize *len)
+{
+	gchar *marker = g_strdup_printf("%s%.*s}@", prefix, (gint)id_len, id);
+	const gchar *found = g_strstr_len(parser->data + parser->pos, parser->size - parser->pos, marker);
+
+	*len = strlen(marker);
+	g_free(marker);
+
+	return found ? (gsize)(found - parser->data) : parser->size;
 }
 
 /**
- * \brief Parse group section
+ * \brief Parse group section, e.g. @$${1{@ ... @$$}1}@. A group is a transaction: its content is
+ * only applied once the commit marker has been written. Aborted groups are skipped, an incomplete
+ * trailing group stops the parse, so that it is read again once it is complete.
+ * \param parser mork parser
  * \return 1 on success, else error
  */
-static gchar parse_group(void)
+static gchar parse_group(struct mork_parser *parser)
 {
-	return parse_meta('@');
+	gsize start = parser->pos;
+	gsize commit, abort;
+	gsize commit_len, abort_len;
+
+	if (!parse_meta(parser, '@')) {
+		return 0;
+	}
+
+	if (parser->pos - start > 5 && !memcmp(parser->data + start, "$${", 3)) {
+		/* Group id is enclosed by "$${" and "{@" */
+		const gchar *id = parser->data + start + 3;
+		gsize id_len = parser->pos - start - 5;
+
+		commit = mork_find_group_end(parser, "@$$}", id, id_len, &commit_len);
+		abort = mork_find_group_end(parser, "@$$}~abort~", id, id_len, &abort_len);
+
+		if (commit < abort) {
+			parser->in_group = TRUE;
+		} else if (abort < parser->size) {
+			/* Discard aborted transaction */
+			parser->pos = abort + abort_len;
+			parser->in_group = FALSE;
+		} else {
+			/* Not complete yet, keep parser end in front of it */
+			parser->pos = parser->size;
+			parser->in_group = TRUE;
+		}
+	} else if (parser->pos - start > 3 && !memcmp(parser->data + start, "$$}", 3)) {
+		/* Committed */
+		parser->in_group = FALSE;
+	}
+
+	return 1;
 }
 
 /**
  * \brief Parse mork code
+ * \param parser mork parser
  * \return 1 on success, else error
  */
-static gboolean parse_mork(void)
+static gboolean parse_mork(struct mork_parser *parser)
 {
 	gboolean result = TRUE;
 	gchar cur = 0;
 
-	cur = next_char();
+	cur = next_char(parser);
 
 	while (result && cur) {
 		if (!is_whitespace(cur)) {
 			switch (cur) {
 			case '/':
 				/* Comment */
-				result = parse_comment();
+				result = parse_comment(parser);
 				break;
 			case '<':
 				/* Dict */
-				result = parse_dict();
+				result = parse_dict(parser);
 				break;
 			case '{':
 				/* Table */
-				result = parse_table();
+				result = parse_table(parser);
 				break;
 			case '@':
 				/* Group */
-				result = parse_group();
+				result = parse_group(parser);
 				break;
 			case '[':
 				/* Row */
-				result = parse_row(0, 0);
+				result = parse_row(parser);
 				break;
 			default:
 				g_warning("Error: %c", cur);
 				result = FALSE;
 				break;
 			}
+
+			/* Appended groups may still be written, continue after the last complete one next time */
+			if (result && !parser->in_group) {
+				parser->end = parser->pos;
+			}
 		}
-		cur = next_char();
+		cur = next_char(parser);
 	}
 
-	g_free(mork_data);
-	mork_data = NULL;
-
 	return result;
 }
 
 /**
- * \brief Get column entry by key
- * \param key key id
- * \return column entry
+ * \brief Create contact from decoded fields, shared by mork and sqlite books
+ * \param book book collecting the photos
+ * \param dir directory of address book, used for photos
+ * \param fields field values indexed by enum mork_field, NULL if not set
+ * \return new contact or NULL if fields describe no person
  */
-static inline gchar *get_column(int key)
+static RmContact *thunderbird_create_contact(struct mork_book *book, const gchar *dir, gchar **fields)
 {
-	return g_hash_table_lookup(mork_columns, GINT_TO_POINTER(key));
+	RmContact *contact;
+	gint index;
+
+	/* Do not add entries without name */
+	if (RM_EMPTY_STRING(fields[MORK_FIELD_DISPLAY_NAME])) {
+		return NULL;
+	}
+
+	contact = g_slice_new0(RmContact);
+	contact->name = g_strdup(fields[MORK_FIELD_DISPLAY_NAME]);
+
+	for (index = 0; index < G_N_ELEMENTS(mork_numbers); index++) {
+		const gchar *value = fields[mork_numbers[index].field];
+
+		if (!RM_EMPTY_STRING(value)) {
+			RmPhoneNumber *number = g_slice_new(RmPhoneNumber);
+
+			number->number = rm_number_full(value, FALSE);
+			number->type = mork_numbers[index].type;
+			contact->numbers = g_slist_prepend(contact->numbers, number);
+		}
+	}
+
+	for (index = 0; index < G_N_ELEMENTS(mork_addresses); index++) {
+		const gchar *street = fields[mork_addresses[index].street];
+		const gchar *city = fields[mork_addresses[index].city];
+		const gchar *zip = fields[mork_addresses[index].zip];
+
+		if (street || city || zip) {
+			RmContactAddress *address = g_slice_new0(RmContactAddress);
+
+			address->city = g_strdup(city ? city : "");
+			address->zip = g_strdup(zip ? zip : "");
+			address->street = g_strdup(street ? street : "");
+			address->type = mork_addresses[index].type;
+
+			contact->addresses = g_slist_prepend(contact->addresses, address);
+		}
+	}
+
+	if (!RM_EMPTY_STRING(fields[MORK_FIELD_PHOTO_NAME]) && dir != NULL) {
+		/* Photo cache is not thread safe, image is set once the book is delivered */
+		g_hash_table_insert(book->photos, contact, g_build_filename(dir, "Photos", fields[MORK_FIELD_PHOTO_NAME], NULL));
+	}
+
+	book->num_persons++;
+
+	return contact;
 }
 
 /**
- * \brief Get value entry by key
- * \param key key id
- * \return value entry
+ * \brief Parse person data
+ * \param parser mork parser
+ * \param book book collecting the photos
+ * \param dir directory of address book, used for photos
+ * \param row mork row holding person informations
+ * \return new contact or NULL if row is not a person
  */
-static inline gchar *get_value(int key)
+static RmContact *parse_person(struct mork_parser *parser, struct mork_book *book, const gchar *dir, struct mork_row *row)
 {
-	return g_hash_table_lookup(mork_values, GINT_TO_POINTER(key));
+	gchar *fields[MORK_FIELD_MAX] = { NULL };
+	RmContact *contact;
+	gint field;
+
+	/* Rows without name are not decoded at all */
+	if (!row->fields[MORK_FIELD_DISPLAY_NAME]) {
+		return NULL;
+	}
+
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		fields[field] = mork_decode(parser, row->fields[field]);
+	}
+
+	contact = thunderbird_create_contact(book, dir, fields);
+
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		g_free(fields[field]);
+	}
+
+	return contact;
 }
 
 /**
- * \brief Parse person data
- * \param map pointer to map structure holding person informations
- * \param pId id
+ * \brief Parse rows for persons
+ * \param parser mork parser
+ * \param book book collecting the persons
+ * \param dir directory of address book, used for photos
  */
-static void parse_person(GHashTable *map, gpointer pId)
+static void parse_tables(struct mork_parser *parser, struct mork_book *book, const gchar *dir)
 {
-	//const gchar *check = NULL;
-	//GdkPixbuf *image = NULL;
-	const gchar *home_street = NULL;
-	const gchar *home_city = NULL;
-	const gchar *home_zip = NULL;
-	const gchar *business_street = NULL;
-	const gchar *business_city = NULL;
-	const gchar *business_zip = NULL;
-	GHashTableIter iter5;
-	gpointer key5, value5;
-	RmContact *contact = NULL;
-	RmPhoneNumber *number;
-	const gchar *thunderbird_dir = thunderbird_get_selected_book();
-
-	if (thunderbird_dir) {
-		thunderbird_dir = g_path_get_dirname(thunderbird_dir);
-	}
-
-	num_possible++;
+	GHashTable *keys = parser->touched ? parser->touched : parser->state->rows;
+	GHashTableIter iter;
+	gpointer key;
 
-#ifdef THUNDERBIRD_DEBUG
-	g_debug("***** possible: %d", num_possible);
-#endif
+	/* A full parse reports all persons, an incremental parse the touched rows only */
+	g_hash_table_iter_init(&iter, keys);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		struct mork_row *row = g_hash_table_lookup(parser->state->rows, key);
+		RmContact *contact = row ? parse_person(parser, book, dir, row) : NULL;
 
-	contact = g_slice_new0(RmContact);
+		book->num_possible++;
 
-	g_hash_table_iter_init(&iter5, map);
-	while (g_hash_table_iter_next(&iter5, &key5, &value5)) {
-		if (GPOINTER_TO_INT(key5) == 0) {
-			continue;
-		}
-		const gchar *column = get_column(GPOINTER_TO_INT(key5));
-		const gchar *value = get_value(GPOINTER_TO_INT(value5));
-#ifdef THUNDERBIRD_DEBUG
-		g_debug("'%s' = '%s'", column, value);
-#endif
+		/* Removed rows and rows that are no person (anymore) are reported as NULL */
+		if (contact != NULL || parser->touched != NULL) {
+			gint64 *copy = g_new(gint64, 1);
 
-		if (!strcmp(column, "HomePhone")) {
-			number = g_slice_new(RmPhoneNumber);
-			number->number = rm_number_full(value, FALSE);
-			number->type = RM_PHONE_NUMBER_TYPE_HOME;
-			contact->numbers = g_slist_prepend(contact->numbers, number);
-		} else if (!strcmp(column, "WorkPhone")) {
-			number = g_slice_new(RmPhoneNumber);
-			number->number = rm_number_full(value, FALSE);
-			number->type = RM_PHONE_NUMBER_TYPE_WORK;
-			contact->numbers = g_slist_prepend(contact->numbers, number);
-		} else if (!strcmp(column, "FaxNumber")) {
-			number = g_slice_new(RmPhoneNumber);
-			number->number = rm_number_full(value, FALSE);
-			number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
-			contact->numbers = g_slist_prepend(contact->numbers, number);
-		} else if (!strcmp(column, "CellularNumber")) {
-			number = g_slice_new(RmPhoneNumber);
-			number->number = rm_number_full(value, FALSE);
-			number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
-			contact->numbers = g_slist_prepend(contact->numbers, number);
-		} else if (!strcmp(column, "DisplayName")) {
-			contact->name = g_strdup(value);
-		} else if (!strcmp(column, "HomeAddress")) {
-			home_street = value;
-		} else if (!strcmp(column, "HomeCity")) {
-			home_city = value;
-		} else if (!strcmp(column, "HomeZipCode")) {
-			home_zip = value;
-		} else if (!strcmp(column, "WorkAddress")) {
-			business_street = value;
-		} else if (!strcmp(column, "WorkCity")) {
-			business_city = value;
-		} else if (!strcmp(column, "WorkZipCode")) {
-			business_zip = value;
-		} else if (!strcmp(column, "PhotoName")) {
-			gchar *file_name = g_build_filename(thunderbird_dir, "Photos", value, NULL);
-
-			contact->image = gdk_pixbuf_new_from_file(file_name, NULL);
-			g_free(file_name);
+			*copy = *(gint64*)key;
+			g_hash_table_insert(book->persons, copy, contact);
 		}
 	}
+}
 
-	/* Do not add entries without name */
-	if (RM_EMPTY_STRING(contact->name)) {
+/**
+ * \brief Create empty mork state
+ * \param file_name address book file name
+ * \param inode inode of address book
+ * \return new mork state
+ */
+static struct mork_state *mork_state_new(const gchar *file_name, guint64 inode)
+{
+	struct mork_state *state = g_slice_new0(struct mork_state);
+
+	state->file_name = g_strdup(file_name);
+	state->inode = inode;
+	state->values = g_hash_table_new(g_direct_hash, g_direct_equal);
+	state->columns = g_hash_table_new(g_direct_hash, g_direct_equal);
+	state->rows = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, mork_row_free);
+
+	return state;
+}
+
+/**
+ * \brief Free mork state
+ * \param state mork state or NULL
+ */
+static void mork_state_free(struct mork_state *state)
+{
+	if (state == NULL) {
 		return;
 	}
 
-	if (home_city || home_zip || home_street) {
-		RmContactAddress *address = g_slice_new0(RmContactAddress);
+#ifdef HAVE_SQLITE3
+	if (state->db != NULL) {
+		sqlite3_close(state->db);
+	}
+#endif
 
-		address->city = g_strdup(home_city ? home_city : "");
-		address->zip = g_strdup(home_zip ? home_zip : "");
-		address->street = g_strdup(home_street ? home_street : "");
-		address->type = 0;
+	g_hash_table_destroy(state->rows);
+	g_hash_table_destroy(state->columns);
+	g_hash_table_destroy(state->values);
+	g_free(state->file_name);
+	g_slice_free(struct mork_state, state);
+}
 
-		contact->addresses = g_slist_prepend(contact->addresses, address);
+/**
+ * \brief Check whether state can be continued with the appended part of file
+ * \param state mork state of previous parse or NULL
+ * \param file_name address book file name
+ * \param inode inode of address book
+ * \param data file contents
+ * \param size file size
+ * \return TRUE if only appended groups need to be parsed
+ */
+static gboolean mork_state_is_valid(struct mork_state *state, const gchar *file_name, guint64 inode, const gchar *data, gsize size)
+{
+	if (state == NULL || g_strcmp0(state->file_name, file_name) || state->inode != inode) {
+		return FALSE;
 	}
 
-	if (business_city || business_zip || business_street) {
-		RmContactAddress *address = g_slice_new0(RmContactAddress);
+	/* Compacted files are rewritten and may be shorter or differ in front of our offset */
+	if (state->offset > size || !state->offset) {
+		return FALSE;
+	}
 
-		address->city = g_strdup(business_city ? business_city : "");
-		address->zip = g_strdup(business_zip ? business_zip : "");
-		address->street = g_strdup(business_street ? business_street : "");
-		address->type = 1;
+	return !memcmp(data + state->offset - state->tail_len, state->tail, state->tail_len);
+}
 
-		contact->addresses = g_slist_prepend(contact->addresses, address);
+/**
+ * \brief Free mork book
+ * \param data struct mork_book
+ */
+static void mork_book_free(gpointer data)
+{
+	struct mork_book *book = data;
+	GHashTableIter iter;
+	gpointer value;
+
+	/* Contacts of a book that has not been delivered */
+	if (book->persons != NULL) {
+		g_hash_table_iter_init(&iter, book->persons);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			if (value != NULL) {
+				rm_contact_free(value);
+			}
+		}
+		g_hash_table_destroy(book->persons);
 	}
 
-	contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
-	num_persons++;
+	g_hash_table_destroy(book->photos);
+	mork_state_free(book->state);
+	g_slice_free(struct mork_book, book);
 }
 
+#ifdef HAVE_SQLITE3
 /**
- * \brief Parse tables for important informations
+ * \brief Get data version of sqlite database, it changes whenever another connection commits
+ * \param db sqlite database
+ * \return data version or -1 on error
  */
-static void parse_tables(void)
+static gint64 thunderbird_sqlite_data_version(sqlite3 *db)
 {
-	GHashTable *tables = table_scope_map;
+	sqlite3_stmt *stmt;
+	gint64 version = -1;
 
-	if (tables != NULL) {
-		GHashTableIter iter1;
-		gpointer key1, value1;
+	if (sqlite3_prepare_v2(db, "PRAGMA data_version", -1, &stmt, NULL) != SQLITE_OK) {
+		return -1;
+	}
 
-		g_hash_table_iter_init(&iter1, tables);
-		while (g_hash_table_iter_next(&iter1, &key1, &value1)) {
-			if (GPOINTER_TO_INT(key1) == 0) {
-				//continue;
-			}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
 
-			GHashTable *rows = value1;
-			if (rows != NULL) {
-				GHashTableIter iter2;
-				gpointer key2, value2;
-
-				g_hash_table_iter_init(&iter2, rows);
-				while (g_hash_table_iter_next(&iter2, &key2, &value2)) {
-					if (GPOINTER_TO_INT(key2) == 0) {
-						//continue;
-					}
-
-					GHashTable *rows2 = value2;
-					if (rows2 != NULL) {
-						GHashTableIter iter3;
-						gpointer key3, value3;
-
-						g_hash_table_iter_init(&iter3, rows2);
-						while (g_hash_table_iter_next(&iter3, &key3, &value3)) {
-							if (GPOINTER_TO_INT(key3) == 0) {
-								//continue;
-							}
-
-							GHashTable *rows3 = value3;
-							if (rows3 != NULL) {
-								GHashTableIter iter4;
-								gpointer key4, value4;
-
-								g_hash_table_iter_init(&iter4, rows3);
-								while (g_hash_table_iter_next(&iter4, &key4, &value4)) {
-									if (GPOINTER_TO_INT(key4) == 0) {
-										//continue;
-									}
-
-									GHashTable *rows4 = value4;
-									if (rows4 != NULL) {
-										parse_person(rows4, key4);
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-		}
+	return version;
+}
+
+/**
+ * \brief Add person of a sqlite card to book
+ * \param book book collecting the persons
+ * \param dir directory of address book, used for photos
+ * \param fields field values of card, freed afterwards
+ */
+static void thunderbird_sqlite_add_person(struct mork_book *book, const gchar *dir, gchar **fields)
+{
+	RmContact *contact = thunderbird_create_contact(book, dir, fields);
+	gint field;
+
+	book->num_possible++;
+
+	if (contact != NULL) {
+		/* Book is always replaced as a whole, so keys only need to be unique */
+		gint64 *key = g_new(gint64, 1);
+
+		*key = g_hash_table_size(book->persons);
+		g_hash_table_insert(book->persons, key, contact);
+	}
+
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		g_free(fields[field]);
+		fields[field] = NULL;
 	}
 }
 
 /**
- * \brief Open thunderbird address book
- * \param book address book file name
+ * \brief Read abook.sqlite address book of newer thunderbird versions
+ * \param book book collecting the persons
+ * \param file_name address book file name
+ * \param inode inode of address book
+ * \param state state of previous read or NULL (transfer full)
+ *
+ * Only the properties used by roger are selected. The database is read again only if
+ * its data version changed since the last read, otherwise book stays empty and incremental.
  */
-static void thunderbird_open_book(gchar *book)
+static void thunderbird_read_sqlite(struct mork_book *book, const gchar *file_name, guint64 inode, struct mork_state *state)
 {
-	int file;
-	off_t size;
+	gchar *fields[MORK_FIELD_MAX] = { NULL };
+	sqlite3_stmt *stmt;
+	GString *sql;
+	gchar *card = NULL;
+	gchar *dir;
+	gint64 version;
+	gint field;
+
+	if (state == NULL || g_strcmp0(state->file_name, file_name) || state->inode != inode || state->db == NULL) {
+		mork_state_free(state);
+		state = mork_state_new(file_name, inode);
+		state->data_version = -1;
+
+		if (sqlite3_open_v2(file_name, &state->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+			g_debug("%s(): Could not open '%s': %s", __FUNCTION__, file_name, sqlite3_errmsg(state->db));
+			sqlite3_close(state->db);
+			state->db = NULL;
+			state->inode = 0;
+			book->state = state;
+			book->full = TRUE;
+
+			return;
+		}
+	}
+	book->state = state;
 
-	file = open(book, O_RDONLY);
-	if (file == -1) {
+	version = thunderbird_sqlite_data_version(state->db);
+	if (version != -1 && version == state->data_version) {
+		g_debug("%s(): Database unchanged", __FUNCTION__);
 		return;
 	}
 
-	size = lseek(file, 0, SEEK_END);
-	if (size == -1) {
-		close(file);
+	state->data_version = version;
+	book->full = TRUE;
+
+	sql = g_string_new("SELECT card, name, value FROM properties WHERE name IN (");
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		g_string_append(sql, field > MORK_FIELD_NONE + 1 ? ", ?" : "?");
+	}
+	g_string_append(sql, ") ORDER BY card");
+
+	if (sqlite3_prepare_v2(state->db, sql->str, -1, &stmt, NULL) != SQLITE_OK) {
+		g_warning("%s(): Could not prepare query: %s", __FUNCTION__, sqlite3_errmsg(state->db));
+		g_string_free(sql, TRUE);
 		return;
 	}
+	g_string_free(sql, TRUE);
+
+	for (field = MORK_FIELD_NONE + 1; field < MORK_FIELD_MAX; field++) {
+		sqlite3_bind_text(stmt, field, mork_field_names[field], -1, SQLITE_STATIC);
+	}
+
+	dir = g_path_get_dirname(file_name);
+
+	/* Properties of a card are consecutive rows */
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const gchar *id = (const gchar*)sqlite3_column_text(stmt, 0);
+		const gchar *name = (const gchar*)sqlite3_column_text(stmt, 1);
+		const gchar *value = (const gchar*)sqlite3_column_text(stmt, 2);
+
+		if (g_strcmp0(id, card)) {
+			if (card != NULL) {
+				thunderbird_sqlite_add_person(book, dir, fields);
+			}
+			g_free(card);
+			card = g_strdup(id);
+		}
+
+		field = name ? mork_lookup_field(name, strlen(name)) : MORK_FIELD_NONE;
+		if (field != MORK_FIELD_NONE && !RM_EMPTY_STRING(value)) {
+			g_free(fields[field]);
+			fields[field] = g_strdup(value);
+		}
+	}
+
+	if (card != NULL) {
+		thunderbird_sqlite_add_person(book, dir, fields);
+	}
 
-	lseek(file, 0, SEEK_SET);
+	sqlite3_finalize(stmt);
+	g_free(card);
+	g_free(dir);
+}
+#else
+static void thunderbird_read_sqlite(struct mork_book *book, const gchar *file_name, guint64 inode, struct mork_state *state)
+{
+	g_warning("%s(): '%s' needs sqlite support", __FUNCTION__, file_name);
+
+	mork_state_free(state);
+	book->state = mork_state_new(file_name, 0);
+	book->full = TRUE;
+}
+#endif
+
+/**
+ * \brief Open thunderbird address book, parse only appended groups if possible
+ * \param file_name address book file name
+ * \param state state of previous parse or NULL (transfer full)
+ * \return book, never NULL
+ */
+static struct mork_book *thunderbird_open_book(const gchar *file_name, struct mork_state *state)
+{
+	struct mork_book *book = g_slice_new0(struct mork_book);
+	struct mork_parser parser;
+	GError *error = NULL;
+	GStatBuf buf;
+	gchar *dir;
+
+	book->persons = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+	book->photos = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+	memset(&parser, 0, sizeof(parser));
+	if (g_stat(file_name, &buf) == 0) {
+		if (g_str_has_suffix(file_name, ".sqlite")) {
+			thunderbird_read_sqlite(book, file_name, buf.st_ino, state);
+
+			return book;
+		}
+
+		parser.map = g_mapped_file_new(file_name, FALSE, &error);
+	}
 
-	mork_data = g_malloc(size);
-	if (mork_data != NULL) {
-		mork_size = size;
-		if (read(file, mork_data, size) == size) {
+	if (parser.map == NULL) {
+		g_debug("%s(): Could not map '%s': %s", __FUNCTION__, file_name, error ? error->message : "?");
+		g_clear_error(&error);
+
+		/* Empty state, next parse starts from scratch */
+		mork_state_free(state);
+		book->state = mork_state_new(file_name, 0);
+		book->full = TRUE;
+
+		return book;
+	}
+
+	parser.data = g_mapped_file_get_contents(parser.map);
+	parser.size = g_mapped_file_get_length(parser.map);
+	parser.buffer = g_string_sized_new(64);
+
+	if (mork_state_is_valid(state, file_name, buf.st_ino, parser.data, parser.size)) {
+		parser.touched = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+	} else {
+		mork_state_free(state);
+		state = mork_state_new(file_name, buf.st_ino);
+		book->full = TRUE;
+	}
+
+	parser.state = state;
+	parser.pos = parser.end = state->offset;
+
+#ifdef THUNDERBIRD_DEBUG
+	g_debug("Parsing mork from %" G_GSIZE_FORMAT, parser.pos);
+#endif
+	parse_mork(&parser);
+
+	state->offset = parser.end;
+	state->tail_len = MIN(parser.end, MORK_TAIL_SIZE);
+	memcpy(state->tail, parser.data + parser.end - state->tail_len, state->tail_len);
+
+#ifdef THUNDERBIRD_DEBUG
+	g_debug("Parsing tables");
+#endif
+	dir = g_path_get_dirname(file_name);
+	parse_tables(&parser, book, dir);
+	g_free(dir);
 #ifdef THUNDERBIRD_DEBUG
-			g_debug("Parsing mork");
+	g_debug("Done");
 #endif
-			parse_mork();
+
+	book->state = state;
+
+	if (parser.touched) {
+		g_hash_table_destroy(parser.touched);
+	}
+	g_string_free(parser.buffer, TRUE);
+	g_mapped_file_unref(parser.map);
+
+	return book;
+}
+
+/**
+ * \brief Free mork job
+ * \param data struct mork_job
+ */
+static void mork_job_free(gpointer data)
+{
+	struct mork_job *job = data;
+
+	mork_state_free(job->state);
+	g_free(job->file_name);
+	g_slice_free(struct mork_job, job);
+}
+
+/**
+ * \brief Read thunderbird book in worker thread
+ * \param task task
+ * \param source_object unused
+ * \param task_data struct mork_job
+ * \param cancellable cancellable
+ */
+static void thunderbird_read_book_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct mork_job *job = task_data;
+	struct mork_book *book;
+
 #ifdef THUNDERBIRD_DEBUG
-			g_debug("Parsing tables");
+	g_debug("Thunderbird book (%s)", job->file_name);
 #endif
-			parse_tables();
+	book = thunderbird_open_book(job->file_name, job->state);
+	job->state = NULL;
+
 #ifdef THUNDERBIRD_DEBUG
-			g_debug("Done");
+	g_debug("%d entries!", book->num_possible);
+	g_debug("%d persons imported!", book->num_persons);
 #endif
+
+	g_task_return_pointer(task, book, mork_book_free);
+}
+
+/**
+ * \brief Free contact and its image
+ * \param data a #RmContact
+ */
+static void thunderbird_contact_free(gpointer data)
+{
+	contact_image_clear(data);
+	rm_contact_free(data);
+}
+
+/**
+ * \brief Rebuild sorted contact list from contact table
+ */
+static void thunderbird_sort_contacts(void)
+{
+	ContactListBuilder *builder = contact_list_builder_new(g_hash_table_size(thunderbird_contacts));
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, thunderbird_contacts);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		contact_list_builder_add(builder, value);
+	}
+
+	g_slist_free(contacts);
+	contacts = contact_list_builder_end(builder);
+}
+
+/**
+ * \brief Replace all contacts by a fully parsed book
+ * \param book mork book
+ */
+static void thunderbird_replace_contacts(struct mork_book *book)
+{
+	GHashTable *old_contacts = thunderbird_contacts;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, book->photos);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		/* Photo is loaded on first display */
+		contact_image_set_file(key, value);
+	}
+
+	thunderbird_contacts = book->persons;
+	book->persons = NULL;
+	thunderbird_sort_contacts();
+
+	rm_object_emit_contacts_changed();
+
+	if (old_contacts != NULL) {
+		g_hash_table_iter_init(&iter, old_contacts);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			thunderbird_contact_free(value);
 		}
+		g_hash_table_destroy(old_contacts);
 	}
+}
 
-	close(file);
+/**
+ * \brief Apply persons of appended groups to contacts and emit the differences
+ * \param book mork book
+ */
+static void thunderbird_apply_contacts(struct mork_book *book)
+{
+	ContactsDelta *delta = contacts_delta_new();
+	GSList *removed = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, book->persons);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		RmContact *old_contact = g_hash_table_lookup(thunderbird_contacts, key);
+		RmContact *contact = value;
+		const gchar *photo = contact ? g_hash_table_lookup(book->photos, contact) : NULL;
+
+		if (contact == NULL) {
+			if (old_contact != NULL) {
+				contacts_delta_removed(delta, old_contact);
+				removed = g_slist_prepend(removed, old_contact);
+				g_hash_table_remove(thunderbird_contacts, key);
+			}
+		} else if (old_contact != NULL) {
+			/* Modified, keep contact pointer but update its content */
+			contacts_delta_add_numbers(delta, old_contact);
+			rm_contact_copy(contact, old_contact);
+			contact_image_clear(old_contact);
+			if (photo != NULL) {
+				contact_image_set_file(old_contact, photo);
+			}
+			rm_contact_free(contact);
+			contacts_delta_modified(delta, old_contact);
+		} else {
+			gint64 *copy = g_new(gint64, 1);
+
+			*copy = *(gint64*)key;
+			g_hash_table_insert(thunderbird_contacts, copy, contact);
+			if (photo != NULL) {
+				contact_image_set_file(contact, photo);
+			}
+			contacts_delta_added(delta, contact);
+		}
+
+		/* Contact is owned by thunderbird_contacts now */
+		g_hash_table_iter_replace(&iter, NULL);
+	}
+
+	if (!contacts_delta_is_empty(delta)) {
+		thunderbird_sort_contacts();
+	}
+
+	g_debug("%s(): %d added, %d modified, %d removed", __FUNCTION__,
+		g_slist_length(delta->added), g_slist_length(delta->modified), g_slist_length(delta->removed));
+
+	contacts_delta_emit(delta);
+	g_slist_free_full(removed, thunderbird_contact_free);
 }
 
 /**
- * \brief Read thunderbird book
+ * \brief Thunderbird book has been read, update contacts in main thread
+ * \param source_object unused
+ * \param res result
+ * \param user_data unused
+ */
+static void thunderbird_read_book_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GCancellable *cancellable = g_task_get_cancellable(G_TASK(res));
+	struct mork_book *book;
+	gboolean pending;
+
+	book = g_task_propagate_pointer(G_TASK(res), NULL);
+
+	thunderbird_busy = FALSE;
+	pending = thunderbird_pending;
+	thunderbird_pending = FALSE;
+
+	if (book == NULL) {
+		/* Cancelled or unreadable, parser state is gone and the next read starts from scratch */
+		if (pending && !g_cancellable_is_cancelled(cancellable)) {
+			thunderbird_read_book();
+		}
+		return;
+	}
+
+	thunderbird_state = book->state;
+	book->state = NULL;
+
+	if (book->full || thunderbird_contacts == NULL) {
+		thunderbird_replace_contacts(book);
+	} else {
+		thunderbird_apply_contacts(book);
+	}
+
+	mork_book_free(book);
+
+	if (pending) {
+		/* Book changed while we were reading it */
+		thunderbird_read_book();
+	}
+}
+
+/**
+ * \brief Read thunderbird book in the background, contacts are updated once it is done
  * \return error code
  */
 static int thunderbird_read_book(void)
 {
-	const gchar *book;
-	gchar file[256];
+	struct mork_job *job;
+	GTask *task;
 
-	num_persons = 0;
-	num_possible = 0;
+	/* Parser state is owned by the running parse, read again afterwards */
+	if (thunderbird_busy) {
+		thunderbird_pending = TRUE;
+		return 0;
+	}
 
-	mork_data = NULL;
-	mork_pos = 0;
-	mork_now_parsing = PARSE_VALUES;
-	mork_next_add_value_id = MAX_VAL;
-	mork_values = NULL;
-	mork_columns = NULL;
-	current_cells = NULL;
-	table_scope_map = NULL;
-	default_table_id = 1;
+	if (!thunderbird_cancellable) {
+		thunderbird_cancellable = g_cancellable_new();
+	}
 
-	mork_values = create_map(free);
-	mork_columns = create_map(free);
-	table_scope_map = create_map(hash_destroy);
+	job = g_slice_new0(struct mork_job);
+	job->file_name = thunderbird_get_selected_book();
+	job->state = thunderbird_state;
+	thunderbird_state = NULL;
+	thunderbird_busy = TRUE;
 
-	book = thunderbird_get_selected_book();
-	memset(file, 0, sizeof(file));
-	strncpy(file, book, sizeof(file) - 1);
+	task = g_task_new(NULL, thunderbird_cancellable, thunderbird_read_book_ready_cb, NULL);
+	g_task_set_task_data(task, job, mork_job_free);
+	g_task_run_in_thread(task, thunderbird_read_book_thread);
+	g_object_unref(task);
 
-#ifdef THUNDERBIRD_DEBUG
-	g_debug("Thunderbird book (%s)", file);
-#endif
-	thunderbird_open_book(file);
+	return 0;
+}
 
-	g_hash_table_destroy(table_scope_map);
-	g_hash_table_destroy(mork_columns);
-	g_hash_table_destroy(mork_values);
+/**
+ * \brief Thunderbird profile directory change callback, reads book if one of its files changed
+ * \param monitor file monitor
+ * \param file file structure
+ * \param other_file unused file structure
+ * \param event_type file monitor event
+ * \param user_data base name of book
+ */
+static void thunderbird_file_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+	gchar *name;
+	gboolean match;
 
-#ifdef THUNDERBIRD_DEBUG
-	g_debug("%d entries!", num_possible);
-	g_debug("%d persons imported!", num_persons);
-#endif
+	if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event_type != G_FILE_MONITOR_EVENT_CREATED) {
+		return;
+	}
 
-	return 0;
+	/* Book itself, or its journal like abook.sqlite-wal */
+	name = g_file_get_basename(file);
+	match = g_str_has_prefix(name, user_data);
+	g_free(name);
+
+	if (!match) {
+		return;
+	}
+
+	g_debug("%s(): %d", __FUNCTION__, event_type);
+
+	thunderbird_read_book();
+}
+
+/**
+ * \brief Monitor selected thunderbird book for changes
+ *
+ * The directory is monitored, as compacted books are replaced and sqlite books write to a journal first.
+ */
+static void thunderbird_monitor_book(void)
+{
+	gchar *book = thunderbird_get_selected_book();
+	GError *error = NULL;
+	GFile *file;
+	gchar *dir;
+
+	if (thunderbird_monitor) {
+		g_file_monitor_cancel(thunderbird_monitor);
+		g_clear_object(&thunderbird_monitor);
+	}
+
+	if (RM_EMPTY_STRING(book)) {
+		g_free(book);
+		return;
+	}
+
+	dir = g_path_get_dirname(book);
+	file = g_file_new_for_path(dir);
+	g_free(dir);
+
+	thunderbird_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, &error);
+	if (thunderbird_monitor) {
+		g_signal_connect_data(thunderbird_monitor, "changed", G_CALLBACK(thunderbird_file_changed_cb), g_path_get_basename(book), (GClosureNotify)g_free, 0);
+	} else {
+		g_warning("%s(): could not connect file monitor. Error: %s", __FUNCTION__, error ? error->message : "?");
+		g_clear_error(&error);
+	}
+
+	g_object_unref(file);
+	g_free(book);
 }
 
 GSList *thunderbird_get_contacts(void)
@@ -985,7 +1686,6 @@ GSList *thunderbird_get_contacts(void)
 
 gboolean thunderbird_reload_contacts(void)
 {
-	contacts = NULL;
 	thunderbird_read_book();
 
 	return TRUE;
@@ -1000,11 +1700,12 @@ gchar *thunderbird_get_active_book_name(void)
 gchar **thunderbird_get_sub_books(void)
 {
 	gchar **ret = NULL;
-	const gchar *name = thunderbird_get_selected_book();
+	gchar *name = thunderbird_get_selected_book();
 
 	if (name) {
 		ret = rm_strv_add(ret, name);
 	}
+	g_free(name);
 
 	return ret;
 }
@@ -1031,6 +1732,7 @@ gboolean thunderbird_plugin_init(RmPlugin *plugin)
 	table = g_hash_table_new(g_str_hash, g_str_equal);
 
 	thunderbird_read_book();
+	thunderbird_monitor_book();
 
 	rm_addressbook_register(&thunderbird_book);
 
@@ -1039,7 +1741,35 @@ gboolean thunderbird_plugin_init(RmPlugin *plugin)
 
 gboolean thunderbird_plugin_shutdown(RmPlugin *plugin)
 {
+	GHashTableIter iter;
+	gpointer value;
+
 	rm_addressbook_unregister(&thunderbird_book);
+
+	if (thunderbird_monitor) {
+		g_file_monitor_cancel(thunderbird_monitor);
+		g_clear_object(&thunderbird_monitor);
+	}
+
+	if (thunderbird_cancellable) {
+		g_cancellable_cancel(thunderbird_cancellable);
+		g_clear_object(&thunderbird_cancellable);
+	}
+
+	if (thunderbird_contacts) {
+		g_hash_table_iter_init(&iter, thunderbird_contacts);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			thunderbird_contact_free(value);
+		}
+		g_hash_table_destroy(thunderbird_contacts);
+		thunderbird_contacts = NULL;
+	}
+	g_slist_free(contacts);
+	contacts = NULL;
+
+	mork_state_free(thunderbird_state);
+	thunderbird_state = NULL;
+
 	g_clear_object(&thunderbird_settings);
 
 	if (table) {
@@ -1053,12 +1783,13 @@ static void thunderbird_filename_button_clicked_cb(GtkButton *button, gpointer u
 {
 	GtkWidget *dialog = gtk_file_chooser_dialog_new(_("Select mab file"), NULL, GTK_FILE_CHOOSER_ACTION_OPEN, _("_Cancel"), GTK_RESPONSE_CANCEL, _("_Open"), GTK_RESPONSE_ACCEPT, NULL);
 	GtkFileFilter *filter;
-	const gchar *book;
+	gchar *book;
 	gchar *dir;
 	gchar file[256];
 
 	filter = gtk_file_filter_new();
 	gtk_file_filter_add_pattern(filter, "*.mab");
+	gtk_file_filter_add_pattern(filter, "*.sqlite");
 
 	gtk_file_chooser_set_filter(GTK_FILE_CHOOSER(dialog), filter);
 
@@ -1067,20 +1798,24 @@ static void thunderbird_filename_button_clicked_cb(GtkButton *button, gpointer u
 		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(dialog), book);
 	} else {
 		dir = find_thunderbird_dir();
-		snprintf(file, sizeof(file), "%s/abook.mab", dir);
+		snprintf(file, sizeof(file), "%s/abook.sqlite", dir);
+		if (!g_file_test(file, G_FILE_TEST_EXISTS)) {
+			snprintf(file, sizeof(file), "%s/abook.mab", dir);
+		}
 
 		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(dialog), file);
 		g_free(dir);
 	}
+	g_free(book);
 
 	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
 		gchar *folder = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 
 		gtk_entry_set_text(GTK_ENTRY(user_data), folder);
-		contacts = NULL;
 		thunderbird_set_selected_book(folder);
 
 		thunderbird_read_book();
+		thunderbird_monitor_book();
 
 		g_free(folder);
 	}
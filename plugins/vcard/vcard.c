@@ -22,9 +22,9 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
-#include <ctype.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <gtk/gtk.h>
 
@@ -33,6 +33,9 @@
 #include <roger/main.h>
 #include <roger/settings.h>
 #include <roger/uitools.h>
+#include <roger/contactimage.h>
+#include <roger/contactlist.h>
+#include <roger/contactsdelta.h>
 
 #include <vcard.h>
 
@@ -41,51 +44,168 @@ static GSList *contacts = NULL;
 static GSettings *vcard_settings = NULL;
 
 static GList *vcard_list = NULL;
-static GList *vcard = NULL;
-static struct vcard_data *current_card_data = NULL;
-static GString *current_string = NULL;
-static gint state = STATE_NEW;
+static GHashTable *vcard_cards = NULL;
+static GHashTable *vcard_files = NULL;
+static GHashTable *vcard_removed = NULL;
+static gchar *vcard_etag = NULL;
 static gint current_position = 0;
-static GString *first_name = NULL;
-static GString *last_name = NULL;
-static GString *company = NULL;
-static GString *title = NULL;
 static GFileMonitor *file_monitor = NULL;
 
 gboolean vcard_reload_contacts(void);
+static void vcard_reload_source(const gchar *source, gboolean directory, gboolean notify);
+static void vcard_reload_directory_file(const gchar *file_name);
 
 /**
- * \brief Free header, options and entry line
- * \param psCard pointer to card structure
+ * \brief Create new empty card
+ * \return new card structure
+ */
+static struct vcard_card *vcard_card_new(void)
+{
+	struct vcard_card *card = g_slice_new0(struct vcard_card);
+
+	card->data = g_array_new(FALSE, FALSE, sizeof(struct vcard_data));
+
+	return card;
+}
+
+/**
+ * \brief Free card structure including its data, but not the contact
+ * \param data pointer to card structure
+ */
+static void vcard_card_free(gpointer data)
+{
+	struct vcard_card *card = data;
+
+	/* Property strings live in the file buffer or in the string chunk */
+	g_array_free(card->data, TRUE);
+	g_free(card->key);
+
+	if (card->strings) {
+		g_string_chunk_free(card->strings);
+	}
+
+	if (card->buffer) {
+		g_bytes_unref(card->buffer);
+	}
+
+	if (card->raw) {
+		g_bytes_unref(card->raw);
+	}
+
+	g_slice_free(struct vcard_card, card);
+}
+
+/**
+ * \brief Copy string into card storage, for properties not backed by the file buffer
+ * \param card pointer to card structure
+ * \param str string to copy
+ * \return copy owned by card, or NULL
  */
-static void vcard_free_data(struct vcard_data *card_data)
+static gchar *vcard_card_strdup(struct vcard_card *card, const gchar *str)
 {
-	/* if header is present, free it and set to NULL */
-	if (card_data->header != NULL) {
-		g_free(card_data->header);
-		card_data->header = NULL;
+	if (!str) {
+		return NULL;
+	}
+
+	if (!card->strings) {
+		card->strings = g_string_chunk_new(128);
 	}
 
-	/* if options is present, free it and set to NULL */
-	if (card_data->options != NULL) {
-		g_free(card_data->options);
-		card_data->options = NULL;
+	return g_string_chunk_insert(card->strings, str);
+}
+
+/**
+ * \brief Append property to card, strings are copied into card storage
+ * \param card pointer to card structure
+ * \param header header string
+ * \param options optional options string
+ * \param entry entry string
+ * \return pointer to new property, valid until the next property is added
+ */
+static struct vcard_data *vcard_card_append(struct vcard_card *card, const gchar *header, const gchar *options, const gchar *entry)
+{
+	struct vcard_data card_data;
+
+	card_data.header = vcard_card_strdup(card, header);
+	card_data.options = vcard_card_strdup(card, options);
+	card_data.entry = vcard_card_strdup(card, entry);
+
+	g_array_append_val(card->data, card_data);
+
+	return &g_array_index(card->data, struct vcard_data, card->data->len - 1);
+}
+
+/**
+ * \brief Free contact created by this plugin
+ * \param contact contact structure
+ */
+static void vcard_contact_free(RmContact *contact)
+{
+	contact_image_clear(contact);
+	rm_contact_free(contact);
+}
+
+/**
+ * \brief Check whether property is part of the card fingerprint
+ * \param card_data pointer to card data structure
+ * \return TRUE if property is relevant, FALSE if it is rewritten on every save
+ */
+static gboolean vcard_data_is_content(struct vcard_data *card_data)
+{
+	return strcasecmp(card_data->header, "BEGIN") && strcasecmp(card_data->header, "END") && strcasecmp(card_data->header, "VERSION");
+}
+
+/**
+ * \brief Compute content hash of card properties
+ * \param data array of struct vcard_data
+ * \return content hash
+ */
+static guint vcard_card_hash(GArray *data)
+{
+	guint hash = 5381;
+	guint index;
+
+	for (index = 0; index < data->len; index++) {
+		struct vcard_data *card_data = &g_array_index(data, struct vcard_data, index);
+
+		if (!vcard_data_is_content(card_data)) {
+			continue;
+		}
+
+		hash = hash * 33 + g_str_hash(card_data->header);
+		hash = hash * 33 + (card_data->options ? g_str_hash(card_data->options) : 0);
+		hash = hash * 33 + g_str_hash(card_data->entry);
 	}
 
-	/* if entry is present, free it and set to NULL */
-	if (card_data->entry != NULL) {
-		g_free(card_data->entry);
-		card_data->entry = NULL;
+	return hash;
+}
+
+/**
+ * \brief Add card to index, keys are made unique in case of duplicated UIDs
+ * \param card pointer to card structure
+ * \param key card key
+ */
+static void vcard_card_index(struct vcard_card *card, const gchar *key)
+{
+	gchar *base = g_strdup(key);
+	gint count = 1;
+
+	g_free(card->key);
+	card->key = g_strdup(base);
+	while (g_hash_table_contains(vcard_cards, card->key)) {
+		g_free(card->key);
+		card->key = g_strdup_printf("%s#%d", base, count++);
 	}
 
-	g_free(card_data);
+	g_hash_table_insert(vcard_cards, card->key, card);
+	g_free(base);
 }
 
 /**
  * \brief Process first/last name structure
  * \param psCard pointer to card structure
  */
-static void process_first_last_name(struct vcard_data *card_data)
+static void process_first_last_name(struct vcard_parser *parser, struct vcard_data *card_data)
 {
 	gint len = 0;
 	gint index = 0;
@@ -97,14 +217,14 @@ static void process_first_last_name(struct vcard_data *card_data)
 	len = strlen(card_data->entry);
 
 	/* Create last name string */
-	last_name = g_string_new("");
+	parser->last_name = g_string_new("");
 	while (index < len) {
 		if (
 			(card_data->entry[index] != 0x00) &&
 			(card_data->entry[index] != ';') &&
 			(card_data->entry[index] != 0x0A) &&
 			(card_data->entry[index] != 0x0D)) {
-			g_string_append_c(last_name, card_data->entry[index++]);
+			g_string_append_c(parser->last_name, card_data->entry[index++]);
 		} else {
 			break;
 		}
@@ -114,14 +234,14 @@ static void process_first_last_name(struct vcard_data *card_data)
 	index++;
 
 	/* Create first name string */
-	first_name = g_string_new("");
+	parser->first_name = g_string_new("");
 	while (index < len) {
 		if (
 			(card_data->entry[index] != 0x00) &&
 			(card_data->entry[index] != ';') &&
 			(card_data->entry[index] != 0x0A) &&
 			(card_data->entry[index] != 0x0D)) {
-			g_string_append_c(first_name, card_data->entry[index++]);
+			g_string_append_c(parser->first_name, card_data->entry[index++]);
 		} else {
 			break;
 		}
@@ -164,7 +284,7 @@ static void process_formatted_name(struct vcard_data *card_data, RmContact *cont
  * \brief Process organization structure
  * \param psCard pointer to card structure
  */
-static void process_organization(struct vcard_data *card_data)
+static void process_organization(struct vcard_parser *parser, struct vcard_data *card_data)
 {
 	gint len = 0;
 	gint index = 0;
@@ -176,14 +296,14 @@ static void process_organization(struct vcard_data *card_data)
 	len = strlen(card_data->entry);
 
 	/* Create company string */
-	company = g_string_new("");
+	parser->company = g_string_new("");
 	while (index < len) {
 		if (
 			(card_data->entry[index] != 0x00) &&
 			(card_data->entry[index] != ';') &&
 			(card_data->entry[index] != 0x0A) &&
 			(card_data->entry[index] != 0x0D)) {
-			g_string_append_c(company, card_data->entry[index++]);
+			g_string_append_c(parser->company, card_data->entry[index++]);
 		} else {
 			break;
 		}
@@ -194,7 +314,7 @@ static void process_organization(struct vcard_data *card_data)
  * \brief Process title structure
  * \param psCard pointer to card structure
  */
-static void process_title(struct vcard_data *card_data)
+static void process_title(struct vcard_parser *parser, struct vcard_data *card_data)
 {
 	gint len = 0;
 	gint index = 0;
@@ -206,14 +326,14 @@ static void process_title(struct vcard_data *card_data)
 	len = strlen(card_data->entry);
 
 	/* Create title string */
-	title = g_string_new("");
+	parser->title = g_string_new("");
 	while (index < len) {
 		if (
 			(card_data->entry[index] != 0x00) &&
 			(card_data->entry[index] != ';') &&
 			(card_data->entry[index] != 0x0A) &&
 			(card_data->entry[index] != 0x0D)) {
-			g_string_append_c(title, card_data->entry[index++]);
+			g_string_append_c(parser->title, card_data->entry[index++]);
 		} else {
 			break;
 		}
@@ -406,11 +526,6 @@ static void process_telephone(struct vcard_data *card_data, RmContact *contact)
  */
 static void process_photo(struct vcard_data *card_data, RmContact *contact)
 {
-	GdkPixbufLoader *loader;
-	guchar *image_ptr;
-	gsize len;
-	GError *error = NULL;
-
 	if (!contact) {
 		return;
 	}
@@ -421,15 +536,8 @@ static void process_photo(struct vcard_data *card_data, RmContact *contact)
 		}
 	}
 
-	image_ptr = g_base64_decode(card_data->entry, &len);
-	loader = gdk_pixbuf_loader_new();
-	if (gdk_pixbuf_loader_write(loader, image_ptr, len, &error)) {
-		contact->image = gdk_pixbuf_loader_get_pixbuf(loader);
-		contact->image_len = len;
-	} else {
-		g_debug("Error!! (%s)", error->message);
-		g_free(image_ptr);
-	}
+	/* Keep encoded data only, photo is decoded on first display */
+	contact_image_set_base64(contact, card_data->entry);
 }
 
 /**
@@ -458,25 +566,70 @@ GString *vcard_create_uid(void)
 }
 
 /**
- * \brief Parse end of vcard, check for valid entry and add person
+ * \brief Free temporary strings of parser
+ * \param parser parser state
  */
-static void process_card_end(RmContact *contact)
+static void vcard_parser_reset(struct vcard_parser *parser)
 {
-	if (!contact) {
-		return;
+	/* Free firstname */
+	if (parser->first_name != NULL) {
+		g_string_free(parser->first_name, TRUE);
+		parser->first_name = NULL;
+	}
+
+	/* Free lastname */
+	if (parser->last_name != NULL) {
+		g_string_free(parser->last_name, TRUE);
+		parser->last_name = NULL;
+	}
+
+	/* Free company */
+	if (parser->company != NULL) {
+		g_string_free(parser->company, TRUE);
+		parser->company = NULL;
+	}
+
+	/* Free title */
+	if (parser->title != NULL) {
+		g_string_free(parser->title, TRUE);
+		parser->title = NULL;
+	}
+
+	/* Drop incomplete card */
+	if (parser->card != NULL) {
+		vcard_contact_free(parser->card->contact);
+		vcard_card_free(parser->card);
+		parser->card = NULL;
 	}
+}
+
+/**
+ * \brief Parse end of vcard, check for valid entry and add person
+ * \param parser parser state
+ * \param end file offset behind end of card
+ */
+static void process_card_end(struct vcard_parser *parser, gsize end)
+{
+	struct vcard_card *card = parser->card;
+	RmContact *contact = card->contact;
+
+	/* Fingerprint card before we add missing information */
+	card->hash = vcard_card_hash(card->data);
+
 	if (!contact->priv) {
-		struct vcard_data *card_data = g_malloc0(sizeof(struct vcard_data));
-		card_data->header = g_strdup("UID");
 		GString *uid = vcard_create_uid();
 		contact->priv = g_string_free(uid, FALSE);
-		card_data->entry = g_strdup(contact->priv);
 
-		vcard = g_list_append(vcard, card_data);
+		vcard_card_append(card, "UID", NULL, contact->priv);
+
+		/* Random UID changes on every load, use content instead */
+		card->key = g_strdup_printf("hash:%08x", card->hash);
+	} else {
+		card->key = g_strdup(contact->priv);
 	}
 
-	if (company != NULL) {
-		contact->company = g_strdup(company->str);
+	if (parser->company != NULL) {
+		contact->company = g_strdup(parser->company->str);
 	}
 
 	/*
@@ -485,81 +638,84 @@ static void process_card_end(RmContact *contact)
 	   }
 	   }*/
 
-	if (!contact->name && first_name != NULL && last_name != NULL) {
-		contact->name = g_strdup_printf("%s %s", first_name->str, last_name->str);
+	if (!contact->name && parser->first_name != NULL && parser->last_name != NULL) {
+		contact->name = g_strdup_printf("%s %s", parser->first_name->str, parser->last_name->str);
 	} else if (!contact->name) {
 		contact->name = g_strdup("");
 	}
 
-	contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
-
-	/* Free firstname */
-	if (first_name != NULL) {
-		g_string_free(first_name, TRUE);
-		first_name = NULL;
-	}
-
-	/* Free lastname */
-	if (last_name != NULL) {
-		g_string_free(last_name, TRUE);
-		last_name = NULL;
+	/* Remember encoded card, it is written back as is unless it is modified */
+	if (parser->raw) {
+		card->raw = g_bytes_new_from_bytes(parser->raw, parser->card_offset, end - parser->card_offset);
 	}
 
-	/* Free company */
-	if (company != NULL) {
-		g_string_free(company, TRUE);
-		company = NULL;
-	}
+	parser->cards = g_list_prepend(parser->cards, card);
+	parser->card = NULL;
 
-	/* Free title */
-	if (title != NULL) {
-		g_string_free(title, TRUE);
-		title = NULL;
-	}
+	vcard_parser_reset(parser);
 }
 
 /**
  * \brief Process new data structure (header/options/entry)
+ * \param parser parser state
  * \param card_data pointer to card data structure
- * \param contact contact data
+ * \param offset file offset of line
+ * \param end file offset behind line including folded continuation lines
  */
-static void process_data(struct vcard_data *card_data)
+static void process_data(struct vcard_parser *parser, struct vcard_data *card_data, gsize offset, gsize end)
 {
-	static RmContact *contact;
+	RmContact *contact;
+	gboolean begin;
 
 	if (!card_data->header || !card_data->entry) {
 		return;
 	}
 
-	if (strcasecmp(card_data->header, "BEGIN") == 0) {
+	begin = strcasecmp(card_data->header, "BEGIN") == 0;
+	if (begin) {
 		/* Begin of vcard */
-		vcard = g_list_append(NULL, card_data);
-		vcard_list = g_list_append(vcard_list, vcard);
-		contact = g_slice_new0(RmContact);
-
+		vcard_parser_reset(parser);
+
+		parser->card = vcard_card_new();
+		parser->card->contact = g_slice_new0(RmContact);
+		parser->card->buffer = g_bytes_ref(parser->buffer);
+		parser->card_offset = offset;
+	} else if (!parser->card) {
+		/* Data outside of a card */
 		return;
+	}
+
+	if (parser->copy) {
+		/* Line is not part of the file buffer */
+		vcard_card_append(parser->card, card_data->header, card_data->options, card_data->entry);
 	} else {
-		vcard = g_list_append(vcard, card_data);
+		g_array_append_val(parser->card->data, *card_data);
+	}
+
+	if (begin) {
+		return;
 	}
 
+	contact = parser->card->contact;
+
 	if (strcasecmp(card_data->header, "FN") == 0) {
 		/* Full name */
 		process_formatted_name(card_data, contact);
 	} else if (strcasecmp(card_data->header, "END") == 0) {
 		/* End of vcard */
-		process_card_end(contact);
+		process_card_end(parser, end);
 	} else if (strcasecmp(card_data->header, "N") == 0) {
 		/* First and Last name */
-		process_first_last_name(card_data);
+		process_first_last_name(parser, card_data);
 	} else if (strcasecmp(card_data->header, "TEL") == 0) {
 		/* Telephone */
 		process_telephone(card_data, contact);
 	} else if (strcasecmp(card_data->header, "ORG") == 0) {
 		/* Organization */
-		process_organization(card_data);
+		process_organization(parser, card_data);
 	} else if (strcasecmp(card_data->header, "TITLE") == 0) {
 		/* Title */
-		process_title(card_data);
+		process_title(parser, card_data);
 	} else if (strcasecmp(card_data->header, "ADR") == 0) {
 		/* Address */
 		process_address(card_data, contact);
@@ -573,530 +729,976 @@ static void process_data(struct vcard_data *card_data)
 }
 
 /**
- * \brief Parse one char and add it to internal card structure
- * \param chr current char
+ * \brief Process one unfolded content line (header[;options]:entry). The line is split in place,
+ * properties refer to it afterwards.
+ * \param parser parser state
+ * \param line line start, NUL terminated
+ * \param len line length
+ * \param offset file offset of line
+ * \param end file offset behind line including folded continuation lines
  */
-void parse_char(int chr)
-{
-	switch (state) {
-	case STATE_NEW:
-		current_card_data = g_malloc0(sizeof(struct vcard_data));
-		state = STATE_TAG;
-	/* fall-through */
-	case STATE_TAG:
-		switch (chr) {
-		case '\r':
-			break;
-		case '\n':
-			if (current_string != NULL) {
-				g_string_free(current_string, TRUE);
-			}
-			current_string = NULL;
-			vcard_free_data(current_card_data);
-			state = STATE_NEW;
-			break;
-		case ':':
-			current_card_data->header = g_string_free(current_string, FALSE);
-			current_string = NULL;
-			state = STATE_ENTRY;
-			break;
-		case ';':
-			current_card_data->header = g_string_free(current_string, FALSE);
-			current_string = NULL;
-			state = STATE_OPTIONS;
-			break;
-		default:
-			if (current_string == NULL) {
-				current_string = g_string_new("");
-			}
-			g_string_append_c(current_string, chr);
-			break;
-		}
-		break;
-	case STATE_OPTIONS:
-		switch (chr) {
-		case '\r':
-			break;
-		case '\n':
-			g_string_free(current_string, TRUE);
-			current_string = NULL;
-			vcard_free_data(current_card_data);
-			state = STATE_NEW;
-			break;
-		case ':':
-			current_card_data->options = g_string_free(current_string, FALSE);
-			current_string = NULL;
-			state = STATE_ENTRY;
-			break;
-		default:
-			if (current_string == NULL) {
-				current_string = g_string_new("");
-			}
-			g_string_append_c(current_string, chr);
-			break;
-		}
-		break;
-	case STATE_ENTRY:
-		switch (chr) {
-		case '\r':
-			break;
-		case '\n':
-			if (current_string != NULL) {
-				current_card_data->entry = g_string_free(current_string, FALSE);
-				process_data(current_card_data);
-			}
-			current_string = NULL;
-			state = STATE_NEW;
-			break;
-		default:
-			if (current_string == NULL) {
-				current_string = g_string_new("");
-			}
-			g_string_append_c(current_string, chr);
-			break;
-		}
-		break;
+static void vcard_process_line(struct vcard_parser *parser, gchar *line, gsize len, gsize offset, gsize end)
+{
+	struct vcard_data card_data;
+	gchar *colon;
+	gchar *semicolon;
+	gchar *header_end;
+
+	colon = memchr(line, ':', len);
+	if (!colon) {
+		/* Not a property line */
+		return;
 	}
-}
 
-/**
- * \brief VCard file change callback
- * \param monitor file monitor
- * \param file file structure
- * \param other_file unused file structure
- * \param event_type file monitor event
- * \param user_data unused pointer
- */
-static void vcard_file_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
-{
-	if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
+	semicolon = memchr(line, ';', colon - line);
+	header_end = semicolon ? semicolon : colon;
+
+	/* Empty header or entry, skip it */
+	if (header_end == line || colon + 1 == line + len) {
 		return;
 	}
 
-	g_debug("%s(): %d", __FUNCTION__, event_type);
+	*header_end = '\0';
+	*colon = '\0';
 
-	/* Reload contacts */
-	vcard_reload_contacts();
+	card_data.header = line;
+	card_data.options = semicolon ? semicolon + 1 : NULL;
+	card_data.entry = colon + 1;
 
-	/* Send signal to redraw journal and update contacts view */
-	rm_object_emit_contacts_changed();
+	process_data(parser, &card_data, offset, end);
 }
 
 /**
- * \brief Load card file information
- * \param file_name file name to read
+ * \brief Tokenize vcard data. Folded lines are joined in place, so data must be writable.
+ * \param parser parser state
+ * \param data vcard data
+ * \param len length of data
  */
-void vcard_load_file(char *file_name)
+static void vcard_parse_data(struct vcard_parser *parser, gchar *data, gsize len)
 {
-	GFile *file;
-	GFileInfo *file_info;
-	goffset file_size;
-	GFileInputStream *input_stream;
-	GError *error = NULL;
-	gchar *data;
-	gint chr;
-	gboolean start_of_line = TRUE;
-	gboolean fold = FALSE;
-	gint index;
-
-	if (!g_file_test(file_name, G_FILE_TEST_EXISTS)) {
-		g_debug("%s(): file does not exists, abort: %s", __FUNCTION__, file_name);
-		return;
-	}
-
-	/* Open file */
-	file = g_file_new_for_path(file_name);
-	if (!file) {
-		g_warning("%s(): could not open file %s", __FUNCTION__, file_name);
-		return;
-	}
-
-	file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
-	file_size = g_file_info_get_size(file_info);
-
-	data = g_malloc0(file_size);
-	input_stream = g_file_read(file, NULL, NULL);
-	g_input_stream_read_all(G_INPUT_STREAM(input_stream), data, file_size, NULL, NULL, NULL);
-
-	state = STATE_NEW;
-
-	for (index = 0; index < file_size; index++) {
-		chr = data[index];
-		if (start_of_line == TRUE) {
-			if (chr == '\r' || chr == '\n') {
-				/* simple empty line */
-				continue;
-			}
-
-			if (fold == FALSE && isspace(chr)) {
-				/* Ok, we have a fold case, mark it and continue */
-				fold = TRUE;
-				continue;
+	gchar *end = data + len;
+	gchar *pos = data;
+	gchar *line = NULL;
+	gchar *out = NULL;
+	gsize line_stop = 0;
+
+	while (pos < end) {
+		gchar *newline = memchr(pos, '\n', end - pos);
+		gchar *line_end = newline ? newline : end;
+		gchar *next = newline ? newline + 1 : end;
+		gsize line_len;
+
+		/* Strip carriage return */
+		if (line_end > pos && line_end[-1] == '\r') {
+			line_end--;
+		}
+		line_len = line_end - pos;
+
+		if (line_len == 0) {
+			/* Simple empty line */
+		} else if (line && (*pos == ' ' || *pos == '\t')) {
+			/* Fold case: append continuation without leading white space */
+			memmove(out, pos + 1, line_len - 1);
+			out += line_len - 1;
+			line_stop = next - data;
+		} else {
+			if (line) {
+				*out = '\0';
+				vcard_process_line(parser, line, out - line, line - data, line_stop);
 			}
 
-			start_of_line = FALSE;
-			if (fold == TRUE) {
-				fold = FALSE;
-			} else {
-				parse_char('\n');
-			}
+			line = pos;
+			out = line_end;
+			line_stop = next - data;
 		}
 
-		if (chr == '\n') {
-			start_of_line = TRUE;
-		} else {
-			parse_char(chr);
-		}
+		pos = next;
 	}
 
-	/* Ensure we get a '\n' */
-	parse_char('\n');
-
-	g_input_stream_close(G_INPUT_STREAM(input_stream), NULL, NULL);
-
-	if (file_monitor) {
-		g_file_monitor_cancel(G_FILE_MONITOR(file_monitor));
-	}
+	if (line) {
+		if (out < end) {
+			*out = '\0';
+			vcard_process_line(parser, line, out - line, line - data, line_stop);
+		} else {
+			/* Last line is not terminated and fills the buffer */
+			gchar *tmp = g_strndup(line, out - line);
 
-	file_monitor = g_file_monitor_file(file, 0, NULL, &error);
-	if (file_monitor) {
-		g_signal_connect(file_monitor, "changed", G_CALLBACK(vcard_file_changed_cb), NULL);
-	} else {
-		g_warning("%s(): could not connect file monitor. Error: %s", __FUNCTION__, error ? error->message : "?");
+			parser->copy = TRUE;
+			vcard_process_line(parser, tmp, out - line, line - data, line_stop);
+			parser->copy = FALSE;
+			g_free(tmp);
+		}
 	}
 }
 
 /**
- * \brief Put char to vcard structure
- * \param data data string
- * \param chr put char
+ * \brief Query entity tag of file
+ * \param file file structure
+ * \return entity tag or NULL, free with g_free()
  */
-static void vcard_put_char(GString *data, gint chr)
+static gchar *vcard_query_etag(GFile *file)
 {
-	if (current_position == 74 && chr != '\r') {
-		g_string_append(data, "\n ");
-		current_position = 1;
-	} else if (chr == '\n') {
-		current_position = 0;
+	GFileInfo *info;
+	gchar *etag = NULL;
+
+	info = g_file_query_info(file, G_FILE_ATTRIBUTE_ETAG_VALUE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if (info) {
+		etag = g_strdup(g_file_info_get_etag(info));
+		g_object_unref(info);
 	}
 
-	data = g_string_append_c(data, chr);
-	current_position++;
+	return etag;
 }
 
 /**
- * \brief printf to data structure
- * \param data data string
- * \param format format string
+ * \brief Check whether file name refers to a vcard file
+ * \param file_name file name
+ * \return TRUE if file name has a vcard extension
  */
-void vcard_print(GString *data, gchar *format, ...)
+static gboolean vcard_is_vcard_file(const gchar *file_name)
 {
-	va_list args;
-	int len;
-	int size = 100;
-	gchar *ptr = NULL;
-
-	if ((ptr = g_malloc(size)) == NULL) {
-		return;
-	}
+	gsize len = strlen(file_name);
 
-	while (1) {
-		va_start(args, format);
+	return len > 4 && !g_ascii_strcasecmp(file_name + len - 4, ".vcf");
+}
 
-		len = vsnprintf(ptr, size, format, args);
+/**
+ * \brief Free file structure, but not its cards
+ * \param data pointer to file structure
+ */
+static void vcard_file_free(gpointer data)
+{
+	struct vcard_file *file = data;
 
-		va_end(args);
+	g_free(file->file_name);
+	g_free(file->etag);
+	g_list_free(file->cards);
 
-		if (len > -1 && len < size) {
-			int index;
+	g_slice_free(struct vcard_file, file);
+}
 
-			for (index = 0; index < len; index++) {
-				vcard_put_char(data, ptr[index]);
-			}
+/**
+ * \brief Get file structure of vcard directory file, create it if it is not known yet
+ * \param file_name full path of vcard file
+ * \return file structure
+ */
+static struct vcard_file *vcard_get_file(const gchar *file_name)
+{
+	struct vcard_file *file = g_hash_table_lookup(vcard_files, file_name);
 
-			break;
-		}
+	if (!file) {
+		file = g_slice_new0(struct vcard_file);
+		file->file_name = g_strdup(file_name);
+		g_hash_table_insert(vcard_files, file->file_name, file);
+	}
 
-		if (len > -1) {
-			size = len + 1;
-		} else {
-			size *= 2;
-		}
+	return file;
+}
 
-		if ((ptr = g_realloc(ptr, size)) == NULL) {
-			break;
-		}
+/**
+ * \brief Remember removed card until the file has been written without it, so that a merge
+ * of the file does not bring it back
+ * \param key card key
+ * \param file_name file containing the card
+ */
+static void vcard_removal_add(const gchar *key, const gchar *file_name)
+{
+	if (!vcard_removed) {
+		vcard_removed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 	}
 
-	if (ptr != NULL) {
-		g_free(ptr);
-	}
+	g_hash_table_insert(vcard_removed, g_strdup(key), g_strdup(file_name));
 }
 
 /**
- * \brief Find vcard entry via uid
- * \param uid uid
- * \param vcard entry list pointer or NULL
+ * \brief Check whether card has been removed by us but is still found in its file
+ * \param key card key
+ * \return TRUE if removal is pending
  */
-GList *vcard_find_entry(const gchar *uid)
+static gboolean vcard_removal_is_pending(const gchar *key)
 {
-	GList *list1 = NULL;
-	GList *list2 = NULL;
-	GList *card = NULL;
-	struct vcard_data *data;
-	gchar *current_uid;
+	return vcard_removed && g_hash_table_contains(vcard_removed, key);
+}
 
-	for (list1 = vcard_list; list1 != NULL && list1->data != NULL; list1 = list1->next) {
-		card = list1->data;
+/**
+ * \brief Forget pending removals of file after it has been written or removed
+ * \param file_name file name
+ */
+static void vcard_removal_done(const gchar *file_name)
+{
+	GHashTableIter iter;
+	gpointer value;
 
-		for (list2 = card; list2 != NULL && list2->data != NULL; list2 = list2->next) {
-			data = list2->data;
+	if (!vcard_removed) {
+		return;
+	}
 
-			if (data->header && strcmp(data->header, "UID") == 0) {
-				current_uid = data->entry;
-				if (current_uid != NULL && !strcmp(current_uid, uid)) {
-					return card;
-				}
-			}
+	g_hash_table_iter_init(&iter, vcard_removed);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		if (!g_strcmp0(value, file_name)) {
+			g_hash_table_iter_remove(&iter);
 		}
 	}
-
-	return NULL;
 }
 
 /**
- * \brief Find card data via header and option
- * \param list vcard list structure
- * \param header header string
- * \param option optional option string
- * \return card data structure or NULL
+ * \brief Check whether file has changes which have not been written yet
+ * \param file_name file name
+ * \param cards list of struct vcard_card stored in the file
+ * \return TRUE if cards are dirty or removals are pending
  */
-struct vcard_data *find_card_data(GList *list, gchar *header, gchar *option)
+static gboolean vcard_is_pending(const gchar *file_name, GList *cards)
 {
-	GList *tmp = NULL;
-	struct vcard_data *data = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	GList *list;
 
-	for (tmp = list; tmp != NULL && tmp->data != NULL; tmp = tmp->next) {
-		data = tmp->data;
+	for (list = cards; list != NULL; list = list->next) {
+		struct vcard_card *card = list->data;
 
-		if (data->header && strcmp(data->header, header) == 0) {
-			if (!option || (data->options != NULL && strstr(data->options, option))) {
-				return data;
-			}
+		if (card->dirty) {
+			return TRUE;
 		}
 	}
 
-	return NULL;
+	if (vcard_removed) {
+		g_hash_table_iter_init(&iter, vcard_removed);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			if (!g_strcmp0(value, file_name)) {
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
 }
 
-gboolean vcard_modify_data(GList *list, gchar *header, gchar *entry)
+/**
+ * \brief Parse card file. Does not touch any global state, so it is safe to call it from a worker thread.
+ * \param file_name file name to read
+ * \param etag pointer to store entity tag of parsed file at
+ * \return list of parsed cards, not yet indexed
+ */
+static GList *vcard_parse_file(const gchar *file_name, gchar **etag)
 {
-	struct vcard_data *card_data;
+	struct vcard_parser parser;
+	GFile *file;
+	GMappedFile *map;
+	GError *error = NULL;
+	gsize len;
 
-	card_data = find_card_data(list, header, NULL);
+	/* Query tag first, a change while we are reading must not go unnoticed */
+	file = g_file_new_for_path(file_name);
+	*etag = vcard_query_etag(file);
+	g_object_unref(file);
+
+	/* Map file only while parsing. Cards outlive the mapping, so they get copies: a mapping
+	 * kept by them would raise SIGBUS once the file is truncated in place by somebody else. */
+	map = g_mapped_file_new(file_name, FALSE, &error);
+	if (!map) {
+		g_warning("%s(): could not open file %s (%s)", __FUNCTION__, file_name, error ? error->message : "?");
+		g_clear_error(&error);
+		return NULL;
+	}
 
-	if (card_data == NULL) {
-		card_data = g_malloc0(sizeof(struct vcard_data));
-		card_data->header = g_strdup(header);
-		list = g_list_append(list, card_data);
+	memset(&parser, 0, sizeof(parser));
+
+	len = g_mapped_file_get_length(map);
+	if (len) {
+		/* One copy is split in place and referenced by the properties, cards keep slices
+		 * of the untouched one for writing them back */
+		gchar *data = g_malloc(len);
+
+		memcpy(data, g_mapped_file_get_contents(map), len);
+		parser.buffer = g_bytes_new_take(data, len);
+		parser.raw = g_bytes_new(g_mapped_file_get_contents(map), len);
+		g_mapped_file_unref(map);
+
+		vcard_parse_data(&parser, data, len);
+
+		vcard_parser_reset(&parser);
+		g_bytes_unref(parser.buffer);
+		g_bytes_unref(parser.raw);
+	} else {
+		g_mapped_file_unref(map);
+	}
+
+	return g_list_reverse(parser.cards);
+}
+
+/**
+ * \brief Thread pool function parsing one file of a vcard directory
+ * \param data pointer to file structure
+ * \param user_data unused pointer
+ */
+static void vcard_parse_file_func(gpointer data, gpointer user_data)
+{
+	struct vcard_file *file = data;
+
+	file->cards = vcard_parse_file(file->file_name, &file->etag);
+}
+
+/**
+ * \brief VCard file change callback
+ * \param monitor file monitor
+ * \param file file structure
+ * \param other_file unused file structure
+ * \param event_type file monitor event
+ * \param user_data unused pointer
+ */
+static void vcard_file_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+	if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
+		return;
+	}
+
+	g_debug("%s(): %d", __FUNCTION__, event_type);
+
+	if (vcard_etag) {
+		gchar *etag = vcard_query_etag(file);
+		gboolean own = !g_strcmp0(etag, vcard_etag);
+
+		g_free(etag);
+
+		if (own) {
+			/* File is still what we loaded or wrote ourself */
+			return;
+		}
+	}
+
+	/* Reload contacts, emits changes */
+	vcard_reload_contacts();
+}
+
+/**
+ * \brief VCard directory change callback, re-reads only the touched file
+ * \param monitor file monitor
+ * \param file file structure
+ * \param other_file unused file structure
+ * \param event_type file monitor event
+ * \param user_data unused pointer
+ */
+static void vcard_directory_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+	gchar *file_name;
+
+	if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event_type != G_FILE_MONITOR_EVENT_CREATED && event_type != G_FILE_MONITOR_EVENT_DELETED) {
+		return;
+	}
+
+	file_name = g_file_get_path(file);
+	if (file_name && vcard_is_vcard_file(file_name)) {
+		g_debug("%s(): %d %s", __FUNCTION__, event_type, file_name);
+		vcard_reload_directory_file(file_name);
+	}
+
+	g_free(file_name);
+}
+
+/**
+ * \brief Watch vcard file or directory for changes
+ * \param file_name file or directory name
+ * \param directory TRUE if file_name is a directory
+ */
+static void vcard_monitor(const gchar *file_name, gboolean directory)
+{
+	GFile *file;
+	GError *error = NULL;
+
+	if (file_monitor) {
+		g_file_monitor_cancel(G_FILE_MONITOR(file_monitor));
+		g_clear_object(&file_monitor);
+	}
+
+	file = g_file_new_for_path(file_name);
+
+	if (directory) {
+		file_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, &error);
 	} else {
-		g_free(card_data->entry);
+		file_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, &error);
 	}
 
-	if (entry) {
-		card_data->entry = g_strdup(entry);
+	if (file_monitor) {
+		g_signal_connect(file_monitor, "changed", directory ? G_CALLBACK(vcard_directory_changed_cb) : G_CALLBACK(vcard_file_changed_cb), NULL);
 	} else {
-		card_data->entry = g_strdup("");
+		g_warning("%s(): could not connect file monitor. Error: %s", __FUNCTION__, error ? error->message : "?");
+		g_clear_error(&error);
+	}
+
+	g_object_unref(file);
+}
+
+/**
+ * \brief Load card file information
+ * \param file_name file name to read
+ * \return list of parsed cards, not yet indexed
+ */
+static GList *vcard_load_file(const gchar *file_name)
+{
+	GList *cards;
+
+	if (!g_file_test(file_name, G_FILE_TEST_EXISTS)) {
+		g_debug("%s(): file does not exists, abort: %s", __FUNCTION__, file_name);
+		return NULL;
+	}
+
+	g_free(vcard_etag);
+	cards = vcard_parse_file(file_name, &vcard_etag);
+
+	vcard_monitor(file_name, FALSE);
+
+	return cards;
+}
+
+static gint vcard_file_compare(gconstpointer a, gconstpointer b)
+{
+	const struct vcard_file *file_a = *(struct vcard_file**)a;
+	const struct vcard_file *file_b = *(struct vcard_file**)b;
+
+	return strcmp(file_a->file_name, file_b->file_name);
+}
+
+/**
+ * \brief Load directory with one or more cards per file, files are parsed in parallel
+ * \param dir_name directory name to read
+ * \return list of parsed cards, not yet indexed
+ */
+static GList *vcard_load_directory(const gchar *dir_name)
+{
+	GThreadPool *pool;
+	GPtrArray *files;
+	GList *cards = NULL;
+	GError *error = NULL;
+	const gchar *name;
+	GDir *dir;
+	guint index;
+
+	g_clear_pointer(&vcard_etag, g_free);
+
+	dir = g_dir_open(dir_name, 0, &error);
+	if (!dir) {
+		g_warning("%s(): could not open directory %s (%s)", __FUNCTION__, dir_name, error ? error->message : "?");
+		g_clear_error(&error);
+		return NULL;
+	}
+
+	files = g_ptr_array_new();
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		struct vcard_file *file;
+
+		if (!vcard_is_vcard_file(name)) {
+			continue;
+		}
+
+		file = g_slice_new0(struct vcard_file);
+		file->file_name = g_build_filename(dir_name, name, NULL);
+		g_ptr_array_add(files, file);
+	}
+	g_dir_close(dir);
+
+	/* Keep a stable order independent of the directory listing */
+	g_ptr_array_sort(files, vcard_file_compare);
+
+	pool = g_thread_pool_new(vcard_parse_file_func, NULL, g_get_num_processors(), FALSE, NULL);
+	for (index = 0; index < files->len; index++) {
+		g_thread_pool_push(pool, g_ptr_array_index(files, index), NULL);
+	}
+
+	/* Wait for all files */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	for (index = files->len; index > 0; index--) {
+		struct vcard_file *file = g_ptr_array_index(files, index - 1);
+		GList *list;
+
+		for (list = g_list_last(file->cards); list != NULL; list = list->prev) {
+			struct vcard_card *card = list->data;
+
+			card->file = file;
+			cards = g_list_prepend(cards, card);
+		}
+
+		g_hash_table_insert(vcard_files, file->file_name, file);
+	}
+
+	g_debug("%s(): %d files, %d cards", __FUNCTION__, files->len, g_list_length(cards));
+
+	g_ptr_array_free(files, TRUE);
+
+	vcard_monitor(dir_name, TRUE);
+
+	return cards;
+}
+
+/**
+ * \brief Put char to vcard structure
+ * \param data data string
+ * \param chr put char
+ */
+static void vcard_put_char(GString *data, gint chr)
+{
+	if (current_position == 74 && chr != '\r') {
+		g_string_append(data, "\n ");
+		current_position = 1;
+	} else if (chr == '\n') {
+		current_position = 0;
+	}
+
+	data = g_string_append_c(data, chr);
+	current_position++;
+}
+
+/**
+ * \brief printf to data structure
+ * \param data data string
+ * \param format format string
+ */
+void vcard_print(GString *data, gchar *format, ...)
+{
+	va_list args;
+	int len;
+	int size = 100;
+	gchar *ptr = NULL;
+
+	if ((ptr = g_malloc(size)) == NULL) {
+		return;
+	}
+
+	while (1) {
+		va_start(args, format);
+
+		len = vsnprintf(ptr, size, format, args);
+
+		va_end(args);
+
+		if (len > -1 && len < size) {
+			int index;
+
+			for (index = 0; index < len; index++) {
+				vcard_put_char(data, ptr[index]);
+			}
+
+			break;
+		}
+
+		if (len > -1) {
+			size = len + 1;
+		} else {
+			size *= 2;
+		}
+
+		if ((ptr = g_realloc(ptr, size)) == NULL) {
+			break;
+		}
+	}
+
+	if (ptr != NULL) {
+		g_free(ptr);
+	}
+}
+
+/**
+ * \brief Find vcard entry of contact
+ * \param contact contact structure
+ * \return card structure or NULL
+ */
+static struct vcard_card *vcard_find_card(RmContact *contact)
+{
+	struct vcard_card *card;
+	GList *list;
+
+	if (contact->priv) {
+		card = g_hash_table_lookup(vcard_cards, contact->priv);
+		if (card && card->contact == contact) {
+			return card;
+		}
+	}
+
+	/* Cards without UID in file are indexed by their content hash */
+	for (list = vcard_list; list != NULL; list = list->next) {
+		card = list->data;
+
+		if (card->key && card->contact == contact) {
+			return card;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Find card data via header and option
+ * \param list vcard list structure
+ * \param header header string
+ * \param option optional option string
+ * \return card data structure or NULL
+ */
+struct vcard_data *find_card_data(GArray *data, gchar *header, gchar *option)
+{
+	guint index;
+
+	for (index = 0; index < data->len; index++) {
+		struct vcard_data *card_data = &g_array_index(data, struct vcard_data, index);
+
+		if (card_data->header && strcmp(card_data->header, header) == 0) {
+			if (!option || (card_data->options != NULL && strstr(card_data->options, option))) {
+				return card_data;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+gboolean vcard_modify_data(struct vcard_card *card, gchar *header, gchar *entry)
+{
+	struct vcard_data *card_data;
+
+	card_data = find_card_data(card->data, header, NULL);
+
+	if (card_data == NULL) {
+		card_data = vcard_card_append(card, header, NULL, NULL);
 	}
 
+	card_data->entry = vcard_card_strdup(card, entry ? entry : "");
+
 	return TRUE;
 }
 
-GList *vcard_remove_data(GList *list, gchar *header)
+void vcard_remove_data(struct vcard_card *card, gchar *header)
 {
-	GList *tmp = NULL;
-	struct vcard_data *data = NULL;
+	guint index;
+	guint len = 0;
 
- again:
-	for (tmp = list; tmp != NULL && tmp->data != NULL; tmp = tmp->next) {
-		data = tmp->data;
+	/* Compact array in a single pass */
+	for (index = 0; index < card->data->len; index++) {
+		struct vcard_data *card_data = &g_array_index(card->data, struct vcard_data, index);
+
+		if (card_data->header && !strcmp(card_data->header, header)) {
+			continue;
+		}
 
-		if (data->header && !strcmp(data->header, header)) {
-			list = g_list_remove(list, data);
-			goto again;
+		if (len != index) {
+			g_array_index(card->data, struct vcard_data, len) = *card_data;
 		}
+		len++;
 	}
 
-	return list;
+	g_array_set_size(card->data, len);
 }
 
 /**
- * \brief Write card file information
- * \param file_name file name to read
+ * \brief Encode card again from its contact, keeping all properties we do not handle
+ * \param card pointer to card structure
  */
-void vcard_write_file(char *file_name)
+static void vcard_encode_card(struct vcard_card *card)
 {
-	GString *data = NULL;
-	GSList *list = NULL;
-	RmContact *contact = NULL;
-	GList *entry = NULL;
-	GList *list2 = NULL;
+	GString *data;
+	RmContact *contact = card->contact;
+	struct vcard_data *card_data;
 	GSList *numbers;
 	GSList *addresses;
+	guint index;
 
 	data = g_string_new("");
 
 	current_position = 0;
 
-	for (list = contacts; list != NULL && list->data != NULL; list = list->next) {
-		contact = list->data;
-
-		if (!contact->priv) {
-			struct vcard_data *card_data = g_malloc0(sizeof(struct vcard_data));
-			card_data->header = g_strdup("UID");
-			GString *uid = vcard_create_uid();
-			contact->priv = g_string_free(uid, FALSE);
-			uid = NULL;
-			card_data->entry = g_strdup(contact->priv);
-			vcard = g_list_append(NULL, card_data);
-			vcard_list = g_list_append(vcard_list, vcard);
+	vcard_print(data, "BEGIN:VCARD\n");
+
+	/* Set version to 4.0 and remove obsolete entries */
+	vcard_print(data, "VERSION:4.0\n");
+
+	vcard_remove_data(card, "BEGIN");
+	vcard_remove_data(card, "END");
+	vcard_remove_data(card, "VERSION");
+	vcard_remove_data(card, "N");
+	vcard_remove_data(card, "LABEL");
+	vcard_remove_data(card, "AGENT");
+
+	/* formatted name */
+	vcard_modify_data(card, "FN", contact->name);
+
+	/* telephone */
+	vcard_remove_data(card, "TEL");
+	for (numbers = contact->numbers; numbers != NULL; numbers = numbers->next) {
+		RmPhoneNumber *number = numbers->data;
+		const gchar *options;
+
+		switch (number->type) {
+		case RM_PHONE_NUMBER_TYPE_HOME:
+			options = "TYPE=HOME,VOICE";
+			break;
+		case RM_PHONE_NUMBER_TYPE_WORK:
+			options = "TYPE=WORK,VOICE";
+			break;
+		case RM_PHONE_NUMBER_TYPE_MOBILE:
+			options = "TYPE=CELL";
+			break;
+		case RM_PHONE_NUMBER_TYPE_FAX_HOME:
+			options = "TYPE=HOME,FAX";
+			break;
+		default:
+			continue;
 		}
 
-		entry = vcard_find_entry(contact->priv);
-		if (entry == NULL) {
+		vcard_card_append(card, "TEL", options, number->number);
+	}
+
+	/* address */
+	vcard_remove_data(card, "ADR");
+	for (addresses = contact->addresses; addresses != NULL; addresses = addresses->next) {
+		RmContactAddress *address = addresses->data;
+		const gchar *options;
+		gchar *entry;
+
+		switch (address->type) {
+		case 0:
+			options = "TYPE=HOME";
+			break;
+		case 1:
+			options = "TYPE=WORK";
+			break;
+		default:
 			continue;
 		}
 
-		vcard_print(data, "BEGIN:VCARD\n");
-
-		/* Set version to 4.0 and remove obsolete entries */
-		vcard_print(data, "VERSION:4.0\n");
-
-		entry = vcard_remove_data(entry, "BEGIN");
-		entry = vcard_remove_data(entry, "END");
-		entry = vcard_remove_data(entry, "VERSION");
-		entry = vcard_remove_data(entry, "N");
-		entry = vcard_remove_data(entry, "LABEL");
-		entry = vcard_remove_data(entry, "AGENT");
-
-		/* formatted name */
-		vcard_modify_data(entry, "FN", contact->name);
-
-		/* telephone */
-		entry = vcard_remove_data(entry, "TEL");
-		for (numbers = contact->numbers; numbers != NULL; numbers = numbers->next) {
-			RmPhoneNumber *number = numbers->data;
-			struct vcard_data *card_data;
-
-			card_data = g_malloc0(sizeof(struct vcard_data));
-			card_data->header = g_strdup("TEL");
-
-			switch (number->type) {
-			case RM_PHONE_NUMBER_TYPE_HOME:
-				card_data->options = g_strdup("TYPE=HOME,VOICE");
-				break;
-			case RM_PHONE_NUMBER_TYPE_WORK:
-				card_data->options = g_strdup("TYPE=WORK,VOICE");
-				break;
-			case RM_PHONE_NUMBER_TYPE_MOBILE:
-				card_data->options = g_strdup("TYPE=CELL");
-				break;
-			case RM_PHONE_NUMBER_TYPE_FAX_HOME:
-				card_data->options = g_strdup("TYPE=HOME,FAX");
-				break;
-			default:
-				continue;
+		entry = g_strdup_printf(";;%s;%s;;%s;%s",
+					address->street,
+					address->city,
+					address->zip,
+		                        /*address->country*/ "");
+		vcard_card_append(card, "ADR", options, entry);
+		g_free(entry);
+	}
+
+	/* Handle photos with care, in case the type is url skip it */
+	if (contact->image_uri != NULL) {
+		/* Ok, new image set */
+		gchar *image = NULL;
+		gsize len = 0;
+
+		card_data = find_card_data(card->data, "PHOTO", NULL);
+		if (card_data && card_data->options && strstr(card_data->options, "VALUE=URL")) {
+			/* Sorry, we cannot handled URL photos yet */
+		} else if (g_file_get_contents(contact->image_uri, &image, &len, NULL)) {
+			gchar *base64 = g_base64_encode((const guchar*)image, len);
+
+			if (!card_data) {
+				card_data = vcard_card_append(card, "PHOTO", NULL, NULL);
 			}
 
-			card_data->entry = g_strdup(number->number);
-			entry = g_list_append(entry, card_data);
+			card_data->options = vcard_card_strdup(card, "ENCODING=b");
+			card_data->entry = vcard_card_strdup(card, base64);
+
+			g_free(base64);
+			g_free(image);
 		}
+	} else if (contact_image_is_removed(contact)) {
+		/* Image has been removed by the user, a missing handle may just not be loaded */
+		card_data = find_card_data(card->data, "PHOTO", NULL);
 
-		/* address */
-		entry = vcard_remove_data(entry, "ADR");
-		for (addresses = contact->addresses; addresses != NULL; addresses = addresses->next) {
-			RmContactAddress *address = addresses->data;
-			struct vcard_data *card_data;
-
-			card_data = g_malloc0(sizeof(struct vcard_data));
-			card_data->header = g_strdup("ADR");
-
-			switch (address->type) {
-			case 0:
-				card_data->options = g_strdup("TYPE=HOME");
-				break;
-			case 1:
-				card_data->options = g_strdup("TYPE=WORK");
-				break;
-			default:
-				continue;
-			}
+		if (card_data && card_data->options && !strstr(card_data->options, "VALUE=URL")) {
+			/* Only remove previous image if it is non URL based */
+			vcard_remove_data(card, "PHOTO");
+		}
+	}
 
-			card_data->entry = g_strdup_printf(";;%s;%s;;%s;%s",
-							   address->street,
-							   address->city,
-							   address->zip,
-			                                   /*address->country*/ "");
+	/* Lets add the additional data */
+	for (index = 0; index < card->data->len; index++) {
+		card_data = &g_array_index(card->data, struct vcard_data, index);
 
-			entry = g_list_append(entry, card_data);
+		if (card_data->options != NULL) {
+			vcard_print(data, "%s;%s:%s\n", card_data->header, card_data->options, card_data->entry);
+		} else {
+			vcard_print(data, "%s:%s\n", card_data->header, card_data->entry);
 		}
+	}
 
-		/* Handle photos with care, in case the type is url skip it */
-		if (contact->image_uri != NULL) {
-			/* Ok, new image set */
-			gchar *data = NULL;
-			gsize len = 0;
-			struct vcard_data *card_data;
-
-			card_data = find_card_data(entry, "PHOTO", NULL);
-			if (card_data && card_data->options && strstr(card_data->options, "VALUE=URL")) {
-				/* Sorry, we cannot handled URL photos yet */
-			} else {
-				if (!card_data) {
-					card_data = g_malloc0(sizeof(struct vcard_data));
-					card_data->header = g_strdup("PHOTO");
-					entry = g_list_append(entry, card_data);
-				} else {
-					g_free(card_data->entry);
-				}
-
-				if (g_file_get_contents(contact->image_uri, &data, &len, NULL)) {
-					gchar *base64 = g_base64_encode((const guchar*)data, len);
-					if (card_data->options != NULL) {
-						g_free(card_data->options);
-					}
-					card_data->options = g_strdup("ENCODING=b");
-					card_data->entry = g_strdup(base64);
-					g_free(base64);
-				}
-			}
-		} else if (contact->image == NULL) {
-			/* No image available, check if contact had an image */
-			struct vcard_data *card_data = find_card_data(entry, "PHOTO", NULL);
+	vcard_print(data, "END:VCARD\n\n");
 
-			if (card_data && card_data->options && !strstr(card_data->options, "VALUE=URL")) {
-				/* Only remove previous image if it is non URL based */
-				entry = vcard_remove_data(entry, "PHOTO");
-			}
+	/* Remember what we wrote, so that the file monitor does not see a change */
+	card->hash = vcard_card_hash(card->data);
+	if (strcmp(card->key, contact->priv)) {
+		g_hash_table_steal(vcard_cards, card->key);
+		vcard_card_index(card, contact->priv);
+	}
+
+	if (card->raw) {
+		g_bytes_unref(card->raw);
+	}
+	card->raw = g_string_free_to_bytes(data);
+	card->dirty = FALSE;
+}
+
+/**
+ * \brief Write cards to file. Only dirty cards are encoded again, all others are
+ * copied from the loaded file. The file is replaced atomically.
+ * \param file_name file name to write
+ * \param cards list of struct vcard_card
+ * \param file_etag pointer to entity tag of file when we read it, updated on success
+ */
+static void vcard_write_cards(const gchar *file_name, GList *cards, gchar **file_etag)
+{
+	GFile *file;
+	GFileOutputStream *stream;
+	GCancellable *cancellable;
+	GError *error = NULL;
+	GList *list;
+	gchar *etag;
+
+	file = g_file_new_for_path(file_name);
+
+	/* Never overwrite changes of somebody else, pending changes are written once the file monitor merged them */
+	etag = vcard_query_etag(file);
+	if (g_strcmp0(etag, *file_etag)) {
+		g_warning("%s(): %s has been modified meanwhile, not writing", __FUNCTION__, file_name);
+		g_free(etag);
+		g_object_unref(file);
+		return;
+	}
+	g_free(etag);
+
+	/* Data is written to a temporary file which replaces the original one on close */
+	cancellable = g_cancellable_new();
+	stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, &error);
+	if (!stream) {
+		g_warning("%s(): could not write file %s (%s)", __FUNCTION__, file_name, error ? error->message : "?");
+		g_clear_error(&error);
+		g_object_unref(cancellable);
+		g_object_unref(file);
+		return;
+	}
+
+	for (list = cards; list != NULL && !error; list = list->next) {
+		struct vcard_card *card = list->data;
+		gconstpointer data;
+		gsize len;
+
+		if (!card->key) {
+			/* Incomplete card */
+			continue;
 		}
 
-		/* Lets add the additional data */
-		for (list2 = entry; list2 != NULL && list2->data != NULL; list2 = list2->next) {
-			struct vcard_data *card_data = list2->data;
+		if (card->dirty || !card->raw) {
+			vcard_encode_card(card);
+		}
 
-			if (card_data->options != NULL) {
-				vcard_print(data, "%s;%s:%s\n", card_data->header, card_data->options, card_data->entry);
-			} else {
-				vcard_print(data, "%s:%s\n", card_data->header, card_data->entry);
-			}
+		data = g_bytes_get_data(card->raw, &len);
+		if (g_output_stream_write_all(G_OUTPUT_STREAM(stream), data, len, NULL, cancellable, &error) && len && ((const gchar*)data)[len - 1] != '\n') {
+			g_output_stream_write_all(G_OUTPUT_STREAM(stream), "\n", 1, NULL, cancellable, &error);
 		}
+	}
+
+	if (error) {
+		/* Keep original file */
+		g_cancellable_cancel(cancellable);
+		g_output_stream_close(G_OUTPUT_STREAM(stream), cancellable, NULL);
+	} else {
+		g_output_stream_close(G_OUTPUT_STREAM(stream), cancellable, &error);
+	}
+
+	if (error) {
+		g_warning("%s(): could not write file %s (%s)", __FUNCTION__, file_name, error->message);
+		g_clear_error(&error);
+	} else {
+		g_free(*file_etag);
+		*file_etag = g_strdup(g_file_output_stream_get_etag(stream));
+
+		vcard_removal_done(file_name);
+	}
+
+	g_object_unref(stream);
+	g_object_unref(cancellable);
+	g_object_unref(file);
+}
+
+/**
+ * \brief Write card file information
+ * \param file_name file name to write
+ */
+void vcard_write_file(char *file_name)
+{
+	vcard_write_cards(file_name, vcard_list, &vcard_etag);
+}
+
+/**
+ * \brief Write changes of directory file which have been refused before its external changes were merged
+ * \param file file structure
+ * \return TRUE if file has been removed as none of its cards is left
+ */
+static gboolean vcard_write_pending_file(struct vcard_file *file)
+{
+	if (!vcard_is_pending(file->file_name, file->cards)) {
+		return FALSE;
+	}
+
+	if (file->cards) {
+		vcard_write_cards(file->file_name, file->cards, &file->etag);
+		return FALSE;
+	}
+
+	if (g_remove(file->file_name)) {
+		g_warning("%s(): could not remove file %s", __FUNCTION__, file->file_name);
+		return FALSE;
+	}
+	vcard_removal_done(file->file_name);
+
+	return TRUE;
+}
+
+/**
+ * \brief Reload file containing card if somebody else modified it since we read it. Dirty cards
+ * are kept, all other changes of the file are merged in and emitted.
+ * \param card pointer to card structure
+ */
+static void vcard_sync_card(struct vcard_card *card)
+{
+	GFile *file;
+	gchar *name;
+	gchar *etag;
+	gboolean changed;
 
-		vcard_print(data, "END:VCARD\n\n");
+	name = card->file ? g_strdup(card->file->file_name) : g_settings_get_string(vcard_settings, "filename");
+
+	file = g_file_new_for_path(name);
+	etag = vcard_query_etag(file);
+	changed = g_strcmp0(etag, card->file ? card->file->etag : vcard_etag) != 0;
+	g_free(etag);
+	g_object_unref(file);
+
+	if (changed) {
+		g_debug("%s(): %s has been modified meanwhile, merging", __FUNCTION__, name);
+
+		if (card->file) {
+			vcard_reload_directory_file(name);
+		} else {
+			vcard_reload_source(name, FALSE, TRUE);
+		}
 	}
 
-	rm_file_save(file_name, data->str, data->len);
+	g_free(name);
+}
+
+/**
+ * \brief Write file containing card, either the card file or the card's own file in directory mode.
+ * External changes of the file are merged first.
+ * \param card pointer to card structure
+ */
+static void vcard_write_card(struct vcard_card *card)
+{
+	gchar *name;
+
+	vcard_sync_card(card);
 
-	g_string_free(data, TRUE);
+	if (card->file) {
+		vcard_write_cards(card->file->file_name, card->file->cards, &card->file->etag);
+		return;
+	}
+
+	name = g_settings_get_string(vcard_settings, "filename");
+	vcard_write_file(name);
+	g_free(name);
 }
 
 GSList *vcard_get_contacts(void)
@@ -1104,40 +1706,465 @@ GSList *vcard_get_contacts(void)
 	return contacts;
 }
 
+/**
+ * \brief Get configured contact source, the vcard directory if set or the vcard file otherwise
+ * \param directory pointer to store whether source is a directory
+ * \return file or directory name, free with g_free()
+ */
+static gchar *vcard_get_source(gboolean *directory)
+{
+	gchar *name = g_settings_get_string(vcard_settings, "directory");
+
+	if (!RM_EMPTY_STRING(name)) {
+		*directory = TRUE;
+		return name;
+	}
+
+	g_free(name);
+	*directory = FALSE;
+
+	return g_settings_get_string(vcard_settings, "filename");
+}
+
+/**
+ * \brief Free removed cards and their contacts
+ * \param cards list of struct vcard_card
+ */
+static void vcard_free_cards(GSList *cards)
+{
+	GSList *list;
+
+	for (list = cards; list != NULL; list = list->next) {
+		struct vcard_card *card = list->data;
+
+		vcard_contact_free(card->contact);
+		vcard_card_free(card);
+	}
+
+	g_slist_free(cards);
+}
+
+/**
+ * \brief Index freshly parsed cards and merge them with the cards they replace. Unchanged cards and
+ * the contacts of modified cards are kept, so that contact pointers stay valid.
+ * \param old_cards cards to be replaced, list is freed
+ * \param new_cards freshly parsed cards
+ * \param delta delta collecting the changes
+ * \param removed pointer to list of removed cards, free them after the delta has been emitted
+ * \return resulting list of cards
+ */
+static GList *vcard_merge_cards(GList *old_cards, GList *new_cards, ContactsDelta *delta, GSList **removed)
+{
+	GHashTable *old_keys;
+	GHashTableIter iter;
+	gpointer value;
+	GList *list;
+	GList *next;
+
+	/* Take previous cards out of the index */
+	old_keys = g_hash_table_new(g_str_hash, g_str_equal);
+	for (list = old_cards; list != NULL; list = list->next) {
+		struct vcard_card *card = list->data;
+
+		g_hash_table_remove(vcard_cards, card->key);
+		g_hash_table_insert(old_keys, card->key, card);
+	}
+	g_list_free(old_cards);
+
+	for (list = new_cards; list != NULL; list = next) {
+		struct vcard_card *card = list->data;
+		struct vcard_card *old_card;
+		struct vcard_data *photo;
+		RmContact *contact;
+		GStringChunk *strings;
+		GBytes *buffer;
+		GBytes *raw;
+		GArray *data;
+
+		next = list->next;
+
+		if (card->key && vcard_removal_is_pending(card->key)) {
+			/* Removed by us, but file has not been written yet */
+			new_cards = g_list_delete_link(new_cards, list);
+			vcard_contact_free(card->contact);
+			vcard_card_free(card);
+			continue;
+		}
+
+		vcard_card_index(card, card->key);
+
+		old_card = g_hash_table_lookup(old_keys, card->key);
+		if (!old_card) {
+			contacts_delta_added(delta, card->contact);
+			continue;
+		}
+
+		g_hash_table_remove(old_keys, card->key);
+
+		contact = card->contact;
+
+		if (old_card->hash == card->hash || old_card->dirty) {
+			/* Unchanged or not written yet, keep previous card and contact. A dirty card
+			 * is encoded on top of the current data, so our changes win over the file. */
+			g_hash_table_insert(vcard_cards, card->key, old_card);
+			g_free(old_card->key);
+			old_card->key = card->key;
+			card->key = NULL;
+			old_card->file = card->file;
+
+			/* Take over data of the current file, so that the previous buffer can go */
+			raw = old_card->raw;
+			old_card->raw = card->raw;
+			card->raw = raw;
+
+			data = old_card->data;
+			old_card->data = card->data;
+			card->data = data;
+
+			buffer = old_card->buffer;
+			old_card->buffer = card->buffer;
+			card->buffer = buffer;
+
+			strings = old_card->strings;
+			old_card->strings = card->strings;
+			card->strings = strings;
+
+			list->data = old_card;
+
+			vcard_contact_free(contact);
+			vcard_card_free(card);
+			continue;
+		}
+
+		/* Modified, keep contact pointer but update its content */
+		contacts_delta_add_numbers(delta, old_card->contact);
+		rm_contact_copy(contact, old_card->contact);
+		contact_image_clear(old_card->contact);
+
+		photo = find_card_data(card->data, "PHOTO", NULL);
+		if (photo) {
+			process_photo(photo, old_card->contact);
+		}
+
+		card->contact = old_card->contact;
+		contacts_delta_modified(delta, card->contact);
+
+		vcard_contact_free(contact);
+		vcard_card_free(old_card);
+	}
+
+	/* Whatever is left has been removed */
+	g_hash_table_iter_init(&iter, old_keys);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct vcard_card *card = value;
+
+		if (card->dirty) {
+			/* Not written yet, keep it */
+			vcard_card_index(card, card->key);
+			new_cards = g_list_append(new_cards, card);
+			continue;
+		}
+
+		contacts_delta_removed(delta, card->contact);
+		*removed = g_slist_prepend(*removed, card);
+	}
+
+	g_hash_table_destroy(old_keys);
+
+	return new_cards;
+}
+
+/**
+ * \brief Reload vcard file or directory and emit the differences to the previous state
+ * \param source file or directory name to read
+ * \param directory TRUE if source is a directory
+ * \param notify TRUE to emit the differences
+ */
+static void vcard_reload_source(const gchar *source, gboolean directory, gboolean notify)
+{
+	ContactListBuilder *builder;
+	ContactsDelta *delta;
+	GHashTableIter iter;
+	GHashTable *old_files;
+	gpointer value;
+	GSList *removed = NULL;
+	GList *cards;
+	GList *list;
+
+	/* Kept cards still point to the previous files until they are moved below */
+	old_files = vcard_files;
+	vcard_files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, vcard_file_free);
+
+	cards = directory ? vcard_load_directory(source) : vcard_load_file(source);
+
+	delta = contacts_delta_new();
+	vcard_list = vcard_merge_cards(vcard_list, cards, delta, &removed);
+
+	/* Files refer to the resulting cards */
+	g_hash_table_iter_init(&iter, vcard_files);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct vcard_file *file = value;
+
+		g_list_free(file->cards);
+		file->cards = NULL;
+	}
+
+	/* Rebuild sorted contact list from cards */
+	g_slist_free(contacts);
+	builder = contact_list_builder_new(g_list_length(vcard_list));
+	for (list = g_list_last(vcard_list); list != NULL; list = list->prev) {
+		struct vcard_card *card = list->data;
+
+		contact_list_builder_add(builder, card->contact);
+
+		if (card->file) {
+			/* Dirty cards kept by the merge may refer to a file which is gone */
+			card->file = directory ? vcard_get_file(card->file->file_name) : NULL;
+		}
+
+		if (card->file) {
+			card->file->cards = g_list_prepend(card->file->cards, card);
+		}
+	}
+	contacts = contact_list_builder_end(builder);
+
+	g_hash_table_destroy(old_files);
+
+	/* Write changes which have been refused as the file changed meanwhile */
+	if (directory) {
+		g_hash_table_iter_init(&iter, vcard_files);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			if (vcard_write_pending_file(value)) {
+				g_hash_table_iter_remove(&iter);
+			}
+		}
+	} else if (vcard_is_pending(source, vcard_list)) {
+		vcard_write_cards(source, vcard_list, &vcard_etag);
+	}
+
+	g_debug("%s(): %d added, %d modified, %d removed", __FUNCTION__,
+		g_slist_length(delta->added), g_slist_length(delta->modified), g_slist_length(delta->removed));
+
+	if (notify) {
+		contacts_delta_emit(delta);
+	} else {
+		contacts_delta_free(delta);
+	}
+
+	vcard_free_cards(removed);
+}
+
+/**
+ * \brief Reload a single file of the vcard directory and emit the differences
+ * \param file_name file name to read
+ */
+static void vcard_reload_directory_file(const gchar *file_name)
+{
+	struct vcard_file *file = g_hash_table_lookup(vcard_files, file_name);
+	ContactsDelta *delta;
+	GSList *removed = NULL;
+	GSList *slist;
+	GList *cards = NULL;
+	GList *list;
+	gchar *etag = NULL;
+
+	if (g_file_test(file_name, G_FILE_TEST_IS_REGULAR)) {
+		if (file && file->etag) {
+			GFile *tmp = g_file_new_for_path(file_name);
+			gboolean own;
+
+			etag = vcard_query_etag(tmp);
+			own = !g_strcmp0(etag, file->etag);
+			g_clear_pointer(&etag, g_free);
+			g_object_unref(tmp);
+
+			if (own) {
+				/* File is still what we loaded or wrote ourself */
+				return;
+			}
+		}
+
+		cards = vcard_parse_file(file_name, &etag);
+	} else if (!file) {
+		return;
+	}
+
+	file = vcard_get_file(file_name);
+
+	g_free(file->etag);
+	file->etag = etag;
+
+	for (list = cards; list != NULL; list = list->next) {
+		struct vcard_card *card = list->data;
+
+		card->file = file;
+	}
+
+	for (list = file->cards; list != NULL; list = list->next) {
+		vcard_list = g_list_remove(vcard_list, list->data);
+	}
+
+	delta = contacts_delta_new();
+	file->cards = vcard_merge_cards(file->cards, cards, delta, &removed);
+	vcard_list = g_list_concat(vcard_list, g_list_copy(file->cards));
+
+	/* Update sorted contact list */
+	for (slist = removed; slist != NULL; slist = slist->next) {
+		struct vcard_card *card = slist->data;
+
+		contacts = g_slist_remove(contacts, card->contact);
+	}
+
+	for (slist = delta->modified; slist != NULL; slist = slist->next) {
+		contacts = g_slist_remove(contacts, slist->data);
+		contacts = g_slist_insert_sorted(contacts, slist->data, contact_list_compare);
+	}
+
+	for (slist = delta->added; slist != NULL; slist = slist->next) {
+		contacts = g_slist_insert_sorted(contacts, slist->data, contact_list_compare);
+	}
+
+	/* Write changes which have been refused as the file changed meanwhile */
+	vcard_write_pending_file(file);
+
+	if (!file->cards) {
+		g_hash_table_remove(vcard_files, file_name);
+	}
+
+	contacts_delta_emit(delta);
+
+	vcard_free_cards(removed);
+}
+
 gboolean vcard_reload_contacts(void)
 {
+	gboolean directory;
 	gchar *name;
 
-	contacts = NULL;
-
-	name = g_settings_get_string(vcard_settings, "filename");
-	vcard_load_file(name);
+	name = vcard_get_source(&directory);
+	vcard_reload_source(name, directory, TRUE);
+	g_free(name);
 
 	return TRUE;
 }
 
 gboolean vcard_remove_contact(RmContact *contact)
 {
-	gchar *name;
+	struct vcard_card *card;
+	ContactsDelta *delta;
+	gchar *key;
+
+	card = vcard_find_card(contact);
+	if (!card) {
+		return FALSE;
+	}
+
+	/* Merge external changes first, card may be gone afterwards */
+	key = g_strdup(card->key);
+	vcard_sync_card(card);
+	card = g_hash_table_lookup(vcard_cards, key);
+	g_free(key);
+
+	if (!card) {
+		return TRUE;
+	}
 
 	contacts = g_slist_remove(contacts, contact);
+	vcard_list = g_list_remove(vcard_list, card);
+	g_hash_table_remove(vcard_cards, card->key);
 
-	name = g_settings_get_string(vcard_settings, "filename");
-	vcard_write_file(name);
+	if (card->file) {
+		card->file->cards = g_list_remove(card->file->cards, card);
+	}
+
+	if (card->file && !card->file->cards) {
+		/* Last card of file is gone, so is the file */
+		if (g_remove(card->file->file_name)) {
+			g_warning("%s(): could not remove file %s", __FUNCTION__, card->file->file_name);
+		}
+		g_hash_table_remove(vcard_files, card->file->file_name);
+	} else {
+		gchar *file_name = card->file ? g_strdup(card->file->file_name) : g_settings_get_string(vcard_settings, "filename");
+
+		/* Card stays in the file until it could be written */
+		vcard_removal_add(card->key, file_name);
+		vcard_write_card(card);
+		g_free(file_name);
+	}
+
+	delta = contacts_delta_new();
+	contacts_delta_removed(delta, contact);
+	contacts_delta_emit(delta);
+
+	vcard_contact_free(contact);
+	vcard_card_free(card);
 
 	return TRUE;
 }
 
 gboolean vcard_save_contact(RmContact *contact)
 {
-	gchar *name;
+	struct vcard_card *card;
+	ContactsDelta *delta;
 
-	if (!contact->priv) {
-		contacts = g_slist_insert_sorted(contacts, contact, rm_contact_name_compare);
+	delta = contacts_delta_new();
+
+	card = vcard_find_card(contact);
+	if (!card) {
+		gboolean directory;
+		gchar *source;
+		GString *uid;
+
+		/* Caller keeps ownership of new contacts, store a copy */
+		contact = rm_contact_dup(contact);
+
+		uid = vcard_create_uid();
+		contact->priv = g_string_free(uid, FALSE);
+
+		card = vcard_card_new();
+		vcard_card_append(card, "UID", NULL, contact->priv);
+		card->contact = contact;
+		vcard_card_index(card, contact->priv);
+		vcard_list = g_list_append(vcard_list, card);
+
+		source = vcard_get_source(&directory);
+		if (directory) {
+			/* One file per new contact */
+			gchar *name = g_strdup_printf("%s.vcf", contact->priv);
+			gchar *file_name = g_build_filename(source, name, NULL);
+
+			card->file = vcard_get_file(file_name);
+			card->file->cards = g_list_append(card->file->cards, card);
+
+			g_free(file_name);
+			g_free(name);
+		}
+		g_free(source);
+
+		contacts = g_slist_insert_sorted(contacts, contact, contact_list_compare);
+		contacts_delta_added(delta, contact);
+	} else {
+		guint index;
+
+		/* Card still holds the numbers from before the change */
+		for (index = 0; index < card->data->len; index++) {
+			struct vcard_data *card_data = &g_array_index(card->data, struct vcard_data, index);
+
+			if (!strcasecmp(card_data->header, "TEL") && !RM_EMPTY_STRING(card_data->entry)) {
+				g_hash_table_add(delta->numbers, rm_number_full(card_data->entry, FALSE));
+			}
+		}
+
+		/* Name may have changed */
+		contacts = g_slist_remove(contacts, contact);
+		contacts = g_slist_insert_sorted(contacts, contact, contact_list_compare);
+		contacts_delta_modified(delta, contact);
 	}
 
-	name = g_settings_get_string(vcard_settings, "filename");
-	vcard_write_file(name);
+	card->dirty = TRUE;
+	vcard_write_card(card);
+
+	contacts_delta_emit(delta);
 
 	return TRUE;
 }
@@ -1150,11 +2177,13 @@ gchar *vcard_get_active_book_name(void)
 gchar **vcard_get_sub_books(void)
 {
 	gchar **ret = NULL;
-	gchar *name = g_settings_get_string(vcard_settings, "filename");
+	gboolean directory;
+	gchar *name = vcard_get_source(&directory);
 
 	if (name) {
 		ret = rm_strv_add(ret, name);
 	}
+	g_free(name);
 
 	return ret;
 }
@@ -1177,17 +2206,24 @@ RmAddressBook vcard_book = {
 
 gboolean vcard_plugin_init(RmPlugin *plugin)
 {
+	gboolean directory;
 	gchar *name;
 
 	vcard_settings = rm_settings_new("org.tabos.roger.plugins.vcard");
+	vcard_cards = g_hash_table_new(g_str_hash, g_str_equal);
+	vcard_files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, vcard_file_free);
 
 	name = g_settings_get_string(vcard_settings, "filename");
 	if (RM_EMPTY_STRING(name)) {
+		g_free(name);
 		name = g_build_filename(g_get_user_data_dir(), "roger", "ab.vcf", NULL);
 		g_settings_set_string(vcard_settings, "filename", name);
 	}
+	g_free(name);
 
-	vcard_load_file(name);
+	name = vcard_get_source(&directory);
+	vcard_reload_source(name, directory, FALSE);
+	g_free(name);
 
 	rm_addressbook_register(&vcard_book);
 
@@ -1216,8 +2252,7 @@ void filename_button_clicked_cb(GtkButton *button, gpointer user_data)
 		gchar *folder = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
 
 		gtk_entry_set_text(GTK_ENTRY(user_data), folder);
-		contacts = NULL;
-		vcard_load_file(folder);
+		vcard_reload_source(folder, FALSE, TRUE);
 
 		g_free(folder);
 	}
@@ -1233,11 +2268,25 @@ void vcard_file_chooser_button_file_set_cb(GtkWidget *button, gpointer user_data
 	g_settings_set_string(vcard_settings, "filename", file);
 }
 
+void vcard_directory_chooser_button_file_set_cb(GtkWidget *button, gpointer user_data)
+{
+	gchar *directory = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(button));
+
+	g_debug("%s(): Setting '%s'", __FUNCTION__, directory);
+	g_settings_set_string(vcard_settings, "directory", directory);
+	g_free(directory);
+
+	vcard_reload_contacts();
+}
+
 gpointer vcard_plugin_configure(RmPlugin *plugin)
 {
 	GtkWidget *grid = gtk_grid_new();
 	GtkWidget *group;
 	GtkWidget *vcard_label;
+	GtkWidget *directory_label;
+	GtkWidget *directory_button;
+	gchar *directory;
 
 	/* Set standard spacing to 5 */
 	gtk_grid_set_row_spacing(GTK_GRID(grid), 5);
@@ -1256,6 +2305,20 @@ gpointer vcard_plugin_configure(RmPlugin *plugin)
 
 	gtk_grid_attach(GTK_GRID(grid), vcard_button, 1, 1, 1, 1);
 
+	/* Directory with one card per file, preferred over the vcard file if set */
+	directory_label = ui_label_new(_("VCard directory"));
+	gtk_grid_attach(GTK_GRID(grid), directory_label, 0, 2, 1, 1);
+
+	directory_button = gtk_file_chooser_button_new(_("Select vcard directory"), GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+	directory = g_settings_get_string(vcard_settings, "directory");
+	if (!RM_EMPTY_STRING(directory)) {
+		gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(directory_button), directory);
+	}
+	g_free(directory);
+	g_signal_connect(directory_button, "file-set", G_CALLBACK(vcard_directory_chooser_button_file_set_cb), NULL);
+
+	gtk_grid_attach(GTK_GRID(grid), directory_button, 1, 2, 1, 1);
+
 	group = ui_group_create(grid, _("Contact book"), TRUE, FALSE);
 
 	return group;
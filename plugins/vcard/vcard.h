@@ -22,27 +22,85 @@
 
 G_BEGIN_DECLS
 
-/** States in parser */
-enum {
-	STATE_NEW = 0,
-	STATE_TAG,
-	STATE_OPTIONS,
-	STATE_ENTRY
-};
-
+/**
+ * struct vcard_data:
+ * @header: property name
+ * @options: property parameters or %NULL
+ * @entry: property value
+ *
+ * Strings are not owned, they point into the file buffer or the string chunk of the card.
+ */
 struct vcard_data {
-	gint state;
 	gchar *header;
 	gchar *options;
 	gchar *entry;
 };
 
-struct vcard {
-	GSList *data;
+/**
+ * struct vcard_card:
+ * @key: UID of card, or content hash based key for cards without UID
+ * @hash: content hash of all properties except BEGIN, VERSION and END
+ * @data: array of struct vcard_data
+ * @buffer: copy of file data the properties point into, or %NULL
+ * @strings: storage for properties added or modified after parsing, or %NULL
+ * @contact: contact built from this card
+ * @raw: encoded card as found in the file, written back as long as the card is not dirty
+ * @dirty: card has been modified and needs to be encoded again
+ * @file: file containing this card in directory mode, %NULL otherwise
+ */
+struct vcard_card {
+	gchar *key;
+	guint hash;
+	GArray *data;
+	GBytes *buffer;
+	GStringChunk *strings;
+	RmContact *contact;
+	GBytes *raw;
+	gboolean dirty;
+	struct vcard_file *file;
+};
+
+/**
+ * struct vcard_file:
+ * @file_name: full path of vcard file
+ * @etag: entity tag of file when it has been read or written by us
+ * @cards: list of struct vcard_card stored in this file
+ */
+struct vcard_file {
+	gchar *file_name;
+	gchar *etag;
+	GList *cards;
+};
+
+/**
+ * struct vcard_parser:
+ * @cards: list of complete struct vcard_card, in reverse order
+ * @card: card currently parsed
+ * @card_offset: file offset of current card
+ * @buffer: copy of file data, unfolded lines are split in place and referenced by the cards
+ * @raw: untouched file data, cards keep slices of it
+ * @copy: current line is a temporary copy, its properties need to be copied into the card
+ * @first_name: first name of current card
+ * @last_name: last name of current card
+ * @company: company of current card
+ * @title: title of current card
+ *
+ * Parser state, one per file so that files can be parsed in parallel
+ */
+struct vcard_parser {
+	GList *cards;
+	struct vcard_card *card;
+	gsize card_offset;
+	GBytes *buffer;
+	GBytes *raw;
+	gboolean copy;
+	GString *first_name;
+	GString *last_name;
+	GString *company;
+	GString *title;
 };
 
 GString *vcard_create_uid(void);
-void vcard_load_file(gchar *file_name);
 void vcard_write_file(gchar *file_name);
 
 G_END_DECLS
@@ -0,0 +1,166 @@
+/*
+ * Roger Router - web journal viewer
+ *
+ * The journal is split into one data file per month. index.js lists them together with
+ * their number of entries, so the complete table height is known up front. Only rows
+ * within the visible area are created, data files are loaded when their rows come
+ * into view. Data files are plain scripts, so the journal can also be opened as local file.
+ */
+var rogerJournal = (function () {
+	var ROW_HEIGHT = 35;
+	var OVERSCAN = 20;
+	var dataDir = '';
+	var index = [];
+	var offsets = [];
+	var total = 0;
+	var chunks = {};
+	var loading = {};
+	var pending = false;
+	var viewport, spacer, rows, body;
+
+	function loadScript(src) {
+		var script = document.createElement('script');
+
+		script.src = src;
+		document.head.appendChild(script);
+	}
+
+	function findChunk(row) {
+		var low = 0;
+		var high = offsets.length - 1;
+
+		while (low < high) {
+			var mid = (low + high + 1) >> 1;
+
+			if (offsets[mid] <= row) {
+				low = mid;
+			} else {
+				high = mid - 1;
+			}
+		}
+
+		return low;
+	}
+
+	function loadChunk(i) {
+		var chunk = index[i];
+
+		if (chunks[chunk.id] || loading[chunk.id]) {
+			return;
+		}
+
+		loading[chunk.id] = true;
+		loadScript(dataDir + '/' + chunk.file);
+	}
+
+	function addCell(tr, text, className) {
+		var td = document.createElement('td');
+
+		if (className) {
+			td.className = className;
+		}
+		td.textContent = text || '';
+		tr.appendChild(td);
+
+		return td;
+	}
+
+	function render() {
+		var first, last, row, fragment;
+
+		pending = false;
+		if (!viewport) {
+			return;
+		}
+
+		first = Math.max(0, Math.floor(viewport.scrollTop / ROW_HEIGHT) - OVERSCAN);
+		/* Keep row striping stable while scrolling */
+		first -= first % 2;
+		last = Math.min(total, Math.ceil((viewport.scrollTop + viewport.clientHeight) / ROW_HEIGHT) + OVERSCAN);
+
+		fragment = document.createDocumentFragment();
+		for (row = first; row < last; row++) {
+			var i = findChunk(row);
+			var data = chunks[index[i].id];
+			var tr = document.createElement('tr');
+
+			tr.style.height = ROW_HEIGHT + 'px';
+
+			if (!data) {
+				loadChunk(i);
+				addCell(tr, '…').colSpan = 9;
+			} else {
+				var entry = data[row - offsets[i]];
+				var link = document.createElement('a');
+
+				addCell(tr, '', entry[0]);
+				addCell(tr, entry[1]);
+				addCell(tr, entry[2]);
+				addCell(tr, entry[3]);
+				link.href = 'tel:' + entry[4];
+				link.textContent = entry[4];
+				addCell(tr, '').appendChild(link);
+				addCell(tr, entry[5]);
+				addCell(tr, entry[6]);
+				addCell(tr, entry[7]);
+				addCell(tr, entry[8]);
+			}
+
+			fragment.appendChild(tr);
+		}
+
+		rows.style.transform = 'translateY(' + (first * ROW_HEIGHT) + 'px)';
+		body.textContent = '';
+		body.appendChild(fragment);
+	}
+
+	function update() {
+		if (!pending) {
+			pending = true;
+			window.requestAnimationFrame(render);
+		}
+	}
+
+	function setIndex(list) {
+		var i;
+
+		index = list;
+		offsets = [];
+		total = 0;
+
+		for (i = 0; i < index.length; i++) {
+			offsets.push(total);
+			total += index[i].count;
+		}
+
+		spacer.style.height = (total * ROW_HEIGHT) + 'px';
+		update();
+	}
+
+	function addChunk(id, data) {
+		chunks[id] = data;
+		delete loading[id];
+		update();
+	}
+
+	function init() {
+		viewport = document.getElementById('viewport');
+		spacer = document.getElementById('spacer');
+		rows = document.getElementById('rows');
+		body = document.getElementById('body');
+		dataDir = viewport.getAttribute('data-dir');
+
+		viewport.addEventListener('scroll', update);
+		window.addEventListener('resize', update);
+
+		/* Index changes with every journal update, bypass cache */
+		loadScript(dataDir + '/index.js?' + Date.now());
+	}
+
+	document.addEventListener('DOMContentLoaded', init);
+
+	return {
+		setIndex: setIndex,
+		addChunk: addChunk
+	};
+})();
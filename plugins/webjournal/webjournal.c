@@ -23,6 +23,7 @@
 #include <stdio.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 
 #include <rm/rm.h>
@@ -33,26 +34,114 @@
 
 #include <webjournal.h>
 
+/**
+ * WebJournalField:
+ *
+ * Placeholders of entry template, written as %NAME% in the template
+ */
+typedef enum {
+	WEBJOURNAL_FIELD_TYPE,
+	WEBJOURNAL_FIELD_DATETIME,
+	WEBJOURNAL_FIELD_NAME,
+	WEBJOURNAL_FIELD_COMPANY,
+	WEBJOURNAL_FIELD_NUMBER,
+	WEBJOURNAL_FIELD_CITY,
+	WEBJOURNAL_FIELD_EXTENSION,
+	WEBJOURNAL_FIELD_LINE,
+	WEBJOURNAL_FIELD_DURATION,
+	WEBJOURNAL_FIELD_CUSTOMKEY,
+	WEBJOURNAL_FIELD_MAX
+} WebJournalField;
+
+static const gchar *webjournal_field_names[WEBJOURNAL_FIELD_MAX] = {
+	"TYPE",
+	"DATETIME",
+	"NAME",
+	"COMPANY",
+	"NUMBER",
+	"CITY",
+	"EXTENSION",
+	"LINE",
+	"DURATION",
+	"CUSTOMKEY"
+};
+
+/**
+ * WebJournalSegment:
+ * @text: literal text, points into template source
+ * @len: length of @text
+ * @field: placeholder following @text or -1
+ */
+typedef struct {
+	const gchar *text;
+	gsize len;
+	gint field;
+} WebJournalSegment;
+
+/**
+ * WebJournalTemplate:
+ * @source: template source
+ * @segments: array of #WebJournalSegment
+ * @size: length of all literal segments, used to estimate the output size
+ */
+typedef struct {
+	gchar *source;
+	GArray *segments;
+	gsize size;
+} WebJournalTemplate;
+
+/**
+ * WebJournalRow:
+ * @values: field values, indexed by #WebJournalField
+ *
+ * Snapshot of a call entry, the journal is written by a worker thread
+ */
+typedef struct {
+	gchar *values[WEBJOURNAL_FIELD_MAX];
+} WebJournalRow;
+
 typedef struct {
 	/*< private >*/
 	guint signal_id;
 	gchar *header;
 	gchar *entry;
+	WebJournalTemplate *entry_template;
 	gchar *footer;
 	gchar *dragtable;
 	gchar *sortable;
 	gchar *styling;
+	gchar *shell;
+	gchar *viewer;
+	/* Checksums of written files, only used by the worker */
+	GHashTable *checksums;
+	gboolean busy;
+	gboolean shutdown;
+	struct webjournal_job *pending;
 } RmWebJournalPlugin;
 
+/**
+ * webjournal_job:
+ * @plugin: a #RmWebJournalPlugin
+ * @file: html file name
+ * @paged: %TRUE to write paged journal
+ * @rows: array of #WebJournalRow
+ */
+struct webjournal_job {
+	RmWebJournalPlugin *plugin;
+	gchar *file;
+	gboolean paged;
+	GArray *rows;
+};
+
 static GSettings *webjournal_settings = NULL;
 
 /**
  * webjournal_get_call_type_string:
  * @type: a #RmCallEntryTypes
  *
- * Returns: call type string, must be freed with g_free()
+ * Returns: call type string
  */
-gchar *webjournal_get_call_type_string(RmCallEntryTypes type)
+const gchar *webjournal_get_call_type_string(RmCallEntryTypes type)
 {
 	switch (type) {
 	case RM_CALL_ENTRY_TYPE_INCOMING:
@@ -79,116 +168,687 @@ gchar *webjournal_get_call_type_string(RmCallEntryTypes type)
 /**
  * webjournal_convert_data_time:
  * @date_time: date time string
+ * @key: output buffer of at least 15 bytes
  *
  * Converts "%d.%dm.%y %h:%m" to "2yyymmddhhmmm"
- *
- * Returns: new date time string
  */
-static gchar *webjournal_convert_date_time(gchar *date_time)
+static void webjournal_convert_date_time(const gchar *date_time, gchar *key)
 {
-	gint year;
-	gint month;
-	gint day;
-	gint hour;
-	gint min;
+	gint year = 0;
+	gint month = 0;
+	gint day = 0;
+	gint hour = 0;
+	gint min = 0;
 
 	sscanf(date_time, "%d.%d.%d %d:%d", &day, &month, &year, &hour, &min);
 
-	return g_strdup_printf("%4.4d%2.2d%2.2d%2.2d%2.2d00", 2000 + year, month, day, hour, min);
+	g_snprintf(key, 15, "%4.4d%2.2d%2.2d%2.2d%2.2d00", 2000 + year, month, day, hour, min);
 }
 
 /**
- * webjournal_journal_loaded_cb:
- * @obj: a #RmObject
- * @journal journal list
- * @user_data: a #RmWebJournalPlugin
+ * webjournal_template_compile:
+ * @source: template source
  *
- * Processes a new loaded journal and create web journal
+ * Splits template into literal segments and placeholder slots. Unknown placeholders are kept as text.
+ *
+ * Returns: new #WebJournalTemplate
  */
-void webjournal_journal_loaded_cb(RmObject *obj, GSList *journal, gpointer user_data)
+static WebJournalTemplate *webjournal_template_compile(const gchar *source)
 {
-	RmWebJournalPlugin *webjournal_plugin = user_data;
+	WebJournalTemplate *template = g_slice_new0(WebJournalTemplate);
+	WebJournalSegment segment;
+	const gchar *start;
+	const gchar *pos;
+
+	template->source = g_strdup(source ? source : "");
+	template->segments = g_array_new(FALSE, FALSE, sizeof(WebJournalSegment));
+
+	start = pos = template->source;
+	while ((pos = strchr(pos, '%')) != NULL) {
+		const gchar *end = strchr(pos + 1, '%');
+		gint field = -1;
+		gint index;
+
+		if (end == NULL) {
+			break;
+		}
+
+		for (index = 0; index < WEBJOURNAL_FIELD_MAX; index++) {
+			gsize len = strlen(webjournal_field_names[index]);
+
+			if ((gsize)(end - pos - 1) == len && !strncmp(pos + 1, webjournal_field_names[index], len)) {
+				field = index;
+				break;
+			}
+		}
+
+		if (field == -1) {
+			/* Not a placeholder, closing '%' may open the next one */
+			pos = end;
+			continue;
+		}
+
+		segment.text = start;
+		segment.len = pos - start;
+		segment.field = field;
+		g_array_append_val(template->segments, segment);
+		template->size += segment.len;
+
+		start = pos = end + 1;
+	}
+
+	segment.text = start;
+	segment.len = strlen(start);
+	segment.field = -1;
+	g_array_append_val(template->segments, segment);
+	template->size += segment.len;
+
+	return template;
+}
+
+/**
+ * webjournal_template_free:
+ * @template: a #WebJournalTemplate
+ *
+ * Free compiled template
+ */
+static void webjournal_template_free(WebJournalTemplate *template)
+{
+	if (!template) {
+		return;
+	}
+
+	g_array_free(template->segments, TRUE);
+	g_free(template->source);
+	g_slice_free(WebJournalTemplate, template);
+}
+
+/**
+ * webjournal_append_escaped:
+ * @string: output buffer
+ * @text: text to append or %NULL
+ *
+ * Append text with HTML special characters escaped
+ */
+static void webjournal_append_escaped(GString *string, const gchar *text)
+{
+	const gchar *start;
+
+	if (!text) {
+		return;
+	}
+
+	for (start = text; *text; text++) {
+		const gchar *entity;
+
+		switch (*text) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		case '"':
+			entity = "&quot;";
+			break;
+		case '\'':
+			entity = "&#39;";
+			break;
+		default:
+			continue;
+		}
+
+		g_string_append_len(string, start, text - start);
+		g_string_append(string, entity);
+		start = text + 1;
+	}
+
+	g_string_append_len(string, start, text - start);
+}
+
+/**
+ * webjournal_template_render:
+ * @template: a #WebJournalTemplate
+ * @string: output buffer
+ * @row: a #WebJournalRow
+ *
+ * Append row rendered with template to output buffer
+ */
+static void webjournal_template_render(WebJournalTemplate *template, GString *string, WebJournalRow *row)
+{
+	gchar customkey[15];
+	guint index;
+
+	for (index = 0; index < template->segments->len; index++) {
+		WebJournalSegment *segment = &g_array_index(template->segments, WebJournalSegment, index);
+
+		g_string_append_len(string, segment->text, segment->len);
+
+		if (segment->field == WEBJOURNAL_FIELD_CUSTOMKEY) {
+			webjournal_convert_date_time(row->values[WEBJOURNAL_FIELD_DATETIME], customkey);
+			webjournal_append_escaped(string, customkey);
+		} else if (segment->field != -1) {
+			webjournal_append_escaped(string, row->values[segment->field]);
+		}
+	}
+}
+
+/**
+ * WebJournalChunk:
+ * @rows: JSON rows of chunk
+ * @count: number of rows
+ */
+typedef struct {
+	GString *rows;
+	guint count;
+} WebJournalChunk;
+
+static void webjournal_chunk_free(gpointer data)
+{
+	WebJournalChunk *chunk = data;
+
+	g_string_free(chunk->rows, TRUE);
+	g_slice_free(WebJournalChunk, chunk);
+}
+
+/**
+ * webjournal_append_json:
+ * @string: output buffer
+ * @text: text to append or %NULL
+ *
+ * Append text as JSON string. '<' is escaped as well, as data files are loaded as scripts.
+ */
+static void webjournal_append_json(GString *string, const gchar *text)
+{
+	const gchar *start;
+
+	g_string_append_c(string, '"');
+
+	if (!text) {
+		g_string_append_c(string, '"');
+		return;
+	}
+
+	for (start = text; *text; text++) {
+		guchar c = *text;
+
+		if (c != '"' && c != '\\' && c != '<' && c >= 0x20) {
+			continue;
+		}
+
+		g_string_append_len(string, start, text - start);
+		if (c == '"' || c == '\\') {
+			g_string_append_c(string, '\\');
+			g_string_append_c(string, c);
+		} else {
+			g_string_append_printf(string, "\\u%04x", c);
+		}
+		start = text + 1;
+	}
+
+	g_string_append_len(string, start, text - start);
+	g_string_append_c(string, '"');
+}
+
+/**
+ * webjournal_get_month:
+ * @date_time: date time string
+ * @month: output buffer of at least 8 bytes
+ *
+ * Converts "%d.%dm.%y %h:%m" to "2yyy-mm"
+ */
+static void webjournal_get_month(const gchar *date_time, gchar *month)
+{
+	gint year = 0;
+	gint mon = 0;
+	gint day = 0;
+
+	sscanf(date_time, "%d.%d.%d", &day, &mon, &year);
+
+	g_snprintf(month, 8, "%4.4d-%2.2d", 2000 + year, mon);
+}
+
+/**
+ * webjournal_save:
+ * @webjournal_plugin: a #RmWebJournalPlugin
+ * @file: file name
+ * @data: file content
+ * @len: length of @data
+ *
+ * Write file atomically unless it already has the given content. Checksums of written files are
+ * remembered, so the file only needs to be read back the first time.
+ */
+static void webjournal_save(RmWebJournalPlugin *webjournal_plugin, const gchar *file, const gchar *data, gsize len)
+{
+	gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*)data, len);
+	const gchar *old = g_hash_table_lookup(webjournal_plugin->checksums, file);
+	gchar *old_data = NULL;
+	gsize old_len = 0;
+	GError *error = NULL;
+	gchar *dirname;
+
+	if (!old && g_file_get_contents(file, &old_data, &old_len, NULL)) {
+		gchar *old_checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*)old_data, old_len);
+
+		g_hash_table_insert(webjournal_plugin->checksums, g_strdup(file), old_checksum);
+		old = old_checksum;
+		g_free(old_data);
+	}
+
+	/* Unchanged, unless somebody removed the file meanwhile */
+	if (!g_strcmp0(old, checksum) && g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+		g_free(checksum);
+		return;
+	}
+
+	dirname = g_path_get_dirname(file);
+	g_mkdir_with_parents(dirname, 0755);
+	g_free(dirname);
+
+	/* Written to a temporary file and renamed, readers never see a partial file */
+	if (!g_file_set_contents(file, data, len, &error)) {
+		g_warning("%s(): Could not write '%s': %s", __FUNCTION__, file, error->message);
+		g_error_free(error);
+		g_hash_table_remove(webjournal_plugin->checksums, file);
+		g_free(checksum);
+		return;
+	}
+
+	g_hash_table_insert(webjournal_plugin->checksums, g_strdup(file), checksum);
+}
+
+/**
+ * webjournal_write_assets:
+ * @webjournal_plugin: a #RmWebJournalPlugin
+ * @dirname: output directory
+ *
+ * Write scripts and style sheet, once per plugin version. A version file in the output
+ * directory records which version they belong to, missing files are written again.
+ */
+static void webjournal_write_assets(RmWebJournalPlugin *webjournal_plugin, const gchar *dirname)
+{
+	const gchar *names[] = { "dragtable.js", "sortable.js", "styling.css", "journal.js" };
+	const gchar *contents[] = { webjournal_plugin->dragtable, webjournal_plugin->sortable, webjournal_plugin->styling, webjournal_plugin->viewer };
+	gchar *marker = g_build_filename(dirname, ".webjournal-version", NULL);
+	gchar *version = NULL;
+	gboolean current;
 	gchar *file;
-	GString *string;
-	GSList *list;
+	gint index;
+
+	current = g_file_get_contents(marker, &version, NULL, NULL) && !strcmp(version, PACKAGE_VERSION);
+
+	for (index = 0; index < G_N_ELEMENTS(names); index++) {
+		file = g_build_filename(dirname, names[index], NULL);
+		if (!current || !g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+			webjournal_save(webjournal_plugin, file, contents[index], strlen(contents[index]));
+		}
+		g_free(file);
+	}
+
+	if (!current) {
+		webjournal_save(webjournal_plugin, marker, PACKAGE_VERSION, strlen(PACKAGE_VERSION));
+	}
+
+	g_free(version);
+	g_free(marker);
+}
+
+static gint webjournal_month_compare(gconstpointer a, gconstpointer b)
+{
+	/* Newest month first */
+	return strcmp(b, a);
+}
+
+/**
+ * webjournal_write_paged:
+ * @job: a #webjournal_job
+ *
+ * Write journal as small HTML page and one data file per month next to it. Data file names
+ * contain a hash of their content, so unchanged months are neither written nor reloaded by browsers.
+ */
+static void webjournal_write_paged(struct webjournal_job *job)
+{
+	RmWebJournalPlugin *webjournal_plugin = job->plugin;
+	const gchar *file = job->file;
+	GHashTable *chunks;
+	GHashTable *wanted;
+	GString *index;
+	GString *shell;
+	GList *months;
+	GList *iter;
+	GDir *dir;
 	gchar *dirname;
+	gchar *base;
+	gchar *data_name;
+	gchar *data_dir;
+	gchar *tmp;
+	gchar **split;
+	const gchar *name;
+	gint part;
+	guint index;
 
-	file = g_settings_get_string(webjournal_settings, "filename");
+	dirname = g_path_get_dirname(file);
+	base = g_path_get_basename(file);
+	tmp = strrchr(base, '.');
+	if (tmp) {
+		*tmp = '\0';
+	}
+	data_name = g_strconcat(base, "-data", NULL);
+	data_dir = g_build_filename(dirname, data_name, NULL);
+	g_mkdir_with_parents(data_dir, 0755);
+
+	/* Group entries by month */
+	chunks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, webjournal_chunk_free);
+
+	for (index = 0; index < job->rows->len; index++) {
+		WebJournalRow *row = &g_array_index(job->rows, WebJournalRow, index);
+		WebJournalChunk *chunk;
+		gchar month[8];
+		gint field;
+
+		webjournal_get_month(row->values[WEBJOURNAL_FIELD_DATETIME], month);
+		chunk = g_hash_table_lookup(chunks, month);
+		if (!chunk) {
+			chunk = g_slice_new0(WebJournalChunk);
+			chunk->rows = g_string_sized_new(4096);
+			g_hash_table_insert(chunks, g_strdup(month), chunk);
+		}
+
+		g_string_append(chunk->rows, chunk->count ? ",\n[" : "[");
+		for (field = WEBJOURNAL_FIELD_TYPE; field <= WEBJOURNAL_FIELD_DURATION; field++) {
+			if (field != WEBJOURNAL_FIELD_TYPE) {
+				g_string_append_c(chunk->rows, ',');
+			}
+			webjournal_append_json(chunk->rows, row->values[field]);
+		}
+		g_string_append_c(chunk->rows, ']');
+		chunk->count++;
+	}
 
-	string = g_string_new(webjournal_plugin->header);
+	/* Write changed months and index */
+	wanted = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	index = g_string_new("rogerJournal.setIndex([");
+	months = g_list_sort(g_hash_table_get_keys(chunks), webjournal_month_compare);
+
+	for (iter = months; iter != NULL; iter = iter->next) {
+		WebJournalChunk *chunk = g_hash_table_lookup(chunks, iter->data);
+		GString *content = g_string_sized_new(chunk->rows->len + 64);
+		gchar *checksum;
+		gchar *chunk_name;
+		gchar *chunk_file;
+
+		g_string_append(content, "rogerJournal.addChunk(");
+		webjournal_append_json(content, iter->data);
+		g_string_append(content, ", [\n");
+		g_string_append_len(content, chunk->rows->str, chunk->rows->len);
+		g_string_append(content, "\n]);\n");
+
+		checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar*)content->str, content->len);
+		chunk_name = g_strdup_printf("%s-%.12s.js", (gchar*)iter->data, checksum);
+		chunk_file = g_build_filename(data_dir, chunk_name, NULL);
+
+		/* Name contains checksum, an existing file is up to date */
+		if (!g_file_test(chunk_file, G_FILE_TEST_EXISTS)) {
+			webjournal_save(webjournal_plugin, chunk_file, content->str, content->len);
+		}
+
+		g_string_append(index, iter != months ? ",\n{\"id\":" : "\n{\"id\":");
+		webjournal_append_json(index, iter->data);
+		g_string_append_printf(index, ",\"count\":%u,\"file\":", chunk->count);
+		webjournal_append_json(index, chunk_name);
+		g_string_append_c(index, '}');
+
+		g_hash_table_add(wanted, chunk_name);
+
+		g_free(chunk_file);
+		g_free(checksum);
+		g_string_free(content, TRUE);
+	}
+	g_string_append(index, "\n]);\n");
+
+	tmp = g_build_filename(data_dir, "index.js", NULL);
+	webjournal_save(webjournal_plugin, tmp, index->str, index->len);
+	g_free(tmp);
+
+	/* Remove data files of previous versions */
+	dir = g_dir_open(data_dir, 0, NULL);
+	while (dir && (name = g_dir_read_name(dir)) != NULL) {
+		if (g_str_has_suffix(name, ".js") && strcmp(name, "index.js") && !g_hash_table_contains(wanted, name)) {
+			tmp = g_build_filename(data_dir, name, NULL);
+			g_hash_table_remove(webjournal_plugin->checksums, tmp);
+			g_remove(tmp);
+			g_free(tmp);
+		}
+	}
+	if (dir) {
+		g_dir_close(dir);
+	}
 
-	for (list = journal; list != NULL; list = list->next) {
-		RmCallEntry *call = list->data;
-		GRegex *type = g_regex_new("%TYPE%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *date_time = g_regex_new("%DATETIME%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *name = g_regex_new("%NAME%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *company = g_regex_new("%COMPANY%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *number = g_regex_new("%NUMBER%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *city = g_regex_new("%CITY%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *extension = g_regex_new("%EXTENSION%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *line = g_regex_new("%LINE%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *duration = g_regex_new("%DURATION%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		GRegex *sortable_customkey = g_regex_new("%CUSTOMKEY%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-		gchar *out1;
-		gchar *out2;
-		gchar *customkey = webjournal_convert_date_time(call->date_time);
-
-		out1 = g_regex_replace_literal(type, webjournal_plugin->entry, -1, 0, webjournal_get_call_type_string(call->type), 0, NULL);
-
-		out2 = g_regex_replace_literal(date_time, out1, -1, 0, call->date_time, 0, NULL);
-		g_free(out1);
-		out1 = g_regex_replace_literal(name, out2, -1, 0, call->remote->name, 0, NULL);
-		g_free(out2);
-		out2 = g_regex_replace_literal(company, out1, -1, 0, call->remote->company ? call->remote->company : "", 0, NULL);
-		g_free(out1);
-		out1 = g_regex_replace_literal(number, out2, -1, 0, call->remote->number, 0, NULL);
-		g_free(out2);
-		out2 = g_regex_replace_literal(city, out1, -1, 0, call->remote->city, 0, NULL);
-		g_free(out1);
-		out1 = g_regex_replace_literal(extension, out2, -1, 0, call->local->name, 0, NULL);
-		g_free(out2);
-		out2 = g_regex_replace_literal(line, out1, -1, 0, call->local->number, 0, NULL);
-		g_free(out1);
-		out1 = g_regex_replace_literal(duration, out2, -1, 0, call->duration, 0, NULL);
-		g_free(out2);
-		out2 = g_regex_replace_literal(sortable_customkey, out1, -1, 0, customkey, 0, NULL);
-		g_free(out1);
-
-		string = g_string_append(string, out2);
-
-		g_free(out2);
-		g_regex_unref(duration);
-		g_regex_unref(line);
-		g_regex_unref(extension);
-		g_regex_unref(city);
-		g_regex_unref(number);
-		g_regex_unref(company);
-		g_regex_unref(name);
-		g_regex_unref(date_time);
-		g_regex_unref(type);
+	/* HTML page */
+	shell = g_string_new(NULL);
+	split = g_strsplit(webjournal_plugin->shell, "%DATA%", -1);
+	for (part = 0; split[part] != NULL; part++) {
+		if (part) {
+			webjournal_append_escaped(shell, data_name);
+		}
+		g_string_append(shell, split[part]);
+	}
+	g_strfreev(split);
+	webjournal_save(webjournal_plugin, file, shell->str, shell->len);
+
+	g_string_free(shell, TRUE);
+	g_string_free(index, TRUE);
+	g_list_free(months);
+	g_hash_table_destroy(wanted);
+	g_hash_table_destroy(chunks);
+	g_free(data_dir);
+	g_free(data_name);
+	g_free(base);
+	g_free(dirname);
+}
+
+/**
+ * webjournal_write_table:
+ * @job: a #webjournal_job
+ *
+ * Write journal as one sortable HTML table
+ */
+static void webjournal_write_table(struct webjournal_job *job)
+{
+	RmWebJournalPlugin *webjournal_plugin = job->plugin;
+	GString *string;
+	gsize size;
+	guint index;
+
+	/* Reserve header, footer and about 100 bytes of values per entry up front */
+	size = strlen(webjournal_plugin->header) + strlen(webjournal_plugin->footer);
+	size += job->rows->len * (webjournal_plugin->entry_template->size + 100);
+
+	string = g_string_sized_new(size);
+	g_string_append(string, webjournal_plugin->header);
+
+	for (index = 0; index < job->rows->len; index++) {
+		webjournal_template_render(webjournal_plugin->entry_template, string, &g_array_index(job->rows, WebJournalRow, index));
 	}
 
 	string = g_string_append(string, webjournal_plugin->footer);
 
-	rm_file_save(file, string->str, string->len);
+	webjournal_save(webjournal_plugin, job->file, string->str, string->len);
 
 	g_string_free(string, TRUE);
+}
 
-	dirname = g_path_get_dirname(file);
+static void webjournal_row_clear(gpointer data)
+{
+	WebJournalRow *row = data;
+	gint field;
 
-	file = g_strdup_printf("%s/dragtable.js", dirname);
-	rm_file_save(file, webjournal_plugin->dragtable, -1);
-	g_free(file);
+	for (field = 0; field < WEBJOURNAL_FIELD_MAX; field++) {
+		g_free(row->values[field]);
+	}
+}
+
+/**
+ * webjournal_job_new:
+ * @webjournal_plugin: a #RmWebJournalPlugin
+ * @journal: journal list
+ *
+ * Take snapshot of journal, call entries are not valid after the signal emission
+ *
+ * Returns: new #webjournal_job
+ */
+static struct webjournal_job *webjournal_job_new(RmWebJournalPlugin *webjournal_plugin, GSList *journal)
+{
+	struct webjournal_job *job = g_slice_new0(struct webjournal_job);
+	GSList *list;
 
-	file = g_strdup_printf("%s/sortable.js", dirname);
-	rm_file_save(file, webjournal_plugin->sortable, -1);
-	g_free(file);
+	job->plugin = webjournal_plugin;
+	job->file = g_settings_get_string(webjournal_settings, "filename");
+	job->paged = g_settings_get_boolean(webjournal_settings, "paged");
+	job->rows = g_array_sized_new(FALSE, FALSE, sizeof(WebJournalRow), g_slist_length(journal));
+	g_array_set_clear_func(job->rows, webjournal_row_clear);
 
-	file = g_strdup_printf("%s/styling.css", dirname);
-	rm_file_save(file, webjournal_plugin->styling, -1);
-	g_free(file);
+	for (list = journal; list != NULL; list = list->next) {
+		RmCallEntry *call = list->data;
+		WebJournalRow row;
+
+		row.values[WEBJOURNAL_FIELD_TYPE] = g_strdup(webjournal_get_call_type_string(call->type));
+		row.values[WEBJOURNAL_FIELD_DATETIME] = g_strdup(call->date_time);
+		row.values[WEBJOURNAL_FIELD_NAME] = g_strdup(call->remote->name);
+		row.values[WEBJOURNAL_FIELD_COMPANY] = g_strdup(call->remote->company);
+		row.values[WEBJOURNAL_FIELD_NUMBER] = g_strdup(call->remote->number);
+		row.values[WEBJOURNAL_FIELD_CITY] = g_strdup(call->remote->city);
+		row.values[WEBJOURNAL_FIELD_EXTENSION] = g_strdup(call->local->name);
+		row.values[WEBJOURNAL_FIELD_LINE] = g_strdup(call->local->number);
+		row.values[WEBJOURNAL_FIELD_DURATION] = g_strdup(call->duration);
+		/* Sort key is derived from date and time while rendering */
+		row.values[WEBJOURNAL_FIELD_CUSTOMKEY] = NULL;
+
+		g_array_append_val(job->rows, row);
+	}
+
+	return job;
+}
 
+static void webjournal_job_free(gpointer data)
+{
+	struct webjournal_job *job = data;
+
+	g_array_free(job->rows, TRUE);
+	g_free(job->file);
+	g_slice_free(struct webjournal_job, job);
+}
+
+/**
+ * webjournal_write_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #webjournal_job
+ * @cancellable: unused
+ *
+ * Render and write web journal
+ */
+static void webjournal_write_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct webjournal_job *job = task_data;
+	gchar *dirname;
+
+	if (RM_EMPTY_STRING(job->file)) {
+		g_task_return_boolean(task, FALSE);
+		return;
+	}
+
+	if (job->paged) {
+		webjournal_write_paged(job);
+	} else {
+		webjournal_write_table(job);
+	}
+
+	dirname = g_path_get_dirname(job->file);
+	webjournal_write_assets(job->plugin, dirname);
 	g_free(dirname);
+
+	g_task_return_boolean(task, TRUE);
+}
+
+static void webjournal_write(struct webjournal_job *job);
+
+/**
+ * webjournal_write_ready_cb:
+ * @source_object: unused
+ * @res: a #GAsyncResult
+ * @user_data: a #RmWebJournalPlugin
+ *
+ * Writer finished, continue with journal loaded meanwhile
+ */
+static void webjournal_write_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	RmWebJournalPlugin *webjournal_plugin = user_data;
+	struct webjournal_job *pending = webjournal_plugin->pending;
+
+	webjournal_plugin->busy = FALSE;
+	webjournal_plugin->pending = NULL;
+
+	if (webjournal_plugin->shutdown) {
+		/* Plugin has been deactivated while writing */
+		if (pending) {
+			webjournal_job_free(pending);
+		}
+		webjournal_template_free(webjournal_plugin->entry_template);
+		g_hash_table_destroy(webjournal_plugin->checksums);
+		g_slice_free(RmWebJournalPlugin, webjournal_plugin);
+		return;
+	}
+
+	if (pending) {
+		webjournal_write(pending);
+	}
+}
+
+/**
+ * webjournal_write:
+ * @job: a #webjournal_job (transfer full)
+ *
+ * Write journal in a worker thread. Only one writer runs at a time, while it is busy only the
+ * most recent journal is kept.
+ */
+static void webjournal_write(struct webjournal_job *job)
+{
+	RmWebJournalPlugin *webjournal_plugin = job->plugin;
+	GTask *task;
+
+	if (webjournal_plugin->busy) {
+		if (webjournal_plugin->pending) {
+			webjournal_job_free(webjournal_plugin->pending);
+		}
+		webjournal_plugin->pending = job;
+		return;
+	}
+
+	webjournal_plugin->busy = TRUE;
+
+	task = g_task_new(NULL, NULL, webjournal_write_ready_cb, webjournal_plugin);
+	g_task_set_task_data(task, job, webjournal_job_free);
+	g_task_run_in_thread(task, webjournal_write_thread);
+	g_object_unref(task);
+}
+
+/**
+ * webjournal_journal_loaded_cb:
+ * @obj: a #RmObject
+ * @journal journal list
+ * @user_data: a #RmWebJournalPlugin
+ *
+ * Processes a new loaded journal and create web journal
+ */
+void webjournal_journal_loaded_cb(RmObject *obj, GSList *journal, gpointer user_data)
+{
+	RmWebJournalPlugin *webjournal_plugin = user_data;
+
+	webjournal_write(webjournal_job_new(webjournal_plugin, journal));
 }
 
 /**
@@ -204,12 +864,14 @@ static gboolean webjournal_plugin_init(RmPlugin *plugin)
 	gchar *file;
 
 	plugin->priv = webjournal_plugin;
+	webjournal_plugin->checksums = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
 	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/header.html", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
 	webjournal_plugin->header = (gchar*)g_bytes_get_data(tmp, NULL);
 
 	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/entry.html", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
 	webjournal_plugin->entry = (gchar*)g_bytes_get_data(tmp, NULL);
+	webjournal_plugin->entry_template = webjournal_template_compile(webjournal_plugin->entry);
 
 	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/footer.html", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
 	webjournal_plugin->footer = (gchar*)g_bytes_get_data(tmp, NULL);
@@ -223,6 +885,12 @@ static gboolean webjournal_plugin_init(RmPlugin *plugin)
 	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/styling.css", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
 	webjournal_plugin->styling = (gchar*)g_bytes_get_data(tmp, NULL);
 
+	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/journal.html", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	webjournal_plugin->shell = (gchar*)g_bytes_get_data(tmp, NULL);
+
+	tmp = g_resources_lookup_data("/org/tabos/roger/plugins/webjournal/share/journal.js", G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+	webjournal_plugin->viewer = (gchar*)g_bytes_get_data(tmp, NULL);
+
 	webjournal_settings = rm_settings_new("org.tabos.roger.plugins.webjournal");
 
 	file = g_settings_get_string(webjournal_settings, "filename");
@@ -254,6 +922,17 @@ static gboolean webjournal_plugin_shutdown(RmPlugin *plugin)
 	}
 
 	g_clear_object(&webjournal_settings);
+	plugin->priv = NULL;
+
+	if (webjournal_plugin->busy) {
+		/* Writer still uses plugin data, released once it is done */
+		webjournal_plugin->shutdown = TRUE;
+		return TRUE;
+	}
+
+	webjournal_template_free(webjournal_plugin->entry_template);
+	g_hash_table_destroy(webjournal_plugin->checksums);
+	g_slice_free(RmWebJournalPlugin, webjournal_plugin);
 
 	return TRUE;
 }
@@ -300,6 +979,7 @@ gpointer webjournal_plugin_configure(RmPlugin *plugin)
 	GtkWidget *grid = gtk_grid_new();
 	GtkWidget *group;
 	GtkWidget *report_dir_label;
+	GtkWidget *paged_check;
 
 	/* Set standard spacing to 5 */
 	gtk_grid_set_row_spacing(GTK_GRID(grid), 5);
@@ -319,6 +999,11 @@ gpointer webjournal_plugin_configure(RmPlugin *plugin)
 	gtk_grid_attach(GTK_GRID(grid), report_dir_entry, 1, 1, 1, 1);
 	gtk_grid_attach(GTK_GRID(grid), report_dir_button, 2, 1, 1, 1);
 
+	/* Large journals: small page with monthly data files, loaded while scrolling */
+	paged_check = gtk_check_button_new_with_label(_("Paged output with monthly data files"));
+	g_settings_bind(webjournal_settings, "paged", paged_check, "active", G_SETTINGS_BIND_DEFAULT);
+	gtk_grid_attach(GTK_GRID(grid), paged_check, 1, 2, 2, 1);
+
 	group = ui_group_create(grid, _("Web Journal"), TRUE, FALSE);
 
 	return group;
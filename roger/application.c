@@ -38,6 +38,7 @@
 #include <roger/uitools.h>
 #include <roger/plugins.h>
 #include <roger/debug.h>
+#include <roger/contactlookup.h>
 
 #include <config.h>
 
@@ -162,6 +163,7 @@ void app_authenticate_cb(RmObject *app, RmAuthData *auth_data)
 
 static void application_shutdown(GObject *object)
 {
+	fax_queue_shutdown();
 	rm_shutdown();
 
 	g_object_unref(app_settings);
@@ -244,7 +246,7 @@ void app_pickup(RmConnection *connection)
 	rm_notification_message_close(message);
 
 	/** Ask for contact information */
-	contact = rm_contact_find_by_number(connection->remote_number);
+	contact = contact_lookup_find_by_number(connection->remote_number);
 
 	/* Show phone window */
 	app_phone(contact, connection);
@@ -573,7 +575,7 @@ static gint application_command_line_cb(GtkApplication *app, GApplicationCommand
 			full_number = rm_number_full(option_state.number, FALSE);
 
 			/** Ask for contact information */
-			contact = rm_contact_find_by_number(full_number);
+			contact = contact_lookup_find_by_number(full_number);
 
 			app_phone(contact, NULL);
 			g_free(full_number);
@@ -0,0 +1,571 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTACTIMAGE_H
+#define CONTACTIMAGE_H
+
+#include <string.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <rm/rm.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Lazy contact images: address book plugins attach the encoded image data, a file
+ * reference or a loader function to a contact instead of setting contact->image.
+ * The image is decoded by contact_image_get() on first display. Decoded images are
+ * owned by the cache and only the most recently used ones are kept, older ones are
+ * dropped again and decoded on demand. Eviction never touches a contact, the cache
+ * only ever dereferences its own handles.
+ *
+ * The handle table is attached to rm_object, see contactsdelta.h. Plugins must call
+ * contact_image_clear() before freeing a contact that has an image handle.
+ */
+
+#define CONTACT_IMAGE_KEY "roger-contact-images"
+#define CONTACT_IMAGE_MAX_DECODED 64
+
+/**
+ * ContactImageLoadFunc:
+ * @contact: a #RmContact
+ * @user_data: user data passed to contact_image_set_loader()
+ *
+ * Starts loading the image of @contact. Once the data is available the function
+ * must pass it to contact_image_set_data() and notify about the changed contact.
+ * On failure it must call contact_image_set_data() with %NULL data, so that the
+ * image is requested again on next display.
+ */
+typedef void (*ContactImageLoadFunc)(RmContact *contact, gpointer user_data);
+
+/**
+ * ContactImage:
+ * @ref_count: reference count, held by each contact sharing the handle and the decoded queue
+ * @origin: contact the handle has been attached to by its address book, or %NULL once cleared
+ * @data: encoded image data
+ * @base64: base64 encoded image data
+ * @file_name: image file name
+ * @load_func: asynchronous image loader
+ * @load_data: user data for @load_func
+ * @load_destroy: destroy notify for @load_data
+ * @loading: %TRUE if @load_func has been called
+ * @pixbuf: decoded image
+ */
+typedef struct {
+	gint ref_count;
+	RmContact *origin;
+	GBytes *data;
+	gchar *base64;
+	gchar *file_name;
+	ContactImageLoadFunc load_func;
+	gpointer load_data;
+	GDestroyNotify load_destroy;
+	gboolean loading;
+	GdkPixbuf *pixbuf;
+} ContactImage;
+
+/**
+ * ContactImageCache:
+ * @mutex: protects cache
+ * @images: image handles, #RmContact -> #ContactImage
+ * @decoded: handles with decoded images, most recently used first
+ * @removed: contacts whose image has been removed by the user, see contact_image_set_removed()
+ */
+typedef struct {
+	GMutex mutex;
+	GHashTable *images;
+	GQueue *decoded;
+	GHashTable *removed;
+} ContactImageCache;
+
+static inline void contact_image_drop_source(ContactImage *image)
+{
+	if (image->data) {
+		g_bytes_unref(image->data);
+		image->data = NULL;
+	}
+
+	if (image->load_destroy) {
+		image->load_destroy(image->load_data);
+	}
+	image->load_func = NULL;
+	image->load_data = NULL;
+	image->load_destroy = NULL;
+	image->loading = FALSE;
+
+	g_clear_pointer(&image->base64, g_free);
+	g_clear_pointer(&image->file_name, g_free);
+}
+
+static inline void contact_image_unref(gpointer data)
+{
+	ContactImage *image = data;
+
+	if (--image->ref_count) {
+		return;
+	}
+
+	contact_image_drop_source(image);
+	g_clear_object(&image->pixbuf);
+
+	g_slice_free(ContactImage, image);
+}
+
+static inline void contact_image_cache_free(gpointer data)
+{
+	ContactImageCache *cache = data;
+
+	g_hash_table_destroy(cache->images);
+	g_hash_table_destroy(cache->removed);
+	g_queue_free_full(cache->decoded, contact_image_unref);
+	g_mutex_clear(&cache->mutex);
+
+	g_slice_free(ContactImageCache, cache);
+}
+
+/**
+ * contact_image_get_cache:
+ *
+ * Get (and create on first use) the process wide image cache
+ *
+ * Returns: a #ContactImageCache
+ */
+static inline ContactImageCache *contact_image_get_cache(void)
+{
+	ContactImageCache *cache = g_object_get_data(G_OBJECT(rm_object), CONTACT_IMAGE_KEY);
+
+	if (!cache) {
+		cache = g_slice_new0(ContactImageCache);
+		g_mutex_init(&cache->mutex);
+		cache->images = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, contact_image_unref);
+		cache->decoded = g_queue_new();
+		cache->removed = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+		if (!g_object_replace_data(G_OBJECT(rm_object), CONTACT_IMAGE_KEY, NULL, cache, contact_image_cache_free, NULL)) {
+			/* Someone else has been faster */
+			contact_image_cache_free(cache);
+			cache = g_object_get_data(G_OBJECT(rm_object), CONTACT_IMAGE_KEY);
+		}
+	}
+
+	return cache;
+}
+
+/**
+ * contact_image_drop_decoded:
+ * @cache: a #ContactImageCache
+ * @image: a #ContactImage
+ *
+ * Drop decoded image of handle. Called with cache mutex held.
+ */
+static inline void contact_image_drop_decoded(ContactImageCache *cache, ContactImage *image)
+{
+	if (image->pixbuf && g_queue_remove(cache->decoded, image)) {
+		g_clear_object(&image->pixbuf);
+		contact_image_unref(image);
+	}
+}
+
+/**
+ * contact_image_detach:
+ * @cache: a #ContactImageCache
+ * @contact: a #RmContact
+ *
+ * Remove image handle of contact. A loader belongs to the contact it has been
+ * attached to, so it is dropped together with its origin even if copies still
+ * share the handle. Called with cache mutex held.
+ */
+static inline void contact_image_detach(ContactImageCache *cache, RmContact *contact)
+{
+	ContactImage *image = g_hash_table_lookup(cache->images, contact);
+
+	if (!image) {
+		return;
+	}
+
+	g_hash_table_steal(cache->images, contact);
+
+	if (image->origin == contact) {
+		image->origin = NULL;
+		if (image->load_destroy) {
+			image->load_destroy(image->load_data);
+		}
+		image->load_func = NULL;
+		image->load_data = NULL;
+		image->load_destroy = NULL;
+	}
+
+	/* Last contact is gone, release decoded image right away */
+	if (image->ref_count == 2) {
+		contact_image_drop_decoded(cache, image);
+	}
+
+	contact_image_unref(image);
+}
+
+/**
+ * contact_image_set:
+ * @contact: a #RmContact
+ * @source: new handle holding the image source
+ *
+ * Attach image source to contact. If contact already is the origin of a handle, the
+ * handle is updated in place so that copies sharing it see the new image as well.
+ */
+static inline void contact_image_set(RmContact *contact, ContactImage *source)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+	ContactImage *image;
+
+	g_clear_object(&contact->image);
+
+	g_mutex_lock(&cache->mutex);
+
+	image = g_hash_table_lookup(cache->images, contact);
+	if (image && image->origin == contact) {
+		contact_image_drop_decoded(cache, image);
+		contact_image_drop_source(image);
+
+		image->data = source->data;
+		image->base64 = source->base64;
+		image->file_name = source->file_name;
+		image->load_func = source->load_func;
+		image->load_data = source->load_data;
+		image->load_destroy = source->load_destroy;
+
+		g_slice_free(ContactImage, source);
+	} else {
+		contact_image_detach(cache, contact);
+
+		source->ref_count = 1;
+		source->origin = contact;
+		g_hash_table_insert(cache->images, contact, source);
+	}
+
+	g_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * contact_image_set_data:
+ * @contact: a #RmContact
+ * @data: encoded image data or %NULL
+ *
+ * Attach encoded image data to contact, decoded on first use. With %NULL data a
+ * failed asynchronous load is reset, so that it is started again on next display.
+ */
+static inline void contact_image_set_data(RmContact *contact, GBytes *data)
+{
+	ContactImage *image;
+
+	if (!data) {
+		ContactImageCache *cache = contact_image_get_cache();
+
+		g_mutex_lock(&cache->mutex);
+		image = g_hash_table_lookup(cache->images, contact);
+		if (image) {
+			image->loading = FALSE;
+		}
+		g_mutex_unlock(&cache->mutex);
+
+		return;
+	}
+
+	image = g_slice_new0(ContactImage);
+	image->data = g_bytes_ref(data);
+	contact_image_set(contact, image);
+
+	contact->image_len = g_bytes_get_size(data);
+}
+
+/**
+ * contact_image_set_base64:
+ * @contact: a #RmContact
+ * @base64: base64 encoded image data
+ *
+ * Attach base64 encoded image data to contact, decoded on first use.
+ */
+static inline void contact_image_set_base64(RmContact *contact, const gchar *base64)
+{
+	ContactImage *image = g_slice_new0(ContactImage);
+
+	image->base64 = g_strdup(base64);
+	contact_image_set(contact, image);
+}
+
+/**
+ * contact_image_set_file:
+ * @contact: a #RmContact
+ * @file_name: image file name
+ *
+ * Attach image file to contact, loaded on first use.
+ */
+static inline void contact_image_set_file(RmContact *contact, const gchar *file_name)
+{
+	ContactImage *image = g_slice_new0(ContactImage);
+
+	image->file_name = g_strdup(file_name);
+	contact_image_set(contact, image);
+}
+
+/**
+ * contact_image_set_loader:
+ * @contact: a #RmContact
+ * @func: a #ContactImageLoadFunc
+ * @user_data: user data for @func
+ * @destroy: destroy notify for @user_data
+ *
+ * Attach an asynchronous image loader to contact, started on first use.
+ */
+static inline void contact_image_set_loader(RmContact *contact, ContactImageLoadFunc func, gpointer user_data, GDestroyNotify destroy)
+{
+	ContactImage *image = g_slice_new0(ContactImage);
+
+	image->load_func = func;
+	image->load_data = user_data;
+	image->load_destroy = destroy;
+	contact_image_set(contact, image);
+}
+
+/**
+ * contact_image_copy:
+ * @dst: a #RmContact, usually a copy of @src
+ * @src: a #RmContact
+ *
+ * Let @dst share the image handle of @src without decoding it. The image is decoded
+ * once for both contacts and a pending loader of @src serves @dst as well.
+ *
+ * Returns: %TRUE if @src has an image handle
+ */
+static inline gboolean contact_image_copy(RmContact *dst, RmContact *src)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+	ContactImage *image;
+
+	g_mutex_lock(&cache->mutex);
+
+	image = g_hash_table_lookup(cache->images, src);
+	if (image && g_hash_table_lookup(cache->images, dst) != image) {
+		contact_image_detach(cache, dst);
+
+		image->ref_count++;
+		g_hash_table_insert(cache->images, dst, image);
+	}
+
+	g_mutex_unlock(&cache->mutex);
+
+	return image != NULL;
+}
+
+/**
+ * contact_image_clear:
+ * @contact: a #RmContact
+ *
+ * Drop image handle of contact. contact->image stays untouched.
+ */
+static inline void contact_image_clear(RmContact *contact)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+
+	g_mutex_lock(&cache->mutex);
+	contact_image_detach(cache, contact);
+	g_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * contact_image_has:
+ * @contact: a #RmContact
+ *
+ * Check whether contact has an image, decoded or not
+ *
+ * Returns: %TRUE if contact has an image
+ */
+static inline gboolean contact_image_has(RmContact *contact)
+{
+	ContactImageCache *cache;
+	gboolean ret;
+
+	if (contact->image) {
+		return TRUE;
+	}
+
+	cache = contact_image_get_cache();
+	g_mutex_lock(&cache->mutex);
+	ret = g_hash_table_contains(cache->images, contact);
+	g_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/**
+ * contact_image_set_removed:
+ * @contact: a #RmContact
+ * @removed: %TRUE if the user removed the image
+ *
+ * Mark image of contact as removed by the user. Address books only drop a stored
+ * image if it is marked, a contact without image handle may just not have loaded it.
+ */
+static inline void contact_image_set_removed(RmContact *contact, gboolean removed)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+
+	g_mutex_lock(&cache->mutex);
+	if (removed) {
+		g_hash_table_add(cache->removed, contact);
+	} else {
+		g_hash_table_remove(cache->removed, contact);
+	}
+	g_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * contact_image_is_removed:
+ * @contact: a #RmContact
+ *
+ * Returns: %TRUE if the user removed the image of contact
+ */
+static inline gboolean contact_image_is_removed(RmContact *contact)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+	gboolean ret;
+
+	g_mutex_lock(&cache->mutex);
+	ret = g_hash_table_contains(cache->removed, contact);
+	g_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+static inline GdkPixbuf *contact_image_decode(ContactImage *image)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf *pixbuf = NULL;
+	GError *error = NULL;
+	const guchar *data;
+	guchar *decoded = NULL;
+	gsize len;
+
+	if (image->file_name) {
+		pixbuf = gdk_pixbuf_new_from_file(image->file_name, &error);
+		if (!pixbuf) {
+			g_debug("%s(): Could not load '%s' (%s)", __FUNCTION__, image->file_name, error ? error->message : "?");
+			g_clear_error(&error);
+		}
+
+		return pixbuf;
+	}
+
+	if (image->base64) {
+		decoded = g_base64_decode(image->base64, &len);
+		data = decoded;
+	} else if (image->data) {
+		data = g_bytes_get_data(image->data, &len);
+	} else {
+		return NULL;
+	}
+
+	loader = gdk_pixbuf_loader_new();
+	if (gdk_pixbuf_loader_write(loader, data, len, &error) && gdk_pixbuf_loader_close(loader, &error)) {
+		pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+		if (pixbuf) {
+			g_object_ref(pixbuf);
+		}
+	} else {
+		g_debug("%s(): Could not decode image (%s)", __FUNCTION__, error ? error->message : "?");
+		g_clear_error(&error);
+		gdk_pixbuf_loader_close(loader, NULL);
+	}
+
+	g_object_unref(loader);
+	g_free(decoded);
+
+	return pixbuf;
+}
+
+/**
+ * contact_image_get:
+ * @contact: a #RmContact
+ *
+ * Get full size contact image, decoding it if needed. Asynchronous loaders are
+ * started and %NULL is returned until their data arrives. Lazy images are owned
+ * by the cache, take a reference if the image is needed beyond the current call.
+ *
+ * Returns: (transfer none): a #GdkPixbuf or %NULL
+ */
+static inline GdkPixbuf *contact_image_get(RmContact *contact)
+{
+	ContactImageCache *cache = contact_image_get_cache();
+	ContactImage *image;
+	ContactImageLoadFunc load_func = NULL;
+	RmContact *origin = NULL;
+	gpointer load_data = NULL;
+	GdkPixbuf *pixbuf;
+
+	if (contact->image) {
+		return contact->image;
+	}
+
+	g_mutex_lock(&cache->mutex);
+
+	image = g_hash_table_lookup(cache->images, contact);
+	if (!image) {
+		/* Not a lazy image */
+		g_mutex_unlock(&cache->mutex);
+		return NULL;
+	}
+
+	if (image->pixbuf) {
+		/* Mark as most recently used */
+		g_queue_remove(cache->decoded, image);
+		g_queue_push_head(cache->decoded, image);
+	} else if (image->data || image->base64 || image->file_name) {
+		image->pixbuf = contact_image_decode(image);
+		if (image->pixbuf) {
+			image->ref_count++;
+			g_queue_push_head(cache->decoded, image);
+		}
+
+		/* Evict least recently used decoded images */
+		while (g_queue_get_length(cache->decoded) > CONTACT_IMAGE_MAX_DECODED) {
+			ContactImage *old = g_queue_pop_tail(cache->decoded);
+
+			g_clear_object(&old->pixbuf);
+			contact_image_unref(old);
+		}
+	} else if (image->load_func && image->origin && !image->loading) {
+		image->loading = TRUE;
+		load_func = image->load_func;
+		load_data = image->load_data;
+		origin = image->origin;
+	}
+
+	pixbuf = image->pixbuf;
+
+	g_mutex_unlock(&cache->mutex);
+
+	if (load_func) {
+		/* Loader reports back to the contact it belongs to */
+		load_func(origin, load_data);
+	}
+
+	return pixbuf;
+}
+
+G_END_DECLS
+
+#endif
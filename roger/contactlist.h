@@ -0,0 +1,169 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTACTLIST_H
+#define CONTACTLIST_H
+
+#include <string.h>
+
+#include <rm/rm.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Address book plugins collect their contacts in a #ContactListBuilder in any order
+ * and sort them once when the book is complete, instead of inserting each contact
+ * into a sorted list. The collation key of each name is computed only once.
+ *
+ * Static inline for the same reason as contactsdelta.h.
+ */
+
+/**
+ * ContactListEntry:
+ * @key: collation key of contact name
+ * @contact: a #RmContact
+ */
+typedef struct {
+	gchar *key;
+	RmContact *contact;
+} ContactListEntry;
+
+/**
+ * ContactListBuilder:
+ * @entries: array of #ContactListEntry
+ */
+typedef struct {
+	GArray *entries;
+} ContactListBuilder;
+
+/**
+ * contact_list_compare:
+ * @a: a #RmContact
+ * @b: a #RmContact
+ *
+ * Compares contacts by name in the order of contact_list_builder_end(), use it
+ * to keep a built list sorted on single changes
+ *
+ * Returns: negative value if @a comes before @b, 0 if equal, positive value otherwise
+ */
+static inline gint contact_list_compare(gconstpointer a, gconstpointer b)
+{
+	const RmContact *contact_a = a;
+	const RmContact *contact_b = b;
+
+	/* Same order as comparing collation keys */
+	return g_utf8_collate(contact_a->name ? contact_a->name : "", contact_b->name ? contact_b->name : "");
+}
+
+/**
+ * contact_list_builder_new:
+ * @size: expected number of contacts, or 0
+ *
+ * Creates a new contact list builder
+ *
+ * Returns: a new #ContactListBuilder
+ */
+static inline ContactListBuilder *contact_list_builder_new(guint size)
+{
+	ContactListBuilder *builder = g_slice_new(ContactListBuilder);
+
+	builder->entries = g_array_sized_new(FALSE, FALSE, sizeof(ContactListEntry), size);
+
+	return builder;
+}
+
+/**
+ * contact_list_builder_add:
+ * @builder: a #ContactListBuilder
+ * @contact: a #RmContact
+ *
+ * Adds contact to builder, order does not matter
+ */
+static inline void contact_list_builder_add(ContactListBuilder *builder, RmContact *contact)
+{
+	ContactListEntry entry;
+
+	entry.key = g_utf8_collate_key(contact->name ? contact->name : "", -1);
+	entry.contact = contact;
+
+	g_array_append_val(builder->entries, entry);
+}
+
+static inline gint contact_list_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const ContactListEntry *entry_a = a;
+	const ContactListEntry *entry_b = b;
+
+	return strcmp(entry_a->key, entry_b->key);
+}
+
+/**
+ * contact_list_builder_end:
+ * @builder: a #ContactListBuilder (transfer full)
+ *
+ * Sorts all added contacts by name and frees the builder
+ *
+ * Returns: sorted contact list, free with g_slist_free()
+ */
+static inline GSList *contact_list_builder_end(ContactListBuilder *builder)
+{
+	GSList *list = NULL;
+	guint index;
+
+	g_array_sort(builder->entries, contact_list_entry_compare);
+
+	/* Build list from the end, so that prepending keeps the order */
+	for (index = builder->entries->len; index > 0; index--) {
+		ContactListEntry *entry = &g_array_index(builder->entries, ContactListEntry, index - 1);
+
+		list = g_slist_prepend(list, entry->contact);
+		g_free(entry->key);
+	}
+
+	g_array_free(builder->entries, TRUE);
+	g_slice_free(ContactListBuilder, builder);
+
+	return list;
+}
+
+/**
+ * contact_list_sort:
+ * @list: contact list (transfer full)
+ *
+ * Sorts an existing contact list by name
+ *
+ * Returns: sorted contact list
+ */
+static inline GSList *contact_list_sort(GSList *list)
+{
+	ContactListBuilder *builder = contact_list_builder_new(g_slist_length(list));
+	GSList *iter;
+
+	for (iter = list; iter != NULL; iter = iter->next) {
+		contact_list_builder_add(builder, iter->data);
+	}
+
+	g_slist_free(list);
+
+	return contact_list_builder_end(builder);
+}
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTACTLOOKUP_H
+#define CONTACTLOOKUP_H
+
+#include <rm/rm.h>
+
+G_BEGIN_DECLS
+
+/*
+ * rm_contact_find_by_number() scans the contact list of the active address book.
+ * Books keeping a number index register a #ContactLookupFunc for themselves, and
+ * roger resolves numbers with contact_lookup_find_by_number(), which uses the
+ * function of the active book if there is one.
+ *
+ * The table of functions is attached to rm_object, see contactsdelta.h.
+ */
+
+#define CONTACT_LOOKUP_KEY "roger-contact-lookup"
+
+/**
+ * ContactLookupFunc:
+ * @full_number: number normalised with rm_number_full()
+ *
+ * Returns: matching #RmContact owned by the address book, or %NULL
+ */
+typedef RmContact *(*ContactLookupFunc)(const gchar *full_number);
+
+/**
+ * contact_lookup_register:
+ * @book: a #RmAddressBook
+ * @func: lookup function of @book, or %NULL to remove it
+ *
+ * Sets number lookup function of address book
+ */
+static inline void contact_lookup_register(RmAddressBook *book, ContactLookupFunc func)
+{
+	GHashTable *table = g_object_get_data(G_OBJECT(rm_object), CONTACT_LOOKUP_KEY);
+
+	if (!table) {
+		if (!func) {
+			return;
+		}
+
+		table = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_object_set_data_full(G_OBJECT(rm_object), CONTACT_LOOKUP_KEY, table, (GDestroyNotify)g_hash_table_destroy);
+	}
+
+	if (func) {
+		g_hash_table_insert(table, book, func);
+	} else {
+		g_hash_table_remove(table, book);
+	}
+}
+
+/**
+ * contact_lookup_find_by_number:
+ * @number: phone number
+ *
+ * Finds contact of @number in the active address book, through its index if it has one
+ *
+ * Returns: matching #RmContact or %NULL
+ */
+static inline RmContact *contact_lookup_find_by_number(const gchar *number)
+{
+	GHashTable *table = g_object_get_data(G_OBJECT(rm_object), CONTACT_LOOKUP_KEY);
+	RmProfile *profile = rm_profile_get_active();
+	RmAddressBook *book = profile ? rm_profile_get_addressbook(profile) : NULL;
+	ContactLookupFunc func = table && book ? g_hash_table_lookup(table, book) : NULL;
+	RmContact *contact;
+	gchar *full_number;
+
+	if (!func || RM_EMPTY_STRING(number)) {
+		return rm_contact_find_by_number((gchar*)number);
+	}
+
+	full_number = rm_number_full((gchar*)number, FALSE);
+	contact = func(full_number);
+	g_free(full_number);
+
+	return contact;
+}
+
+G_END_DECLS
+
+#endif
@@ -29,6 +29,10 @@
 #include <roger/uitools.h>
 #include <roger/phone.h>
 #include <roger/journal.h>
+#include <roger/contactsdelta.h>
+#include <roger/contactlist.h>
+#include <roger/contactimage.h>
+#include <roger/contactlookup.h>
 
 typedef struct {
 	GtkWidget *window;
@@ -52,10 +56,17 @@ typedef struct {
 
 	RmContact *tmp_contact;
 	RmContact *new_contact;
+
+	GHashTable *rows;
+
+	guint changed_serial;
 } Contacts;
 
 static Contacts *contacts = NULL;
 
+/* Deltas with more contacts rebuild the whole list instead of placing each row */
+#define CONTACTS_DELTA_MAX 128
+
 /**
  * contacts_dial_clicked_cb:
  * @button: phone button
@@ -74,7 +85,7 @@ static void contacts_dial_clicked_cb(GtkWidget *button, gpointer user_data)
 	g_assert(full_number != NULL);
 
 	/* Find matching contact */
-	contact = rm_contact_find_by_number(full_number);
+	contact = contact_lookup_find_by_number(full_number);
 	g_free(full_number);
 	g_assert(contact != NULL);
 
@@ -127,8 +138,10 @@ static void contacts_update_details(RmContact *contact)
 			gtk_widget_set_hexpand(detail_name_label, TRUE);
 			gtk_grid_attach(GTK_GRID(grid), detail_name_label, 1, 0, 1, 1);
 
-			if (contact->image) {
-				GdkPixbuf *buf = rm_image_scale(contact->image, 96);
+			GdkPixbuf *image = contact_image_get(contact);
+
+			if (image) {
+				GdkPixbuf *buf = rm_image_scale(image, 96);
 				gtk_image_set_from_pixbuf(GTK_IMAGE(detail_photo_image), buf);
 			} else {
 				gtk_image_set_from_icon_name(GTK_IMAGE(detail_photo_image), AVATAR_DEFAULT, GTK_ICON_SIZE_DIALOG);
@@ -308,6 +321,139 @@ static RmContact *contacts_get_selected_contact(void)
 	return contact;
 }
 
+/**
+ * contacts_matches_filter:
+ * @contact: a #RmContact
+ *
+ * Check whether contact matches the current search text
+ *
+ * Returns: %TRUE if contact should be listed
+ */
+static gboolean contacts_matches_filter(RmContact *contact)
+{
+	const gchar *text = gtk_entry_get_text(GTK_ENTRY(contacts->search_entry));
+
+	return !text || rm_strcasestr(contact->name, text) || rm_strcasestr(contact->company, text);
+}
+
+/**
+ * contacts_create_child:
+ * @contact: a #RmContact
+ *
+ * Creates list box child showing contact image and name
+ *
+ * Returns: child box widget
+ */
+static GtkWidget *contacts_create_child(RmContact *contact)
+{
+	GtkWidget *child_box;
+	GtkWidget *img;
+	GtkWidget *txt;
+	GdkPixbuf *image;
+
+	/* Create child box */
+	child_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+	g_object_set_data(G_OBJECT(child_box), "contact", contact);
+
+	/* Create contact image */
+	image = contact_image_get(contact);
+	if (image) {
+		gint size;
+		gtk_icon_size_lookup(GTK_ICON_SIZE_DIALOG, &size, NULL);
+		img = gtk_image_new_from_pixbuf(rm_image_scale(image, size));
+	} else {
+		img = gtk_image_new_from_icon_name(AVATAR_DEFAULT, GTK_ICON_SIZE_DIALOG);
+	}
+	gtk_box_pack_start(GTK_BOX(child_box), img, FALSE, FALSE, 6);
+
+	/* Add contact name */
+	txt = gtk_label_new(contact->name);
+	gtk_label_set_ellipsize(GTK_LABEL(txt), PANGO_ELLIPSIZE_END);
+	gtk_box_pack_start(GTK_BOX(child_box), txt, FALSE, FALSE, 6);
+	gtk_widget_show_all(child_box);
+
+	return child_box;
+}
+
+/**
+ * contacts_row_destroy_cb:
+ * @row: list box row
+ * @user_data: a #RmContact
+ *
+ * Forget row of contact once it is destroyed
+ */
+static void contacts_row_destroy_cb(GtkWidget *row, gpointer user_data)
+{
+	if (contacts && g_hash_table_lookup(contacts->rows, user_data) == row) {
+		g_hash_table_remove(contacts->rows, user_data);
+	}
+}
+
+/**
+ * contacts_add_row:
+ * @contact: a #RmContact
+ * @pos: position in list box
+ *
+ * Insert row showing @contact at @pos and remember it for lookups
+ *
+ * Returns: new #GtkListBoxRow
+ */
+static GtkListBoxRow *contacts_add_row(RmContact *contact, gint pos)
+{
+	GtkListBoxRow *row;
+
+	gtk_list_box_insert(GTK_LIST_BOX(contacts->list_box), contacts_create_child(contact), pos);
+	row = gtk_list_box_get_row_at_index(GTK_LIST_BOX(contacts->list_box), pos);
+
+	g_hash_table_insert(contacts->rows, contact, row);
+	g_signal_connect(row, "destroy", G_CALLBACK(contacts_row_destroy_cb), contact);
+
+	return row;
+}
+
+/**
+ * contacts_find_row:
+ * @contact: a #RmContact
+ *
+ * Find list box row showing @contact
+ *
+ * Returns: a #GtkListBoxRow or %NULL if contact is not listed
+ */
+static GtkListBoxRow *contacts_find_row(RmContact *contact)
+{
+	return g_hash_table_lookup(contacts->rows, contact);
+}
+
+/**
+ * contacts_insert_row:
+ * @contact: a #RmContact
+ *
+ * Insert contact at its sorted position in list box
+ *
+ * Returns: new #GtkListBoxRow
+ */
+static GtkListBoxRow *contacts_insert_row(RmContact *contact)
+{
+	gint low = 0;
+	gint high = g_hash_table_size(contacts->rows);
+
+	/* Rows are sorted, search for the first row after contact */
+	while (low < high) {
+		gint mid = (low + high) / 2;
+		GtkListBoxRow *row = gtk_list_box_get_row_at_index(GTK_LIST_BOX(contacts->list_box), mid);
+		GtkWidget *child = gtk_bin_get_child(GTK_BIN(row));
+		RmContact *row_contact = g_object_get_data(G_OBJECT(child), "contact");
+
+		if (contact_list_compare(contact, row_contact) < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return contacts_add_row(contact, low);
+}
+
 /**
  * contacts_update_list:
  *
@@ -318,7 +464,7 @@ static void contacts_update_list(void)
 	GSList *list;
 	RmAddressBook *book = contacts->book;
 	GSList *contact_list = rm_addressbook_get_contacts(book);
-	const gchar *text = gtk_entry_get_text(GTK_ENTRY(contacts->search_entry));
+	GtkListBoxRow *row;
 	gint pos = 0;
 	RmContact *selected_contact;
 
@@ -327,51 +473,141 @@ static void contacts_update_list(void)
 	/* For all children of list box, call contacts_destory_child() */
 	gtk_container_foreach(GTK_CONTAINER(contacts->list_box), contacts_destroy_child, NULL);
 
-	for (list = contact_list; list != NULL; list = list->next, pos++) {
+	for (list = contact_list; list != NULL; list = list->next) {
 		RmContact *contact = list->data;
-		GtkWidget *child_box;
-		GtkWidget *img;
-		GtkWidget *txt;
 
 		/* Check whether we have a filter set and it matches */
-		if (text && (!rm_strcasestr(contact->name, text) && !rm_strcasestr(contact->company, text))) {
+		if (!contacts_matches_filter(contact)) {
 			continue;
 		}
 
-		/* Create child box */
-		child_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-		g_object_set_data(G_OBJECT(child_box), "contact", contact);
-
-		/* Create contact image */
-		if (contact->image) {
-			gint size;
-			gtk_icon_size_lookup(GTK_ICON_SIZE_DIALOG, &size, NULL);
-			img = gtk_image_new_from_pixbuf(rm_image_scale(contact->image, size));
-		} else {
-			img = gtk_image_new_from_icon_name(AVATAR_DEFAULT, GTK_ICON_SIZE_DIALOG);
-		}
-		gtk_box_pack_start(GTK_BOX(child_box), img, FALSE, FALSE, 6);
-
-		/* Add contact name */
-		txt = gtk_label_new(contact->name);
-		gtk_label_set_ellipsize(GTK_LABEL(txt), PANGO_ELLIPSIZE_END);
-		gtk_box_pack_start(GTK_BOX(child_box), txt, FALSE, FALSE, 6);
-		gtk_widget_show_all(child_box);
-
 		/* Insert child box to contacts list box */
-		gtk_list_box_insert(GTK_LIST_BOX(contacts->list_box), child_box, pos);
+		row = contacts_add_row(contact, pos);
 
 		if (selected_contact && !strcmp(selected_contact->name, contact->name)) {
-			GtkListBoxRow *row = gtk_list_box_get_row_at_index(GTK_LIST_BOX(contacts->list_box), pos);
-
 			gtk_list_box_select_row(GTK_LIST_BOX(contacts->list_box), row);
 		}
+		pos++;
 	}
 
 	/* Update contact details */
 	contacts_update_details(selected_contact);
 }
 
+/**
+ * contacts_update_contact:
+ * @contact: a #RmContact
+ *
+ * Replace list box row of a modified contact, keeping the selection
+ */
+static void contacts_update_contact(RmContact *contact)
+{
+	GtkListBoxRow *row = contacts_find_row(contact);
+	gboolean selected = row && gtk_list_box_get_selected_row(GTK_LIST_BOX(contacts->list_box)) == row;
+
+	if (row) {
+		gtk_widget_destroy(GTK_WIDGET(row));
+	}
+
+	if (!contacts_matches_filter(contact)) {
+		return;
+	}
+
+	row = contacts_insert_row(contact);
+	if (selected) {
+		gtk_list_box_select_row(GTK_LIST_BOX(contacts->list_box), row);
+		contacts_update_details(contact);
+	}
+}
+
+/**
+ * contacts_apply_delta:
+ * @delta: a #ContactsDelta
+ *
+ * Patch only changed rows of contact list
+ *
+ * Returns: %TRUE if delta could be applied, %FALSE if a full update is needed
+ */
+static gboolean contacts_apply_delta(ContactsDelta *delta)
+{
+	GSList *contact_list;
+	GHashTable *changed;
+	GtkListBoxRow *selected_row;
+	RmContact *selected = NULL;
+	GSList *list;
+	guint found = 0;
+
+	if (g_slist_length(delta->added) + g_slist_length(delta->modified) + g_slist_length(delta->removed) > CONTACTS_DELTA_MAX) {
+		return FALSE;
+	}
+
+	/* Delta must describe contacts of the shown book, check them in one pass */
+	changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (list = delta->added; list != NULL; list = list->next) {
+		g_hash_table_add(changed, list->data);
+	}
+	for (list = delta->modified; list != NULL; list = list->next) {
+		g_hash_table_add(changed, list->data);
+	}
+
+	contact_list = rm_addressbook_get_contacts(contacts->book);
+	for (list = contact_list; list != NULL && found < g_hash_table_size(changed); list = list->next) {
+		if (g_hash_table_contains(changed, list->data)) {
+			found++;
+		}
+	}
+
+	if (found < g_hash_table_size(changed)) {
+		g_hash_table_destroy(changed);
+		return FALSE;
+	}
+	g_hash_table_destroy(changed);
+
+	selected_row = gtk_list_box_get_selected_row(GTK_LIST_BOX(contacts->list_box));
+
+	/* Drop rows of removed and modified contacts first, so that the remaining rows stay sorted */
+	for (list = delta->removed; list != NULL; list = list->next) {
+		GtkListBoxRow *row = contacts_find_row(list->data);
+
+		if (row) {
+			if (row == selected_row) {
+				contacts_update_details(NULL);
+			}
+			gtk_widget_destroy(GTK_WIDGET(row));
+		}
+	}
+
+	for (list = delta->modified; list != NULL; list = list->next) {
+		GtkListBoxRow *row = contacts_find_row(list->data);
+
+		if (row) {
+			if (row == selected_row) {
+				selected = list->data;
+			}
+			gtk_widget_destroy(GTK_WIDGET(row));
+		}
+	}
+
+	for (list = delta->modified; list != NULL; list = list->next) {
+		if (contacts_matches_filter(list->data)) {
+			GtkListBoxRow *row = contacts_insert_row(list->data);
+
+			if (list->data == selected) {
+				gtk_list_box_select_row(GTK_LIST_BOX(contacts->list_box), row);
+				contacts_update_details(selected);
+			}
+		}
+	}
+
+	for (list = delta->added; list != NULL; list = list->next) {
+		if (!contacts_find_row(list->data) && contacts_matches_filter(list->data)) {
+			contacts_insert_row(list->data);
+		}
+	}
+
+	return TRUE;
+}
+
 /**
  * \brief Search entry changed callback
  * \param entry search entry widget
@@ -529,10 +765,11 @@ void photo_button_clicked_cb(GtkWidget *button, gpointer user_data)
 	if (result == GTK_RESPONSE_ACCEPT) {
 		gchar *image_uri = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_chooser));
 		rm_contact_set_image_from_file(contact, image_uri);
+		contact_image_set_removed(contact, FALSE);
 	} else if (result == 1) {
-		if (contact->image != NULL) {
-			contact->image = NULL;
-		}
+		g_clear_object(&contact->image);
+		/* Only an explicit removal drops the image stored in the book */
+		contact_image_set_removed(contact, TRUE);
 	}
 	refresh_edit_dialog(contact);
 
@@ -796,6 +1033,7 @@ void contacts_cancel_button_clicked_cb(GtkComboBox *box, gpointer user_data)
 	gtk_widget_set_visible(contacts->edit_button, TRUE);
 
 	if (contacts->tmp_contact) {
+		contact_image_set_removed(contacts->tmp_contact, FALSE);
 		rm_contact_free(contacts->tmp_contact);
 		contacts->tmp_contact = NULL;
 	}
@@ -809,6 +1047,7 @@ void contacts_save_button_clicked_cb(GtkComboBox *box, gpointer user_data)
 	RmAddressBook *book = contacts->book;
 	RmContact *contact;
 	gboolean ok = g_settings_get_boolean(app_settings, "contacts-hide-warning");
+	guint serial;
 
 	contact = contacts_get_selected_contact();
 
@@ -836,22 +1075,38 @@ void contacts_save_button_clicked_cb(GtkComboBox *box, gpointer user_data)
 		}
 	}
 
+	serial = contacts->changed_serial;
+
 	if (ok) {
 		if (contact) {
 			rm_contact_copy(contacts->tmp_contact, contact);
+			/* Edited image state is authoritative now */
+			contact_image_clear(contact);
+			contact_image_set_removed(contact, contact_image_is_removed(contacts->tmp_contact));
 			rm_addressbook_save_contact(book, contact);
+			contact_image_set_removed(contact, FALSE);
 		} else {
 			rm_addressbook_save_contact(book, contacts->tmp_contact);
 		}
 	}
 
 	if (contacts->tmp_contact) {
+		contact_image_set_removed(contacts->tmp_contact, FALSE);
 		rm_contact_free(contacts->tmp_contact);
 		contacts->tmp_contact = NULL;
 	}
 
+	/* Book already notified us about the change */
+	if (serial != contacts->changed_serial) {
+		return;
+	}
+
 	/* Update contact list */
-	contacts_update_list();
+	if (ok && contact) {
+		contacts_update_contact(contact);
+	} else {
+		contacts_update_list();
+	}
 }
 
 void book_item_toggled_cb(GtkWidget *widget, gpointer user_data)
@@ -928,6 +1183,15 @@ void contact_editor(RmContact *contact)
 {
 	contacts->tmp_contact = rm_contact_dup(contact);
 
+	/* Lazy images are not part of the copy, the editor works on the decoded one */
+	if (contact && !contacts->tmp_contact->image) {
+		GdkPixbuf *image = contact_image_get(contact);
+
+		if (image) {
+			contacts->tmp_contact->image = g_object_ref(image);
+		}
+	}
+
 	gtk_widget_set_visible(contacts->cancel_button, TRUE);
 	gtk_widget_set_visible(contacts->save_button, TRUE);
 	gtk_widget_set_visible(contacts->edit_button, FALSE);
@@ -1027,35 +1291,28 @@ void remove_button_clicked_cb(GtkWidget *button, gpointer user_data)
 	gtk_widget_destroy(dialog);
 
 	if (result == GTK_RESPONSE_OK) {
+		GtkListBoxRow *row = contacts_find_row(contact);
+		guint serial = contacts->changed_serial;
+
 		/* Remove selected contact */
 		rm_addressbook_remove_contact(contacts->book, contact);
 
-		/* Update contact list */
-		contacts_update_list();
-	}
-}
-
-gboolean contacts_window_delete_event_cb(GtkWidget *widget, GdkEvent event, gpointer data)
-{
-	contacts->window = NULL;
-	contacts->active_user_widget = NULL;
-
-	if (contacts->new_contact) {
-		rm_contact_free(contacts->new_contact);
-		contacts->new_contact = NULL;
+		/* Drop row unless book already notified us about the change */
+		if (serial == contacts->changed_serial && row) {
+			gtk_widget_destroy(GTK_WIDGET(row));
+			contacts_update_details(NULL);
+		}
 	}
-
-	g_free(contacts);
-	contacts = NULL;
-
-	return FALSE;
 }
 
 static void contacts_contacts_changed_cb(RmObject *object, gpointer user_data)
 {
+	ContactsDelta *delta = contacts_delta_get();
 	gchar *name;
 	gchar *tmp;
 
+	contacts->changed_serial++;
+
 	name = rm_addressbook_get_name(contacts->book);
 
 	tmp = g_strdup_printf("<b>%s</b>", name);
@@ -1069,8 +1326,29 @@ static void contacts_contacts_changed_cb(RmObject *object, gpointer user_data)
 	g_free(tmp);
 	g_free(name);
 
-	/* Update contact list */
-	contacts_update_list();
+	/* Patch changed rows only, fall back to full update */
+	if (!delta || !contacts_apply_delta(delta)) {
+		contacts_update_list();
+	}
+}
+
+gboolean contacts_window_delete_event_cb(GtkWidget *widget, GdkEvent event, gpointer data)
+{
+	contacts->window = NULL;
+	contacts->active_user_widget = NULL;
+
+	if (contacts->new_contact) {
+		rm_contact_free(contacts->new_contact);
+		contacts->new_contact = NULL;
+	}
+
+	g_signal_handlers_disconnect_by_func(rm_object, contacts_contacts_changed_cb, NULL);
+
+	g_hash_table_destroy(contacts->rows);
+	g_free(contacts);
+	contacts = NULL;
+
+	return FALSE;
 }
 
 void contacts_set_contact(Contacts *contacts, RmContact *contact)
@@ -1127,6 +1405,7 @@ void app_contacts(RmContact *contact)
 	}
 
 	contacts = g_malloc0(sizeof(Contacts));
+	contacts->rows = g_hash_table_new(g_direct_hash, g_direct_equal);
 	contacts_set_contact(contacts, contact);
 
 	parent = journal_get_window();
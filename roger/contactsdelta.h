@@ -0,0 +1,194 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTACTSDELTA_H
+#define CONTACTSDELTA_H
+
+#include <rm/rm.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Address book plugins describe what changed in a #ContactsDelta and emit it with
+ * contacts_delta_emit(). The delta is attached to rm_object during the "contacts-changed"
+ * emission, so receivers can fetch it with contacts_delta_get(). A %NULL delta means
+ * that the whole address book changed.
+ *
+ * Everything is static inline as plugins can not link against the roger executable.
+ * The same holds for contactlist.h, contactimage.h and contactlookup.h, state shared
+ * between roger and the plugins is therefore attached to rm_object.
+ */
+
+#define CONTACTS_DELTA_KEY "roger-contacts-delta"
+
+/**
+ * ContactsDelta:
+ * @added: list of added #RmContact
+ * @removed: list of removed #RmContact, only valid for pointer comparison
+ * @modified: list of modified #RmContact
+ * @numbers: set of full phone numbers affected by this change
+ */
+typedef struct {
+	GSList *added;
+	GSList *removed;
+	GSList *modified;
+	GHashTable *numbers;
+} ContactsDelta;
+
+/**
+ * contacts_delta_new:
+ *
+ * Creates a new empty contacts delta
+ *
+ * Returns: a new #ContactsDelta
+ */
+static inline ContactsDelta *contacts_delta_new(void)
+{
+	ContactsDelta *delta = g_slice_new0(ContactsDelta);
+
+	delta->numbers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	return delta;
+}
+
+/**
+ * contacts_delta_free:
+ * @delta: a #ContactsDelta
+ *
+ * Frees contacts delta
+ */
+static inline void contacts_delta_free(ContactsDelta *delta)
+{
+	g_slist_free(delta->added);
+	g_slist_free(delta->removed);
+	g_slist_free(delta->modified);
+	g_hash_table_destroy(delta->numbers);
+
+	g_slice_free(ContactsDelta, delta);
+}
+
+/**
+ * contacts_delta_add_numbers:
+ * @delta: a #ContactsDelta
+ * @contact: a #RmContact
+ *
+ * Marks all phone numbers of @contact as affected. Call it before and after modifying
+ * a contact to catch both, old and new numbers.
+ */
+static inline void contacts_delta_add_numbers(ContactsDelta *delta, RmContact *contact)
+{
+	GSList *list;
+
+	for (list = contact->numbers; list != NULL; list = list->next) {
+		RmPhoneNumber *phone_number = list->data;
+
+		if (RM_EMPTY_STRING(phone_number->number)) {
+			continue;
+		}
+
+		g_hash_table_add(delta->numbers, rm_number_full(phone_number->number, FALSE));
+	}
+}
+
+/**
+ * contacts_delta_added:
+ * @delta: a #ContactsDelta
+ * @contact: added #RmContact
+ *
+ * Records an added contact
+ */
+static inline void contacts_delta_added(ContactsDelta *delta, RmContact *contact)
+{
+	delta->added = g_slist_prepend(delta->added, contact);
+	contacts_delta_add_numbers(delta, contact);
+}
+
+/**
+ * contacts_delta_removed:
+ * @delta: a #ContactsDelta
+ * @contact: removed #RmContact
+ *
+ * Records a removed contact. @contact must stay valid until contacts_delta_emit() returns.
+ */
+static inline void contacts_delta_removed(ContactsDelta *delta, RmContact *contact)
+{
+	delta->removed = g_slist_prepend(delta->removed, contact);
+	contacts_delta_add_numbers(delta, contact);
+}
+
+/**
+ * contacts_delta_modified:
+ * @delta: a #ContactsDelta
+ * @contact: modified #RmContact
+ *
+ * Records a modified contact
+ */
+static inline void contacts_delta_modified(ContactsDelta *delta, RmContact *contact)
+{
+	if (!g_slist_find(delta->modified, contact)) {
+		delta->modified = g_slist_prepend(delta->modified, contact);
+	}
+	contacts_delta_add_numbers(delta, contact);
+}
+
+/**
+ * contacts_delta_is_empty:
+ * @delta: a #ContactsDelta
+ *
+ * Checks whether delta contains any change
+ *
+ * Returns: %TRUE if nothing changed
+ */
+static inline gboolean contacts_delta_is_empty(ContactsDelta *delta)
+{
+	return !delta->added && !delta->removed && !delta->modified;
+}
+
+/**
+ * contacts_delta_emit:
+ * @delta: a #ContactsDelta (transfer full)
+ *
+ * Emits "contacts-changed" with @delta attached and frees it afterwards. Empty deltas are dropped.
+ */
+static inline void contacts_delta_emit(ContactsDelta *delta)
+{
+	if (!contacts_delta_is_empty(delta)) {
+		g_object_set_data(G_OBJECT(rm_object), CONTACTS_DELTA_KEY, delta);
+		rm_object_emit_contacts_changed();
+		g_object_set_data(G_OBJECT(rm_object), CONTACTS_DELTA_KEY, NULL);
+	}
+
+	contacts_delta_free(delta);
+}
+
+/**
+ * contacts_delta_get:
+ *
+ * Get delta of the current "contacts-changed" emission
+ *
+ * Returns: a #ContactsDelta or %NULL if the whole address book changed
+ */
+static inline ContactsDelta *contacts_delta_get(void)
+{
+	return g_object_get_data(G_OBJECT(rm_object), CONTACTS_DELTA_KEY);
+}
+
+G_END_DECLS
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <roger/contactsearch.h>
 #include <roger/contacts.h>
+#include <roger/contactimage.h>
 #include <roger/main.h>
 #include <roger/gd-two-lines-renderer.h>
 
@@ -173,6 +174,45 @@ static gboolean contact_search_completion_match_selected_cb(GtkEntryCompletion *
 	return TRUE;
 }
 
+/**
+ * contact_search_image_data_func:
+ * @layout: a #GtkCellLayout
+ * @cell: pixbuf cell renderer
+ * @model: completion model
+ * @iter: row to render
+ * @user_data: unused
+ *
+ * Set contact image of a shown row, decoding and scaling it on first use
+ */
+static void contact_search_image_data_func(GtkCellLayout *layout, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data)
+{
+	RmContact *contact;
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *image;
+
+	gtk_tree_model_get(model, iter, 0, &pixbuf, 4, &contact, -1);
+
+	if (!pixbuf && (image = contact_image_get(contact))) {
+		GtkTreeIter child_iter;
+
+		pixbuf = rm_image_scale(image, 32);
+
+		/* Keep scaled image, completion renders rows through a filter model */
+		if (GTK_IS_TREE_MODEL_FILTER(model)) {
+			gtk_tree_model_filter_convert_iter_to_child_iter(GTK_TREE_MODEL_FILTER(model), &child_iter, iter);
+			gtk_list_store_set(GTK_LIST_STORE(gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(model))), &child_iter, 0, pixbuf, -1);
+		}
+	}
+
+	if (!pixbuf) {
+		/* No image or asynchronous loader still running, try again on next draw */
+		pixbuf = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), AVATAR_DEFAULT, 32, 0, NULL);
+	}
+
+	g_object_set(cell, "pixbuf", pixbuf, NULL);
+	g_clear_object(&pixbuf);
+}
+
 /**
  * contact_search_init:
  * @widget: a #ContactSearch
@@ -191,7 +231,7 @@ static void contact_search_init(ContactSearch *widget)
 
 	widget->completion = gtk_entry_completion_new();
 
-	store = gtk_list_store_new(4, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER);
+	store = gtk_list_store_new(5, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_POINTER);
 
 	book = rm_profile_get_addressbook(rm_profile_get_active());
 	if (!book) {
@@ -207,35 +247,31 @@ static void contact_search_init(ContactSearch *widget)
 	}
 	list = rm_addressbook_get_contacts(book);
 
-        while (list != NULL) {
-                RmContact *contact = list->data;
+	while (list != NULL) {
+		RmContact *contact = list->data;
 		GtkTreeIter iter;
 
-                if (contact != NULL) {
-			GdkPixbuf *pixbuf;
-			GSList *numbers = contact->numbers;
+		if (contact != NULL) {
+			GSList *numbers;
 
-					if (contact->image) {
-						pixbuf = rm_image_scale(contact->image, 32);
-					} else {
-						pixbuf  = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), AVATAR_DEFAULT, 32, 0, NULL);
-					}
+			/* Image is decoded by contact_search_image_data_func() once the row is shown */
 			for (numbers = contact->numbers; numbers != NULL; numbers = numbers->next) {
 				RmPhoneNumber *phone_number = numbers->data;
 				gchar *num_str = g_strdup_printf("%s: %s", phone_number_type_to_string(phone_number->type), phone_number->number);
 
-				gtk_list_store_insert_with_values(store, &iter, -1, 0, pixbuf, 1, contact->name, 2, num_str, 3, phone_number, -1);
+				gtk_list_store_insert_with_values(store, &iter, -1, 1, contact->name, 2, num_str, 3, phone_number, 4, contact, -1);
+				g_free(num_str);
 			}
-                }
+		}
 
-                list = list->next;
-        }
-        gtk_entry_completion_set_model(widget->completion, GTK_TREE_MODEL(store));
+		list = list->next;
+	}
+	gtk_entry_completion_set_model(widget->completion, GTK_TREE_MODEL(store));
 	g_signal_connect(widget->completion, "match-selected", G_CALLBACK(contact_search_completion_match_selected_cb), widget);
 
 	cell = gtk_cell_renderer_pixbuf_new();
 	gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(widget->completion), cell, FALSE);
-	gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(widget->completion), cell, "pixbuf", 0, NULL);
+	gtk_cell_layout_set_cell_data_func(GTK_CELL_LAYOUT(widget->completion), cell, contact_search_image_data_func, NULL, NULL);
 
 	gtk_cell_renderer_set_padding(cell, ICON_PADDING_LEFT, ROW_PADDING_VERT);
 	gtk_cell_renderer_set_fixed_size(cell, (ICON_PADDING_LEFT + ICON_CONTENT_WIDTH + ICON_PADDING_RIGHT), ICON_CONTENT_HEIGHT);
@@ -20,6 +20,8 @@
 #include <config.h>
 
 #include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <gtk/gtk.h>
 #include <glib/gstdio.h>
@@ -30,12 +32,17 @@
 #include <rm/rm.h>
 
 #include <roger/journal.h>
+#include <roger/fax.h>
+#include <roger/faxcache.h>
+#include <roger/faxrender.h>
 #include <roger/contacts.h>
 #include <roger/contactsearch.h>
 #include <roger/print.h>
 #include <roger/main.h>
 #include <roger/uitools.h>
 
+extern GSettings *app_settings;
+
 /* Workaround to build with pre-9.18 versions */
 #if defined(e_Quit)
    #define gs_error_Quit  e_Quit
@@ -62,8 +69,19 @@ struct fax_ui {
 
 	gchar *filter;
 	gboolean discard;
+
+	FaxQueueJob *job;
+	guint convert_timer_id;
+	guint retry_timer_id;
+	guint retry_seconds;
+	gboolean sending;
 };
 
+/* Ghostscript can only run once per process */
+static GMutex fax_convert_mutex;
+
+static void fax_window_send_failed(struct fax_ui *fax_ui);
+
 gboolean fax_status_timer_cb(gpointer user_data)
 {
 	struct fax_ui *fax_ui = user_data;
@@ -106,6 +124,18 @@ gboolean fax_status_timer_cb(gpointer user_data)
 
 		rm_fax_hangup(fax_ui->fax, fax_ui->connection);
 		fax_ui->status_timer_id = 0;
+
+		if (fax_ui->sending) {
+			fax_ui->sending = FALSE;
+
+			if (fax_status->error_code) {
+				fax_window_send_failed(fax_ui);
+			} else if (fax_ui->job) {
+				/* Queue is done with this job, window keeps the fax file */
+				fax_queue_job_sent(fax_ui->job);
+				fax_ui->job = NULL;
+			}
+		}
 		return G_SOURCE_REMOVE;
 	case RM_FAX_PHASE_CALL:
 		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), _("Connecting…"));
@@ -158,26 +188,26 @@ static void fax_connection_changed_cb(RmObject *object, gint event, RmConnection
 
 		fax_dial_buttons_set_dial(fax_ui, TRUE);
 		fax_ui->connection = NULL;
+
+		if (fax_ui->sending) {
+			/* Connection ended before the transfer was released, e.g. line busy */
+			fax_ui->sending = FALSE;
+			fax_window_send_failed(fax_ui);
+		}
 	}
 }
 
-void fax_pickup_button_clicked_cb(GtkWidget *button, gpointer user_data)
+/**
+ * fax_window_dial:
+ * @fax_ui: fax window
+ *
+ * Send fax file to fax_ui->number
+ */
+static void fax_window_dial(struct fax_ui *fax_ui)
 {
 	RmProfile *profile = rm_profile_get_active();
-	struct fax_ui *fax_ui = user_data;
 	gchar *scramble;
 
-	/* Get selected number (either number format or based on the selected name) */
-	fax_ui->number = g_strdup(contact_search_get_number(CONTACT_SEARCH(fax_ui->contact_search)));
-	if (!RM_EMPTY_STRING(fax_ui->number) && !(isdigit(fax_ui->number[0]) || fax_ui->number[0] == '*' || fax_ui->number[0] == '#' || fax_ui->number[0] == '+')) {
-		fax_ui->number = g_object_get_data(G_OBJECT(fax_ui->contact_search), "number");
-	}
-
-	if (RM_EMPTY_STRING(fax_ui->number)) {
-		g_debug("%s(): No number, exiting", __FUNCTION__);
-		return;
-	}
-
 	scramble = rm_number_scramble(fax_ui->number);
 	g_debug("%s(): Dialing '%s'", __FUNCTION__, scramble);
 	g_free(scramble);
@@ -185,13 +215,118 @@ void fax_pickup_button_clicked_cb(GtkWidget *button, gpointer user_data)
 	fax_ui->fax = rm_profile_get_fax(profile);
 	fax_ui->connection = rm_fax_send(fax_ui->fax, fax_ui->file, fax_ui->number, rm_router_get_suppress_state(profile));
 
+	if (fax_ui->job) {
+		fax_queue_job_sending(fax_ui->job, fax_ui->number);
+	}
+
 	if (fax_ui->connection) {
+		fax_ui->sending = TRUE;
 		fax_dial_buttons_set_dial(fax_ui, FALSE);
 		if (!fax_ui->status_timer_id) {
 			fax_ui->status_timer_id = g_timeout_add(250, fax_status_timer_cb, fax_ui);
 		}
 		g_debug("%s(): connection %p", __FUNCTION__, fax_ui->connection);
+	} else {
+		fax_window_send_failed(fax_ui);
+	}
+}
+
+/**
+ * fax_retry_timer_cb:
+ * @user_data: a #fax_ui
+ *
+ * Count down until job is sent again
+ *
+ * Returns: %G_SOURCE_REMOVE once dialing started
+ */
+static gboolean fax_retry_timer_cb(gpointer user_data)
+{
+	struct fax_ui *fax_ui = user_data;
+	gchar *text;
+
+	if (fax_ui->retry_seconds == 0) {
+		fax_ui->retry_timer_id = 0;
+		fax_window_dial(fax_ui);
+		return G_SOURCE_REMOVE;
+	}
+
+	text = g_strdup_printf(_("Retrying in %u s…"), fax_ui->retry_seconds);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), text);
+	g_free(text);
+
+	fax_ui->retry_seconds--;
+
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * fax_window_retry:
+ * @fax_ui: fax window
+ * @delay: seconds to wait
+ *
+ * Send queued job again after @delay seconds
+ */
+static void fax_window_retry(struct fax_ui *fax_ui, guint delay)
+{
+	if (fax_ui->retry_timer_id) {
+		g_source_remove(fax_ui->retry_timer_id);
+	}
+
+	if (!delay) {
+		fax_ui->retry_timer_id = 0;
+		fax_window_dial(fax_ui);
+		return;
+	}
+
+	fax_ui->retry_seconds = delay;
+	fax_ui->retry_timer_id = g_timeout_add_seconds(1, fax_retry_timer_cb, fax_ui);
+	fax_retry_timer_cb(fax_ui);
+}
+
+/**
+ * fax_window_send_failed:
+ * @fax_ui: fax window
+ *
+ * Transfer failed, queued jobs are retried automatically
+ */
+static void fax_window_send_failed(struct fax_ui *fax_ui)
+{
+	guint delay;
+
+	if (!fax_ui->job) {
+		return;
+	}
+
+	delay = fax_queue_job_failed(fax_ui->job);
+	if (delay) {
+		fax_window_retry(fax_ui, delay);
+	} else {
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), _("Fax transfer failed"));
+	}
+}
+
+void fax_pickup_button_clicked_cb(GtkWidget *button, gpointer user_data)
+{
+	struct fax_ui *fax_ui = user_data;
+
+	/* Get selected number (either number format or based on the selected name) */
+	fax_ui->number = g_strdup(contact_search_get_number(CONTACT_SEARCH(fax_ui->contact_search)));
+	if (!RM_EMPTY_STRING(fax_ui->number) && !(isdigit(fax_ui->number[0]) || fax_ui->number[0] == '*' || fax_ui->number[0] == '#' || fax_ui->number[0] == '+')) {
+		fax_ui->number = g_object_get_data(G_OBJECT(fax_ui->contact_search), "number");
 	}
+
+	if (RM_EMPTY_STRING(fax_ui->number)) {
+		g_debug("%s(): No number, exiting", __FUNCTION__);
+		return;
+	}
+
+	/* Manual dial replaces a pending retry */
+	if (fax_ui->retry_timer_id) {
+		g_source_remove(fax_ui->retry_timer_id);
+		fax_ui->retry_timer_id = 0;
+	}
+
+	fax_window_dial(fax_ui);
 }
 
 void fax_hangup_button_clicked_cb(GtkWidget *button, gpointer user_data)
@@ -212,6 +347,23 @@ gboolean fax_delete_event_cb(GtkWidget *window,
 {
 	struct fax_ui *fax_ui = user_data;
 
+	if (fax_ui->convert_timer_id) {
+		g_source_remove(fax_ui->convert_timer_id);
+		fax_ui->convert_timer_id = 0;
+	}
+
+	if (fax_ui->retry_timer_id) {
+		g_source_remove(fax_ui->retry_timer_id);
+		fax_ui->retry_timer_id = 0;
+	}
+
+	if (fax_ui->job) {
+		/* Queue discards job and its files */
+		fax_queue_job_close(fax_ui->job);
+		fax_ui->job = NULL;
+		fax_ui->file = NULL;
+	}
+
 	if (fax_ui->file) {
 			g_unlink(fax_ui->file);
 			fax_ui->file = NULL;
@@ -253,23 +405,34 @@ static GtkWidget *fax_create_menu(struct fax_ui *fax_ui)
 	return menu;
 }
 
-gboolean app_show_fax_window_idle(gpointer data)
+/**
+ * fax_window_new:
+ * @fax_file: tiff file to send or %NULL if it is still being converted
+ *
+ * Create and show fax window
+ *
+ * Returns: fax window or %NULL on error
+ */
+static struct fax_ui *fax_window_new(gchar *fax_file)
 {
 	GtkBuilder *builder;
 	RmProfile *profile = rm_profile_get_active();
 	struct fax_ui *fax_ui;
-	gchar *fax_file = data;
 
 	if (!profile) {
-		g_unlink(fax_file);
-		return FALSE;
+		if (fax_file) {
+			g_unlink(fax_file);
+		}
+		return NULL;
 	}
 
 	builder = gtk_builder_new_from_resource("/org/tabos/roger/fax.glade");
 	if (!builder) {
 		g_warning("Could not load fax ui");
-		g_unlink(fax_file);
-		return FALSE;
+		if (fax_file) {
+			g_unlink(fax_file);
+		}
+		return NULL;
 	}
 
 	/* Allocate fax window structure */
@@ -326,64 +489,204 @@ gboolean app_show_fax_window_idle(gpointer data)
 	gtk_widget_show_all(fax_ui->window);
 	gtk_window_present(GTK_WINDOW(fax_ui->window));
 
+	return fax_ui;
+}
+
+gboolean app_show_fax_window_idle(gpointer data)
+{
+	fax_window_new(data);
+
 	return FALSE;
 }
 
-gchar *convert_to_fax(gchar *file_name)
+/**
+ * fax_job:
+ * @file_name: print file to convert
+ * @resolution: fax resolution setting
+ * @cancellable: cancels conversion
+ * @page: page currently converted, updated by ghostscript output
+ * @pages: number of pages if known, updated by ghostscript output
+ * @output: incomplete ghostscript output line
+ */
+struct fax_job {
+	const gchar *file_name;
+	gint resolution;
+	GCancellable *cancellable;
+	gint *page;
+	gint *pages;
+	GString *output;
+};
+
+/**
+ * fax_gs_stdin:
+ * @caller_handle: a #fax_job
+ * @buf: input buffer
+ * @len: size of @buf
+ *
+ * Ghostscript gets no input
+ *
+ * Returns: 0 (end of input)
+ */
+static int GSDLLCALL fax_gs_stdin(void *caller_handle, char *buf, int len)
+{
+	return 0;
+}
+
+/**
+ * fax_gs_stdout:
+ * @caller_handle: a #fax_job
+ * @str: output
+ * @len: length of @str
+ *
+ * Parse ghostscript progress messages ("Processing pages 1 through 3.", "Page 2")
+ *
+ * Returns: number of consumed bytes
+ */
+static int GSDLLCALL fax_gs_stdout(void *caller_handle, const char *str, int len)
 {
-	gchar *args[13];
+	struct fax_job *job = caller_handle;
+	gchar *line;
+	gchar *end;
+
+	g_string_append_len(job->output, str, len);
+
+	while ((end = memchr(job->output->str, '\n', job->output->len)) != NULL) {
+		gint first;
+		gint last;
+		gint page;
+
+		line = job->output->str;
+		*end = '\0';
+
+		if (sscanf(line, "Processing pages %d through %d.", &first, &last) == 2) {
+			g_atomic_int_set(job->pages, last - first + 1);
+		} else if (sscanf(line, "Page %d", &page) == 1) {
+			g_atomic_int_set(job->page, page);
+		}
+
+		g_string_erase(job->output, 0, end - line + 1);
+	}
+
+	return len;
+}
+
+/**
+ * fax_gs_stderr:
+ * @caller_handle: a #fax_job
+ * @str: output
+ * @len: length of @str
+ *
+ * Forward ghostscript errors to debug log
+ *
+ * Returns: number of consumed bytes
+ */
+static int GSDLLCALL fax_gs_stderr(void *caller_handle, const char *str, int len)
+{
+	g_debug("%s(): %.*s", __FUNCTION__, len, str);
+
+	return len;
+}
+
+/**
+ * fax_gs_poll:
+ * @caller_handle: a #fax_job
+ *
+ * Called regularly by ghostscript while converting
+ *
+ * Returns: negative value to abort conversion
+ */
+static int GSDLLCALL fax_gs_poll(void *caller_handle)
+{
+	struct fax_job *job = caller_handle;
+
+	return g_cancellable_is_cancelled(job->cancellable) ? -1 : 0;
+}
+
+/**
+ * fax_get_out_file:
+ * @file_name: print file
+ *
+ * Get name of converted tiff file in cache directory
+ *
+ * Returns: tiff file name, free with g_free()
+ */
+static gchar *fax_get_out_file(const gchar *file_name)
+{
+	gchar *out_file;
+	gchar *base;
+	gchar *ofile;
+
+	base = g_path_get_basename(file_name);
+	ofile = g_strdup_printf("%s.tif", base);
+	out_file = g_build_filename(rm_get_user_cache_dir(), ofile, NULL);
+	g_free(ofile);
+	g_free(base);
+
+	return out_file;
+}
+
+/**
+ * convert_to_fax:
+ * @job: a #fax_job
+ *
+ * Convert print file of job to a G4 tiff file using ghostscript
+ *
+ * Returns: out file name or %NULL on error
+ */
+static gchar *convert_to_fax(struct fax_job *job)
+{
+	gchar *args[12];
 	gchar *output;
 	gchar *out_file;
-	RmProfile *profile = rm_profile_get_active();
 	gint ret;
 	gint ret1;
 	void *minst;
 
-	/* convert ps to fax */
+	/* convert ps to fax, progress messages are parsed so no -q */
 	args[0] = "gs";
-	args[1] = "-q";
-	args[2] = "-dNOPAUSE";
-	args[3] = "-dSAFER";
-	args[4] = "-dBATCH";
+	args[1] = "-dNOPAUSE";
+	args[2] = "-dSAFER";
+	args[3] = "-dBATCH";
 
-	{
-		gchar *ofile = g_strdup_printf("%s.tif", g_path_get_basename(file_name));
-		args[5] = "-sDEVICE=tiffg4";
-		out_file = g_build_filename(rm_get_user_cache_dir(), ofile, NULL);
-		g_free(ofile);
-	}
+	args[4] = "-sDEVICE=tiffg4";
+	out_file = fax_get_out_file(job->file_name);
 
 	g_debug("%s(): out_file: '%s'", __FUNCTION__, out_file);
 
-	args[6] = "-dPDFFitPage";
-	args[7] = "-dMaxStripSize=0";
-	switch (g_settings_get_int(profile->settings, "fax-resolution")) {
+	args[5] = "-dPDFFitPage";
+	args[6] = "-dMaxStripSize=0";
+	switch (job->resolution) {
 	case 2:
 		/* Super - fine */
-		args[8] = "-r204x392";
+		args[7] = "-r204x392";
 		break;
 	case 1:
 		/* Fine */
-		args[8] = "-r204x196";
+		args[7] = "-r204x196";
 		break;
 	default:
 		/* Standard */
-		args[8] = "-r204x98";
+		args[7] = "-r204x98";
 		break;
 	}
 	output = g_strdup_printf("-sOutputFile=%s", out_file);
-	args[9] = output;
-	args[10] = "-f";
-	args[11] = file_name;
-	args[12] = NULL;
+	args[8] = output;
+	args[9] = "-f";
+	args[10] = (gchar *)job->file_name;
+	args[11] = NULL;
 
-	ret = gsapi_new_instance(&minst, NULL);
+	/* Ghostscript supports only one instance per process, jobs are run one after another */
+	ret = gsapi_new_instance(&minst, job);
 	if (ret < 0) {
+		g_free(output);
+		g_free(out_file);
 		return NULL;
 	}
+	gsapi_set_stdio(minst, fax_gs_stdin, fax_gs_stdout, fax_gs_stderr);
+	gsapi_set_poll(minst, fax_gs_poll);
 	ret = gsapi_set_arg_encoding(minst, GS_ARG_ENCODING_UTF8);
 	g_debug("%s(): 1. ret %d", __FUNCTION__, ret);
-	ret = gsapi_init_with_args(minst, 12, args);
+	ret = gsapi_init_with_args(minst, 11, args);
 	g_debug("%s(): 1.1 ret %d", __FUNCTION__, ret);
 
 	ret1 = gsapi_exit(minst);
@@ -394,6 +697,15 @@ gchar *convert_to_fax(gchar *file_name)
 	g_debug("%s(): final ret %d", __FUNCTION__, ret1);
 
 	gsapi_delete_instance(minst);
+	g_free(output);
+
+	if (g_cancellable_is_cancelled(job->cancellable)) {
+		g_debug("%s(): Conversion cancelled", __FUNCTION__);
+		g_unlink(out_file);
+		g_free(out_file);
+
+		return NULL;
+	}
 
 	if (!g_file_test(out_file, G_FILE_TEST_EXISTS)) {
 		g_warning("%s(): Error converting print file to FAX format!", __FUNCTION__);
@@ -405,19 +717,192 @@ gchar *convert_to_fax(gchar *file_name)
 	return out_file;
 }
 
-void fax_process_cb(GtkWidget *widget, gchar *file_name, gpointer user_data)
+/**
+ * fax_convert_file:
+ * @file_name: print file
+ * @resolution: fax resolution setting (0 = standard, 1 = fine, 2 = super fine)
+ * @cancellable: a #GCancellable
+ * @page: location for page currently converted, updated atomically
+ * @pages: location for number of pages, updated atomically
+ *
+ * Convert print file to G4 tiff file, called from worker threads. PDF documents are
+ * rendered with poppler, ghostscript handles everything else (e.g. PostScript).
+ *
+ * Returns: out file name or %NULL on error
+ */
+gchar *fax_convert_file(const gchar *file_name, gint resolution, GCancellable *cancellable, gint *page, gint *pages)
 {
-	gchar *out_file;
+	struct fax_job job;
+	gchar *out_file = NULL;
+	gchar *key;
+
+	/* Same document has been converted before (cover sheets, forms, resends) */
+	key = fax_cache_get_key(file_name, resolution);
+	if (key) {
+		out_file = fax_get_out_file(file_name);
+
+		if (fax_cache_lookup(key, out_file)) {
+			g_free(key);
+			return out_file;
+		}
 
-	out_file = convert_to_fax(file_name);
-	//g_unlink(file_name);
+		g_clear_pointer(&out_file, g_free);
+	}
+
+	if (fax_render_is_pdf(file_name)) {
+		out_file = fax_get_out_file(file_name);
+
+		if (fax_render_pdf(file_name, out_file, resolution, cancellable, page, pages)) {
+			goto out;
+		}
 
-	if (out_file) {
-		g_idle_add(app_show_fax_window_idle, out_file);
+		g_clear_pointer(&out_file, g_free);
+		if (g_cancellable_is_cancelled(cancellable)) {
+			goto out;
+		}
+
+		g_debug("%s(): Rendering with poppler failed, falling back to ghostscript", __FUNCTION__);
+		g_atomic_int_set(page, 0);
+	}
+
+	job.file_name = file_name;
+	job.resolution = resolution;
+	job.cancellable = cancellable;
+	job.page = page;
+	job.pages = pages;
+	job.output = g_string_new(NULL);
+
+	/* Serialize conversions */
+	g_mutex_lock(&fax_convert_mutex);
+	if (!g_cancellable_is_cancelled(cancellable)) {
+		out_file = convert_to_fax(&job);
+	}
+	g_mutex_unlock(&fax_convert_mutex);
+
+	g_string_free(job.output, TRUE);
+
+out:
+	if (out_file && key) {
+		fax_cache_store(key, out_file);
+	}
+	g_free(key);
+
+	return out_file;
+}
+
+/**
+ * fax_convert_progress_cb:
+ * @user_data: a #fax_ui
+ *
+ * Show conversion progress of queued job in fax window
+ *
+ * Returns: %G_SOURCE_CONTINUE
+ */
+static gboolean fax_convert_progress_cb(gpointer user_data)
+{
+	struct fax_ui *fax_ui = user_data;
+	FaxQueueJob *job = fax_ui->job;
+	gint page = g_atomic_int_get(&job->page);
+	gint pages = g_atomic_int_get(&job->pages);
+	gchar *text;
+
+	if (pages > 0) {
+		text = g_strdup_printf(_("Converting page %d of %d…"), MAX(page, 1), pages);
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(fax_ui->progress_bar), (gdouble)MAX(page - 1, 0) / pages);
+	} else if (page > 0) {
+		text = g_strdup_printf(_("Converting page %d…"), page);
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(fax_ui->progress_bar));
+	} else {
+		text = g_strdup(_("Converting…"));
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(fax_ui->progress_bar));
 	}
+
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), text);
+	g_free(text);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * fax_window_job_converted:
+ * @job: a #FaxQueueJob
+ *
+ * Conversion of job shown in fax window finished, fax can be sent now
+ */
+void fax_window_job_converted(FaxQueueJob *job)
+{
+	struct fax_ui *fax_ui = job->window;
+
+	if (fax_ui->convert_timer_id) {
+		g_source_remove(fax_ui->convert_timer_id);
+		fax_ui->convert_timer_id = 0;
+	}
+
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(fax_ui->progress_bar), 0.0f);
+
+	if (!job->tiff_file) {
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), _("Error converting print file to FAX format!"));
+		return;
+	}
+
+	/* Restored job without attempts left */
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(fax_ui->progress_bar), job->state == FAX_QUEUE_JOB_FAILED ? _("Fax transfer failed") : "");
+
+	fax_ui->file = job->tiff_file;
+	fax_dial_buttons_set_dial(fax_ui, TRUE);
+}
+
+/**
+ * fax_window_show_job:
+ * @job: a #FaxQueueJob
+ *
+ * Show fax window for queued job. Jobs still being converted show their progress,
+ * jobs waiting for a retry are sent again automatically.
+ *
+ * Returns: %TRUE if window has been created
+ */
+gboolean fax_window_show_job(FaxQueueJob *job)
+{
+	struct fax_ui *fax_ui;
+
+	fax_ui = fax_window_new(NULL);
+	if (!fax_ui) {
+		return FALSE;
+	}
+
+	fax_ui->job = job;
+	job->window = fax_ui;
+
+	if (job->number) {
+		contact_search_set_text(CONTACT_SEARCH(fax_ui->contact_search), job->number);
+	}
+
+	switch (job->state) {
+	case FAX_QUEUE_JOB_QUEUED:
+	case FAX_QUEUE_JOB_CONVERTING:
+		/* Nothing to send until conversion is done */
+		gtk_widget_set_sensitive(fax_ui->pickup_button, FALSE);
+		gtk_widget_set_sensitive(fax_ui->hangup_button, FALSE);
+
+		fax_ui->convert_timer_id = g_timeout_add(250, fax_convert_progress_cb, fax_ui);
+		fax_convert_progress_cb(fax_ui);
+		break;
+	case FAX_QUEUE_JOB_RETRY:
+		fax_ui->file = job->tiff_file;
+		if (job->number) {
+			fax_ui->number = g_strdup(job->number);
+			fax_window_retry(fax_ui, g_settings_get_uint(app_settings, "fax-queue-retry-delay"));
+		}
+		break;
+	default:
+		fax_window_job_converted(job);
+		break;
+	}
+
+	return TRUE;
 }
 
 void fax_process_init(void)
 {
-	g_signal_connect(G_OBJECT(rm_object), "fax-process", G_CALLBACK(fax_process_cb), NULL);
+	fax_queue_init();
 }
@@ -20,18 +20,14 @@
 #ifndef ROGER_FAX_H
 #define ROGER_FAX_H
 
-G_BEGIN_DECLS
-
-struct fax_ui {
-	gchar *file;
+#include <roger/faxqueue.h>
 
-	GtkWidget *progress_bar;
-	GtkWidget *remote_label;
-
-	struct fax_status *status;
-};
+G_BEGIN_DECLS
 
 void fax_process_init(void);
+gchar *fax_convert_file(const gchar *file_name, gint resolution, GCancellable *cancellable, gint *page, gint *pages);
+gboolean fax_window_show_job(FaxQueueJob *job);
+void fax_window_job_converted(FaxQueueJob *job);
 void app_show_fax_window(gchar *tiff_file);
 void fax_window_clear(gpointer priv);
 
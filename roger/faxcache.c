@@ -0,0 +1,308 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <rm/rm.h>
+
+#include <roger/faxcache.h>
+
+/* Bump whenever the conversion output changes, old entries are not used anymore */
+#define FAX_CACHE_VERSION 1
+
+extern GSettings *app_settings;
+
+/* Conversions run in parallel, keep eviction and lookups apart */
+static GMutex fax_cache_mutex;
+
+struct fax_cache_entry {
+	gchar *file;
+	goffset size;
+	gint64 mtime;
+};
+
+/**
+ * fax_cache_get_dir:
+ *
+ * Get directory of converted fax documents
+ *
+ * Returns: cache directory, free with g_free()
+ */
+static gchar *fax_cache_get_dir(void)
+{
+	return g_build_filename(rm_get_user_cache_dir(), "fax", NULL);
+}
+
+/**
+ * fax_cache_get_file:
+ * @key: cache key
+ *
+ * Get cache file name of key
+ *
+ * Returns: file name, free with g_free()
+ */
+static gchar *fax_cache_get_file(const gchar *key)
+{
+	gchar *dir = fax_cache_get_dir();
+	gchar *name = g_strdup_printf("%s.tif", key);
+	gchar *file = g_build_filename(dir, name, NULL);
+
+	g_free(name);
+	g_free(dir);
+
+	return file;
+}
+
+/**
+ * fax_cache_get_key:
+ * @file_name: print file
+ * @resolution: fax resolution setting
+ *
+ * Hash print file content together with the resolution
+ *
+ * Returns: cache key or %NULL if cache is disabled or file could not be read, free with g_free()
+ */
+gchar *fax_cache_get_key(const gchar *file_name, gint resolution)
+{
+	GChecksum *checksum;
+	guchar buffer[65536];
+	gchar *key;
+	FILE *file;
+	gsize len;
+
+	if (!g_settings_get_uint(app_settings, "fax-cache-size")) {
+		/* Do not hash documents nobody is going to look up */
+		return NULL;
+	}
+
+	file = g_fopen(file_name, "rb");
+	if (!file) {
+		return NULL;
+	}
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		g_checksum_update(checksum, buffer, len);
+	}
+
+	if (ferror(file)) {
+		fclose(file);
+		g_checksum_free(checksum);
+		return NULL;
+	}
+	fclose(file);
+
+	key = g_strdup_printf("%s-%d-%d", g_checksum_get_string(checksum), resolution, FAX_CACHE_VERSION);
+	g_checksum_free(checksum);
+
+	return key;
+}
+
+/**
+ * fax_cache_copy:
+ * @src: source file name
+ * @dst: destination file name
+ *
+ * Copy file, replacing an existing destination
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean fax_cache_copy(const gchar *src, const gchar *dst)
+{
+	GFile *src_file = g_file_new_for_path(src);
+	GFile *dst_file = g_file_new_for_path(dst);
+	GError *error = NULL;
+	gboolean ret;
+
+	ret = g_file_copy(src_file, dst_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error);
+	if (!ret) {
+		g_debug("%s(): Could not copy '%s': %s", __FUNCTION__, src, error->message);
+		g_error_free(error);
+	}
+
+	g_object_unref(dst_file);
+	g_object_unref(src_file);
+
+	return ret;
+}
+
+/**
+ * fax_cache_lookup:
+ * @key: cache key
+ * @out_file: file name for the converted document
+ *
+ * Copy cached conversion to @out_file
+ *
+ * Returns: %TRUE on cache hit
+ */
+gboolean fax_cache_lookup(const gchar *key, const gchar *out_file)
+{
+	gchar *file = fax_cache_get_file(key);
+	gboolean ret = FALSE;
+
+	g_mutex_lock(&fax_cache_mutex);
+
+	if (g_file_test(file, G_FILE_TEST_IS_REGULAR)) {
+		ret = fax_cache_copy(file, out_file);
+		if (ret) {
+			/* Mark as recently used */
+			g_utime(file, NULL);
+		}
+	}
+
+	g_mutex_unlock(&fax_cache_mutex);
+
+	g_debug("%s(): %s '%s'", __FUNCTION__, ret ? "hit" : "miss", key);
+	g_free(file);
+
+	return ret;
+}
+
+static gint fax_cache_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const struct fax_cache_entry *entry_a = *(struct fax_cache_entry **)a;
+	const struct fax_cache_entry *entry_b = *(struct fax_cache_entry **)b;
+
+	return entry_a->mtime < entry_b->mtime ? -1 : entry_a->mtime > entry_b->mtime;
+}
+
+static void fax_cache_entry_free(gpointer data)
+{
+	struct fax_cache_entry *entry = data;
+
+	g_free(entry->file);
+	g_slice_free(struct fax_cache_entry, entry);
+}
+
+/**
+ * fax_cache_evict:
+ * @dir: cache directory
+ *
+ * Remove least recently used documents until the cache fits the configured size
+ */
+static void fax_cache_evict(const gchar *dir)
+{
+	GPtrArray *entries;
+	const gchar *name;
+	GDir *cache;
+	goffset limit = (goffset)g_settings_get_uint(app_settings, "fax-cache-size") * 1024 * 1024;
+	goffset total = 0;
+	guint index;
+
+	cache = g_dir_open(dir, 0, NULL);
+	if (!cache) {
+		return;
+	}
+
+	entries = g_ptr_array_new_with_free_func(fax_cache_entry_free);
+	while ((name = g_dir_read_name(cache)) != NULL) {
+		struct fax_cache_entry *entry;
+		GStatBuf buf;
+		gchar *file;
+
+		file = g_build_filename(dir, name, NULL);
+
+		if (g_str_has_suffix(name, ".tif.tmp")) {
+			/* Left behind by an interrupted store, mutex is held so nobody writes it */
+			g_unlink(file);
+			g_free(file);
+			continue;
+		}
+
+		if (!g_str_has_suffix(name, ".tif")) {
+			g_free(file);
+			continue;
+		}
+
+		if (g_stat(file, &buf)) {
+			g_free(file);
+			continue;
+		}
+
+		entry = g_slice_new(struct fax_cache_entry);
+		entry->file = file;
+		entry->size = buf.st_size;
+		entry->mtime = buf.st_mtime;
+		g_ptr_array_add(entries, entry);
+
+		total += entry->size;
+	}
+	g_dir_close(cache);
+
+	g_ptr_array_sort(entries, fax_cache_entry_compare);
+
+	for (index = 0; index < entries->len && total > limit; index++) {
+		struct fax_cache_entry *entry = g_ptr_array_index(entries, index);
+
+		g_debug("%s(): Removing '%s'", __FUNCTION__, entry->file);
+		if (!g_unlink(entry->file)) {
+			total -= entry->size;
+		}
+	}
+
+	g_ptr_array_free(entries, TRUE);
+}
+
+/**
+ * fax_cache_store:
+ * @key: cache key
+ * @file: converted document
+ *
+ * Add converted document to cache
+ */
+void fax_cache_store(const gchar *key, const gchar *file)
+{
+	gchar *dir = fax_cache_get_dir();
+	gchar *cache_file = fax_cache_get_file(key);
+	gchar *tmp_file = g_strconcat(cache_file, ".tmp", NULL);
+
+	if (!g_settings_get_uint(app_settings, "fax-cache-size")) {
+		goto out;
+	}
+
+	g_mutex_lock(&fax_cache_mutex);
+
+	g_mkdir_with_parents(dir, 0700);
+
+	/* Copy next to the entry and rename it into place, so a partial entry is never visible */
+	if (fax_cache_copy(file, tmp_file)) {
+		if (g_rename(tmp_file, cache_file)) {
+			g_debug("%s(): Could not rename '%s': %s", __FUNCTION__, tmp_file, g_strerror(errno));
+			g_unlink(tmp_file);
+		} else {
+			fax_cache_evict(dir);
+		}
+	} else {
+		g_unlink(tmp_file);
+	}
+
+	g_mutex_unlock(&fax_cache_mutex);
+
+out:
+	g_free(tmp_file);
+	g_free(cache_file);
+	g_free(dir);
+}
@@ -0,0 +1,33 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROGER_FAXCACHE_H
+#define ROGER_FAXCACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gchar *fax_cache_get_key(const gchar *file_name, gint resolution);
+gboolean fax_cache_lookup(const gchar *key, const gchar *out_file);
+void fax_cache_store(const gchar *key, const gchar *file);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,718 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+
+#include <rm/rm.h>
+
+#include <roger/fax.h>
+#include <roger/faxqueue.h>
+
+extern GSettings *app_settings;
+
+/* Jobs by id */
+static GHashTable *fax_queue_jobs = NULL;
+/* Spool directory monitor */
+static GFileMonitor *fax_queue_monitor = NULL;
+/* Arrival counter */
+static guint64 fax_queue_sequence = 0;
+/* Number of running conversions */
+static gint fax_queue_converting = 0;
+/* Number of jobs shown in a fax window */
+static gint fax_queue_dispatched = 0;
+
+static const gchar *fax_queue_state_names[] = {
+	"queued",
+	"converting",
+	"ready",
+	"sending",
+	"retry",
+	"failed",
+	"done",
+};
+
+static void fax_queue_process(void);
+
+/**
+ * fax_queue_get_state_file:
+ *
+ * Get file name of persistent queue state
+ *
+ * Returns: state file name, free with g_free()
+ */
+static gchar *fax_queue_get_state_file(void)
+{
+	return g_build_filename(rm_get_user_data_dir(), "fax-queue.ini", NULL);
+}
+
+/**
+ * fax_queue_job_new:
+ * @id: job id
+ * @spool_file: print file in spool directory
+ *
+ * Create a new queued job
+ *
+ * Returns: new #FaxQueueJob
+ */
+static FaxQueueJob *fax_queue_job_new(const gchar *id, const gchar *spool_file)
+{
+	FaxQueueJob *job = g_slice_new0(FaxQueueJob);
+
+	job->id = g_strdup(id);
+	job->spool_file = g_strdup(spool_file);
+	job->priority = FAX_QUEUE_DEFAULT_PRIORITY;
+	job->state = FAX_QUEUE_JOB_QUEUED;
+	job->cancellable = g_cancellable_new();
+
+	return job;
+}
+
+static void fax_queue_job_free(FaxQueueJob *job)
+{
+	if (job->retry_id) {
+		g_source_remove(job->retry_id);
+	}
+
+	g_free(job->id);
+	g_free(job->spool_file);
+	g_free(job->tiff_file);
+	g_free(job->number);
+	g_object_unref(job->cancellable);
+	g_slice_free(FaxQueueJob, job);
+}
+
+/**
+ * fax_queue_get_priority:
+ * @id: job id
+ *
+ * roger-cups appends the CUPS job priority as "-P<priority>" to the spool file name
+ *
+ * Returns: job priority
+ */
+static gint fax_queue_get_priority(const gchar *id)
+{
+	gchar *pos = g_strrstr(id, "-P");
+	gchar *end;
+	gint64 priority;
+
+	if (!pos) {
+		return FAX_QUEUE_DEFAULT_PRIORITY;
+	}
+
+	priority = g_ascii_strtoll(pos + 2, &end, 10);
+	if (end == pos + 2 || *end != '\0') {
+		return FAX_QUEUE_DEFAULT_PRIORITY;
+	}
+
+	return CLAMP(priority, 1, 100);
+}
+
+/**
+ * fax_queue_save:
+ *
+ * Write queue state, so that pending jobs survive a restart
+ */
+static void fax_queue_save(void)
+{
+	GKeyFile *key_file = g_key_file_new();
+	GHashTableIter iter;
+	gpointer value;
+	gchar *file;
+	gchar *data;
+	gsize len;
+	GError *error = NULL;
+
+	g_key_file_set_uint64(key_file, "queue", "sequence", fax_queue_sequence);
+
+	g_hash_table_iter_init(&iter, fax_queue_jobs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		FaxQueueJob *job = value;
+		FaxQueueJobState state = job->state;
+
+		/* Conversions are restarted */
+		if (state == FAX_QUEUE_JOB_CONVERTING) {
+			state = FAX_QUEUE_JOB_QUEUED;
+		}
+
+		g_key_file_set_string(key_file, job->id, "spool-file", job->spool_file);
+		if (job->tiff_file) {
+			g_key_file_set_string(key_file, job->id, "tiff-file", job->tiff_file);
+		}
+		if (job->number) {
+			g_key_file_set_string(key_file, job->id, "number", job->number);
+		}
+		g_key_file_set_integer(key_file, job->id, "priority", job->priority);
+		g_key_file_set_uint64(key_file, job->id, "sequence", job->sequence);
+		g_key_file_set_string(key_file, job->id, "state", fax_queue_state_names[state]);
+		g_key_file_set_integer(key_file, job->id, "attempts", job->attempts);
+		g_key_file_set_integer(key_file, job->id, "convert-attempts", job->convert_attempts);
+	}
+
+	data = g_key_file_to_data(key_file, &len, NULL);
+	file = fax_queue_get_state_file();
+
+	if (!g_file_set_contents(file, data, len, &error)) {
+		g_warning("%s(): Could not save fax queue: %s", __FUNCTION__, error->message);
+		g_error_free(error);
+	}
+
+	g_free(file);
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
+/**
+ * fax_queue_load:
+ *
+ * Restore queue state of last session
+ */
+static void fax_queue_load(void)
+{
+	GKeyFile *key_file = g_key_file_new();
+	gchar **groups;
+	gchar *file;
+	gint i;
+
+	file = fax_queue_get_state_file();
+	if (!g_key_file_load_from_file(key_file, file, G_KEY_FILE_NONE, NULL)) {
+		goto out;
+	}
+
+	fax_queue_sequence = g_key_file_get_uint64(key_file, "queue", "sequence", NULL);
+
+	groups = g_key_file_get_groups(key_file, NULL);
+	for (i = 0; groups[i]; i++) {
+		FaxQueueJob *job;
+		gchar *spool_file;
+		gchar *state;
+		gint index;
+
+		if (!strcmp(groups[i], "queue")) {
+			continue;
+		}
+
+		spool_file = g_key_file_get_string(key_file, groups[i], "spool-file", NULL);
+		if (!spool_file) {
+			continue;
+		}
+
+		job = fax_queue_job_new(groups[i], spool_file);
+		g_free(spool_file);
+
+		job->tiff_file = g_key_file_get_string(key_file, groups[i], "tiff-file", NULL);
+		job->number = g_key_file_get_string(key_file, groups[i], "number", NULL);
+		job->priority = g_key_file_get_integer(key_file, groups[i], "priority", NULL);
+		job->sequence = g_key_file_get_uint64(key_file, groups[i], "sequence", NULL);
+		job->attempts = g_key_file_get_integer(key_file, groups[i], "attempts", NULL);
+		job->convert_attempts = g_key_file_get_integer(key_file, groups[i], "convert-attempts", NULL);
+
+		state = g_key_file_get_string(key_file, groups[i], "state", NULL);
+		for (index = 0; index < (gint)G_N_ELEMENTS(fax_queue_state_names); index++) {
+			if (!g_strcmp0(state, fax_queue_state_names[index])) {
+				job->state = index;
+				break;
+			}
+		}
+		g_free(state);
+
+		/* An interrupted transfer is retried */
+		if (job->state == FAX_QUEUE_JOB_SENDING) {
+			job->state = FAX_QUEUE_JOB_RETRY;
+		}
+
+		/* Converted file is gone, convert again */
+		if (job->tiff_file && !g_file_test(job->tiff_file, G_FILE_TEST_EXISTS)) {
+			g_clear_pointer(&job->tiff_file, g_free);
+			job->state = FAX_QUEUE_JOB_QUEUED;
+		}
+
+		if (job->state == FAX_QUEUE_JOB_DONE || (!job->tiff_file && !g_file_test(job->spool_file, G_FILE_TEST_EXISTS))) {
+			g_debug("%s(): Dropping stale job '%s'", __FUNCTION__, job->id);
+			fax_queue_job_free(job);
+			continue;
+		}
+
+		if (!job->tiff_file) {
+			job->state = FAX_QUEUE_JOB_QUEUED;
+		}
+
+		g_debug("%s(): Restored job '%s' (%s)", __FUNCTION__, job->id, fax_queue_state_names[job->state]);
+		g_hash_table_insert(fax_queue_jobs, job->id, job);
+	}
+	g_strfreev(groups);
+
+out:
+	g_free(file);
+	g_key_file_free(key_file);
+}
+
+/**
+ * fax_queue_compare:
+ * @a: a #FaxQueueJob
+ * @b: a #FaxQueueJob
+ *
+ * Order jobs by priority, then by arrival
+ *
+ * Returns: sort order
+ */
+static gint fax_queue_compare(gconstpointer a, gconstpointer b)
+{
+	const FaxQueueJob *job_a = a;
+	const FaxQueueJob *job_b = b;
+
+	if (job_a->priority != job_b->priority) {
+		return job_b->priority - job_a->priority;
+	}
+
+	return job_a->sequence < job_b->sequence ? -1 : job_a->sequence > job_b->sequence;
+}
+
+/**
+ * fax_queue_remove:
+ * @job: a #FaxQueueJob
+ *
+ * Remove job and its files from queue
+ */
+static void fax_queue_remove(FaxQueueJob *job)
+{
+	g_unlink(job->spool_file);
+	if (job->tiff_file) {
+		g_unlink(job->tiff_file);
+	}
+
+	g_hash_table_steal(fax_queue_jobs, job->id);
+	fax_queue_save();
+}
+
+/**
+ * fax_queue_convert_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #FaxQueueJob
+ * @cancellable: a #GCancellable
+ *
+ * Convert job in worker thread
+ */
+static void fax_queue_convert_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	FaxQueueJob *job = task_data;
+	gint resolution = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(task), "resolution"));
+	gchar *out_file;
+
+	out_file = fax_convert_file(job->spool_file, resolution, cancellable, &job->page, &job->pages);
+
+	g_task_return_pointer(task, out_file, g_free);
+}
+
+static gboolean fax_queue_retry_cb(gpointer user_data)
+{
+	FaxQueueJob *job = user_data;
+
+	job->retry_id = 0;
+	fax_queue_process();
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * fax_queue_convert_ready_cb:
+ * @source_object: unused
+ * @res: a #GAsyncResult
+ * @user_data: a #FaxQueueJob
+ *
+ * Conversion finished, job can be sent
+ */
+static void fax_queue_convert_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	FaxQueueJob *job = user_data;
+	gchar *out_file;
+
+	fax_queue_converting--;
+
+	out_file = g_task_propagate_pointer(G_TASK(res), NULL);
+
+	if (!fax_queue_jobs) {
+		/* Queue has been shut down, job is converted again next time */
+		if (out_file) {
+			g_unlink(out_file);
+			g_free(out_file);
+		}
+		fax_queue_job_free(job);
+		return;
+	}
+
+	if (job->state == FAX_QUEUE_JOB_DONE) {
+		/* Job has been closed meanwhile */
+		if (out_file) {
+			g_unlink(out_file);
+			g_free(out_file);
+		}
+		g_unlink(job->spool_file);
+		fax_queue_job_free(job);
+		fax_queue_process();
+		return;
+	}
+
+	if (out_file) {
+		g_debug("%s(): Job '%s' converted", __FUNCTION__, job->id);
+		job->tiff_file = out_file;
+		job->state = FAX_QUEUE_JOB_READY;
+	} else if (++job->convert_attempts < g_settings_get_uint(app_settings, "fax-queue-retries") && !job->window) {
+		g_debug("%s(): Job '%s' conversion failed, retrying", __FUNCTION__, job->id);
+		job->state = FAX_QUEUE_JOB_QUEUED;
+		job->retry_id = g_timeout_add_seconds(g_settings_get_uint(app_settings, "fax-queue-retry-delay"), fax_queue_retry_cb, job);
+	} else {
+		g_warning("%s(): Could not convert job '%s'", __FUNCTION__, job->id);
+		job->state = FAX_QUEUE_JOB_FAILED;
+	}
+
+	if (job->window && job->state != FAX_QUEUE_JOB_QUEUED) {
+		fax_window_job_converted(job);
+	}
+
+	fax_queue_save();
+	fax_queue_process();
+}
+
+/**
+ * fax_queue_convert:
+ * @job: a #FaxQueueJob
+ *
+ * Start converting job in background
+ */
+static void fax_queue_convert(FaxQueueJob *job)
+{
+	RmProfile *profile = rm_profile_get_active();
+	GTask *task;
+
+	g_debug("%s(): Converting job '%s'", __FUNCTION__, job->id);
+
+	job->state = FAX_QUEUE_JOB_CONVERTING;
+	job->page = 0;
+	job->pages = 0;
+	fax_queue_converting++;
+
+	task = g_task_new(NULL, job->cancellable, fax_queue_convert_ready_cb, job);
+	g_task_set_task_data(task, job, NULL);
+	g_object_set_data(G_OBJECT(task), "resolution", GINT_TO_POINTER(g_settings_get_int(profile->settings, "fax-resolution")));
+	g_task_run_in_thread(task, fax_queue_convert_thread);
+	g_object_unref(task);
+}
+
+/**
+ * fax_queue_process:
+ *
+ * Start conversions and show fax windows as long as the configured concurrency allows it
+ */
+static void fax_queue_process(void)
+{
+	GList *jobs;
+	GList *list;
+	gint concurrency;
+
+	if (!fax_queue_jobs || !rm_profile_get_active()) {
+		return;
+	}
+
+	concurrency = MAX(g_settings_get_uint(app_settings, "fax-queue-concurrency"), 1);
+
+	jobs = g_list_sort(g_hash_table_get_values(fax_queue_jobs), fax_queue_compare);
+
+	/* Convert ahead of time */
+	for (list = jobs; list != NULL && fax_queue_converting < concurrency; list = list->next) {
+		FaxQueueJob *job = list->data;
+
+		if (job->state == FAX_QUEUE_JOB_QUEUED && !job->retry_id) {
+			fax_queue_convert(job);
+		}
+	}
+
+	/* Hand jobs over to fax windows */
+	for (list = jobs; list != NULL && fax_queue_dispatched < concurrency; list = list->next) {
+		FaxQueueJob *job = list->data;
+
+		if (job->window || job->state == FAX_QUEUE_JOB_QUEUED) {
+			continue;
+		}
+
+		if (fax_window_show_job(job)) {
+			fax_queue_dispatched++;
+		}
+	}
+
+	g_list_free(jobs);
+}
+
+/**
+ * fax_queue_add:
+ * @spool_file: print file in spool directory
+ *
+ * Add print file to queue unless it is already known
+ */
+void fax_queue_add(const gchar *spool_file)
+{
+	FaxQueueJob *job;
+	gchar *id;
+
+	if (!fax_queue_jobs || g_str_has_suffix(spool_file, ".tmp") || !g_file_test(spool_file, G_FILE_TEST_IS_REGULAR)) {
+		return;
+	}
+
+	id = g_path_get_basename(spool_file);
+	if (g_hash_table_contains(fax_queue_jobs, id)) {
+		g_free(id);
+		return;
+	}
+
+	job = fax_queue_job_new(id, spool_file);
+	job->priority = fax_queue_get_priority(id);
+	job->sequence = ++fax_queue_sequence;
+	g_free(id);
+
+	g_debug("%s(): Queued job '%s' (priority %d)", __FUNCTION__, job->id, job->priority);
+	g_hash_table_insert(fax_queue_jobs, job->id, job);
+
+	fax_queue_save();
+	fax_queue_process();
+}
+
+/**
+ * fax_queue_job_sending:
+ * @job: a #FaxQueueJob
+ * @number: target number
+ *
+ * Job is being sent to @number
+ */
+void fax_queue_job_sending(FaxQueueJob *job, const gchar *number)
+{
+	if (g_strcmp0(job->number, number)) {
+		g_free(job->number);
+		job->number = g_strdup(number);
+	}
+
+	job->state = FAX_QUEUE_JOB_SENDING;
+	fax_queue_save();
+}
+
+/**
+ * fax_queue_job_failed:
+ * @job: a #FaxQueueJob
+ *
+ * Sending job failed (e.g. line busy)
+ *
+ * Returns: delay in seconds until job should be retried, 0 if there are no attempts left
+ */
+guint fax_queue_job_failed(FaxQueueJob *job)
+{
+	guint retries = g_settings_get_uint(app_settings, "fax-queue-retries");
+	guint delay = 0;
+
+	job->attempts++;
+
+	if (job->attempts < retries) {
+		/* Back off a little more with every attempt */
+		delay = g_settings_get_uint(app_settings, "fax-queue-retry-delay") * job->attempts;
+		job->state = FAX_QUEUE_JOB_RETRY;
+	} else {
+		job->state = FAX_QUEUE_JOB_FAILED;
+	}
+
+	g_debug("%s(): Job '%s' attempt %d failed, retry in %u s", __FUNCTION__, job->id, job->attempts, delay);
+	fax_queue_save();
+
+	return delay;
+}
+
+/**
+ * fax_queue_job_sent:
+ * @job: a #FaxQueueJob
+ *
+ * Job has been sent successfully. Job is removed from queue and freed, the converted file
+ * is handed over to the fax window.
+ */
+void fax_queue_job_sent(FaxQueueJob *job)
+{
+	g_debug("%s(): Job '%s' sent", __FUNCTION__, job->id);
+
+	/* Converted file now belongs to the fax window */
+	job->tiff_file = NULL;
+	fax_queue_remove(job);
+	fax_queue_job_free(job);
+
+	fax_queue_dispatched--;
+	fax_queue_process();
+}
+
+/**
+ * fax_queue_job_close:
+ * @job: a #FaxQueueJob
+ *
+ * Fax window of job has been closed, job is discarded
+ */
+void fax_queue_job_close(FaxQueueJob *job)
+{
+	g_debug("%s(): Job '%s' closed", __FUNCTION__, job->id);
+
+	job->window = NULL;
+	fax_queue_dispatched--;
+
+	if (job->state == FAX_QUEUE_JOB_CONVERTING) {
+		/* Conversion callback cleans up */
+		job->state = FAX_QUEUE_JOB_DONE;
+		g_cancellable_cancel(job->cancellable);
+		g_hash_table_steal(fax_queue_jobs, job->id);
+		fax_queue_save();
+	} else {
+		fax_queue_remove(job);
+		fax_queue_job_free(job);
+	}
+
+	fax_queue_process();
+}
+
+/**
+ * fax_queue_changed_cb:
+ * @monitor: a #GFileMonitor
+ * @file: a #GFile
+ * @other_file: a #GFile
+ * @event_type: a #GFileMonitorEvent
+ * @user_data: unused
+ *
+ * New file in spool directory
+ */
+static void fax_queue_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+	gchar *path;
+
+	switch (event_type) {
+	case G_FILE_MONITOR_EVENT_CREATED:
+	case G_FILE_MONITOR_EVENT_MOVED_IN:
+		path = g_file_get_path(file);
+		break;
+	case G_FILE_MONITOR_EVENT_RENAMED:
+		/* roger-cups renames the finished temporary file */
+		path = g_file_get_path(other_file);
+		break;
+	default:
+		return;
+	}
+
+	fax_queue_add(path);
+	g_free(path);
+}
+
+/**
+ * fax_queue_fax_process_cb:
+ * @object: a #RmObject
+ * @file_name: spooled print file
+ * @user_data: unused
+ *
+ * librm found a new spool file
+ */
+static void fax_queue_fax_process_cb(RmObject *object, gchar *file_name, gpointer user_data)
+{
+	fax_queue_add(file_name);
+}
+
+/**
+ * fax_queue_init:
+ *
+ * Restore queue, pick up spooled files and watch spool directory
+ */
+void fax_queue_init(void)
+{
+	gchar *spool_dir;
+	GFile *dir;
+	GDir *spool;
+	const gchar *name;
+	GError *error = NULL;
+
+	fax_queue_jobs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)fax_queue_job_free);
+
+	fax_queue_load();
+
+	spool_dir = g_settings_get_string(app_settings, "fax-spool-dir");
+
+	/* Jobs which arrived while we were not running */
+	spool = g_dir_open(spool_dir, 0, NULL);
+	if (spool) {
+		while ((name = g_dir_read_name(spool)) != NULL) {
+			gchar *file = g_build_filename(spool_dir, name, NULL);
+
+			fax_queue_add(file);
+			g_free(file);
+		}
+		g_dir_close(spool);
+	}
+
+	dir = g_file_new_for_path(spool_dir);
+	fax_queue_monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+	if (fax_queue_monitor) {
+		g_signal_connect(fax_queue_monitor, "changed", G_CALLBACK(fax_queue_changed_cb), NULL);
+	} else {
+		g_debug("%s(): Could not watch '%s': %s", __FUNCTION__, spool_dir, error->message);
+		g_error_free(error);
+	}
+	g_object_unref(dir);
+	g_free(spool_dir);
+
+	/* librm watches its spool directory as well */
+	g_signal_connect(G_OBJECT(rm_object), "fax-process", G_CALLBACK(fax_queue_fax_process_cb), NULL);
+
+	fax_queue_process();
+}
+
+/**
+ * fax_queue_shutdown:
+ *
+ * Stop watching spool directory and save queue state
+ */
+void fax_queue_shutdown(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	if (!fax_queue_jobs) {
+		return;
+	}
+
+	g_signal_handlers_disconnect_by_func(G_OBJECT(rm_object), G_CALLBACK(fax_queue_fax_process_cb), NULL);
+	g_clear_object(&fax_queue_monitor);
+
+	fax_queue_save();
+
+	g_hash_table_iter_init(&iter, fax_queue_jobs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		FaxQueueJob *job = value;
+
+		if (job->state == FAX_QUEUE_JOB_CONVERTING) {
+			/* Conversion is restarted next time, worker still owns the job */
+			g_cancellable_cancel(job->cancellable);
+			g_hash_table_iter_steal(&iter);
+		}
+	}
+
+	g_clear_pointer(&fax_queue_jobs, g_hash_table_destroy);
+}
@@ -0,0 +1,83 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROGER_FAXQUEUE_H
+#define ROGER_FAXQUEUE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define FAX_QUEUE_DEFAULT_PRIORITY 50
+
+typedef enum {
+	FAX_QUEUE_JOB_QUEUED,
+	FAX_QUEUE_JOB_CONVERTING,
+	FAX_QUEUE_JOB_READY,
+	FAX_QUEUE_JOB_SENDING,
+	FAX_QUEUE_JOB_RETRY,
+	FAX_QUEUE_JOB_FAILED,
+	FAX_QUEUE_JOB_DONE,
+} FaxQueueJobState;
+
+/**
+ * FaxQueueJob:
+ * @id: job id (spool file base name)
+ * @spool_file: print file in spool directory
+ * @tiff_file: converted fax file or %NULL
+ * @number: number the job has been sent to, used for retries
+ * @priority: higher priority jobs are dispatched first
+ * @sequence: arrival order within the same priority
+ * @state: current #FaxQueueJobState
+ * @attempts: number of failed send attempts
+ * @convert_attempts: number of failed conversions
+ * @page: page currently converted (atomic)
+ * @pages: number of pages to convert if known (atomic)
+ * @cancellable: cancels the conversion
+ * @window: fax window showing this job or %NULL
+ * @retry_id: pending conversion retry source id
+ */
+typedef struct {
+	gchar *id;
+	gchar *spool_file;
+	gchar *tiff_file;
+	gchar *number;
+	gint priority;
+	guint64 sequence;
+	FaxQueueJobState state;
+	gint attempts;
+	gint convert_attempts;
+	gint page;
+	gint pages;
+	GCancellable *cancellable;
+	gpointer window;
+	guint retry_id;
+} FaxQueueJob;
+
+void fax_queue_init(void);
+void fax_queue_shutdown(void);
+void fax_queue_add(const gchar *spool_file);
+void fax_queue_job_sending(FaxQueueJob *job, const gchar *number);
+guint fax_queue_job_failed(FaxQueueJob *job);
+void fax_queue_job_sent(FaxQueueJob *job);
+void fax_queue_job_close(FaxQueueJob *job);
+
+G_END_DECLS
+
+#endif
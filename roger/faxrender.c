@@ -0,0 +1,425 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <cairo.h>
+#include <poppler.h>
+
+#include <tiff.h>
+#include <tiffio.h>
+
+#include <roger/faxrender.h>
+
+/* Standard fax line width (215 mm at 8.04 pixel/mm) */
+#define FAX_RENDER_WIDTH 1728
+#define FAX_RENDER_X_DPI 204
+/* Gray level below which a pixel becomes black */
+#define FAX_RENDER_THRESHOLD 128
+
+/**
+ * fax_render_page:
+ * @index: page index
+ * @width: width in pixel
+ * @height: height in pixel
+ * @stride: bytes per 1 bpp row
+ * @bits: 1 bpp bitmap, 1 = black, or %NULL on error
+ * @done: page has been rendered
+ */
+struct fax_render_page {
+	gint index;
+	gint width;
+	gint height;
+	gint stride;
+	guchar *bits;
+	gboolean done;
+};
+
+/**
+ * fax_render_worker:
+ * @document: poppler document of this worker
+ * @surface: RGB24 surface pages are rendered to, reused while pages fit, or %NULL
+ */
+struct fax_render_worker {
+	PopplerDocument *document;
+	cairo_surface_t *surface;
+};
+
+/**
+ * fax_render:
+ * @data: pdf file content, shared by all documents
+ * @length: length of @data
+ * @y_dpi: vertical resolution
+ * @workers: idle #fax_render_worker, one per pool thread at most
+ * @pages: all #fax_render_page
+ * @mutex: protects @pages
+ * @cond: signals a finished page
+ * @cancellable: a #GCancellable
+ */
+struct fax_render {
+	gchar *data;
+	gsize length;
+	gint y_dpi;
+	GAsyncQueue *workers;
+	struct fax_render_page *pages;
+	GMutex mutex;
+	GCond cond;
+	GCancellable *cancellable;
+};
+
+/**
+ * fax_render_is_pdf:
+ * @file_name: print file
+ *
+ * Check whether print file is a PDF document
+ *
+ * Returns: %TRUE if file starts with a PDF header
+ */
+gboolean fax_render_is_pdf(const gchar *file_name)
+{
+	gchar header[5];
+	gboolean ret = FALSE;
+	FILE *file;
+
+	file = g_fopen(file_name, "rb");
+	if (!file) {
+		return FALSE;
+	}
+
+	if (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+		ret = !memcmp(header, "%PDF-", sizeof(header));
+	}
+	fclose(file);
+
+	return ret;
+}
+
+/**
+ * fax_render_worker_free:
+ * @data: a #fax_render_worker
+ *
+ * Free worker with its document and surface
+ */
+static void fax_render_worker_free(gpointer data)
+{
+	struct fax_render_worker *worker = data;
+
+	if (worker->surface) {
+		cairo_surface_destroy(worker->surface);
+	}
+	g_object_unref(worker->document);
+
+	g_slice_free(struct fax_render_worker, worker);
+}
+
+/**
+ * fax_render_threshold:
+ * @image: RGB24 cairo image data
+ * @image_stride: stride of @image
+ * @rows: number of rows to convert
+ * @width: width in pixel
+ * @bits: 1 bpp destination
+ * @stride: stride of @bits
+ *
+ * Convert rendered page to 1 bpp, black is set
+ */
+static void fax_render_threshold(const guchar *image, gint image_stride, gint rows, gint width, guchar *bits, gint stride)
+{
+	gint y;
+	gint x;
+
+	for (y = 0; y < rows; y++) {
+		const guint32 *src = (const guint32 *)(image + y * image_stride);
+		guchar *dst = bits + y * stride;
+
+		for (x = 0; x < width; x++) {
+			guint32 pixel = src[x];
+			/* Integer luma approximation (0.299 R + 0.587 G + 0.114 B) */
+			guint gray = (((pixel >> 16) & 0xFF) * 77 + ((pixel >> 8) & 0xFF) * 150 + (pixel & 0xFF) * 29) >> 8;
+
+			if (gray < FAX_RENDER_THRESHOLD) {
+				dst[x >> 3] |= 0x80 >> (x & 7);
+			}
+		}
+	}
+}
+
+/**
+ * fax_render_page_func:
+ * @data: a #fax_render_page
+ * @user_data: a #fax_render
+ *
+ * Rasterize one page in a pool thread
+ */
+static void fax_render_page_func(gpointer data, gpointer user_data)
+{
+	struct fax_render_page *render_page = data;
+	struct fax_render *render = user_data;
+	struct fax_render_worker *worker;
+	PopplerPage *page = NULL;
+	cairo_t *cr;
+	gdouble page_width;
+	gdouble page_height;
+	gdouble scale_x;
+	gdouble scale_y;
+
+	if (g_cancellable_is_cancelled(render->cancellable)) {
+		goto out;
+	}
+
+	/* Poppler documents must not be shared between threads, each worker uses its own */
+	worker = g_async_queue_try_pop(render->workers);
+	if (!worker) {
+		PopplerDocument *document = poppler_document_new_from_data(render->data, (gint)render->length, NULL, NULL);
+
+		if (!document) {
+			goto out;
+		}
+
+		worker = g_slice_new0(struct fax_render_worker);
+		worker->document = document;
+	}
+
+	page = poppler_document_get_page(worker->document, render_page->index);
+	if (!page) {
+		g_async_queue_push(render->workers, worker);
+		goto out;
+	}
+
+	/* Fit page to fax line width */
+	poppler_page_get_size(page, &page_width, &page_height);
+	scale_x = FAX_RENDER_WIDTH / page_width;
+	scale_y = scale_x * render->y_dpi / FAX_RENDER_X_DPI;
+
+	render_page->width = FAX_RENDER_WIDTH;
+	render_page->height = ceil(page_height * scale_y);
+	render_page->stride = (render_page->width + 7) / 8;
+	render_page->bits = g_malloc0(render_page->stride * render_page->height);
+
+	/* Render whole page once, the surface is kept for the next page of this worker */
+	if (worker->surface && cairo_image_surface_get_height(worker->surface) < render_page->height) {
+		g_clear_pointer(&worker->surface, cairo_surface_destroy);
+	}
+	if (!worker->surface) {
+		worker->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, render_page->width, render_page->height);
+	}
+
+	cr = cairo_create(worker->surface);
+	cairo_set_source_rgb(cr, 1.0f, 1.0f, 1.0f);
+	cairo_paint(cr);
+	cairo_scale(cr, scale_x, scale_y);
+	poppler_page_render_for_printing(page, cr);
+	cairo_destroy(cr);
+
+	cairo_surface_flush(worker->surface);
+	fax_render_threshold(cairo_image_surface_get_data(worker->surface), cairo_image_surface_get_stride(worker->surface), render_page->height, render_page->width, render_page->bits, render_page->stride);
+
+	g_object_unref(page);
+	g_async_queue_push(render->workers, worker);
+
+out:
+	g_mutex_lock(&render->mutex);
+	render_page->done = TRUE;
+	g_cond_broadcast(&render->cond);
+	g_mutex_unlock(&render->mutex);
+}
+
+/**
+ * fax_render_write_page:
+ * @tiff: a #TIFF
+ * @render_page: a #fax_render_page
+ * @y_dpi: vertical resolution
+ * @pages: number of pages
+ *
+ * Append page to G4 tiff file
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean fax_render_write_page(TIFF *tiff, struct fax_render_page *render_page, gint y_dpi, gint pages)
+{
+	gint y;
+
+	TIFFSetField(tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+	TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, render_page->width);
+	TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, render_page->height);
+	TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 1);
+	TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
+	TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_CCITTFAX4);
+	TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+	TIFFSetField(tiff, TIFFTAG_FILLORDER, FILLORDER_MSB2LSB);
+	TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff, TIFFTAG_XRESOLUTION, (gfloat)FAX_RENDER_X_DPI);
+	TIFFSetField(tiff, TIFFTAG_YRESOLUTION, (gfloat)y_dpi);
+	TIFFSetField(tiff, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+	TIFFSetField(tiff, TIFFTAG_PAGENUMBER, render_page->index, pages);
+	/* Single strip per page, same layout as ghostscript with -dMaxStripSize=0 */
+	TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, render_page->height);
+
+	for (y = 0; y < render_page->height; y++) {
+		if (TIFFWriteScanline(tiff, render_page->bits + y * render_page->stride, y, 0) < 0) {
+			return FALSE;
+		}
+	}
+
+	return TIFFWriteDirectory(tiff);
+}
+
+/**
+ * fax_render_pdf:
+ * @file_name: pdf print file
+ * @out_file: G4 tiff file to create
+ * @resolution: fax resolution setting (0 = standard, 1 = fine, 2 = super fine)
+ * @cancellable: a #GCancellable
+ * @page: location for page currently converted, updated atomically
+ * @pages: location for number of pages, updated atomically
+ *
+ * Rasterize pdf document with poppler on a thread pool and write pages in order to a G4 tiff file
+ *
+ * Returns: %TRUE on success
+ */
+gboolean fax_render_pdf(const gchar *file_name, const gchar *out_file, gint resolution, GCancellable *cancellable, gint *page, gint *pages)
+{
+	struct fax_render render;
+	struct fax_render_worker *worker;
+	PopplerDocument *document;
+	GThreadPool *pool;
+	TIFF *tiff = NULL;
+	gboolean ret = FALSE;
+	gint num_pages;
+	gint window;
+	gint next;
+	gint index;
+
+	memset(&render, 0, sizeof(render));
+
+	if (!g_file_get_contents(file_name, &render.data, &render.length, NULL)) {
+		return FALSE;
+	}
+
+	document = poppler_document_new_from_data(render.data, (gint)render.length, NULL, NULL);
+	if (!document) {
+		g_debug("%s(): Could not open '%s' with poppler", __FUNCTION__, file_name);
+		g_free(render.data);
+		return FALSE;
+	}
+
+	num_pages = poppler_document_get_n_pages(document);
+	if (num_pages <= 0) {
+		g_object_unref(document);
+		g_free(render.data);
+		return FALSE;
+	}
+
+	g_atomic_int_set(pages, num_pages);
+
+	switch (resolution) {
+	case 2:
+		render.y_dpi = 392;
+		break;
+	case 1:
+		render.y_dpi = 196;
+		break;
+	default:
+		render.y_dpi = 98;
+		break;
+	}
+
+	render.workers = g_async_queue_new_full(fax_render_worker_free);
+	worker = g_slice_new0(struct fax_render_worker);
+	worker->document = document;
+	g_async_queue_push(render.workers, worker);
+	render.pages = g_new0(struct fax_render_page, num_pages);
+	render.cancellable = cancellable;
+	g_mutex_init(&render.mutex);
+	g_cond_init(&render.cond);
+
+	pool = g_thread_pool_new(fax_render_page_func, &render, g_get_num_processors(), FALSE, NULL);
+
+	/* Limit the number of finished pages waiting for the writer */
+	window = g_get_num_processors() * 2;
+	for (next = 0; next < num_pages && next < window; next++) {
+		render.pages[next].index = next;
+		g_thread_pool_push(pool, &render.pages[next], NULL);
+	}
+
+	tiff = TIFFOpen(out_file, "w");
+	if (!tiff) {
+		goto out;
+	}
+
+	for (index = 0; index < num_pages; index++) {
+		struct fax_render_page *render_page = &render.pages[index];
+
+		g_mutex_lock(&render.mutex);
+		while (!render_page->done) {
+			g_cond_wait(&render.cond, &render.mutex);
+		}
+		g_mutex_unlock(&render.mutex);
+
+		if (!render_page->bits || g_cancellable_is_cancelled(cancellable)) {
+			goto out;
+		}
+
+		g_atomic_int_set(page, index + 1);
+
+		if (!fax_render_write_page(tiff, render_page, render.y_dpi, num_pages)) {
+			g_warning("%s(): Could not write page %d", __FUNCTION__, index + 1);
+			goto out;
+		}
+
+		g_clear_pointer(&render_page->bits, g_free);
+
+		if (next < num_pages) {
+			render.pages[next].index = next;
+			g_thread_pool_push(pool, &render.pages[next], NULL);
+			next++;
+		}
+	}
+
+	ret = TRUE;
+
+out:
+	/* On error queued pages are dropped, running ones are waited for */
+	g_thread_pool_free(pool, !ret, TRUE);
+
+	if (tiff) {
+		TIFFClose(tiff);
+	}
+
+	if (!ret) {
+		g_unlink(out_file);
+	}
+
+	for (index = 0; index < num_pages; index++) {
+		g_free(render.pages[index].bits);
+	}
+	g_free(render.pages);
+	g_mutex_clear(&render.mutex);
+	g_cond_clear(&render.cond);
+	g_async_queue_unref(render.workers);
+	g_free(render.data);
+
+	return ret;
+}
@@ -0,0 +1,32 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROGER_FAXRENDER_H
+#define ROGER_FAXRENDER_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+gboolean fax_render_is_pdf(const gchar *file_name);
+gboolean fax_render_pdf(const gchar *file_name, const gchar *out_file, gint resolution, GCancellable *cancellable, gint *page, gint *pages);
+
+G_END_DECLS
+
+#endif
@@ -35,9 +35,11 @@
 #include <roger/journal.h>
 #include <roger/print.h>
 #include <roger/contacts.h>
+#include <roger/contactsdelta.h>
 #include <roger/application.h>
 #include <roger/uitools.h>
 #include <roger/answeringmachine.h>
+#include <roger/contactlookup.h>
 
 GtkWidget *journal_view = NULL;
 GtkWidget *journal_win = NULL;
@@ -56,6 +58,12 @@ static RmFilter *journal_filter = NULL;
 static RmFilter *journal_search_filter = NULL;
 static GtkWidget *spinner = NULL;
 static GMutex journal_mutex;
+/* Full remote number -> GSList of #RmCallEntry, built on first contacts delta */
+static GHashTable *journal_numbers = NULL;
+/* #RmCallEntry -> name and company before they have been taken from the address book */
+static GHashTable *journal_book_names = NULL;
+
+static void journal_numbers_invalidate(void);
 
 void journal_clear(void)
 {
@@ -203,6 +211,21 @@ void journal_redraw(void)
 	g_free(text);
 }
 
+/**
+ * journal_add_call_entry:
+ * @call: a #RmCallEntry, journal takes ownership
+ *
+ * Add a locally created entry (e.g. fax report) without reloading the journal
+ */
+void journal_add_call_entry(RmCallEntry *call)
+{
+	journal_list = g_slist_prepend(journal_list, call);
+	journal_numbers_invalidate();
+
+	journal_clear();
+	journal_redraw();
+}
+
 static gboolean reload_journal(gpointer user_data)
 {
 	GtkListStore *list_store;
@@ -281,6 +304,11 @@ void journal_loaded_cb(RmObject *obj, GSList *journal, gpointer unused)
 	old = journal_list;
 	journal_list = journal;
 
+	journal_numbers_invalidate();
+	if (journal_book_names) {
+		g_hash_table_remove_all(journal_book_names);
+	}
+
 	if (old) {
 		g_slist_free_full(old, rm_call_entry_free);
 	}
@@ -370,6 +398,10 @@ void delete_foreach(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, g
 		break;
 	default:
 		journal_list = g_slist_remove(journal_list, call);
+		journal_numbers_invalidate();
+		if (journal_book_names) {
+			g_hash_table_remove(journal_book_names, call);
+		}
 		g_debug("Deleting: '%s'", call->date_time);
 		rm_journal_save(journal_list);
 		break;
@@ -914,8 +946,170 @@ void add_contact_activated(GSimpleAction *action, GVariant *parameter, gpointer
 	journal_button_add_clicked_cb(NULL, journal_view);
 }
 
+/**
+ * journal_numbers_invalidate:
+ *
+ * Drop number index, journal entries have changed
+ */
+static void journal_numbers_invalidate(void)
+{
+	g_clear_pointer(&journal_numbers, g_hash_table_destroy);
+}
+
+static void journal_numbers_free(gpointer data)
+{
+	g_slist_free(data);
+}
+
+/**
+ * journal_numbers_get:
+ *
+ * Get (and build on first use) index of journal entries by full remote number
+ *
+ * Returns: full number -> GSList of #RmCallEntry
+ */
+static GHashTable *journal_numbers_get(void)
+{
+	GSList *list;
+
+	if (journal_numbers) {
+		return journal_numbers;
+	}
+
+	journal_numbers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, journal_numbers_free);
+
+	for (list = journal_list; list != NULL; list = list->next) {
+		RmCallEntry *call = list->data;
+		gchar *full_number;
+		GSList *calls;
+
+		if (RM_EMPTY_STRING(call->remote->number)) {
+			continue;
+		}
+
+		full_number = rm_number_full(call->remote->number, FALSE);
+		calls = g_hash_table_lookup(journal_numbers, full_number);
+		if (calls) {
+			/* Key is owned by the table already, list head stays the same */
+			calls->next = g_slist_prepend(calls->next, call);
+			g_free(full_number);
+		} else {
+			g_hash_table_insert(journal_numbers, full_number, g_slist_prepend(NULL, call));
+		}
+	}
+
+	return journal_numbers;
+}
+
+/**
+ * journal_update_remote:
+ * @call: a #RmCallEntry
+ * @full_number: full remote number of @call
+ *
+ * Re-resolves name and company of call remote side using the address book. Names
+ * taken from the address book are remembered, so that only those are reverted once
+ * the contact is gone. Names of the router or a reverse lookup stay untouched.
+ */
+static void journal_update_remote(RmCallEntry *call, const gchar *full_number)
+{
+	RmContact *contact;
+	gchar **original;
+
+	if (!journal_book_names) {
+		journal_book_names = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_strfreev);
+	}
+
+	contact = contact_lookup_find_by_number(full_number);
+	original = g_hash_table_lookup(journal_book_names, call);
+
+	if (contact && !RM_EMPTY_STRING(contact->name)) {
+		if (!original) {
+			original = g_new0(gchar *, 3);
+			original[0] = g_strdup(call->remote->name);
+			original[1] = g_strdup(call->remote->company);
+			g_hash_table_insert(journal_book_names, call, original);
+		}
+
+		g_free(call->remote->name);
+		call->remote->name = g_strdup(contact->name);
+		g_free(call->remote->company);
+		call->remote->company = g_strdup(contact->company);
+	} else if (original) {
+		/* Name was taken from the address book, but contact is gone */
+		g_free(call->remote->name);
+		call->remote->name = g_strdup(original[0] ? original[0] : "");
+		g_free(call->remote->company);
+		call->remote->company = g_strdup(original[1] ? original[1] : "");
+		g_hash_table_remove(journal_book_names, call);
+	}
+}
+
+/**
+ * journal_apply_contacts_delta:
+ * @delta: a #ContactsDelta
+ *
+ * Re-resolves only those journal entries whose remote number is affected by @delta
+ * and updates the matching rows of the list store.
+ */
+static void journal_apply_contacts_delta(ContactsDelta *delta)
+{
+	GHashTable *changed;
+	GHashTable *numbers;
+	GHashTableIter number_iter;
+	GtkListStore *list_store;
+	GtkTreeIter iter;
+	gpointer key;
+	gboolean valid;
+	GSList *list;
+
+	changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+	numbers = journal_numbers_get();
+
+	/* Only visit entries calling from or to an affected number */
+	g_hash_table_iter_init(&number_iter, delta->numbers);
+	while (g_hash_table_iter_next(&number_iter, &key, NULL)) {
+		for (list = g_hash_table_lookup(numbers, key); list != NULL; list = list->next) {
+			RmCallEntry *call = list->data;
+
+			journal_update_remote(call, key);
+			g_hash_table_add(changed, call);
+		}
+	}
+
+	g_debug("%s(): %d journal entries affected", __FUNCTION__, g_hash_table_size(changed));
+
+	if (journal_win && g_hash_table_size(changed)) {
+		list_store = g_object_get_data(G_OBJECT(journal_win), "list_store");
+		valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(list_store), &iter);
+		while (valid) {
+			RmCallEntry *call;
+
+			gtk_tree_model_get(GTK_TREE_MODEL(list_store), &iter, JOURNAL_COL_CALL_PTR, &call, -1);
+
+			if (g_hash_table_contains(changed, call)) {
+				gtk_list_store_set(list_store, &iter,
+						   JOURNAL_COL_NAME, call->remote->name,
+						   JOURNAL_COL_COMPANY, call->remote->company,
+						   -1);
+			}
+			valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(list_store), &iter);
+		}
+	}
+
+	g_hash_table_destroy(changed);
+}
+
 static void journal_contacts_changed_cb(RmObject *app, gpointer user_data)
 {
+	ContactsDelta *delta = contacts_delta_get();
+
+	if (delta && g_mutex_trylock(&journal_mutex)) {
+		/* Only touch affected entries */
+		journal_apply_contacts_delta(delta);
+		g_mutex_unlock(&journal_mutex);
+		return;
+	}
+
 	journal_button_refresh_clicked_cb(NULL, NULL);
 }
 
@@ -54,6 +54,7 @@ gboolean roger_uses_headerbar(void);
 void journal_clear(void);
 void journal_init_call_icon(void);
 void journal_redraw(void);
+void journal_add_call_entry(RmCallEntry *call);
 
 G_END_DECLS
 
@@ -18,6 +18,7 @@
  */
 
 #include <glib/gi18n.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <glib.h>
@@ -37,34 +38,262 @@ typedef struct pdf_viewer {
 	gint length;
 	gint num_pages;
 	gint current_page;
+
+	/* Rendered pages (index + 1 -> cairo_surface_t) at cache_scale and cache_device_scale */
+	GHashTable *cache;
+	gdouble cache_scale;
+	gint cache_device_scale;
+	/* Separate document for the prefetch worker, poppler documents are not thread safe */
+	PopplerDocument *prefetch_doc;
+	gboolean prefetch_busy;
+	gboolean prefetch_pending;
+	gboolean closed;
 } PdfViewer;
 
+/**
+ * pdf_prefetch_job:
+ * @pdf_viewer: a #PdfViewer
+ * @pages: page indices to render
+ * @surfaces: rendered pages, same order as @pages
+ * @scale: scale factor
+ * @device_scale: widget scale factor, pixels per logical pixel
+ */
+struct pdf_prefetch_job {
+	PdfViewer *pdf_viewer;
+	GArray *pages;
+	GPtrArray *surfaces;
+	gdouble scale;
+	gint device_scale;
+};
+
+static void pdf_prefetch(PdfViewer *pdf_viewer);
+
+/**
+ * pdf_render_page:
+ * @page: a #PopplerPage
+ * @scale: scale factor
+ * @device_scale: widget scale factor
+ *
+ * Render page into an image surface at device resolution, so it stays sharp on HiDPI screens
+ *
+ * Returns: new cairo image surface
+ */
+static cairo_surface_t *pdf_render_page(PopplerPage *page, gdouble scale, gint device_scale)
+{
+	cairo_surface_t *surface;
+	gdouble popwidth, popheight;
+	cairo_t *cr;
+
+	poppler_page_get_size(page, &popwidth, &popheight);
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ceil(popwidth * scale * device_scale), ceil(popheight * scale * device_scale));
+	cairo_surface_set_device_scale(surface, device_scale, device_scale);
+	cr = cairo_create(surface);
+	cairo_scale(cr, scale, scale);
+	poppler_page_render(page, cr);
+	cairo_destroy(cr);
+
+	return surface;
+}
+
+static void pdf_viewer_free(PdfViewer *pdf_viewer)
+{
+	g_hash_table_destroy(pdf_viewer->cache);
+	g_clear_object(&pdf_viewer->prefetch_doc);
+	g_clear_object(&pdf_viewer->page);
+	g_object_unref(pdf_viewer->doc);
+	g_free(pdf_viewer->data);
+	g_slice_free(PdfViewer, pdf_viewer);
+}
+
+/**
+ * pdf_cache_trim:
+ * @pdf_viewer: a #PdfViewer
+ *
+ * Keep only current page and its neighbours in cache
+ */
+static void pdf_cache_trim(PdfViewer *pdf_viewer)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, pdf_viewer->cache);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		gint index = GPOINTER_TO_INT(key) - 1;
+
+		if (ABS(index - pdf_viewer->current_page) > 1) {
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+}
+
+/**
+ * pdf_prefetch_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #pdf_prefetch_job
+ * @cancellable: unused
+ *
+ * Render neighbour pages in background
+ */
+static void pdf_prefetch_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct pdf_prefetch_job *job = task_data;
+	PdfViewer *pdf_viewer = job->pdf_viewer;
+	guint index;
+
+	for (index = 0; index < job->pages->len; index++) {
+		PopplerPage *page = poppler_document_get_page(pdf_viewer->prefetch_doc, g_array_index(job->pages, gint, index));
+
+		g_ptr_array_add(job->surfaces, page ? pdf_render_page(page, job->scale, job->device_scale) : NULL);
+		g_clear_object(&page);
+	}
+
+	g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * pdf_prefetch_ready_cb:
+ * @source_object: unused
+ * @res: a #GAsyncResult
+ * @user_data: a #pdf_prefetch_job
+ *
+ * Store prefetched pages in cache
+ */
+static void pdf_prefetch_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	struct pdf_prefetch_job *job = user_data;
+	PdfViewer *pdf_viewer = job->pdf_viewer;
+	guint index;
+
+	pdf_viewer->prefetch_busy = FALSE;
+
+	for (index = 0; index < job->surfaces->len; index++) {
+		cairo_surface_t *surface = g_ptr_array_index(job->surfaces, index);
+		gint page = g_array_index(job->pages, gint, index);
+
+		if (!surface) {
+			continue;
+		}
+
+		/* Drop pages rendered for an old size */
+		if (pdf_viewer->closed || job->scale != pdf_viewer->cache_scale || job->device_scale != pdf_viewer->cache_device_scale || ABS(page - pdf_viewer->current_page) > 1) {
+			cairo_surface_destroy(surface);
+			continue;
+		}
+
+		g_hash_table_replace(pdf_viewer->cache, GINT_TO_POINTER(page + 1), surface);
+	}
+
+	g_array_free(job->pages, TRUE);
+	g_ptr_array_free(job->surfaces, TRUE);
+	g_slice_free(struct pdf_prefetch_job, job);
+
+	if (pdf_viewer->closed) {
+		pdf_viewer_free(pdf_viewer);
+		return;
+	}
+
+	if (pdf_viewer->prefetch_pending) {
+		pdf_viewer->prefetch_pending = FALSE;
+		pdf_prefetch(pdf_viewer);
+	}
+}
+
+/**
+ * pdf_prefetch:
+ * @pdf_viewer: a #PdfViewer
+ *
+ * Render previous and next page on a worker thread so paging is instant
+ */
+static void pdf_prefetch(PdfViewer *pdf_viewer)
+{
+	struct pdf_prefetch_job *job;
+	GTask *task;
+	gint page;
+
+	if (!pdf_viewer->prefetch_doc || pdf_viewer->cache_scale <= 0) {
+		return;
+	}
+
+	if (pdf_viewer->prefetch_busy) {
+		pdf_viewer->prefetch_pending = TRUE;
+		return;
+	}
+
+	job = g_slice_new0(struct pdf_prefetch_job);
+	job->pdf_viewer = pdf_viewer;
+	job->pages = g_array_new(FALSE, FALSE, sizeof(gint));
+	job->scale = pdf_viewer->cache_scale;
+	job->device_scale = pdf_viewer->cache_device_scale;
+
+	/* Next page first, that is where readers usually go */
+	for (page = pdf_viewer->current_page + 1; page >= pdf_viewer->current_page - 1; page -= 2) {
+		if (page < 0 || page >= pdf_viewer->num_pages || g_hash_table_contains(pdf_viewer->cache, GINT_TO_POINTER(page + 1))) {
+			continue;
+		}
+		g_array_append_val(job->pages, page);
+	}
+
+	if (!job->pages->len) {
+		g_array_free(job->pages, TRUE);
+		g_slice_free(struct pdf_prefetch_job, job);
+		return;
+	}
+
+	job->surfaces = g_ptr_array_new();
+	pdf_viewer->prefetch_busy = TRUE;
+
+	task = g_task_new(NULL, NULL, pdf_prefetch_ready_cb, job);
+	g_task_set_task_data(task, job, NULL);
+	g_task_run_in_thread(task, pdf_prefetch_thread);
+	g_object_unref(task);
+}
+
 /**
  * pdf_draw_cb:
  * @widget: a #GtkDrawingArea
  * @cr: a #cairo_t
  * @user_data: a #PdfViewer
  *
- * Draw pdf on gtk drawing area
+ * Draw pdf on gtk drawing area, pages are rendered once per scale and cached
  *
  * Returns: %FALSE
  */
 static gboolean pdf_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
 {
 	PdfViewer *pdf_viewer = user_data;
+	cairo_surface_t *surface;
 	guint width;
+	gint device_scale;
 	gdouble popwidth, popheight, scale_factor;
 
 	width = gtk_widget_get_allocated_width(widget);
+	device_scale = gtk_widget_get_scale_factor(widget);
 	poppler_page_get_size(pdf_viewer->page, &popwidth, &popheight);
 
 	scale_factor = width / popwidth;
 
-	cairo_scale(cr, scale_factor, scale_factor);
-	poppler_page_render(pdf_viewer->page, cr);
+	/* Size or monitor scale changed, cached pages are useless now */
+	if (scale_factor != pdf_viewer->cache_scale || device_scale != pdf_viewer->cache_device_scale) {
+		g_hash_table_remove_all(pdf_viewer->cache);
+		pdf_viewer->cache_scale = scale_factor;
+		pdf_viewer->cache_device_scale = device_scale;
+	}
+
+	surface = g_hash_table_lookup(pdf_viewer->cache, GINT_TO_POINTER(pdf_viewer->current_page + 1));
+	if (!surface) {
+		surface = pdf_render_page(pdf_viewer->page, scale_factor, device_scale);
+		g_hash_table_insert(pdf_viewer->cache, GINT_TO_POINTER(pdf_viewer->current_page + 1), surface);
+	}
+
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_paint(cr);
 
 	gtk_widget_set_size_request(widget, (int)popwidth * scale_factor, (int)popheight * scale_factor);
 
+	pdf_prefetch(pdf_viewer);
+
 	return FALSE;
 }
 
@@ -102,7 +331,9 @@ static void pdf_prev_page(GtkWidget *widget, gpointer user_data)
 	if (pdf_viewer->current_page - 1 >= 0) {
 		pdf_viewer->current_page--;
 
+		g_object_unref(pdf_viewer->page);
 		pdf_viewer->page = poppler_document_get_page(pdf_viewer->doc, pdf_viewer->current_page);
+		pdf_cache_trim(pdf_viewer);
 		gtk_widget_queue_draw(pdf_viewer->da);
 
 		if (pdf_viewer->current_page == 0) {
@@ -124,7 +355,9 @@ static void pdf_next_page(GtkWidget *widget, gpointer user_data)
 	if (pdf_viewer->current_page + 1 < pdf_viewer->num_pages) {
 		pdf_viewer->current_page++;
 
+		g_object_unref(pdf_viewer->page);
 		pdf_viewer->page = poppler_document_get_page(pdf_viewer->doc, pdf_viewer->current_page);
+		pdf_cache_trim(pdf_viewer);
 		gtk_widget_queue_draw(pdf_viewer->da);
 
 		if (pdf_viewer->current_page == pdf_viewer->num_pages - 1) {
@@ -158,6 +391,25 @@ static void pdf_save(GtkWidget *widget, gpointer user_data)
 	gtk_widget_destroy(filechooser);
 }
 
+/**
+ * pdf_destroy_cb:
+ * @widget: pdf viewer window
+ * @user_data: a #PdfViewer
+ *
+ * Release viewer, deferred while a prefetch is running
+ */
+static void pdf_destroy_cb(GtkWidget *widget, gpointer user_data)
+{
+	PdfViewer *pdf_viewer = user_data;
+
+	if (pdf_viewer->prefetch_busy) {
+		pdf_viewer->closed = TRUE;
+		return;
+	}
+
+	pdf_viewer_free(pdf_viewer);
+}
+
 /**
  * app_pdf:
  * @data: data in memory
@@ -201,13 +453,18 @@ int app_pdf(gchar *data, gsize length, gchar *uri) {
 	pdf_viewer->doc = doc;
 	pdf_viewer->length = length;
 	pdf_viewer->data = data;
+	pdf_viewer->cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)cairo_surface_destroy);
+	pdf_viewer->prefetch_doc = poppler_document_new_from_data(data, length, "", NULL);
 
 	/* Get first page */
 	pdf_viewer->page = poppler_document_get_page(doc, 0);
 	if(!pdf_viewer->page) {
 		g_warning("%s(): Could not open first page of document", __FUNCTION__);
 
+		g_hash_table_destroy(pdf_viewer->cache);
+		g_clear_object(&pdf_viewer->prefetch_doc);
 		g_object_unref(pdf_viewer->doc);
+		g_slice_free(PdfViewer, pdf_viewer);
 
 		return -2;
 	}
@@ -275,6 +532,7 @@ int app_pdf(gchar *data, gsize length, gchar *uri) {
 	gtk_window_set_default_size(GTK_WINDOW(win), popwidth, popheight);
 
 	g_signal_connect(G_OBJECT(win), "configure-event", G_CALLBACK(pdf_configure_event_cb), pdf_viewer->da);
+	g_signal_connect(G_OBJECT(win), "destroy", G_CALLBACK(pdf_destroy_cb), pdf_viewer);
 
 	/* Show window */
 	gtk_widget_show_all(win);
@@ -19,11 +19,13 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <math.h>
 #include <string.h>
 #include <strings.h>
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <cairo-pdf.h>
 
 #include <tiff.h>
@@ -34,6 +36,7 @@
 #include <roger/print.h>
 #include <roger/journal.h>
 #include <roger/main.h>
+#include <roger/contactlookup.h>
 
 #define FONT "cairo:monospace 10"
 
@@ -544,43 +547,269 @@ void print_journal(GtkWidget *view_widget)
 	}
 }
 
+/* A4 fax report layout (points) */
+#define FAX_REPORT_WIDTH MM_TO_POINTS(210)
+#define FAX_REPORT_HEIGHT MM_TO_POINTS(297)
+#define FAX_REPORT_MARGIN 40.0
+#define FAX_REPORT_COLUMNS 3
+#define FAX_REPORT_GAP 15.0
+#define FAX_REPORT_CAPTION 14.0
+/* Thumbnails are rendered at twice their size for printing */
+#define FAX_REPORT_THUMBNAIL_SCALE 2
+
+/**
+ * fax_report:
+ * @tiff: opened fax document, owned by the worker
+ * @file: report file name
+ * @title: report title
+ * @date_time: transfer date/time
+ * @status_code: transfer status text
+ * @remote_ident: receiver fax id
+ * @local_ident: sender fax id
+ * @remote_name: recipient name
+ * @remote_number: recipient number
+ * @local_number: sender number
+ * @pages: number of transferred pages
+ *
+ * Snapshot of a fax transfer, all data the report worker needs
+ */
+struct fax_report {
+	TIFF *tiff;
+	gchar *file;
+	gchar *title;
+	gchar *date_time;
+	const gchar *status_code;
+	gchar *remote_ident;
+	gchar *local_ident;
+	gchar *remote_name;
+	gchar *remote_number;
+	gchar *local_number;
+	gint pages;
+};
+
+static void fax_report_free(gpointer data)
+{
+	struct fax_report *report = data;
+
+	if (report->tiff) {
+		TIFFClose(report->tiff);
+	}
+	g_free(report->file);
+	g_free(report->title);
+	g_free(report->date_time);
+	g_free(report->remote_ident);
+	g_free(report->local_ident);
+	g_free(report->remote_name);
+	g_free(report->remote_number);
+	g_free(report->local_number);
+	g_slice_free(struct fax_report, report);
+}
+
+/**
+ * fax_report_draw_field:
+ * @cairo: a #cairo_t
+ * @x: x position of label
+ * @y: y position
+ * @label: field label
+ * @value: field value, may be %NULL
+ *
+ * Draw one "label: value" field of the report header
+ */
+static void fax_report_draw_field(cairo_t *cairo, gdouble x, gdouble y, const gchar *label, const gchar *value)
+{
+	cairo_move_to(cairo, x, y);
+	cairo_show_text(cairo, label);
+	cairo_move_to(cairo, x + 100, y);
+	cairo_show_text(cairo, value ? value : "");
+}
+
 /**
- * print_load_tiff_page:
- * @tiff_file: a #TIFF
+ * fax_report_draw_header:
+ * @cairo: a #cairo_t
+ * @report: a #fax_report
  *
- * Loads a tiff file into a #GdkPixbuf
+ * Draw transfer details on first report page
  *
- * Returns: TIFF file as new #GdkPixbuf
+ * Returns: y position below header
  */
-GdkPixbuf *print_load_tiff_page(TIFF *tiff_file)
+static gdouble fax_report_draw_header(cairo_t *cairo, struct fax_report *report)
 {
-	TIFFRGBAImage img;
-	gint row, col;
-	gint width, height;
-	uint32 *raster;
-
-	/* discover image height, width */
-	TIFFGetField(tiff_file, TIFFTAG_IMAGEWIDTH, &width);
-	TIFFGetField(tiff_file, TIFFTAG_IMAGELENGTH, &height);
-
-	/* allocate and fill raster from file. */
-	raster = (uint32*)_TIFFmalloc(width * height * sizeof(uint32));
-	TIFFRGBAImageBegin(&img, tiff_file, FALSE, NULL);
-	TIFFRGBAImageGet(&img, raster, width, height);
-	TIFFRGBAImageEnd(&img);
-
-	/* vertically flip the raster */
-	for (row = 0; row <= height / 2; row++) {
-		for (col = 0; col < width; col++) {
-			uint32 tmp;
-
-			tmp = raster[row * width + col];
-			raster[row * width + col] = raster[(height - row - 1) * width + col];
-			raster[(height - row - 1) * width + col] = tmp;
+	gdouble right = FAX_REPORT_WIDTH / 2 + 10;
+	gchar *pages = g_strdup_printf("%d", report->pages);
+
+	cairo_set_source_rgb(cairo, 0, 0, 0);
+	cairo_select_font_face(cairo, "cairo:monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cairo, 14);
+	cairo_move_to(cairo, FAX_REPORT_MARGIN, FAX_REPORT_MARGIN + 14);
+	cairo_show_text(cairo, report->title);
+
+	cairo_select_font_face(cairo, "cairo:monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cairo, 8);
+
+	fax_report_draw_field(cairo, FAX_REPORT_MARGIN, 90, _("Date/Time:"), report->date_time);
+	fax_report_draw_field(cairo, right, 90, _("Transfer status:"), report->status_code);
+	fax_report_draw_field(cairo, FAX_REPORT_MARGIN, 105, _("Receiver ID:"), report->remote_ident);
+	fax_report_draw_field(cairo, right, 105, _("Pages sent:"), pages);
+	fax_report_draw_field(cairo, FAX_REPORT_MARGIN, 120, _("Recipient name:"), report->remote_name);
+	fax_report_draw_field(cairo, right, 120, _("Recipient number:"), report->remote_number);
+	fax_report_draw_field(cairo, FAX_REPORT_MARGIN, 135, _("Sender name:"), report->local_ident);
+	fax_report_draw_field(cairo, right, 135, _("Sender number:"), report->local_number);
+
+	g_free(pages);
+
+	/* line */
+	cairo_set_line_width(cairo, 0.5);
+	cairo_move_to(cairo, FAX_REPORT_MARGIN, 150);
+	cairo_line_to(cairo, FAX_REPORT_WIDTH - FAX_REPORT_MARGIN, 150);
+	cairo_stroke(cairo);
+
+	return 150 + FAX_REPORT_GAP;
+}
+
+/**
+ * fax_report_draw_thumbnail:
+ * @cairo: a #cairo_t
+ * @pixbuf: page thumbnail at FAX_REPORT_THUMBNAIL_SCALE
+ * @x: x position
+ * @y: y position
+ * @page: page number
+ *
+ * Draw framed page thumbnail with caption
+ */
+static void fax_report_draw_thumbnail(cairo_t *cairo, GdkPixbuf *pixbuf, gdouble x, gdouble y, gint page)
+{
+	gdouble width = (gdouble)gdk_pixbuf_get_width(pixbuf) / FAX_REPORT_THUMBNAIL_SCALE;
+	gdouble height = (gdouble)gdk_pixbuf_get_height(pixbuf) / FAX_REPORT_THUMBNAIL_SCALE;
+	gchar *caption;
+
+	cairo_save(cairo);
+	cairo_translate(cairo, x, y);
+	cairo_scale(cairo, 1.0f / FAX_REPORT_THUMBNAIL_SCALE, 1.0f / FAX_REPORT_THUMBNAIL_SCALE);
+	gdk_cairo_set_source_pixbuf(cairo, pixbuf, 0, 0);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+
+	cairo_set_source_rgb(cairo, 0, 0, 0);
+	cairo_set_line_width(cairo, 0.5);
+	cairo_rectangle(cairo, x, y, width, height);
+	cairo_stroke(cairo);
+
+	caption = g_strdup_printf(_("Page %d"), page);
+	cairo_move_to(cairo, x, y + height + FAX_REPORT_CAPTION - 4);
+	cairo_show_text(cairo, caption);
+	g_free(caption);
+}
+
+/**
+ * fax_report_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #fax_report
+ * @cancellable: unused
+ *
+ * Render fax report with page thumbnails, the pdf file is written atomically
+ */
+static void fax_report_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct fax_report *report = task_data;
+	cairo_surface_t *out;
+	cairo_status_t status;
+	cairo_t *cairo;
+	gdouble thumb_width = (FAX_REPORT_WIDTH - 2 * FAX_REPORT_MARGIN - (FAX_REPORT_COLUMNS - 1) * FAX_REPORT_GAP) / FAX_REPORT_COLUMNS;
+	gdouble y;
+	gdouble row_height = 0;
+	gchar *tmp_file;
+	gint num_pages;
+	gint index;
+	gint column = 0;
+
+	tmp_file = g_strconcat(report->file, ".tmp", NULL);
+	out = cairo_pdf_surface_create(tmp_file, FAX_REPORT_WIDTH, FAX_REPORT_HEIGHT);
+	cairo = cairo_create(out);
+
+	y = fax_report_draw_header(cairo, report);
+
+	num_pages = print_tiff_get_n_pages(report->tiff);
+	for (index = 0; index < num_pages; index++) {
+		GdkPixbuf *pixbuf = print_load_tiff_page(report->tiff, index, thumb_width * FAX_REPORT_THUMBNAIL_SCALE, -1);
+		gdouble height;
+
+		if (!pixbuf) {
+			continue;
+		}
+
+		height = (gdouble)gdk_pixbuf_get_height(pixbuf) / FAX_REPORT_THUMBNAIL_SCALE + FAX_REPORT_CAPTION;
+
+		/* Start a new row, or a new page if this one is full */
+		if (column == FAX_REPORT_COLUMNS) {
+			column = 0;
+			y += row_height + FAX_REPORT_GAP;
+			row_height = 0;
 		}
+		if (column == 0 && y + height > FAX_REPORT_HEIGHT - FAX_REPORT_MARGIN && y > FAX_REPORT_MARGIN) {
+			cairo_show_page(cairo);
+			y = FAX_REPORT_MARGIN;
+		}
+
+		fax_report_draw_thumbnail(cairo, pixbuf, FAX_REPORT_MARGIN + column * (thumb_width + FAX_REPORT_GAP), y, index + 1);
+		g_object_unref(pixbuf);
+
+		row_height = MAX(row_height, height);
+		column++;
+	}
+
+	cairo_show_page(cairo);
+	cairo_destroy(cairo);
+
+	cairo_surface_finish(out);
+	status = cairo_surface_status(out);
+	cairo_surface_destroy(out);
+
+	if (status != CAIRO_STATUS_SUCCESS) {
+		g_unlink(tmp_file);
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", cairo_status_to_string(status));
+	} else if (g_rename(tmp_file, report->file)) {
+		g_unlink(tmp_file);
+		g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(errno), "%s", g_strerror(errno));
+	} else {
+		g_task_return_boolean(task, TRUE);
+	}
+
+	g_free(tmp_file);
+}
+
+/**
+ * fax_report_ready_cb:
+ * @source_object: unused
+ * @res: a #GAsyncResult
+ * @user_data: unused
+ *
+ * Report has been written, add it to the journal
+ */
+static void fax_report_ready_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	struct fax_report *report = g_task_get_task_data(G_TASK(res));
+	RmCallEntry *call;
+	GDateTime *now;
+	gchar *date_time;
+	GError *error = NULL;
+
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_warning("%s(): Could not write fax report '%s': %s", __FUNCTION__, report->file, error->message);
+		g_error_free(error);
+		return;
 	}
 
-	return gdk_pixbuf_new_from_data((const guchar*)raster, GDK_COLORSPACE_RGB, TRUE, 8, width, height, width * 4, NULL, NULL);
+	g_debug("%s(): Fax report '%s' written", __FUNCTION__, report->file);
+
+	now = g_date_time_new_now_local();
+	date_time = g_date_time_format(now, "%d.%m.%y %H:%M");
+	g_date_time_unref(now);
+
+	call = rm_call_entry_new(RM_CALL_ENTRY_TYPE_FAX_REPORT, date_time, report->remote_name, report->remote_number, "", report->local_number, "", g_strdup(report->file));
+	journal_add_call_entry(call);
+
+	g_free(date_time);
 }
 
 /**
@@ -589,24 +818,18 @@ GdkPixbuf *print_load_tiff_page(TIFF *tiff_file)
  * @file: tiff file name (fax document)
  * @report_dir: storage directory
  *
- * Create fax report based on give information
+ * Create fax report based on given information. Status is copied and the report
+ * is rendered in background.
  */
 void print_fax_report(RmFaxStatus *status, gchar *file, const char *report_dir)
 {
-	cairo_t *cairo;
-	cairo_surface_t *out;
+	struct fax_report *report;
 	time_t time_s = time(NULL);
 	struct tm *time_ptr = localtime(&time_s);
-	char *buffer;
-	GdkPixbuf *pixbuf;
-	RmContact *contact = NULL;
-	char *remote = status->remote_number;
-	char *local = status->local_number;
-	char *status_code = status->error_code == 0 ? _("SUCCESS") : _("FAILED");
-	int pages = status->pages_transferred;
+	RmContact *contact;
 	RmProfile *profile = rm_profile_get_active();
 	TIFF *tiff;
-	GdkPixbuf *scale;
+	GTask *task;
 
 	if (file == NULL || !g_file_test(file, G_FILE_TEST_EXISTS)) {
 		g_warning("file is invalid\n");
@@ -618,133 +841,34 @@ void print_fax_report(RmFaxStatus *status, gchar *file, const char *report_dir)
 		return;
 	}
 
+	/* Open document now, window may remove it while the report is rendered */
 	tiff = TIFFOpen(file, "r");
-
-	pixbuf = print_load_tiff_page(tiff);
-	if (pixbuf == NULL) {
-		g_warning("pixbuf is null (file '%s')\n", file);
+	if (tiff == NULL) {
+		g_warning("Could not open '%s'\n", file);
 		return;
 	}
 
-	scale = gdk_pixbuf_scale_simple(pixbuf, MM_TO_POINTS(594) - 140, MM_TO_POINTS(841) - 200, GDK_INTERP_BILINEAR);
-	g_object_unref(pixbuf);
-	pixbuf = scale;
-
-	buffer = g_strdup_printf("%s/fax-report_%s_%s_%02d_%02d_%d_%02d_%02d_%02d.pdf",
-				 report_dir, local, remote,
-				 time_ptr->tm_mday, time_ptr->tm_mon + 1, time_ptr->tm_year + 1900,
-				 time_ptr->tm_hour, time_ptr->tm_min, time_ptr->tm_sec);
-	out = cairo_pdf_surface_create(buffer, MM_TO_POINTS(594), MM_TO_POINTS(841));
-	g_free(buffer);
-
-	if (!out) {
-		g_warning("Could not create pdf surface - is report directory writeable?\n");
-		return;
-	}
-
-	cairo = cairo_create(out);
-	gdk_cairo_set_source_pixbuf(cairo, pixbuf, 70, 200);
-	cairo_paint(cairo);
-
-	cairo_set_source_rgb(cairo, 0, 0, 0);
-	cairo_select_font_face(cairo, "cairo:monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cairo, 20);
-
-	cairo_move_to(cairo, 60, 60);
-	buffer = g_strconcat(_("Fax Transfer Protocol"), " (", rm_router_get_name(profile), ")", NULL);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
-
-	cairo_select_font_face(cairo, "cairo:monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-
-	/* Date/Time */
-	cairo_move_to(cairo, 60, 95);
-	cairo_show_text(cairo, _("Date/Time:"));
-	cairo_move_to(cairo, 280, 95);
-	buffer = print_journal_get_date_time("%a %b %d %Y - %X");
-	cairo_show_text(cairo, buffer);
-
-	/* Status */
-	cairo_move_to(cairo, 1000, 95);
-	cairo_show_text(cairo, _("Transfer status:"));
-	cairo_move_to(cairo, 1220, 95);
-	cairo_show_text(cairo, status_code);
-
-	/* FAX-ID */
-	cairo_move_to(cairo, 60, 120);
-	cairo_show_text(cairo, _("Receiver ID:"));
-	cairo_move_to(cairo, 280, 120);
-	buffer = g_strdup_printf("%s", status->remote_ident);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
-
-	/* Pages */
-	cairo_move_to(cairo, 1000, 120);
-	cairo_show_text(cairo, _("Pages sent:"));
-	cairo_move_to(cairo, 1220, 120);
-	buffer = g_strdup_printf("%d", pages);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
-
-	/* Remote name */
-	cairo_move_to(cairo, 60, 145);
-	cairo_show_text(cairo, _("Recipient name:"));
+	report = g_slice_new0(struct fax_report);
+	report->tiff = tiff;
+	report->file = g_strdup_printf("%s/fax-report_%s_%s_%02d_%02d_%d_%02d_%02d_%02d.pdf",
+				       report_dir, status->local_number, status->remote_number,
+				       time_ptr->tm_mday, time_ptr->tm_mon + 1, time_ptr->tm_year + 1900,
+				       time_ptr->tm_hour, time_ptr->tm_min, time_ptr->tm_sec);
+	report->title = g_strconcat(_("Fax Transfer Protocol"), " (", rm_router_get_name(profile), ")", NULL);
+	report->date_time = g_strdup(print_journal_get_date_time("%a %b %d %Y - %X"));
+	report->status_code = status->error_code == 0 ? _("SUCCESS") : _("FAILED");
+	report->remote_ident = g_strdup(status->remote_ident);
+	report->local_ident = g_strdup(status->local_ident);
+	report->remote_number = rm_number_full(status->remote_number, FALSE);
+	report->local_number = rm_number_full(status->local_number, FALSE);
+	report->pages = status->pages_transferred;
 
 	/** Ask for contact information */
-	contact = rm_contact_find_by_number(remote);
-	cairo_move_to(cairo, 280, 145);
-	cairo_show_text(cairo, contact ? contact->name : "");
-
-	/* Remote number */
-	cairo_move_to(cairo, 1000, 145);
-	cairo_show_text(cairo, _("Recipient number:"));
-	cairo_move_to(cairo, 1220, 145);
-	buffer = rm_number_full(remote, FALSE);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
-
-	/* Local name */
-	cairo_move_to(cairo, 60, 170);
-	cairo_show_text(cairo, _("Sender name:"));
-	buffer = g_strdup_printf("%s", status->local_ident);
-	cairo_move_to(cairo, 280, 170);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
-
-	/* Local number */
-	cairo_move_to(cairo, 1000, 170);
-	cairo_show_text(cairo, _("Sender number:"));
-	cairo_move_to(cairo, 1220, 170);
-	buffer = rm_number_full(local, FALSE);
-	cairo_show_text(cairo, buffer);
-	g_free(buffer);
+	contact = contact_lookup_find_by_number(status->remote_number);
+	report->remote_name = g_strdup(contact ? contact->name : "");
 
-	/* line */
-	cairo_set_line_width(cairo, 0.5);
-	cairo_move_to(cairo, 0, 200);
-	cairo_rel_line_to(cairo, MM_TO_POINTS(594), 0);
-	cairo_stroke(cairo);
-
-	cairo_show_page(cairo);
-
-	while (TIFFReadDirectory(tiff)) {
-		pixbuf = print_load_tiff_page(tiff);
-
-		scale = gdk_pixbuf_scale_simple(pixbuf, MM_TO_POINTS(594), MM_TO_POINTS(841), GDK_INTERP_BILINEAR);
-		g_object_unref(pixbuf);
-		pixbuf = scale;
-
-		gdk_cairo_set_source_pixbuf(cairo, pixbuf, 0, 0);
-
-		cairo_paint(cairo);
-		cairo_show_page(cairo);
-	}
-
-	cairo_destroy(cairo);
-
-	cairo_surface_flush(out);
-	cairo_surface_destroy(out);
-
-	g_object_unref(pixbuf);
+	task = g_task_new(NULL, NULL, fax_report_ready_cb, NULL);
+	g_task_set_task_data(task, report, fax_report_free);
+	g_task_run_in_thread(task, fax_report_thread);
+	g_object_unref(task);
 }
-
@@ -22,6 +22,8 @@
 
 #include <rm/rm.h>
 
+#include <roger/printtiff.h>
+
 G_BEGIN_DECLS
 
 void print_journal(GtkWidget *view_widget);
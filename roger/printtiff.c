@@ -0,0 +1,293 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <tiff.h>
+#include <tiffio.h>
+
+#include <roger/printtiff.h>
+
+/**
+ * print_tiff_scaler:
+ * @pixbuf: destination pixbuf
+ * @src_width: source width
+ * @src_height: source height
+ * @sum: accumulated ink per destination column of current destination row
+ * @columns: number of source columns per destination column
+ * @rows: number of source rows accumulated in @sum
+ * @dst_row: destination row @sum belongs to
+ * @ink: ink of current source row, one value per source column
+ *
+ * Scales a page row by row while it is being decoded (box filter when shrinking,
+ * nearest neighbour when enlarging)
+ */
+struct print_tiff_scaler {
+	GdkPixbuf *pixbuf;
+	gint src_width;
+	gint src_height;
+	guint32 *sum;
+	guint32 *columns;
+	gint rows;
+	gint dst_row;
+	guchar *ink;
+};
+
+static void print_tiff_scaler_init(struct print_tiff_scaler *scaler, gint src_width, gint src_height, gint width, gint height)
+{
+	gint x;
+
+	scaler->pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+	scaler->src_width = src_width;
+	scaler->src_height = src_height;
+	scaler->sum = g_new0(guint32, width);
+	scaler->columns = g_new0(guint32, width);
+	scaler->rows = 0;
+	scaler->dst_row = 0;
+	scaler->ink = g_malloc0(src_width);
+
+	if (src_width >= width) {
+		for (x = 0; x < src_width; x++) {
+			scaler->columns[(gint64)x * width / src_width]++;
+		}
+	} else {
+		for (x = 0; x < width; x++) {
+			scaler->columns[x] = 1;
+		}
+	}
+}
+
+/**
+ * print_tiff_scaler_emit:
+ * @scaler: a #print_tiff_scaler
+ * @first: first destination row
+ * @last: last destination row (exclusive)
+ *
+ * Write accumulated row to destination rows
+ */
+static void print_tiff_scaler_emit(struct print_tiff_scaler *scaler, gint first, gint last)
+{
+	gint width = gdk_pixbuf_get_width(scaler->pixbuf);
+	gint stride = gdk_pixbuf_get_rowstride(scaler->pixbuf);
+	guchar *pixels = gdk_pixbuf_get_pixels(scaler->pixbuf);
+	guchar *row;
+	gint x;
+	gint y;
+
+	if (first >= last || !scaler->rows) {
+		return;
+	}
+
+	row = pixels + first * stride;
+	for (x = 0; x < width; x++) {
+		guint32 count = scaler->columns[x] * scaler->rows;
+		guchar value = count ? 255 - scaler->sum[x] / count : 255;
+
+		row[x * 3] = value;
+		row[x * 3 + 1] = value;
+		row[x * 3 + 2] = value;
+	}
+
+	for (y = first + 1; y < last; y++) {
+		memcpy(pixels + y * stride, row, width * 3);
+	}
+
+	memset(scaler->sum, 0, width * sizeof(guint32));
+	scaler->rows = 0;
+}
+
+/**
+ * print_tiff_scaler_push:
+ * @scaler: a #print_tiff_scaler
+ * @y: source row, ink values are in scaler->ink
+ *
+ * Add decoded source row
+ */
+static void print_tiff_scaler_push(struct print_tiff_scaler *scaler, gint y)
+{
+	gint width = gdk_pixbuf_get_width(scaler->pixbuf);
+	gint height = gdk_pixbuf_get_height(scaler->pixbuf);
+	gint x;
+
+	if (scaler->src_width >= width) {
+		for (x = 0; x < scaler->src_width; x++) {
+			scaler->sum[(gint64)x * width / scaler->src_width] += scaler->ink[x];
+		}
+	} else {
+		for (x = 0; x < width; x++) {
+			scaler->sum[x] += scaler->ink[(gint64)x * scaler->src_width / width];
+		}
+	}
+	scaler->rows++;
+
+	if (scaler->src_height >= height) {
+		gint next = (gint64)(y + 1) * height / scaler->src_height;
+
+		/* Destination row is complete once the next source row belongs to another one */
+		if (next != scaler->dst_row || y + 1 == scaler->src_height) {
+			print_tiff_scaler_emit(scaler, scaler->dst_row, scaler->dst_row + 1);
+			scaler->dst_row = next;
+		}
+	} else {
+		print_tiff_scaler_emit(scaler, (gint64)y * height / scaler->src_height, (gint64)(y + 1) * height / scaler->src_height);
+	}
+}
+
+static GdkPixbuf *print_tiff_scaler_finish(struct print_tiff_scaler *scaler, gboolean ok)
+{
+	g_free(scaler->sum);
+	g_free(scaler->columns);
+	g_free(scaler->ink);
+
+	if (!ok) {
+		g_clear_object(&scaler->pixbuf);
+	}
+
+	return scaler->pixbuf;
+}
+
+/**
+ * print_tiff_get_n_pages:
+ * @tiff_file: a #TIFF
+ *
+ * Get number of pages in tiff file
+ *
+ * Returns: number of pages
+ */
+gint print_tiff_get_n_pages(TIFF *tiff_file)
+{
+	return TIFFNumberOfDirectories(tiff_file);
+}
+
+/**
+ * print_load_tiff_page:
+ * @tiff_file: a #TIFF
+ * @page: page index
+ * @width: target width or -1 for original width
+ * @height: target height, or -1 to keep the aspect ratio (honoring fax resolution)
+ *
+ * Loads a tiff page into a #GdkPixbuf, scaling it while decoding. Bilevel fax pages are
+ * decoded scanline by scanline at 1 bpp, other pages strip by strip.
+ *
+ * Returns: TIFF page as new #GdkPixbuf or %NULL on error
+ */
+GdkPixbuf *print_load_tiff_page(TIFF *tiff_file, gint page, gint width, gint height)
+{
+	struct print_tiff_scaler scaler;
+	uint32 src_width = 0;
+	uint32 src_height = 0;
+	uint16 bits_per_sample = 1;
+	uint16 samples_per_pixel = 1;
+	uint16 photometric = PHOTOMETRIC_MINISWHITE;
+	gfloat x_res = 0.0f;
+	gfloat y_res = 0.0f;
+	gboolean ok = TRUE;
+	uint32 y;
+	uint32 x;
+
+	if (!TIFFSetDirectory(tiff_file, page)) {
+		return NULL;
+	}
+
+	TIFFGetField(tiff_file, TIFFTAG_IMAGEWIDTH, &src_width);
+	TIFFGetField(tiff_file, TIFFTAG_IMAGELENGTH, &src_height);
+	TIFFGetFieldDefaulted(tiff_file, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+	TIFFGetFieldDefaulted(tiff_file, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+	TIFFGetField(tiff_file, TIFFTAG_PHOTOMETRIC, &photometric);
+
+	if (!src_width || !src_height) {
+		return NULL;
+	}
+
+	if (width <= 0) {
+		width = src_width;
+	}
+
+	if (height <= 0) {
+		gdouble aspect = (gdouble)src_height / src_width;
+
+		/* Fax pages have non-square pixels (e.g. 204x98 dpi) */
+		if (TIFFGetField(tiff_file, TIFFTAG_XRESOLUTION, &x_res) && TIFFGetField(tiff_file, TIFFTAG_YRESOLUTION, &y_res) && x_res > 0 && y_res > 0) {
+			aspect *= x_res / y_res;
+		}
+		height = MAX(1, (gint)(width * aspect + 0.5f));
+	}
+
+	print_tiff_scaler_init(&scaler, src_width, src_height, width, height);
+
+	if (bits_per_sample == 1 && samples_per_pixel == 1) {
+		/* Bilevel fast path */
+		guchar *line = _TIFFmalloc(TIFFScanlineSize(tiff_file));
+		guchar black = photometric == PHOTOMETRIC_MINISBLACK ? 0 : 1;
+
+		for (y = 0; y < src_height && ok; y++) {
+			if (TIFFReadScanline(tiff_file, line, y, 0) < 0) {
+				ok = FALSE;
+				break;
+			}
+
+			for (x = 0; x < src_width; x++) {
+				scaler.ink[x] = ((line[x >> 3] >> (7 - (x & 7))) & 1) == black ? 255 : 0;
+			}
+
+			print_tiff_scaler_push(&scaler, y);
+		}
+
+		_TIFFfree(line);
+	} else {
+		/* Generic path, decode one strip at a time */
+		uint32 rows_per_strip = src_height;
+		uint32 *raster;
+
+		TIFFGetFieldDefaulted(tiff_file, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+		rows_per_strip = MIN(rows_per_strip, src_height);
+		raster = _TIFFmalloc(src_width * rows_per_strip * sizeof(uint32));
+
+		for (y = 0; y < src_height && ok; y += rows_per_strip) {
+			uint32 rows = MIN(rows_per_strip, src_height - y);
+			uint32 row;
+
+			if (!TIFFReadRGBAStrip(tiff_file, y, raster)) {
+				ok = FALSE;
+				break;
+			}
+
+			/* Strip raster is stored bottom-up */
+			for (row = 0; row < rows; row++) {
+				uint32 *src = raster + (rows - row - 1) * src_width;
+
+				for (x = 0; x < src_width; x++) {
+					uint32 pixel = src[x];
+
+					scaler.ink[x] = 255 - ((TIFFGetR(pixel) * 77 + TIFFGetG(pixel) * 150 + TIFFGetB(pixel) * 29) >> 8);
+				}
+
+				print_tiff_scaler_push(&scaler, y + row);
+			}
+		}
+
+		_TIFFfree(raster);
+	}
+
+	return print_tiff_scaler_finish(&scaler, ok);
+}
@@ -0,0 +1,33 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROGER_PRINTTIFF_H
+#define ROGER_PRINTTIFF_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <tiffio.h>
+
+G_BEGIN_DECLS
+
+gint print_tiff_get_n_pages(TIFF *tiff_file);
+GdkPixbuf *print_load_tiff_page(TIFF *tiff_file, gint page, gint width, gint height);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <utime.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <rm/rm.h>
+
+#include <roger/faxcache.h>
+
+GSettings *app_settings = NULL;
+
+static gchar *test_dir = NULL;
+
+/**
+ * test_faxcache_create:
+ * @name: file name within test directory
+ * @size: file size
+ * @fill: byte to fill file with
+ *
+ * Returns: full file name, free with g_free()
+ */
+static gchar *test_faxcache_create(const gchar *name, gsize size, gchar fill)
+{
+	gchar *file_name = g_build_filename(test_dir, name, NULL);
+	gchar *data = g_malloc(size);
+
+	memset(data, fill, size);
+	g_assert_true(g_file_set_contents(file_name, data, size, NULL));
+	g_free(data);
+
+	return file_name;
+}
+
+/**
+ * test_faxcache_get_entry:
+ * @key: cache key
+ *
+ * Returns: file name of cache entry, free with g_free()
+ */
+static gchar *test_faxcache_get_entry(const gchar *key)
+{
+	gchar *name = g_strdup_printf("%s.tif", key);
+	gchar *file_name = g_build_filename(rm_get_user_cache_dir(), "fax", name, NULL);
+
+	g_free(name);
+
+	return file_name;
+}
+
+/**
+ * test_faxcache_set_mtime:
+ * @key: cache key
+ * @mtime: modification time
+ *
+ * Age cache entry, eviction order is based on the modification time
+ */
+static void test_faxcache_set_mtime(const gchar *key, time_t mtime)
+{
+	gchar *file_name = test_faxcache_get_entry(key);
+	struct utimbuf times;
+
+	times.actime = mtime;
+	times.modtime = mtime;
+	g_assert_cmpint(g_utime(file_name, &times), ==, 0);
+
+	g_free(file_name);
+}
+
+/**
+ * test_faxcache_remove_dir:
+ * @dir_name: directory to remove including its content
+ */
+static void test_faxcache_remove_dir(const gchar *dir_name)
+{
+	GDir *dir = g_dir_open(dir_name, 0, NULL);
+	const gchar *name;
+
+	if (dir) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			gchar *file_name = g_build_filename(dir_name, name, NULL);
+
+			if (g_file_test(file_name, G_FILE_TEST_IS_DIR)) {
+				test_faxcache_remove_dir(file_name);
+			} else {
+				g_unlink(file_name);
+			}
+			g_free(file_name);
+		}
+		g_dir_close(dir);
+	}
+
+	g_rmdir(dir_name);
+}
+
+static void test_faxcache_key(void)
+{
+	gchar *file_a = test_faxcache_create("key-a.ps", 4096, 'a');
+	gchar *file_b = test_faxcache_create("key-b.ps", 4096, 'b');
+	gchar *key_a;
+	gchar *key;
+
+	g_settings_set_uint(app_settings, "fax-cache-size", 0);
+	g_assert_null(fax_cache_get_key(file_a, 1));
+
+	g_settings_set_uint(app_settings, "fax-cache-size", 64);
+	key_a = fax_cache_get_key(file_a, 1);
+	g_assert_nonnull(key_a);
+
+	/* Same content and resolution, same key */
+	key = fax_cache_get_key(file_a, 1);
+	g_assert_cmpstr(key, ==, key_a);
+	g_free(key);
+
+	key = fax_cache_get_key(file_a, 0);
+	g_assert_cmpstr(key, !=, key_a);
+	g_free(key);
+
+	key = fax_cache_get_key(file_b, 1);
+	g_assert_cmpstr(key, !=, key_a);
+	g_free(key);
+
+	g_assert_null(fax_cache_get_key("/nonexistent/roger.ps", 1));
+
+	g_free(key_a);
+	g_unlink(file_b);
+	g_unlink(file_a);
+	g_free(file_b);
+	g_free(file_a);
+}
+
+static void test_faxcache_store_lookup(void)
+{
+	gchar *file = test_faxcache_create("store.tif", 4096, 's');
+	gchar *out_file = g_build_filename(test_dir, "out.tif", NULL);
+	gchar *data = NULL;
+	gsize len = 0;
+	GStatBuf buf;
+	gchar *entry;
+	gchar *key;
+
+	g_settings_set_uint(app_settings, "fax-cache-size", 64);
+	key = fax_cache_get_key(file, 1);
+
+	g_assert_false(fax_cache_lookup(key, out_file));
+
+	fax_cache_store(key, file);
+	g_assert_true(fax_cache_lookup(key, out_file));
+
+	g_assert_true(g_file_get_contents(out_file, &data, &len, NULL));
+	g_assert_cmpuint(len, ==, 4096);
+	g_assert_cmpint(data[0], ==, 's');
+	g_free(data);
+
+	/* Hit marks entry as recently used */
+	test_faxcache_set_mtime(key, 1000000000);
+	g_assert_true(fax_cache_lookup(key, out_file));
+
+	entry = test_faxcache_get_entry(key);
+	g_assert_cmpint(g_stat(entry, &buf), ==, 0);
+	g_assert_cmpint(buf.st_mtime, >, 1000000000);
+	g_free(entry);
+
+	g_free(key);
+	g_unlink(out_file);
+	g_unlink(file);
+	g_free(out_file);
+	g_free(file);
+}
+
+static void test_faxcache_evict(void)
+{
+	gchar *file_a = test_faxcache_create("evict-a.tif", 600 * 1024, 'a');
+	gchar *file_b = test_faxcache_create("evict-b.tif", 600 * 1024, 'b');
+	gchar *out_file = g_build_filename(test_dir, "out.tif", NULL);
+	gchar *stale = NULL;
+	gchar *entry;
+	gchar *key_a;
+	gchar *key_b;
+
+	g_settings_set_uint(app_settings, "fax-cache-size", 1);
+	key_a = fax_cache_get_key(file_a, 1);
+	key_b = fax_cache_get_key(file_b, 1);
+
+	fax_cache_store(key_a, file_a);
+	test_faxcache_set_mtime(key_a, 1000000000);
+
+	/* Left behind by an interrupted store */
+	entry = test_faxcache_get_entry(key_a);
+	stale = g_strconcat(entry, ".tmp", NULL);
+	g_assert_true(g_file_set_contents(stale, "stale", -1, NULL));
+	g_free(entry);
+
+	/* Both do not fit into 1 MiB, least recently used one goes */
+	fax_cache_store(key_b, file_b);
+	g_assert_false(fax_cache_lookup(key_a, out_file));
+	g_assert_true(fax_cache_lookup(key_b, out_file));
+	g_assert_false(g_file_test(stale, G_FILE_TEST_EXISTS));
+
+	g_free(stale);
+	g_free(key_b);
+	g_free(key_a);
+	g_unlink(out_file);
+	g_unlink(file_b);
+	g_unlink(file_a);
+	g_free(out_file);
+	g_free(file_b);
+	g_free(file_a);
+}
+
+int main(int argc, char **argv)
+{
+	gint ret;
+
+	test_dir = g_dir_make_tmp("roger-faxcache-XXXXXX", NULL);
+	g_assert_nonnull(test_dir);
+
+	/* Keep cache and settings away from the user */
+	g_setenv("XDG_CACHE_HOME", test_dir, TRUE);
+	g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+
+	g_test_init(&argc, &argv, NULL);
+
+	app_settings = g_settings_new("org.tabos.roger");
+
+	g_test_add_func("/faxcache/key", test_faxcache_key);
+	g_test_add_func("/faxcache/store-lookup", test_faxcache_store_lookup);
+	g_test_add_func("/faxcache/evict", test_faxcache_evict);
+
+	ret = g_test_run();
+
+	g_object_unref(app_settings);
+	test_faxcache_remove_dir(test_dir);
+	g_free(test_dir);
+
+	return ret;
+}
@@ -0,0 +1,295 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Sync functions are static, test them within the plugin source */
+#include "plugins/google/google.c"
+
+static gchar *test_dir = NULL;
+
+/**
+ * test_google_remove_dir:
+ * @dir_name: directory to remove including its content
+ */
+static void test_google_remove_dir(const gchar *dir_name)
+{
+	GDir *dir = g_dir_open(dir_name, 0, NULL);
+	const gchar *name;
+
+	if (dir) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			gchar *file_name = g_build_filename(dir_name, name, NULL);
+
+			if (g_file_test(file_name, G_FILE_TEST_IS_DIR)) {
+				test_google_remove_dir(file_name);
+			} else {
+				g_unlink(file_name);
+			}
+			g_free(file_name);
+		}
+		g_dir_close(dir);
+	}
+
+	g_rmdir(dir_name);
+}
+
+/**
+ * test_google_contact_new:
+ * @id: entry id
+ * @name: full name
+ * @etag: entry etag
+ * @deleted: %TRUE for a deleted entry as returned by an incremental query
+ *
+ * Create google contact the same way cached entries are read
+ *
+ * Returns: a new #GDataContactsContact
+ */
+static GDataContactsContact *test_google_contact_new(const gchar *id, const gchar *name, const gchar *etag, gboolean deleted)
+{
+	GDataParsable *parsable;
+	GError *error = NULL;
+	gchar *xml;
+
+	xml = g_strdup_printf("<entry xmlns='http://www.w3.org/2005/Atom' xmlns:gd='http://schemas.google.com/g/2005' gd:etag='%s'>"
+		"<id>%s</id>"
+		"<updated>2017-01-01T00:00:00Z</updated>"
+		"<category scheme='http://schemas.google.com/g/2005#kind' term='http://schemas.google.com/contact/2008#contact'/>"
+		"<title>%s</title>"
+		"<gd:name><gd:fullName>%s</gd:fullName></gd:name>"
+		"%s"
+		"</entry>", etag, id, name, name, deleted ? "<gd:deleted/>" : "");
+
+	parsable = gdata_parsable_new_from_xml(GDATA_TYPE_CONTACTS_CONTACT, xml, -1, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(parsable);
+	g_free(xml);
+
+	return GDATA_CONTACTS_CONTACT(parsable);
+}
+
+/**
+ * test_google_apply:
+ * @sync: a #google_sync
+ * @id: entry id
+ * @name: full name
+ * @etag: entry etag
+ * @deleted: %TRUE for a deleted entry
+ *
+ * Apply entry as if it has been received from the server
+ */
+static void test_google_apply(struct google_sync *sync, const gchar *id, const gchar *name, const gchar *etag, gboolean deleted)
+{
+	GDataContactsContact *gcontact = test_google_contact_new(id, name, etag, deleted);
+
+	google_apply_entry(sync, gcontact);
+	g_object_unref(gcontact);
+}
+
+/**
+ * test_google_contact:
+ * @id: entry id
+ *
+ * Returns: contact of entry or %NULL
+ */
+static RmContact *test_google_contact(const gchar *id)
+{
+	struct google_entry *entry = g_hash_table_lookup(google_entries, id);
+
+	return entry ? entry->contact : NULL;
+}
+
+static void test_google_setup(gpointer fixture, gconstpointer user_data)
+{
+	struct google_sync *sync;
+
+	google_settings = g_settings_new("org.tabos.roger.plugins.google");
+	google_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, google_entry_free);
+	google_updated = 0;
+
+	/* Initial full sync with two contacts */
+	sync = google_sync_new();
+	g_assert_nonnull(sync->seen);
+	sync->updated = 1000;
+
+	test_google_apply(sync, "alice", "Alice", "\"a1\"", FALSE);
+	test_google_apply(sync, "bob", "Bob", "\"b1\"", FALSE);
+	g_assert_cmpuint(g_slist_length(sync->delta->added), ==, 2);
+
+	google_sync_finish(sync, TRUE);
+	g_assert_cmpint(google_updated, ==, 1000);
+	g_assert_cmpuint(g_slist_length(contacts), ==, 2);
+}
+
+static void test_google_teardown(gpointer fixture, gconstpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, google_entries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct google_entry *entry = value;
+
+		google_contact_free(entry->contact);
+	}
+	g_clear_pointer(&google_entries, g_hash_table_destroy);
+
+	g_slist_free(contacts);
+	contacts = NULL;
+
+	google_updated = 0;
+	g_clear_object(&google_settings);
+}
+
+static void test_google_etag(gpointer fixture, gconstpointer user_data)
+{
+	RmContact *alice = test_google_contact("alice");
+	struct google_sync *sync;
+
+	/* Same etag, entry is skipped */
+	sync = google_sync_new();
+	g_assert_null(sync->seen);
+	test_google_apply(sync, "alice", "Alice Smith", "\"a1\"", FALSE);
+	g_assert_true(contacts_delta_is_empty(sync->delta));
+	g_assert_cmpstr(alice->name, ==, "Alice");
+	google_sync_finish(sync, TRUE);
+
+	/* New etag, contact is updated in place */
+	sync = google_sync_new();
+	test_google_apply(sync, "alice", "Alice Smith", "\"a2\"", FALSE);
+	g_assert_cmpuint(g_slist_length(sync->delta->modified), ==, 1);
+	g_assert_true(sync->delta->modified->data == alice);
+	google_sync_finish(sync, TRUE);
+
+	g_assert_true(test_google_contact("alice") == alice);
+	g_assert_cmpstr(alice->name, ==, "Alice Smith");
+}
+
+static void test_google_deleted(gpointer fixture, gconstpointer user_data)
+{
+	RmContact *bob = test_google_contact("bob");
+	struct google_sync *sync;
+
+	/* Incremental sync reports deleted entries */
+	sync = google_sync_new();
+	test_google_apply(sync, "bob", "Bob", "\"b2\"", TRUE);
+	g_assert_null(test_google_contact("bob"));
+	g_assert_cmpuint(g_slist_length(sync->delta->removed), ==, 1);
+	g_assert_true(sync->delta->removed->data == bob);
+
+	/* Unknown deleted entries are ignored */
+	test_google_apply(sync, "carol", "Carol", "\"c1\"", TRUE);
+	g_assert_cmpuint(g_slist_length(sync->delta->removed), ==, 1);
+	g_assert_null(sync->delta->added);
+
+	google_sync_finish(sync, TRUE);
+
+	g_assert_cmpuint(g_hash_table_size(google_entries), ==, 1);
+	g_assert_cmpuint(g_slist_length(contacts), ==, 1);
+	g_assert_true(contacts->data == test_google_contact("alice"));
+}
+
+static void test_google_full_sync(gpointer fixture, gconstpointer user_data)
+{
+	struct google_sync *sync;
+
+	/* Full sync returns alice only, bob is gone */
+	google_updated = 0;
+	sync = google_sync_new();
+	g_assert_nonnull(sync->seen);
+	test_google_apply(sync, "alice", "Alice", "\"a1\"", FALSE);
+	test_google_apply(sync, "carol", "Carol", "\"c1\"", FALSE);
+	g_assert_nonnull(test_google_contact("bob"));
+
+	google_sync_finish(sync, TRUE);
+
+	g_assert_null(test_google_contact("bob"));
+	g_assert_nonnull(test_google_contact("alice"));
+	g_assert_nonnull(test_google_contact("carol"));
+	g_assert_cmpuint(g_slist_length(contacts), ==, 2);
+}
+
+static void test_google_incomplete_sync(gpointer fixture, gconstpointer user_data)
+{
+	struct google_sync *sync;
+
+	/* Entries not seen by an incomplete full sync are kept */
+	google_updated = 0;
+	sync = google_sync_new();
+	test_google_apply(sync, "alice", "Alice", "\"a1\"", FALSE);
+	google_sync_finish(sync, FALSE);
+
+	g_assert_nonnull(test_google_contact("bob"));
+	g_assert_cmpint(google_updated, ==, 0);
+}
+
+static void test_google_fallback(gpointer fixture, gconstpointer user_data)
+{
+	struct google_sync *sync;
+
+	/* Incremental query failing right away starts over with a full sync */
+	sync = google_sync_new();
+	g_assert_null(sync->seen);
+	g_assert_true(google_sync_fail(sync));
+	g_assert_cmpint(google_updated, ==, 0);
+
+	sync = google_sync_new();
+	g_assert_nonnull(sync->seen);
+
+	/* Failing full sync does not restart */
+	g_assert_false(google_sync_fail(sync));
+
+	/* Incremental sync which already received a page keeps its state */
+	google_updated = 1000;
+	sync = google_sync_new();
+	sync->updated = 2000;
+	g_assert_false(google_sync_fail(sync));
+	g_assert_cmpint(google_updated, ==, 1000);
+
+	/* Contacts survive failed syncs */
+	g_assert_cmpuint(g_hash_table_size(google_entries), ==, 2);
+}
+
+int main(int argc, char **argv)
+{
+	gint ret;
+
+	test_dir = g_dir_make_tmp("roger-google-XXXXXX", NULL);
+	g_assert_nonnull(test_dir);
+
+	/* Keep cache and settings away from the user */
+	g_setenv("XDG_CACHE_HOME", test_dir, TRUE);
+	g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+
+	g_test_init(&argc, &argv, NULL);
+
+	/* Deltas are emitted on rm_object */
+	rm_new(FALSE, NULL);
+
+	g_test_add("/google/etag", gpointer, NULL, test_google_setup, test_google_etag, test_google_teardown);
+	g_test_add("/google/deleted", gpointer, NULL, test_google_setup, test_google_deleted, test_google_teardown);
+	g_test_add("/google/full-sync", gpointer, NULL, test_google_setup, test_google_full_sync, test_google_teardown);
+	g_test_add("/google/incomplete-sync", gpointer, NULL, test_google_setup, test_google_incomplete_sync, test_google_teardown);
+	g_test_add("/google/fallback", gpointer, NULL, test_google_setup, test_google_fallback, test_google_teardown);
+
+	ret = g_test_run();
+
+	test_google_remove_dir(test_dir);
+	g_free(test_dir);
+
+	return ret;
+}
@@ -0,0 +1,240 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+/* Parser functions are static, test them within the plugin source */
+#include "plugins/thunderbird/thunderbird.c"
+
+#define TEST_MORK_BOOK \
+	"// <!-- <mdb:mork:z v=\"1.4\"/> -->\n" \
+	"< <(a=c)>\n" \
+	"  (80=DisplayName)(81=PrimaryEmail)>\n" \
+	"<(90=Alice)(91=Bob)>\n" \
+	"{1:^80 {(k^C0:c)(s=9)}\n" \
+	"  [1(^80^90)]\n" \
+	"  [2(^80^91)]}\n"
+
+/**
+ * TestMorkFixture:
+ * @dir: temporary directory
+ * @file_name: address book file
+ * @state: parsed state, handed from one read to the next
+ */
+typedef struct {
+	gchar *dir;
+	gchar *file_name;
+	struct mork_state *state;
+} TestMorkFixture;
+
+static void test_mork_setup(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	fixture->dir = g_dir_make_tmp("roger-mork-XXXXXX", NULL);
+	g_assert_nonnull(fixture->dir);
+
+	fixture->file_name = g_build_filename(fixture->dir, "abook.mab", NULL);
+	g_assert_true(g_file_set_contents(fixture->file_name, TEST_MORK_BOOK, -1, NULL));
+
+	fixture->state = NULL;
+}
+
+static void test_mork_teardown(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	mork_state_free(fixture->state);
+	g_unlink(fixture->file_name);
+	g_rmdir(fixture->dir);
+	g_free(fixture->file_name);
+	g_free(fixture->dir);
+}
+
+/**
+ * test_mork_append:
+ * @fixture: a #TestMorkFixture
+ * @text: mork code
+ *
+ * Append to book in place, as Thunderbird does for every change
+ */
+static void test_mork_append(TestMorkFixture *fixture, const gchar *text)
+{
+	FILE *file = g_fopen(fixture->file_name, "ab");
+
+	g_assert_nonnull(file);
+	g_assert_cmpuint(fwrite(text, 1, strlen(text), file), ==, strlen(text));
+	fclose(file);
+}
+
+/**
+ * test_mork_read:
+ * @fixture: a #TestMorkFixture
+ * @full: expected parse mode
+ *
+ * Read book continuing the state of the previous read
+ *
+ * Returns: book, free with mork_book_free()
+ */
+static struct mork_book *test_mork_read(TestMorkFixture *fixture, gboolean full)
+{
+	struct mork_book *book = thunderbird_open_book(fixture->file_name, fixture->state);
+
+	fixture->state = book->state;
+	book->state = NULL;
+
+	g_assert_cmpint(book->full, ==, full);
+
+	return book;
+}
+
+/**
+ * test_mork_get_name:
+ * @book: a struct mork_book
+ * @id: row id in default scope
+ *
+ * Returns: name of reported person, %NULL if row has been reported without person
+ */
+static const gchar *test_mork_get_name(struct mork_book *book, gint id)
+{
+	gint64 key = mork_row_key(0, id);
+	RmContact *contact;
+
+	g_assert_true(g_hash_table_lookup_extended(book->persons, &key, NULL, (gpointer*)&contact));
+
+	return contact ? contact->name : NULL;
+}
+
+static void test_mork_full(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 2);
+	g_assert_cmpstr(test_mork_get_name(book, 1), ==, "Alice");
+	g_assert_cmpstr(test_mork_get_name(book, 2), ==, "Bob");
+
+	mork_book_free(book);
+}
+
+static void test_mork_committed_group(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+
+	mork_book_free(book);
+
+	test_mork_append(fixture, "@$${1{@\n[-2(^80=Robert)]\n[3(^80=Carol)]\n@$$}1}@\n");
+
+	/* Only touched rows are reported */
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 2);
+	g_assert_cmpstr(test_mork_get_name(book, 2), ==, "Robert");
+	g_assert_cmpstr(test_mork_get_name(book, 3), ==, "Carol");
+	mork_book_free(book);
+
+	g_assert_cmpuint(g_hash_table_size(fixture->state->rows), ==, 3);
+}
+
+static void test_mork_removed_row(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+
+	mork_book_free(book);
+
+	test_mork_append(fixture, "@$${2{@\n{1:^80 -1}\n@$$}2}@\n");
+
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 1);
+	g_assert_null(test_mork_get_name(book, 1));
+	mork_book_free(book);
+
+	g_assert_cmpuint(g_hash_table_size(fixture->state->rows), ==, 1);
+}
+
+static void test_mork_aborted_group(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+	gsize offset;
+
+	mork_book_free(book);
+
+	test_mork_append(fixture, "@$${3{@\n[-1(^80=Mallory)]\n[4(^80=Dave)]\n@$$}~abort~3}@\n");
+
+	/* Aborted transaction must not change anything, but is not parsed again */
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 0);
+	mork_book_free(book);
+
+	offset = fixture->state->offset;
+	g_assert_cmpuint(g_hash_table_size(fixture->state->rows), ==, 2);
+
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 0);
+	g_assert_cmpuint(fixture->state->offset, ==, offset);
+	mork_book_free(book);
+}
+
+static void test_mork_incomplete_group(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+	gsize offset = fixture->state->offset;
+
+	mork_book_free(book);
+
+	/* Thunderbird is still writing the group */
+	test_mork_append(fixture, "@$${4{@\n[5(^80=Eve)]\n");
+
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 0);
+	mork_book_free(book);
+
+	/* Parse continues in front of the group */
+	g_assert_cmpuint(fixture->state->offset, ==, offset);
+
+	test_mork_append(fixture, "@$$}4}@\n");
+
+	book = test_mork_read(fixture, FALSE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 1);
+	g_assert_cmpstr(test_mork_get_name(book, 5), ==, "Eve");
+	mork_book_free(book);
+}
+
+static void test_mork_compacted(TestMorkFixture *fixture, gconstpointer user_data)
+{
+	struct mork_book *book = test_mork_read(fixture, TRUE);
+
+	mork_book_free(book);
+
+	/* Compaction rewrites the whole file */
+	g_assert_true(g_file_set_contents(fixture->file_name, TEST_MORK_BOOK "[3(^80=Carol)]\n", -1, NULL));
+
+	book = test_mork_read(fixture, TRUE);
+	g_assert_cmpuint(g_hash_table_size(book->persons), ==, 3);
+	g_assert_cmpstr(test_mork_get_name(book, 3), ==, "Carol");
+	mork_book_free(book);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/mork/full", TestMorkFixture, NULL, test_mork_setup, test_mork_full, test_mork_teardown);
+	g_test_add("/mork/committed-group", TestMorkFixture, NULL, test_mork_setup, test_mork_committed_group, test_mork_teardown);
+	g_test_add("/mork/removed-row", TestMorkFixture, NULL, test_mork_setup, test_mork_removed_row, test_mork_teardown);
+	g_test_add("/mork/aborted-group", TestMorkFixture, NULL, test_mork_setup, test_mork_aborted_group, test_mork_teardown);
+	g_test_add("/mork/incomplete-group", TestMorkFixture, NULL, test_mork_setup, test_mork_incomplete_group, test_mork_teardown);
+	g_test_add("/mork/compacted", TestMorkFixture, NULL, test_mork_setup, test_mork_compacted, test_mork_teardown);
+
+	return g_test_run();
+}
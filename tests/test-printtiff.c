@@ -0,0 +1,271 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <roger/printtiff.h>
+
+static gchar *test_dir = NULL;
+
+/**
+ * TestTiffPixelFunc:
+ * @x: column
+ * @y: row
+ *
+ * Returns: %TRUE if pixel is black
+ */
+typedef gboolean (*TestTiffPixelFunc)(gint x, gint y);
+
+/**
+ * test_tiff_create:
+ * @width: page width
+ * @height: page height
+ * @bits: 1 for a bilevel fax page, 8 for greyscale
+ * @rows_per_strip: rows per strip
+ * @func: pixel function
+ *
+ * Write single page tiff document
+ *
+ * Returns: opened document, close with TIFFClose()
+ */
+static TIFF *test_tiff_create(gint width, gint height, gint bits, gint rows_per_strip, TestTiffPixelFunc func)
+{
+	gchar *file_name = g_build_filename(test_dir, "page.tif", NULL);
+	TIFF *tiff = TIFFOpen(file_name, "w");
+	guchar *line;
+	gint x;
+	gint y;
+
+	g_assert_nonnull(tiff);
+
+	TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, height);
+	TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, bits);
+	TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
+	TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+	TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+	/* Fax pages are white on zero, greyscale pages black on zero */
+	TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, bits == 1 ? PHOTOMETRIC_MINISWHITE : PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(tiff, TIFFTAG_XRESOLUTION, 204.0);
+	TIFFSetField(tiff, TIFFTAG_YRESOLUTION, 98.0);
+	TIFFSetField(tiff, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+
+	line = g_malloc0(TIFFScanlineSize(tiff));
+	for (y = 0; y < height; y++) {
+		memset(line, 0, TIFFScanlineSize(tiff));
+
+		for (x = 0; x < width; x++) {
+			gboolean black = func(x, y);
+
+			if (bits == 1) {
+				line[x >> 3] |= black ? 0x80 >> (x & 7) : 0;
+			} else {
+				line[x] = black ? 0 : 255;
+			}
+		}
+
+		g_assert_cmpint(TIFFWriteScanline(tiff, line, y, 0), ==, 1);
+	}
+	g_free(line);
+	TIFFClose(tiff);
+
+	tiff = TIFFOpen(file_name, "r");
+	g_assert_nonnull(tiff);
+
+	g_unlink(file_name);
+	g_free(file_name);
+
+	return tiff;
+}
+
+/**
+ * test_tiff_get_pixel:
+ * @pixbuf: a #GdkPixbuf
+ * @x: column
+ * @y: row
+ *
+ * Returns: grey value of pixel
+ */
+static gint test_tiff_get_pixel(GdkPixbuf *pixbuf, gint x, gint y)
+{
+	guchar *pixel = gdk_pixbuf_get_pixels(pixbuf) + y * gdk_pixbuf_get_rowstride(pixbuf) + x * gdk_pixbuf_get_n_channels(pixbuf);
+
+	g_assert_cmpint(pixel[0], ==, pixel[1]);
+	g_assert_cmpint(pixel[0], ==, pixel[2]);
+
+	return pixel[0];
+}
+
+static gboolean test_tiff_left_half(gint x, gint y)
+{
+	return x < 8;
+}
+
+static gboolean test_tiff_top_half(gint x, gint y)
+{
+	return y < 4;
+}
+
+static gboolean test_tiff_checkerboard(gint x, gint y)
+{
+	return (x + y) & 1;
+}
+
+static gboolean test_tiff_top_left(gint x, gint y)
+{
+	return !x && !y;
+}
+
+static void test_tiff_shrink(void)
+{
+	TIFF *tiff = test_tiff_create(16, 8, 1, 8, test_tiff_left_half);
+	GdkPixbuf *pixbuf;
+	gint x;
+	gint y;
+
+	pixbuf = print_load_tiff_page(tiff, 0, 8, 4);
+	g_assert_nonnull(pixbuf);
+	g_assert_cmpint(gdk_pixbuf_get_width(pixbuf), ==, 8);
+	g_assert_cmpint(gdk_pixbuf_get_height(pixbuf), ==, 4);
+
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 8; x++) {
+			g_assert_cmpint(test_tiff_get_pixel(pixbuf, x, y), ==, x < 4 ? 0 : 255);
+		}
+	}
+
+	g_object_unref(pixbuf);
+	TIFFClose(tiff);
+}
+
+static void test_tiff_box_filter(void)
+{
+	TIFF *tiff = test_tiff_create(16, 8, 1, 8, test_tiff_checkerboard);
+	GdkPixbuf *pixbuf;
+	gint x;
+	gint y;
+
+	/* Every destination pixel covers two black and two white source pixels */
+	pixbuf = print_load_tiff_page(tiff, 0, 8, 4);
+	g_assert_nonnull(pixbuf);
+
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 8; x++) {
+			g_assert_cmpint(test_tiff_get_pixel(pixbuf, x, y), ==, 255 - 510 / 4);
+		}
+	}
+
+	g_object_unref(pixbuf);
+	TIFFClose(tiff);
+}
+
+static void test_tiff_enlarge(void)
+{
+	TIFF *tiff = test_tiff_create(2, 2, 1, 2, test_tiff_top_left);
+	GdkPixbuf *pixbuf;
+	gint x;
+	gint y;
+
+	pixbuf = print_load_tiff_page(tiff, 0, 4, 4);
+	g_assert_nonnull(pixbuf);
+
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 4; x++) {
+			g_assert_cmpint(test_tiff_get_pixel(pixbuf, x, y), ==, x < 2 && y < 2 ? 0 : 255);
+		}
+	}
+
+	g_object_unref(pixbuf);
+	TIFFClose(tiff);
+}
+
+static void test_tiff_aspect(void)
+{
+	TIFF *tiff = test_tiff_create(16, 8, 1, 8, test_tiff_left_half);
+	GdkPixbuf *pixbuf;
+
+	/* 204x98 dpi pixels are about twice as high as wide */
+	pixbuf = print_load_tiff_page(tiff, 0, 16, -1);
+	g_assert_nonnull(pixbuf);
+	g_assert_cmpint(gdk_pixbuf_get_width(pixbuf), ==, 16);
+	g_assert_cmpint(gdk_pixbuf_get_height(pixbuf), ==, 17);
+
+	g_object_unref(pixbuf);
+	TIFFClose(tiff);
+}
+
+static void test_tiff_strips(void)
+{
+	TIFF *tiff = test_tiff_create(16, 8, 8, 3, test_tiff_top_half);
+	GdkPixbuf *pixbuf;
+	gint x;
+	gint y;
+
+	/* Generic path, strips are stored bottom-up and the last one is short */
+	pixbuf = print_load_tiff_page(tiff, 0, 8, 4);
+	g_assert_nonnull(pixbuf);
+
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 8; x++) {
+			g_assert_cmpint(test_tiff_get_pixel(pixbuf, x, y), ==, y < 2 ? 0 : 255);
+		}
+	}
+
+	g_object_unref(pixbuf);
+	TIFFClose(tiff);
+}
+
+static void test_tiff_invalid_page(void)
+{
+	TIFF *tiff = test_tiff_create(16, 8, 1, 8, test_tiff_left_half);
+
+	g_assert_cmpint(print_tiff_get_n_pages(tiff), ==, 1);
+	g_assert_null(print_load_tiff_page(tiff, 1, 8, 4));
+
+	TIFFClose(tiff);
+}
+
+int main(int argc, char **argv)
+{
+	gint ret;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_dir = g_dir_make_tmp("roger-printtiff-XXXXXX", NULL);
+	g_assert_nonnull(test_dir);
+
+	g_test_add_func("/printtiff/shrink", test_tiff_shrink);
+	g_test_add_func("/printtiff/box-filter", test_tiff_box_filter);
+	g_test_add_func("/printtiff/enlarge", test_tiff_enlarge);
+	g_test_add_func("/printtiff/aspect", test_tiff_aspect);
+	g_test_add_func("/printtiff/strips", test_tiff_strips);
+	g_test_add_func("/printtiff/invalid-page", test_tiff_invalid_page);
+
+	ret = g_test_run();
+
+	g_rmdir(test_dir);
+	g_free(test_dir);
+
+	return ret;
+}
@@ -0,0 +1,275 @@
+/*
+ * Roger Router
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This file is part of Roger Router.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 only.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <utime.h>
+
+/* Merge and write functions are static, test them within the plugin source */
+#include "plugins/vcard/vcard.c"
+
+#define TEST_VCARD_ALICE "BEGIN:VCARD\nVERSION:3.0\nUID:alice\nFN:Alice\nEND:VCARD\n"
+#define TEST_VCARD_BOB "BEGIN:VCARD\nVERSION:3.0\nUID:bob\nFN:Bob\nEND:VCARD\n"
+#define TEST_VCARD_ROBERT "BEGIN:VCARD\nVERSION:3.0\nUID:bob\nFN:Robert\nEND:VCARD\n"
+#define TEST_VCARD_CAROL "BEGIN:VCARD\nVERSION:3.0\nUID:carol\nFN:Carol\nEND:VCARD\n"
+
+/**
+ * TestVCardFixture:
+ * @dir: temporary directory
+ * @file_name: card file
+ */
+typedef struct {
+	gchar *dir;
+	gchar *file_name;
+} TestVCardFixture;
+
+/**
+ * test_vcard_write:
+ * @fixture: a #TestVCardFixture
+ * @text: file content
+ * @mtime: modification time
+ *
+ * Write card file as another application would. The modification time is set
+ * explicitly, so that the entity tag changes even on coarse file systems.
+ */
+static void test_vcard_write(TestVCardFixture *fixture, const gchar *text, time_t mtime)
+{
+	struct utimbuf times;
+
+	g_assert_true(g_file_set_contents(fixture->file_name, text, -1, NULL));
+
+	times.actime = mtime;
+	times.modtime = mtime;
+	g_assert_cmpint(g_utime(fixture->file_name, &times), ==, 0);
+}
+
+/**
+ * test_vcard_contains:
+ * @fixture: a #TestVCardFixture
+ * @text: text to look for
+ *
+ * Returns: %TRUE if card file contains @text
+ */
+static gboolean test_vcard_contains(TestVCardFixture *fixture, const gchar *text)
+{
+	gchar *data = NULL;
+	gboolean ret;
+
+	g_assert_true(g_file_get_contents(fixture->file_name, &data, NULL, NULL));
+	ret = strstr(data, text) != NULL;
+	g_free(data);
+
+	return ret;
+}
+
+/**
+ * test_vcard_modify:
+ * @key: card key
+ * @name: new name
+ *
+ * Change contact name as the contact editor does, without writing it
+ *
+ * Returns: modified card
+ */
+static struct vcard_card *test_vcard_modify(const gchar *key, const gchar *name)
+{
+	struct vcard_card *card = g_hash_table_lookup(vcard_cards, key);
+
+	g_assert_nonnull(card);
+
+	g_free(card->contact->name);
+	card->contact->name = g_strdup(name);
+	card->dirty = TRUE;
+
+	return card;
+}
+
+static void test_vcard_setup(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	vcard_settings = g_settings_new("org.tabos.roger.plugins.vcard");
+	vcard_cards = g_hash_table_new(g_str_hash, g_str_equal);
+	vcard_files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, vcard_file_free);
+
+	fixture->dir = g_dir_make_tmp("roger-vcard-XXXXXX", NULL);
+	g_assert_nonnull(fixture->dir);
+
+	fixture->file_name = g_build_filename(fixture->dir, "ab.vcf", NULL);
+	g_settings_set_string(vcard_settings, "filename", fixture->file_name);
+	test_vcard_write(fixture, TEST_VCARD_ALICE TEST_VCARD_BOB, 1000000000);
+
+	vcard_reload_source(fixture->file_name, FALSE, FALSE);
+	g_assert_cmpuint(g_list_length(vcard_list), ==, 2);
+}
+
+static void test_vcard_teardown(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	GList *list;
+
+	if (file_monitor) {
+		g_file_monitor_cancel(G_FILE_MONITOR(file_monitor));
+		g_clear_object(&file_monitor);
+	}
+
+	for (list = vcard_list; list != NULL; list = list->next) {
+		struct vcard_card *card = list->data;
+
+		vcard_contact_free(card->contact);
+		vcard_card_free(card);
+	}
+	g_list_free(vcard_list);
+	vcard_list = NULL;
+
+	g_slist_free(contacts);
+	contacts = NULL;
+
+	g_clear_pointer(&vcard_etag, g_free);
+	g_clear_pointer(&vcard_removed, g_hash_table_destroy);
+	g_clear_pointer(&vcard_files, g_hash_table_destroy);
+	g_clear_pointer(&vcard_cards, g_hash_table_destroy);
+	g_clear_object(&vcard_settings);
+
+	g_unlink(fixture->file_name);
+	g_rmdir(fixture->dir);
+	g_free(fixture->file_name);
+	g_free(fixture->dir);
+}
+
+static void test_vcard_write_unchanged(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	test_vcard_modify("alice", "Alice Smith");
+
+	vcard_write_file(fixture->file_name);
+
+	g_assert_true(test_vcard_contains(fixture, "FN:Alice Smith"));
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_BOB));
+	g_assert_false(((struct vcard_card*)g_hash_table_lookup(vcard_cards, "alice"))->dirty);
+}
+
+static void test_vcard_etag_mismatch(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	struct vcard_card *card = test_vcard_modify("alice", "Alice Smith");
+
+	/* Somebody else adds a card meanwhile */
+	test_vcard_write(fixture, TEST_VCARD_ALICE TEST_VCARD_BOB TEST_VCARD_CAROL, 1000000100);
+
+	/* Must not overwrite the external change */
+	vcard_write_file(fixture->file_name);
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_CAROL));
+	g_assert_false(test_vcard_contains(fixture, "FN:Alice Smith"));
+	g_assert_true(card->dirty);
+
+	/* Merge keeps our pending change on top of the new file and writes it */
+	vcard_reload_source(fixture->file_name, FALSE, FALSE);
+	g_assert_cmpuint(g_list_length(vcard_list), ==, 3);
+	g_assert_true(g_hash_table_lookup(vcard_cards, "alice") == card);
+	g_assert_cmpstr(card->contact->name, ==, "Alice Smith");
+	g_assert_false(card->dirty);
+
+	g_assert_true(test_vcard_contains(fixture, "FN:Alice Smith"));
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_CAROL));
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_BOB));
+}
+
+static void test_vcard_merge_modified(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	struct vcard_card *alice = g_hash_table_lookup(vcard_cards, "alice");
+	RmContact *alice_contact = alice->contact;
+	RmContact *bob_contact = ((struct vcard_card*)g_hash_table_lookup(vcard_cards, "bob"))->contact;
+
+	test_vcard_write(fixture, TEST_VCARD_ALICE TEST_VCARD_ROBERT, 1000000100);
+	vcard_reload_source(fixture->file_name, FALSE, FALSE);
+
+	/* Contact pointers stay valid, modified contacts are updated in place */
+	g_assert_true(g_hash_table_lookup(vcard_cards, "alice") == alice);
+	g_assert_true(alice->contact == alice_contact);
+	g_assert_true(((struct vcard_card*)g_hash_table_lookup(vcard_cards, "bob"))->contact == bob_contact);
+	g_assert_cmpstr(bob_contact->name, ==, "Robert");
+}
+
+static void test_vcard_merge_removed(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	test_vcard_modify("alice", "Alice Smith");
+
+	/* Somebody else removes both cards, our pending change survives */
+	test_vcard_write(fixture, TEST_VCARD_CAROL, 1000000100);
+	vcard_reload_source(fixture->file_name, FALSE, FALSE);
+
+	g_assert_cmpuint(g_list_length(vcard_list), ==, 2);
+	g_assert_nonnull(g_hash_table_lookup(vcard_cards, "alice"));
+	g_assert_null(g_hash_table_lookup(vcard_cards, "bob"));
+	g_assert_nonnull(g_hash_table_lookup(vcard_cards, "carol"));
+
+	g_assert_true(test_vcard_contains(fixture, "FN:Alice Smith"));
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_CAROL));
+	g_assert_false(test_vcard_contains(fixture, "FN:Bob"));
+}
+
+static void test_vcard_remove(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	struct vcard_card *card = g_hash_table_lookup(vcard_cards, "bob");
+
+	g_assert_true(vcard_remove_contact(card->contact));
+
+	g_assert_cmpuint(g_list_length(vcard_list), ==, 1);
+	g_assert_null(g_hash_table_lookup(vcard_cards, "bob"));
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_ALICE));
+	g_assert_false(test_vcard_contains(fixture, "FN:Bob"));
+	g_assert_false(vcard_removal_is_pending("bob"));
+}
+
+static void test_vcard_remove_pending(TestVCardFixture *fixture, gconstpointer user_data)
+{
+	struct vcard_card *card = g_hash_table_lookup(vcard_cards, "bob");
+
+	/* Removal whose write has been refused, card is still in the file */
+	contacts = g_slist_remove(contacts, card->contact);
+	vcard_list = g_list_remove(vcard_list, card);
+	g_hash_table_remove(vcard_cards, card->key);
+	vcard_removal_add(card->key, fixture->file_name);
+	vcard_contact_free(card->contact);
+	vcard_card_free(card);
+
+	/* Somebody else adds a card meanwhile, merge must not bring back the removed one */
+	test_vcard_write(fixture, TEST_VCARD_ALICE TEST_VCARD_BOB TEST_VCARD_CAROL, 1000000100);
+	vcard_reload_source(fixture->file_name, FALSE, FALSE);
+
+	g_assert_cmpuint(g_list_length(vcard_list), ==, 2);
+	g_assert_null(g_hash_table_lookup(vcard_cards, "bob"));
+	g_assert_nonnull(g_hash_table_lookup(vcard_cards, "carol"));
+
+	g_assert_true(test_vcard_contains(fixture, TEST_VCARD_CAROL));
+	g_assert_false(test_vcard_contains(fixture, "FN:Bob"));
+	g_assert_false(vcard_removal_is_pending("bob"));
+}
+
+int main(int argc, char **argv)
+{
+	g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+	g_test_init(&argc, &argv, NULL);
+
+	/* Image handles are attached to rm_object */
+	rm_new(FALSE, NULL);
+
+	g_test_add("/vcard/write-unchanged", TestVCardFixture, NULL, test_vcard_setup, test_vcard_write_unchanged, test_vcard_teardown);
+	g_test_add("/vcard/etag-mismatch", TestVCardFixture, NULL, test_vcard_setup, test_vcard_etag_mismatch, test_vcard_teardown);
+	g_test_add("/vcard/merge-modified", TestVCardFixture, NULL, test_vcard_setup, test_vcard_merge_modified, test_vcard_teardown);
+	g_test_add("/vcard/merge-removed", TestVCardFixture, NULL, test_vcard_setup, test_vcard_merge_removed, test_vcard_teardown);
+	g_test_add("/vcard/remove", TestVCardFixture, NULL, test_vcard_setup, test_vcard_remove, test_vcard_teardown);
+	g_test_add("/vcard/remove-pending", TestVCardFixture, NULL, test_vcard_setup, test_vcard_remove_pending, test_vcard_teardown);
+
+	return g_test_run();
+}